@@ -49,6 +49,9 @@ char                        _privateKey[128] = {0};
 static le_data_RequestObjRef_t  _RequestRef = NULL;
 static le_data_ConnectionStateHandlerRef_t  _hDataConnectionState = NULL;
 
+// the service saw the bearer down when the session was started : it starts it once the bearer is back
+static bool                 _sessionDeferred = false;
+
 static void DcsStateHandler(const char* intfName, bool        isConnected, void*       contextPtr);
 static void OnIncomingMessage(
                 const char* topicName,
@@ -196,6 +199,7 @@ static void Disconnect
         LE_INFO("Delete MQTT instance");
         mqttClient_Delete(_cliMqttRef);
         _cliMqttRef = NULL;
+        _sessionDeferred = false;
     }
 
     
@@ -220,6 +224,20 @@ static void timerHandler
     le_timer_Ref_t  timerRef
 )
 {
+    if (_sessionDeferred)
+    {
+        le_result_t res = mqttClient_StartSession(_cliMqttRef);
+
+        if (LE_WOULD_BLOCK == res)
+        {
+            le_timer_Start(_timerRef);
+            return;
+        }
+
+        _sessionDeferred = false;
+        PrintMessage(LE_OK == res ? "MQTT session started" : "Failed to start MQTT session");
+    }
+
     if (mqttClient_IsConnected(_cliMqttRef))
     {
         LE_INFO("MQTT yield");
@@ -316,11 +334,20 @@ static void DcsStateHandler
 
         LE_INFO("%s connected! Starting MQTT session", intfName);
         
-        if (LE_OK == mqttClient_StartSession(_cliMqttRef))
+        le_result_t res = mqttClient_StartSession(_cliMqttRef);
+
+        if (LE_OK == res)
         {
             PrintMessage("MQTT session started");
             le_timer_Start(_timerRef);
         }
+        else if (LE_WOULD_BLOCK == res)
+        {
+            //the service has not seen the bearer up yet : not a failure, the session is kept
+            PrintMessage("MQTT session deferred until the service sees the data connection");
+            _sessionDeferred = true;
+            le_timer_Start(_timerRef);
+        }
         else
         {
             PrintMessage("Failed to start MQTT session");
@@ -329,9 +356,9 @@ static void DcsStateHandler
     }
     else
     {
-        LE_INFO("Data connection is closed, deleting MQTT instance");
-        //restart the session if network issue
-        mqttClient_StopSession(_cliMqttRef);
+        LE_INFO("Data connection is closed, MQTT session paused");
+        //the service keeps the session and resumes it when the bearer is back
+        le_timer_Stop(_timerRef);
     }
 }
 
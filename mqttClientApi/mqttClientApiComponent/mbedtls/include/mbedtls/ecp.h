@@ -522,6 +522,26 @@ int mbedtls_ecp_mul( mbedtls_ecp_group *grp, mbedtls_ecp_point *R,
              const mbedtls_mpi *m, const mbedtls_ecp_point *P,
              int (*f_rng)(void *, unsigned char *, size_t), void *p_rng );
 
+/**
+ * \brief           Precompute the comb table of the base point G
+ *
+ * \param grp       ECP group (short Weierstrass curves only), the table
+ *                  replaces grp->T
+ * \param w         Window size, 2 to MBEDTLS_ECP_WINDOW_SIZE
+ *
+ * \return          0 if successful,
+ *                  MBEDTLS_ERR_ECP_BAD_INPUT_DATA for a bad window or curve,
+ *                  MBEDTLS_ERR_ECP_ALLOC_FAILED or MBEDTLS_ERR_MPI_XXX
+ *
+ * \note            mbedtls_ecp_mul() computes a table of G with a small
+ *                  window the first time it is called with P == G. Calling
+ *                  this function first (or installing a table computed with
+ *                  it in grp->T and grp->T_size) makes the following
+ *                  multiplications by G use the table as is: ECDSA signing
+ *                  then costs about nbits / w additions and doublings.
+ */
+int mbedtls_ecp_precompute_g( mbedtls_ecp_group *grp, unsigned char w );
+
 /**
  * \brief           Multiplication and addition of two points by integers:
  *                  R = m * P + n * Q
@@ -30,9 +30,45 @@
 #include "mbedtls/base64.h"
 
 #include <stdint.h>
+#include <string.h>
+
+/*
+ * Blocks of symbols are translated with SIMD instructions when available:
+ * SSE2 (SSSE3 shuffles when enabled) handles 12 bytes / 16 symbols per step,
+ * NEON 48 bytes / 64 symbols (one PEM line). Symbols are translated with
+ * range compares, so that both alphabets (RFC 4648 base64 and base64url)
+ * share the kernels. Whatever is not a full block of symbols (line breaks,
+ * padding, tail) goes through the scalar code. The kernels are only
+ * worth it once the intrinsics are inlined, they are left out of
+ * unoptimized builds, and when MBEDTLS_BASE64_NO_SIMD is defined (scalar
+ * reference of mqttBase64Bench).
+ */
+#if !defined(__OPTIMIZE__) || defined(MBEDTLS_BASE64_NO_SIMD)
+/* scalar code only */
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#define BASE64_SSE2
+#define BASE64_SSSE3
+#define BASE64_BLOCK_LOAD       16      /* bytes read to encode a block */
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define BASE64_SSE2
+#define BASE64_BLOCK_LOAD       12
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define BASE64_NEON
+#define BASE64_BLOCK_LOAD       48
+#endif
+
+#if defined(BASE64_SSE2)
+#define BASE64_BLOCK_BYTES      12
+#define BASE64_BLOCK_CHARS      16
+#elif defined(BASE64_NEON)
+#define BASE64_BLOCK_BYTES      48
+#define BASE64_BLOCK_CHARS      64
+#endif
 
 #if defined(MBEDTLS_SELF_TEST)
-#include <string.h>
 #if defined(MBEDTLS_PLATFORM_C)
 #include "mbedtls/platform.h"
 #else
@@ -52,6 +88,17 @@ static const unsigned char base64_enc_map[64] =
     '8', '9', '+', '/'
 };
 
+static const unsigned char base64url_enc_map[64] =
+{
+    'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J',
+    'K', 'L', 'M', 'N', 'O', 'P', 'Q', 'R', 'S', 'T',
+    'U', 'V', 'W', 'X', 'Y', 'Z', 'a', 'b', 'c', 'd',
+    'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n',
+    'o', 'p', 'q', 'r', 's', 't', 'u', 'v', 'w', 'x',
+    'y', 'z', '0', '1', '2', '3', '4', '5', '6', '7',
+    '8', '9', '-', '_'
+};
+
 static const unsigned char base64_dec_map[128] =
 {
     127, 127, 127, 127, 127, 127, 127, 127, 127, 127,
@@ -69,17 +116,271 @@ static const unsigned char base64_dec_map[128] =
      49,  50,  51, 127, 127, 127, 127, 127
 };
 
+static const unsigned char base64url_dec_map[128] =
+{
+    127, 127, 127, 127, 127, 127, 127, 127, 127, 127,
+    127, 127, 127, 127, 127, 127, 127, 127, 127, 127,
+    127, 127, 127, 127, 127, 127, 127, 127, 127, 127,
+    127, 127, 127, 127, 127, 127, 127, 127, 127, 127,
+    127, 127, 127, 127, 127,  62, 127, 127,  52,  53,
+     54,  55,  56,  57,  58,  59,  60,  61, 127, 127,
+    127,  64, 127, 127, 127,   0,   1,   2,   3,   4,
+      5,   6,   7,   8,   9,  10,  11,  12,  13,  14,
+     15,  16,  17,  18,  19,  20,  21,  22,  23,  24,
+     25, 127, 127, 127, 127,  63, 127,  26,  27,  28,
+     29,  30,  31,  32,  33,  34,  35,  36,  37,  38,
+     39,  40,  41,  42,  43,  44,  45,  46,  47,  48,
+     49,  50,  51, 127, 127, 127, 127, 127
+};
+
 #define BASE64_SIZE_T_MAX   ( (size_t) -1 ) /* SIZE_T_MAX is not standard */
 
+#if defined(BASE64_SSE2)
+
 /*
- * Encode a buffer into base64 format
+ * 6-bit values to symbols: A-Z +65, a-z +71, 0-9 -4, then the two last
+ * symbols of the alphabet
  */
-int mbedtls_base64_encode( unsigned char *dst, size_t dlen, size_t *olen,
-                   const unsigned char *src, size_t slen )
+static __m128i base64_sse2_enc_translate( __m128i s, int url )
+{
+    __m128i off, m62, m63;
+
+    off = _mm_set1_epi8( 65 );
+    off = _mm_add_epi8( off, _mm_and_si128( _mm_cmpgt_epi8( s, _mm_set1_epi8( 25 ) ),
+                                            _mm_set1_epi8( 6 ) ) );
+    off = _mm_sub_epi8( off, _mm_and_si128( _mm_cmpgt_epi8( s, _mm_set1_epi8( 51 ) ),
+                                            _mm_set1_epi8( 75 ) ) );
+
+    m62 = _mm_cmpeq_epi8( s, _mm_set1_epi8( 62 ) );
+    m63 = _mm_cmpeq_epi8( s, _mm_set1_epi8( 63 ) );
+    off = _mm_or_si128( _mm_andnot_si128( _mm_or_si128( m62, m63 ), off ),
+          _mm_or_si128( _mm_and_si128( m62, _mm_set1_epi8( (char)( url ? '-' - 62 : '+' - 62 ) ) ),
+                        _mm_and_si128( m63, _mm_set1_epi8( (char)( url ? '_' - 63 : '/' - 63 ) ) ) ) );
+
+    return( _mm_add_epi8( s, off ) );
+}
+
+static __m128i base64_sse2_range( __m128i c, char lo, char hi )
+{
+    return( _mm_and_si128( _mm_cmpgt_epi8( c, _mm_set1_epi8( lo - 1 ) ),
+                           _mm_cmplt_epi8( c, _mm_set1_epi8( hi + 1 ) ) ) );
+}
+
+/*
+ * Symbols to 6-bit values, returns -1 if a character is not a symbol of the
+ * alphabet (bytes above 127 are negative and fall out of all ranges)
+ */
+static int base64_sse2_dec_translate( __m128i c, __m128i *values, int url )
+{
+    __m128i upper, lower, digit, m62, m63, v;
+
+    upper = base64_sse2_range( c, 'A', 'Z' );
+    lower = base64_sse2_range( c, 'a', 'z' );
+    digit = base64_sse2_range( c, '0', '9' );
+    m62 = _mm_cmpeq_epi8( c, _mm_set1_epi8( url ? '-' : '+' ) );
+    m63 = _mm_cmpeq_epi8( c, _mm_set1_epi8( url ? '_' : '/' ) );
+
+    if( _mm_movemask_epi8( _mm_or_si128( _mm_or_si128( upper, lower ),
+                           _mm_or_si128( digit, _mm_or_si128( m62, m63 ) ) ) ) != 0xFFFF )
+        return( -1 );
+
+    v = _mm_and_si128( upper, _mm_sub_epi8( c, _mm_set1_epi8( 65 ) ) );
+    v = _mm_or_si128( v, _mm_and_si128( lower, _mm_sub_epi8( c, _mm_set1_epi8( 71 ) ) ) );
+    v = _mm_or_si128( v, _mm_and_si128( digit, _mm_add_epi8( c, _mm_set1_epi8( 4 ) ) ) );
+    v = _mm_or_si128( v, _mm_and_si128( m62, _mm_set1_epi8( 62 ) ) );
+    v = _mm_or_si128( v, _mm_and_si128( m63, _mm_set1_epi8( 63 ) ) );
+
+    *values = v;
+
+    return( 0 );
+}
+
+#if !defined(BASE64_SSSE3)
+/* bytes 1, 0, 2, 1 of a group, the layout produced by the SSSE3 shuffle */
+#define BASE64_LANE( p )    (int)( (uint32_t) (p)[1]         | ( (uint32_t) (p)[0] << 8 ) | \
+                                   ( (uint32_t) (p)[2] << 16 ) | ( (uint32_t) (p)[1] << 24 ) )
+#endif
+
+static void base64_encode_block( unsigned char *dst, const unsigned char *src, int url )
+{
+    __m128i in, t0, t1, t2, t3;
+
+#if defined(BASE64_SSSE3)
+    in = _mm_loadu_si128( (const __m128i *) src );
+    in = _mm_shuffle_epi8( in, _mm_setr_epi8( 1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10 ) );
+#else
+    in = _mm_setr_epi32( BASE64_LANE( src ), BASE64_LANE( src + 3 ),
+                         BASE64_LANE( src + 6 ), BASE64_LANE( src + 9 ) );
+#endif
+
+    /* move the four 6-bit fields of each 32-bit lane to their own byte */
+    t0 = _mm_and_si128( in, _mm_set1_epi32( 0x0fc0fc00 ) );
+    t1 = _mm_mulhi_epu16( t0, _mm_set1_epi32( 0x04000040 ) );
+    t2 = _mm_and_si128( in, _mm_set1_epi32( 0x003f03f0 ) );
+    t3 = _mm_mullo_epi16( t2, _mm_set1_epi32( 0x01000010 ) );
+
+    _mm_storeu_si128( (__m128i *) dst, base64_sse2_enc_translate( _mm_or_si128( t1, t3 ), url ) );
+}
+
+/*
+ * Decode a block of symbols, dst NULL: check only
+ */
+static int base64_decode_block( unsigned char *dst, const unsigned char *src, int url )
+{
+    __m128i values, merged, out;
+
+    if( base64_sse2_dec_translate( _mm_loadu_si128( (const __m128i *) src ), &values, url ) != 0 )
+        return( -1 );
+
+    if( dst == NULL )
+        return( 0 );
+
+#if defined(BASE64_SSSE3)
+    merged = _mm_maddubs_epi16( values, _mm_set1_epi32( 0x01400140 ) );
+#else
+    merged = _mm_or_si128( _mm_slli_epi16( _mm_and_si128( values, _mm_set1_epi16( 0x00FF ) ), 6 ),
+                           _mm_srli_epi16( values, 8 ) );
+#endif
+    /* 24-bit group in each 32-bit lane */
+    out = _mm_madd_epi16( merged, _mm_set1_epi32( 0x00011000 ) );
+
+#if defined(BASE64_SSSE3)
+    out = _mm_shuffle_epi8( out, _mm_setr_epi8( 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1 ) );
+    _mm_storel_epi64( (__m128i *) dst, out );
+    {
+        uint32_t last = (uint32_t) _mm_cvtsi128_si32( _mm_srli_si128( out, 8 ) );
+        memcpy( dst + 8, &last, 4 );
+    }
+#else
+    {
+        uint32_t groups[4];
+        int k;
+
+        _mm_storeu_si128( (__m128i *) groups, out );
+        for( k = 0; k < 4; k++ )
+        {
+            *dst++ = (unsigned char)( groups[k] >> 16 );
+            *dst++ = (unsigned char)( groups[k] >>  8 );
+            *dst++ = (unsigned char)( groups[k]       );
+        }
+    }
+#endif
+
+    return( 0 );
+}
+
+#elif defined(BASE64_NEON)
+
+static uint8x16_t base64_neon_enc_translate( uint8x16_t s, int url )
+{
+    uint8x16_t off;
+
+    off = vdupq_n_u8( 65 );
+    off = vaddq_u8( off, vandq_u8( vcgtq_u8( s, vdupq_n_u8( 25 ) ), vdupq_n_u8( 6 ) ) );
+    off = vsubq_u8( off, vandq_u8( vcgtq_u8( s, vdupq_n_u8( 51 ) ), vdupq_n_u8( 75 ) ) );
+    off = vbslq_u8( vceqq_u8( s, vdupq_n_u8( 62 ) ),
+                    vdupq_n_u8( (uint8_t)( url ? '-' - 62 : '+' - 62 ) ), off );
+    off = vbslq_u8( vceqq_u8( s, vdupq_n_u8( 63 ) ),
+                    vdupq_n_u8( (uint8_t)( url ? '_' - 63 : '/' - 63 ) ), off );
+
+    return( vaddq_u8( s, off ) );
+}
+
+static uint8x16_t base64_neon_range( uint8x16_t c, uint8_t lo, uint8_t hi )
+{
+    return( vandq_u8( vcgeq_u8( c, vdupq_n_u8( lo ) ), vcleq_u8( c, vdupq_n_u8( hi ) ) ) );
+}
+
+/*
+ * Symbols to 6-bit values, the lanes holding a symbol of the alphabet are
+ * kept set in *valid
+ */
+static uint8x16_t base64_neon_dec_translate( uint8x16_t c, uint8x16_t *valid, int url )
+{
+    uint8x16_t upper, lower, digit, m62, m63, v;
+
+    upper = base64_neon_range( c, 'A', 'Z' );
+    lower = base64_neon_range( c, 'a', 'z' );
+    digit = base64_neon_range( c, '0', '9' );
+    m62 = vceqq_u8( c, vdupq_n_u8( url ? '-' : '+' ) );
+    m63 = vceqq_u8( c, vdupq_n_u8( url ? '_' : '/' ) );
+
+    *valid = vandq_u8( *valid, vorrq_u8( vorrq_u8( upper, lower ),
+                                         vorrq_u8( digit, vorrq_u8( m62, m63 ) ) ) );
+
+    v = vandq_u8( upper, vsubq_u8( c, vdupq_n_u8( 65 ) ) );
+    v = vorrq_u8( v, vandq_u8( lower, vsubq_u8( c, vdupq_n_u8( 71 ) ) ) );
+    v = vorrq_u8( v, vandq_u8( digit, vaddq_u8( c, vdupq_n_u8( 4 ) ) ) );
+    v = vorrq_u8( v, vandq_u8( m62, vdupq_n_u8( 62 ) ) );
+    v = vorrq_u8( v, vandq_u8( m63, vdupq_n_u8( 63 ) ) );
+
+    return( v );
+}
+
+static void base64_encode_block( unsigned char *dst, const unsigned char *src, int url )
+{
+    /* de-interleave the groups of 3 bytes, interleave the groups of 4 symbols */
+    uint8x16x3_t in = vld3q_u8( src );
+    uint8x16x4_t out;
+
+    out.val[0] = vshrq_n_u8( in.val[0], 2 );
+    out.val[1] = vorrq_u8( vshlq_n_u8( vandq_u8( in.val[0], vdupq_n_u8( 0x03 ) ), 4 ),
+                           vshrq_n_u8( in.val[1], 4 ) );
+    out.val[2] = vorrq_u8( vshlq_n_u8( vandq_u8( in.val[1], vdupq_n_u8( 0x0F ) ), 2 ),
+                           vshrq_n_u8( in.val[2], 6 ) );
+    out.val[3] = vandq_u8( in.val[2], vdupq_n_u8( 0x3F ) );
+
+    out.val[0] = base64_neon_enc_translate( out.val[0], url );
+    out.val[1] = base64_neon_enc_translate( out.val[1], url );
+    out.val[2] = base64_neon_enc_translate( out.val[2], url );
+    out.val[3] = base64_neon_enc_translate( out.val[3], url );
+
+    vst4q_u8( dst, out );
+}
+
+/*
+ * Decode a block of symbols, dst NULL: check only
+ */
+static int base64_decode_block( unsigned char *dst, const unsigned char *src, int url )
+{
+    uint8x16x4_t in = vld4q_u8( src );
+    uint8x16x3_t out;
+    uint8x16_t valid = vdupq_n_u8( 0xFF );
+    uint8x8_t folded;
+
+    in.val[0] = base64_neon_dec_translate( in.val[0], &valid, url );
+    in.val[1] = base64_neon_dec_translate( in.val[1], &valid, url );
+    in.val[2] = base64_neon_dec_translate( in.val[2], &valid, url );
+    in.val[3] = base64_neon_dec_translate( in.val[3], &valid, url );
+
+    folded = vand_u8( vget_low_u8( valid ), vget_high_u8( valid ) );
+    if( vget_lane_u64( vreinterpret_u64_u8( folded ), 0 ) != UINT64_MAX )
+        return( -1 );
+
+    if( dst == NULL )
+        return( 0 );
+
+    out.val[0] = vorrq_u8( vshlq_n_u8( in.val[0], 2 ), vshrq_n_u8( in.val[1], 4 ) );
+    out.val[1] = vorrq_u8( vshlq_n_u8( in.val[1], 4 ), vshrq_n_u8( in.val[2], 2 ) );
+    out.val[2] = vorrq_u8( vshlq_n_u8( in.val[2], 6 ), in.val[3] );
+
+    vst3q_u8( dst, out );
+
+    return( 0 );
+}
+
+#endif /* BASE64_SSE2 / BASE64_NEON */
+
+/*
+ * Encode a buffer, with padding (base64) or without (base64url)
+ */
+static int base64_encode_alphabet( unsigned char *dst, size_t dlen, size_t *olen,
+                   const unsigned char *src, size_t slen, int url )
 {
     size_t i, n;
     int C1, C2, C3;
     unsigned char *p;
+    const unsigned char *map = url ? base64url_enc_map : base64_enc_map;
 
     if( slen == 0 )
     {
@@ -97,6 +398,9 @@ int mbedtls_base64_encode( unsigned char *dst, size_t dlen, size_t *olen,
 
     n *= 4;
 
+    if( url )
+        n -= ( 3 - slen % 3 ) % 3;
+
     if( dlen < n + 1 )
     {
         *olen = n + 1;
@@ -104,32 +408,44 @@ int mbedtls_base64_encode( unsigned char *dst, size_t dlen, size_t *olen,
     }
 
     n = ( slen / 3 ) * 3;
+    i = 0;
+    p = dst;
 
-    for( i = 0, p = dst; i < n; i += 3 )
+#if defined(BASE64_BLOCK_BYTES)
+    for( ; i + BASE64_BLOCK_LOAD <= slen; i += BASE64_BLOCK_BYTES )
     {
-        C1 = *src++;
-        C2 = *src++;
-        C3 = *src++;
-
-        *p++ = base64_enc_map[(C1 >> 2) & 0x3F];
-        *p++ = base64_enc_map[(((C1 &  3) << 4) + (C2 >> 4)) & 0x3F];
-        *p++ = base64_enc_map[(((C2 & 15) << 2) + (C3 >> 6)) & 0x3F];
-        *p++ = base64_enc_map[C3 & 0x3F];
+        base64_encode_block( p, src + i, url );
+        p += BASE64_BLOCK_CHARS;
+    }
+#endif
+
+    for( ; i < n; i += 3 )
+    {
+        C1 = src[i];
+        C2 = src[i + 1];
+        C3 = src[i + 2];
+
+        *p++ = map[(C1 >> 2) & 0x3F];
+        *p++ = map[(((C1 &  3) << 4) + (C2 >> 4)) & 0x3F];
+        *p++ = map[(((C2 & 15) << 2) + (C3 >> 6)) & 0x3F];
+        *p++ = map[C3 & 0x3F];
     }
 
     if( i < slen )
     {
-        C1 = *src++;
-        C2 = ( ( i + 1 ) < slen ) ? *src++ : 0;
+        C1 = src[i];
+        C2 = ( ( i + 1 ) < slen ) ? src[i + 1] : 0;
 
-        *p++ = base64_enc_map[(C1 >> 2) & 0x3F];
-        *p++ = base64_enc_map[(((C1 & 3) << 4) + (C2 >> 4)) & 0x3F];
+        *p++ = map[(C1 >> 2) & 0x3F];
+        *p++ = map[(((C1 & 3) << 4) + (C2 >> 4)) & 0x3F];
 
         if( ( i + 1 ) < slen )
-             *p++ = base64_enc_map[((C2 & 15) << 2) & 0x3F];
-        else *p++ = '=';
+             *p++ = map[((C2 & 15) << 2) & 0x3F];
+        else if( !url )
+             *p++ = '=';
 
-        *p++ = '=';
+        if( !url )
+            *p++ = '=';
     }
 
     *olen = p - dst;
@@ -139,18 +455,32 @@ int mbedtls_base64_encode( unsigned char *dst, size_t dlen, size_t *olen,
 }
 
 /*
- * Decode a base64-formatted buffer
+ * Decode a buffer. Padding is optional in base64url.
  */
-int mbedtls_base64_decode( unsigned char *dst, size_t dlen, size_t *olen,
-                   const unsigned char *src, size_t slen )
+static int base64_decode_alphabet( unsigned char *dst, size_t dlen, size_t *olen,
+                   const unsigned char *src, size_t slen, int url )
 {
     size_t i, n;
     uint32_t j, x;
     unsigned char *p;
+    const unsigned char *map = url ? base64url_dec_map : base64_dec_map;
 
     /* First pass: check for validity and get output length */
     for( i = n = j = 0; i < slen; i++ )
     {
+#if defined(BASE64_BLOCK_CHARS)
+        /* Runs of symbols, such as whole PEM lines, are checked a block at a time */
+        while( j == 0 && slen - i >= BASE64_BLOCK_CHARS &&
+               base64_decode_block( NULL, src + i, url ) == 0 )
+        {
+            i += BASE64_BLOCK_CHARS;
+            n += BASE64_BLOCK_CHARS;
+        }
+
+        if( i == slen )
+            break;
+#endif
+
         /* Skip spaces before checking for EOL */
         x = 0;
         while( i < slen && src[i] == ' ' )
@@ -177,10 +507,10 @@ int mbedtls_base64_decode( unsigned char *dst, size_t dlen, size_t *olen,
         if( src[i] == '=' && ++j > 2 )
             return( MBEDTLS_ERR_BASE64_INVALID_CHARACTER );
 
-        if( src[i] > 127 || base64_dec_map[src[i]] == 127 )
+        if( src[i] > 127 || map[src[i]] == 127 )
             return( MBEDTLS_ERR_BASE64_INVALID_CHARACTER );
 
-        if( base64_dec_map[src[i]] < 64 && j != 0 )
+        if( map[src[i]] < 64 && j != 0 )
             return( MBEDTLS_ERR_BASE64_INVALID_CHARACTER );
 
         n++;
@@ -192,8 +522,19 @@ int mbedtls_base64_decode( unsigned char *dst, size_t dlen, size_t *olen,
         return( 0 );
     }
 
-    n = ( ( n * 6 ) + 7 ) >> 3;
-    n -= j;
+    if( url )
+    {
+        /* a last group of a single symbol does not carry a byte */
+        if( ( n - j ) % 4 == 1 )
+            return( MBEDTLS_ERR_BASE64_INVALID_CHARACTER );
+
+        n = ( ( n - j ) * 3 ) >> 2;
+    }
+    else
+    {
+        n = ( ( n * 6 ) + 7 ) >> 3;
+        n -= j;
+    }
 
     if( dst == NULL || dlen < n )
     {
@@ -203,11 +544,24 @@ int mbedtls_base64_decode( unsigned char *dst, size_t dlen, size_t *olen,
 
    for( j = 3, n = x = 0, p = dst; i > 0; i--, src++ )
    {
+#if defined(BASE64_BLOCK_CHARS)
+        while( n == 0 && i >= BASE64_BLOCK_CHARS &&
+               base64_decode_block( p, src, url ) == 0 )
+        {
+            src += BASE64_BLOCK_CHARS;
+            i -= BASE64_BLOCK_CHARS;
+            p += BASE64_BLOCK_BYTES;
+        }
+
+        if( i == 0 )
+            break;
+#endif
+
         if( *src == '\r' || *src == '\n' || *src == ' ' )
             continue;
 
-        j -= ( base64_dec_map[*src] == 64 );
-        x  = ( x << 6 ) | ( base64_dec_map[*src] & 0x3F );
+        j -= ( map[*src] == 64 );
+        x  = ( x << 6 ) | ( map[*src] & 0x3F );
 
         if( ++n == 4 )
         {
@@ -218,11 +572,64 @@ int mbedtls_base64_decode( unsigned char *dst, size_t dlen, size_t *olen,
         }
     }
 
+    /* last group without padding, or with part of it: its '=' carry no bits */
+    if( url && n > 0 )
+    {
+        x >>= 6 * ( 3 - j );
+        n -= 3 - j;
+
+        if( n == 2 )
+        {
+            *p++ = (unsigned char)( x >> 4 );
+        }
+        else if( n == 3 )
+        {
+            *p++ = (unsigned char)( x >> 10 );
+            *p++ = (unsigned char)( x >>  2 );
+        }
+    }
+
     *olen = p - dst;
 
     return( 0 );
 }
 
+/*
+ * Encode a buffer into base64 format
+ */
+int mbedtls_base64_encode( unsigned char *dst, size_t dlen, size_t *olen,
+                   const unsigned char *src, size_t slen )
+{
+    return( base64_encode_alphabet( dst, dlen, olen, src, slen, 0 ) );
+}
+
+/*
+ * Decode a base64-formatted buffer
+ */
+int mbedtls_base64_decode( unsigned char *dst, size_t dlen, size_t *olen,
+                   const unsigned char *src, size_t slen )
+{
+    return( base64_decode_alphabet( dst, dlen, olen, src, slen, 0 ) );
+}
+
+/*
+ * Encode a buffer into base64url format, without padding
+ */
+int mbedtls_base64url_encode( unsigned char *dst, size_t dlen, size_t *olen,
+                   const unsigned char *src, size_t slen )
+{
+    return( base64_encode_alphabet( dst, dlen, olen, src, slen, 1 ) );
+}
+
+/*
+ * Decode a base64url-formatted buffer, padded or not
+ */
+int mbedtls_base64url_decode( unsigned char *dst, size_t dlen, size_t *olen,
+                   const unsigned char *src, size_t slen )
+{
+    return( base64_decode_alphabet( dst, dlen, olen, src, slen, 1 ) );
+}
+
 #if defined(MBEDTLS_SELF_TEST)
 
 static const unsigned char base64_test_dec[64] =
@@ -241,6 +648,10 @@ static const unsigned char base64_test_enc[] =
     "JEhuVodiWr2/F9mixBcaAZTtjx4Rs9cJDLbpEG8i7hPK"
     "swcFdsn6MWwINP+Nwmw4AEPpVJevUEvRQbqVMVoLlw==";
 
+static const unsigned char base64url_test_enc[] =
+    "JEhuVodiWr2_F9mixBcaAZTtjx4Rs9cJDLbpEG8i7hPK"
+    "swcFdsn6MWwINP-Nwmw4AEPpVJevUEvRQbqVMVoLlw";
+
 /*
  * Checkup routine
  */
@@ -278,6 +689,34 @@ int mbedtls_base64_self_test( int verbose )
         return( 1 );
     }
 
+    if( verbose != 0 )
+        mbedtls_printf( "passed\n  Base64url encoding test: " );
+
+    src = base64_test_dec;
+
+    if( mbedtls_base64url_encode( buffer, sizeof( buffer ), &len, src, 64 ) != 0 ||
+         len != 86 || memcmp( base64url_test_enc, buffer, 87 ) != 0 )
+    {
+        if( verbose != 0 )
+            mbedtls_printf( "failed\n" );
+
+        return( 1 );
+    }
+
+    if( verbose != 0 )
+        mbedtls_printf( "passed\n  Base64url decoding test: " );
+
+    src = base64url_test_enc;
+
+    if( mbedtls_base64url_decode( buffer, sizeof( buffer ), &len, src, 86 ) != 0 ||
+         len != 64 || memcmp( base64_test_dec, buffer, 64 ) != 0 )
+    {
+        if( verbose != 0 )
+            mbedtls_printf( "failed\n" );
+
+        return( 1 );
+    }
+
     if( verbose != 0 )
         mbedtls_printf( "passed\n\n" );
 
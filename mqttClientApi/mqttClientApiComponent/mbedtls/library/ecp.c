@@ -1346,6 +1346,13 @@ static int ecp_mul_comb( mbedtls_ecp_group *grp, mbedtls_ecp_point *R,
     p_eq_g = 0;
 #endif
 
+    /*
+     * A table of G installed beforehand (mbedtls_ecp_precompute_g) may use
+     * a larger window, its size gives the window
+     */
+    if( p_eq_g && grp->T != NULL )
+        for( w = 2; ( 1U << ( w - 1 ) ) < grp->T_size; w++ );
+
     /*
      * Make sure w is within bounds.
      * (The last test is useful only for very small curves in the test suite.)
@@ -1605,6 +1612,52 @@ cleanup:
 
 #endif /* ECP_MONTGOMERY */
 
+#if defined(ECP_SHORTWEIERSTRASS)
+/*
+ * Precompute the comb table of G with window w, replacing grp->T
+ */
+int mbedtls_ecp_precompute_g( mbedtls_ecp_group *grp, unsigned char w )
+{
+    int ret;
+    size_t i, d, pre_len;
+    mbedtls_ecp_point *T;
+
+    if( ecp_get_type( grp ) != ECP_TYPE_SHORT_WEIERSTRASS ||
+        w < 2 || w > MBEDTLS_ECP_WINDOW_SIZE || w >= grp->nbits )
+        return( MBEDTLS_ERR_ECP_BAD_INPUT_DATA );
+
+    pre_len = 1U << ( w - 1 );
+    d = ( grp->nbits + w - 1 ) / w;
+
+    T = mbedtls_calloc( pre_len, sizeof( mbedtls_ecp_point ) );
+    if( T == NULL )
+        return( MBEDTLS_ERR_ECP_ALLOC_FAILED );
+
+    for( i = 0; i < pre_len; i++ )
+        mbedtls_ecp_point_init( &T[i] );
+
+    if( ( ret = ecp_precompute_comb( grp, T, &grp->G, w, d ) ) != 0 )
+    {
+        for( i = 0; i < pre_len; i++ )
+            mbedtls_ecp_point_free( &T[i] );
+        mbedtls_free( T );
+        return( ret );
+    }
+
+    if( grp->T != NULL )
+    {
+        for( i = 0; i < grp->T_size; i++ )
+            mbedtls_ecp_point_free( &grp->T[i] );
+        mbedtls_free( grp->T );
+    }
+
+    grp->T = T;
+    grp->T_size = pre_len;
+
+    return( 0 );
+}
+#endif /* ECP_SHORTWEIERSTRASS */
+
 /*
  * Multiplication R = m * P
  */
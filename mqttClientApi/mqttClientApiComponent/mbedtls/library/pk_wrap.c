@@ -225,18 +225,12 @@ static int eckey_sign_wrap( void *ctx, mbedtls_md_type_t md_alg,
                    unsigned char *sig, size_t *sig_len,
                    int (*f_rng)(void *, unsigned char *, size_t), void *p_rng )
 {
-    int ret;
-    mbedtls_ecdsa_context ecdsa;
-
-    mbedtls_ecdsa_init( &ecdsa );
-
-    if( ( ret = mbedtls_ecdsa_from_keypair( &ecdsa, ctx ) ) == 0 )
-        ret = ecdsa_sign_wrap( &ecdsa, md_alg, hash, hash_len, sig, sig_len,
-                               f_rng, p_rng );
-
-    mbedtls_ecdsa_free( &ecdsa );
-
-    return( ret );
+    /*
+     * An ECDSA context is a key pair: sign with the key itself rather than
+     * a copy, the group keeps its precomputed table of G across signatures
+     */
+    return( ecdsa_sign_wrap( ctx, md_alg, hash, hash_len, sig, sig_len,
+                             f_rng, p_rng ) );
 }
 
 #endif /* MBEDTLS_ECDSA_C */
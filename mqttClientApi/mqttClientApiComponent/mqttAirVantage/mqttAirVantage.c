@@ -45,6 +45,10 @@
 
 #include "mqttAirVantage.h"
 #include "swir_json.h"
+#include "mqttJson.h"
+#include "mqttSeries.h"
+#include "mqttAggregate.h"
+#include "mqttDownload.h"
 
 #include <stdio.h>
 #include <signal.h>
@@ -68,6 +72,33 @@
 #define		AV_MQTT_QOS						QOS0
 
 #define		AV_USER_DATA_INDEX				1
+#define		AV_TOPIC_DATA_INDEX				2
+
+#define		AV_SERIES_MAX_SAMPLES			64		//default time series policy
+#define		AV_SERIES_MAX_BYTES				4096
+#define		AV_SERIES_MAX_AGE_MS			10000
+
+//AirVantage topics registered on first use, released with the mqtt instance
+typedef struct {
+	mqtt_topic_st*		publishTopic;
+	mqtt_topic_st*		ackTopic;
+	mqtt_topic_st*		seriesTopic;		//time series as binary batches (mqttCodec), NULL : JSON on publishTopic
+} mqtt_avTopics_t;
+
+//package download started by a swinstall task or by the application, one at a time
+typedef struct {
+	mqtt_download_t		download;
+	char				uid[128];			//operation acked when the download ends
+	char				directory[128];		//automatic download of the swinstall packages, "" : disabled
+	unsigned long long	reported;			//progress last reported to the application
+} mqtt_avDownload_t;
+
+//acks pending until the end of the receive loop, sent as one array : [{"uid":..., "status":...}, ...]
+typedef struct {
+	mqtt_jsonWriter_t	writer;				//array left open while acks are queued
+	int					count;
+	int					receiving;			//dispatching incoming tasks : acks are only queued
+} mqtt_avAcks_t;
 
 //-------------------------------------------------------------------------------------------------------
 char* getDeviceId(mqtt_instance_st * mqttObject)
@@ -116,215 +147,728 @@ int mqtt_avIsAirVantageBroker(mqtt_instance_st * mqttObject)
 }
 
 //-------------------------------------------------------------------------------------------------------
-int  mqtt_avPublishData(mqtt_instance_st * mqttObject, const char* szKey, const char* szValue)
+static mqtt_avTopics_t* mqtt_avGetTopics(mqtt_instance_st * mqttObject)
 {
-	char* 	pTopic = (char *) malloc(strlen(getDeviceId(mqttObject)) + strlen(TOPIC_NAME_PUBLISH) + 1);
-	sprintf(pTopic, "%s%s", getDeviceId(mqttObject), TOPIC_NAME_PUBLISH);
+	mqtt_avTopics_t* topics = (mqtt_avTopics_t*) mqtt_GetUserData(mqttObject, AV_TOPIC_DATA_INDEX);
 
-	int rc = mqtt_PublishKeyValue(mqttObject, szKey, szValue, pTopic);
+	if (!topics)
+	{
+		char	szTopic[SIZE_DEVICE_ID + 16];
 
-	free(pTopic);
+		topics = (mqtt_avTopics_t *) malloc(sizeof(mqtt_avTopics_t));
+		if (!topics)
+		{
+			return NULL;
+		}
+		topics->seriesTopic = NULL;
 
-	return rc;
+		sprintf(szTopic, "%s%s", getDeviceId(mqttObject), TOPIC_NAME_PUBLISH);
+		topics->publishTopic = mqtt_RegisterTopic(mqttObject, szTopic, mqttObject->mqttConfig.qoS, 0);
+
+		sprintf(szTopic, "%s%s", getDeviceId(mqttObject), TOPIC_NAME_ACK);
+		topics->ackTopic = mqtt_RegisterTopic(mqttObject, szTopic, mqttObject->mqttConfig.qoS, 0);
+
+		mqtt_SetUserData(mqttObject, topics, AV_TOPIC_DATA_INDEX);
+	}
+
+	return topics;
 }
 
+//-------------------------------------------------------------------------------------------------------
+//summary of an aggregated key : key.count, key.min, key.max and key.mean samples timestamped at the end
+//of the window, published with the time series
+static void mqtt_avPublishWindow(mqtt_instance_st* mqttObject, const char* topicName, const char* key, const mqtt_window_t* window)
+{
+	char	szPath[MQTT_AGGREGATE_NAME_SIZE + 8];
+	char	szValue[32];
+
+	snprintf(szPath, sizeof(szPath), "%s.count", key);
+	sprintf(szValue, "%lu", window->count);
+	mqtt_avBufferSample(mqttObject, szPath, szValue, window->end);
+
+	snprintf(szPath, sizeof(szPath), "%s.min", key);
+	sprintf(szValue, "%.10g", window->min);
+	mqtt_avBufferSample(mqttObject, szPath, szValue, window->end);
+
+	snprintf(szPath, sizeof(szPath), "%s.max", key);
+	sprintf(szValue, "%.10g", window->max);
+	mqtt_avBufferSample(mqttObject, szPath, szValue, window->end);
+
+	snprintf(szPath, sizeof(szPath), "%s.mean", key);
+	sprintf(szValue, "%.10g", window->mean);
+	mqtt_avBufferSample(mqttObject, szPath, szValue, window->end);
+}
 
 //-------------------------------------------------------------------------------------------------------
-int mqtt_avPublishAck(mqtt_instance_st * mqttObject, const char* szUid, int nAck, const char* szMessage)
+int  mqtt_avPublishData(mqtt_instance_st * mqttObject, const char* szKey, const char* szValue)
 {
-	char* szPayload = (char*) malloc(strlen(szUid)+strlen(szMessage)+48);
+	mqtt_avTopics_t* topics = mqtt_avGetTopics(mqttObject);
 
-	if (nAck == 0)
+	if (!topics || !topics->publishTopic)
 	{
-		sprintf(szPayload, "[{\"uid\": \"%s\", \"status\" : \"OK\"", szUid);
+		return FAILURE;
 	}
-	else
+
+	if (mqtt_AggregateAdd(mqttObject->aggregate, mqttObject, topics->publishTopic->name, szKey, szValue, mqtt_avPublishWindow))
 	{
-		sprintf(szPayload, "[{\"uid\": \"%s\", \"status\" : \"KO\"", szUid);
+		return SUCCESS;
 	}
 
-	if (strlen(szMessage) > 0)
+	return mqtt_PublishKeyValueToTopic(mqttObject, topics->publishTopic, szKey, szValue);
+}
+
+
+//-------------------------------------------------------------------------------------------------------
+static int mqtt_avSendAcks(mqtt_instance_st * mqttObject, mqtt_avAcks_t* acks)
+{
+	//close the pending array and send all the acks in one message
+	mqtt_avTopics_t*	topics = mqtt_avGetTopics(mqttObject);
+	int					rc = FAILURE;
+
+	if (acks->count == 0)
 	{
-		sprintf(szPayload, "%s, \"message\" : \"%s\"}]", szPayload, szMessage);
+		return SUCCESS;
 	}
-	else
+
+	mqtt_JsonEndArray(&acks->writer);
+
+	if (topics && topics->ackTopic && !acks->writer.error)
+	{
+		printf("Sending %d ACK(s): %.*s\n", acks->count, (int) acks->writer.len, acks->writer.buffer);
+		rc = mqtt_PublishToTopic(mqttObject, topics->ackTopic, acks->writer.buffer, acks->writer.len);
+	}
+
+	if (rc != SUCCESS)
 	{
-		sprintf(szPayload, "%s}]", szPayload);
+		fprintf(stdout, "%d ACK(s) dropped\n", acks->count);
+		fflush(stdout);
 	}
 
-	printf("Sending ACK: %s\n", szPayload);
+	mqtt_JsonWriterFree(&acks->writer);
+	acks->count = 0;
 
-	char* 	pTopic = (char *) malloc(strlen(getDeviceId(mqttObject)) + strlen(TOPIC_NAME_ACK) + 1);
-	sprintf(pTopic, "%s%s", getDeviceId(mqttObject), TOPIC_NAME_ACK);
+	return rc;
+}
 
-	int rc =  mqtt_PublishData(mqttObject, szPayload, strlen(szPayload), pTopic);
+//-------------------------------------------------------------------------------------------------------
+static void mqtt_avProcessAcks(mqtt_instance_st * mqttObject, void* context)
+{
+	//acks queued while dispatching the received tasks, run by mqtt_ProcessEvent after the receive loop
+	mqtt_avSendAcks(mqttObject, (mqtt_avAcks_t *) context);
+}
 
-	free(pTopic);
-	free(szPayload);
+//-------------------------------------------------------------------------------------------------------
+static void mqtt_avReleaseAcks(mqtt_instance_st * mqttObject, void* context)
+{
+	mqtt_avAcks_t* acks = (mqtt_avAcks_t *) context;
 
-	return rc;
+	mqtt_JsonWriterFree(&acks->writer);
+	free(acks);
 }
 
+//-------------------------------------------------------------------------------------------------------
+static mqtt_avAcks_t* mqtt_avGetAcks(mqtt_instance_st * mqttObject)
+{
+	mqtt_avAcks_t* acks = (mqtt_avAcks_t *) mqtt_GetProcessHookContext(mqttObject, mqtt_avProcessAcks);
+
+	if (!acks)
+	{
+		acks = (mqtt_avAcks_t *) malloc(sizeof(mqtt_avAcks_t));
+
+		if (!acks)
+		{
+			return NULL;
+		}
+
+		memset(acks, 0, sizeof(mqtt_avAcks_t));
+
+		if (mqtt_AddProcessHook(mqttObject, mqtt_avProcessAcks, mqtt_avReleaseAcks, acks) != SUCCESS)
+		{
+			free(acks);
+			return NULL;
+		}
+	}
+
+	return acks;
+}
 
 //-------------------------------------------------------------------------------------------------------
-void mqtt_avOnIncomingMessage(MessageData* md)
+static int mqtt_avQueueAck(mqtt_avAcks_t* acks, const char* szUid, int nAck, const char* szMessage)
+{
+	if (acks->count == 0)
+	{
+		mqtt_JsonWriterInit(&acks->writer, NULL, 0, 1);
+		mqtt_JsonBeginArray(&acks->writer);
+	}
+
+	mqtt_JsonBeginObject(&acks->writer);
+	mqtt_JsonWriteKeyValue(&acks->writer, "uid", szUid);
+	mqtt_JsonWriteKeyValue(&acks->writer, "status", (nAck == 0) ? "OK" : "KO");
+	if (strlen(szMessage) > 0)
+	{
+		mqtt_JsonWriteKeyValue(&acks->writer, "message", szMessage);
+	}
+	mqtt_JsonEndObject(&acks->writer);
+
+	acks->count++;
+
+	return acks->writer.error ? FAILURE : SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_avPublishAck(mqtt_instance_st * mqttObject, const char* szUid, int nAck, const char* szMessage)
 {
 	/*
-		This is a callback function (handler), invoked by MQTT client whenever there is an incoming message
-		It performs the following actions :
-		  - deserialize the incoming MQTT JSON-formatted message
-		  - call convertDataToCSV()
+		Acks are appended to the pending ack array. From a task handler (inside the receive callback)
+		they are only queued, the array is sent by mqtt_ProcessEvent once the received packets are handled.
+		Otherwise the array, including the acks still pending, is sent now.
 	*/
+	mqtt_avAcks_t* acks = mqtt_avGetAcks(mqttObject);
 
-	MQTTMessage* message = md->message;
-	MQTTString*  topicName = md->topicName;
-	Client*      client = md->client;
+	if (!acks || mqtt_avQueueAck(acks, szUid, nAck, szMessage) != SUCCESS)
+	{
+		return FAILURE;
+	}
 
-	mqtt_instance_st * mqttObject = (mqtt_instance_st *) client->userCtxData;
+	if (acks->receiving)
+	{
+		return SUCCESS;
+	}
 
-	int payloadLen = (int)message->payloadlen;
+	return mqtt_avSendAcks(mqttObject, acks);
+}
 
-	char* topic = (char *) malloc(topicName->lenstring.len + 1);
-	memcpy(topic, topicName->lenstring.data, topicName->lenstring.len);
-	topic[topicName->lenstring.len] = 0;
+//-------------------------------------------------------------------------------------------------------
+static void mqtt_avProcessSeries(mqtt_instance_st * mqttObject, void* context)
+{
+	//publish the buffered samples once their policy is due, run by mqtt_ProcessEvent
+	if (mqtt_SeriesIsDue((mqtt_series_t *) context))
+	{
+		mqtt_avPublishSeries(mqttObject);
+	}
+}
 
-	printf("\nIncoming data from topic %s(%d) : Length(%d)\n", topic, topicName->lenstring.len, payloadLen);
-	printf("%.*s\n", payloadLen, (char*)message->payload);
+//-------------------------------------------------------------------------------------------------------
+static void mqtt_avReleaseSeries(mqtt_instance_st * mqttObject, void* context)
+{
+	mqtt_SeriesFree((mqtt_series_t *) context);
+	free(context);
+}
 
-	char* szPayload = (char *) malloc(payloadLen + 1);
+//-------------------------------------------------------------------------------------------------------
+static mqtt_series_t* mqtt_avGetSeries(mqtt_instance_st * mqttObject)
+{
+	mqtt_series_t* series = (mqtt_series_t *) mqtt_GetProcessHookContext(mqttObject, mqtt_avProcessSeries);
 
-	memcpy(szPayload, (char*)message->payload, payloadLen);
-	szPayload[payloadLen] = 0;
+	if (!series)
+	{
+		series = (mqtt_series_t *) malloc(sizeof(mqtt_series_t));
 
-	//decode JSON payload
+		if (!series)
+		{
+			return NULL;
+		}
+
+		if (mqtt_SeriesInit(series, AV_SERIES_MAX_SAMPLES, AV_SERIES_MAX_BYTES, AV_SERIES_MAX_AGE_MS) != SUCCESS ||
+			mqtt_AddProcessHook(mqttObject, mqtt_avProcessSeries, mqtt_avReleaseSeries, series) != SUCCESS)
+		{
+			mqtt_SeriesFree(series);
+			free(series);
+			return NULL;
+		}
+	}
+
+	return series;
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_avPublishSeries(mqtt_instance_st * mqttObject)
+{
+	mqtt_series_t*		series = (mqtt_series_t *) mqtt_GetProcessHookContext(mqttObject, mqtt_avProcessSeries);
+	mqtt_avTopics_t*	topics;
+	mqtt_jsonWriter_t	writer;
 
-	char* pszCommand = swirjson_getValue(szPayload, -1, (char *) "command");
-	if (pszCommand)
+	if (!series || series->count == 0)
 	{
-		char*	pszUid = swirjson_getValue(szPayload, -1, (char *) "uid");
-		char*	pszTimestamp = swirjson_getValue(szPayload, -1, (char *) "timestamp");
-		char*	pszId = swirjson_getValue(pszCommand, -1, (char *) "id");
-		char*	pszParam = swirjson_getValue(pszCommand, -1, (char *) "params");
+		return SUCCESS;
+	}
 
-		int     i;
-		int		rc = 0;
+	topics = mqtt_avGetTopics(mqttObject);
+	if (!topics || !topics->publishTopic)
+	{
+		return FAILURE;
+	}
 
-		#define     AV_JSON_KEY_MAX_COUNT       	10
-		#define     AV_JSON_KEY_MAX_LENGTH      	32
+	int rc = FAILURE;
 
-		for (i=0; i<AV_JSON_KEY_MAX_COUNT; i++)
+	if (topics->seriesTopic)
+	{
+		//the batch is smaller than the JSON estimate, but for a few bytes of header per key
+		mqtt_arenaMark_t	mark = mqtt_ArenaMark(mqttObject);
+		size_t				size = series->payloadBytes + 16 + 2 * (size_t) series->keyCount;
+		unsigned char*		batch = (unsigned char *) mqtt_ArenaAlloc(mqttObject, size);
+		size_t				len = batch ? mqtt_SeriesEncode(series, batch, size) : 0;
+
+		if (len > 0)
 		{
-			char szKey[AV_JSON_KEY_MAX_LENGTH];
+			rc = mqtt_PublishToTopic(mqttObject, topics->seriesTopic, (const char *) batch, len);
+		}
 
-			char * pszValue = swirjson_getValue(pszParam, i, szKey);
+		mqtt_ArenaRelease(mqttObject, mark);
+	}
+	else
+	{
+		mqtt_InitJsonWriter(mqttObject, &writer, NULL);
+		mqtt_SeriesWrite(series, &writer);
 
-			if (pszValue)
-			{
-				char key[128] = {0};
-				sprintf(key, "%s.%s", pszId, szKey);
-
-				if (mqttObject)
-				{
-					mqtt_ctxData_t* userCb =  (mqtt_ctxData_t*) mqtt_GetUserData(mqttObject, AV_USER_DATA_INDEX);
-
-					if (userCb && userCb->pfnUserCommandHandler)
-					{
-						printf("calling user handler");
-						userCb->pfnUserCommandHandler(topic, key, pszValue, pszTimestamp, userCb->pUserCommandContext);
-					}
-				}
-				else
-				{
-					fprintf(stdout, "Command[%d] : %s, %s, %s, %s\n", i, topic, key, pszValue, pszTimestamp);	
-				}
-				free(pszValue);
-			}
-			else
-			{
-				break;
-			}
-		}
+		rc = mqtt_PublishJsonToTopic(mqttObject, &writer, topics->publishTopic);
+	}
 
-		mqtt_avPublishAck(mqttObject, pszUid, rc, (char *) "");
+	if (rc == SUCCESS)
+	{
+		mqtt_SeriesClear(series);
+	}
+	else
+	{
+		//keep the samples for the next attempt, the age policy is restarted
+		countdown_ms(&series->deadline, (unsigned int) series->maxAgeMs);
+	}
 
-		free(pszCommand);
+	return rc;
+}
 
-		if (pszId)
+//-------------------------------------------------------------------------------------------------------
+int mqtt_avBufferSample(mqtt_instance_st * mqttObject, const char* szKey, const char* szValue, unsigned long long timestamp)
+{
+	mqtt_series_t* series = mqtt_avGetSeries(mqttObject);
+
+	if (!series)
+	{
+		return FAILURE;
+	}
+
+	if (mqtt_SeriesAdd(series, szKey, szValue, timestamp) != SUCCESS)
+	{
+		//full : publish what is buffered and try again
+		if (mqtt_avPublishSeries(mqttObject) != SUCCESS || mqtt_SeriesAdd(series, szKey, szValue, timestamp) != SUCCESS)
 		{
-			free(pszId);
+			return FAILURE;
 		}
-		if (pszParam)
+	}
+
+	if (mqtt_SeriesIsDue(series))
+	{
+		mqtt_avPublishSeries(mqttObject);
+	}
+
+	return SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_avSetSeriesPolicy(mqtt_instance_st * mqttObject, int maxSamples, int maxBytes, int maxAgeMs)
+{
+	mqtt_series_t* series = mqtt_avGetSeries(mqttObject);
+	mqtt_series_t  resized;
+
+	if (!series || maxSamples <= 0 || maxBytes <= 0 || maxAgeMs < 0)
+	{
+		return FAILURE;
+	}
+
+	//samples buffered with the previous policy are published first
+	if (mqtt_avPublishSeries(mqttObject) != SUCCESS)
+	{
+		return FAILURE;
+	}
+
+	if (mqtt_SeriesInit(&resized, maxSamples, (size_t) maxBytes, maxAgeMs) != SUCCESS)
+	{
+		return FAILURE;
+	}
+
+	mqtt_SeriesFree(series);
+	memcpy(series, &resized, sizeof(mqtt_series_t));
+
+	return SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------------------------
+//binary : the time series is published as mqttCodec batches on szTopicName, which AirVantage does not
+//decode : the topic is to be read by a backend or a subscriber using the codec
+int mqtt_avSetSeriesCodec(mqtt_instance_st * mqttObject, int binary, const char* szTopicName)
+{
+	mqtt_avTopics_t*	topics = mqtt_avGetTopics(mqttObject);
+	mqtt_topic_st*		seriesTopic = NULL;
+
+	if (!topics || (binary && (szTopicName == NULL || szTopicName[0] == '\0')))
+	{
+		return FAILURE;
+	}
+
+	//samples buffered are published the way they were expected
+	if (mqtt_avPublishSeries(mqttObject) != SUCCESS)
+	{
+		return FAILURE;
+	}
+
+	if (binary && (seriesTopic = mqtt_RegisterTopic(mqttObject, szTopicName, mqttObject->mqttConfig.qoS, 0)) == NULL)
+	{
+		return FAILURE;
+	}
+
+	if (topics->seriesTopic)
+	{
+		mqtt_UnregisterTopic(mqttObject, topics->seriesTopic);
+	}
+	topics->seriesTopic = seriesTopic;
+
+	return SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------------------------
+static void mqtt_avReportDownload(mqtt_instance_st * mqttObject, mqtt_avDownload_t* avDownload, int status)
+{
+	//status : 0 in progress, 1 done, MQTT_DOWNLOAD_ERROR_xxx when failed
+	mqtt_ctxData_t* userCb =  (mqtt_ctxData_t*) mqtt_GetUserData(mqttObject, AV_USER_DATA_INDEX);
+
+	avDownload->reported = avDownload->download.received;
+
+	if (userCb && userCb->pfnUserDownloadHandler)
+	{
+		userCb->pfnUserDownloadHandler(avDownload->uid, avDownload->download.received, avDownload->download.total, status,
+										userCb->pUserDownloadContext);
+	}
+}
+
+//-------------------------------------------------------------------------------------------------------
+static void mqtt_avProcessDownload(mqtt_instance_st * mqttObject, void* context)
+{
+	//one bounded step per mqtt_ProcessEvent, the operation is acked when the download ends
+	mqtt_avDownload_t*		avDownload = (mqtt_avDownload_t *) context;
+	mqtt_download_t*		download = &avDownload->download;
+
+	if (download->state != MQTT_DOWNLOAD_RUNNING)
+	{
+		return;
+	}
+
+	if (mqtt_DownloadStep(download) == MQTT_DOWNLOAD_RUNNING)
+	{
+		if (download->received != avDownload->reported)
 		{
-			free(pszParam);
+			mqtt_avReportDownload(mqttObject, avDownload, 0);
 		}
-		if (pszTimestamp)
+		return;
+	}
+
+	if (download->state == MQTT_DOWNLOAD_DONE)
+	{
+		mqtt_avReportDownload(mqttObject, avDownload, 1);
+		mqtt_avPublishAck(mqttObject, avDownload->uid, 0, "");
+	}
+	else
+	{
+		mqtt_avReportDownload(mqttObject, avDownload, download->error);
+		mqtt_avPublishAck(mqttObject, avDownload->uid, 1, mqtt_DownloadErrorString(download->error));
+	}
+}
+
+//-------------------------------------------------------------------------------------------------------
+static void mqtt_avReleaseDownload(mqtt_instance_st * mqttObject, void* context)
+{
+	mqtt_DownloadCancel(&((mqtt_avDownload_t *) context)->download);
+	free(context);
+}
+
+//-------------------------------------------------------------------------------------------------------
+static mqtt_avDownload_t* mqtt_avGetDownload(mqtt_instance_st * mqttObject)
+{
+	mqtt_avDownload_t* avDownload = (mqtt_avDownload_t *) mqtt_GetProcessHookContext(mqttObject, mqtt_avProcessDownload);
+
+	if (!avDownload)
+	{
+		avDownload = (mqtt_avDownload_t *) malloc(sizeof(mqtt_avDownload_t));
+
+		if (!avDownload)
 		{
-			free(pszTimestamp);
+			return NULL;
 		}
-		if (pszUid)
+
+		memset(avDownload, 0, sizeof(mqtt_avDownload_t));
+
+		if (mqtt_AddProcessHook(mqttObject, mqtt_avProcessDownload, mqtt_avReleaseDownload, avDownload) != SUCCESS)
 		{
-			free(pszUid);
+			free(avDownload);
+			return NULL;
 		}
 	}
-	else
+
+	return avDownload;
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_avStartDownload(mqtt_instance_st * mqttObject, const char* szUid, const char* szUrl, const char* szTargetFile, const char* szSha256)
+{
+	mqtt_avDownload_t* avDownload = mqtt_avGetDownload(mqttObject);
+
+	if (!avDownload || avDownload->download.state == MQTT_DOWNLOAD_RUNNING || strlen(szUid) >= sizeof(avDownload->uid))
 	{
-		pszCommand = swirjson_getValue(szPayload, -1, (char *) "swinstall");
-		if (pszCommand)
-		{
-			char*	uid = swirjson_getValue(szPayload, -1, (char *) "uid");
-			char*	pszTimestamp = swirjson_getValue(szPayload, -1, (char *) "timestamp");
-			char*	type = swirjson_getValue(pszCommand, -1, (char *) "type");
-			char*	revision = swirjson_getValue(pszCommand, -1, (char *) "revision");
-			char*	url = swirjson_getValue(pszCommand, -1, (char *) "url");
+		return FAILURE;
+	}
 
-			if (mqttObject)
-			{
-				mqtt_ctxData_t* userCb =  (mqtt_ctxData_t*) mqtt_GetUserData(mqttObject, AV_USER_DATA_INDEX);
+	strcpy(avDownload->uid, szUid);
+	avDownload->reported = 0;
 
-				if (userCb && userCb->pfnUserSWInstallHandler)
-				{
-					userCb->pfnUserSWInstallHandler(uid, type, revision, url, pszTimestamp, userCb->pUserSWInstallContext);
-				}
-			}
-			else
+	if (mqtt_DownloadStart(&avDownload->download, szUrl, szTargetFile, szSha256, mqttObject->mqttConfig.tlsRootCA) != SUCCESS)
+	{
+		mqtt_avReportDownload(mqttObject, avDownload, avDownload->download.error);
+		return FAILURE;
+	}
+
+	fprintf(stdout, "Download of %s into %s started\n", szUrl, szTargetFile);
+	fflush(stdout);
+
+	return SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_avCancelDownload(mqtt_instance_st * mqttObject)
+{
+	mqtt_avDownload_t* avDownload = (mqtt_avDownload_t *) mqtt_GetProcessHookContext(mqttObject, mqtt_avProcessDownload);
+
+	if (!avDownload || avDownload->download.state != MQTT_DOWNLOAD_RUNNING)
+	{
+		return FAILURE;
+	}
+
+	mqtt_DownloadCancel(&avDownload->download);
+	mqtt_avReportDownload(mqttObject, avDownload, avDownload->download.error);
+
+	return SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_avSetDownloadDirectory(mqtt_instance_st * mqttObject, const char* szDirectory)
+{
+	mqtt_avDownload_t* avDownload = mqtt_avGetDownload(mqttObject);
+
+	if (!avDownload || strlen(szDirectory) >= sizeof(avDownload->directory))
+	{
+		return FAILURE;
+	}
+
+	strcpy(avDownload->directory, szDirectory);
+
+	return SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------------------------
+//the operation of a download is acked by the engine when the download ends, not by the application
+int mqtt_avIsDownloadUid(mqtt_instance_st * mqttObject, const char* szUid)
+{
+	mqtt_avDownload_t* avDownload = (mqtt_avDownload_t *) mqtt_GetProcessHookContext(mqttObject, mqtt_avProcessDownload);
+
+	return avDownload && avDownload->download.state != MQTT_DOWNLOAD_IDLE && avDownload->uid[0] != '\0'
+			&& strcmp(avDownload->uid, szUid) == 0;
+}
+
+//-------------------------------------------------------------------------------------------------------
+static char* mqtt_avGetValue(char* szJson, mqtt_jsonToken_t* tokens, int object, const char* szKey)
+{
+	//value of szKey in object, terminated in place, "" if missing
+	int index = mqtt_JsonFind(szJson, tokens, object, szKey);
+
+	if (index < 0)
+	{
+		return (char *) "";
+	}
+
+	return mqtt_JsonString(szJson, &tokens[index]);
+}
+
+//-------------------------------------------------------------------------------------------------------
+static void mqtt_avOnTask(mqtt_instance_st * mqttObject, const char* topic, char* szPayload, mqtt_jsonToken_t* tokens, int tokenCount, int task)
+{
+	mqtt_ctxData_t* userCb =  (mqtt_ctxData_t*) mqtt_GetUserData(mqttObject, AV_USER_DATA_INDEX);
+
+	int command = mqtt_JsonFind(szPayload, tokens, task, "command");
+	if (command >= 0)
+	{
+		int		params = mqtt_JsonFind(szPayload, tokens, command, "params");
+		int		paramCount = (params >= 0 && tokens[params].type == MQTT_JSON_OBJECT) ? tokens[params].size : 0;
+		int		i;
+		int		rc = 0;
+
+		char*	pszUid = mqtt_avGetValue(szPayload, tokens, task, "uid");
+		char*	pszTimestamp = mqtt_avGetValue(szPayload, tokens, task, "timestamp");
+		char*	pszId = mqtt_avGetValue(szPayload, tokens, command, "id");
+
+		for (i=0; i<paramCount; i++)
+		{
+			int		keyIndex = mqtt_JsonChild(tokens, params, i);
+			char	key[128];
+
+			//a key without its value is not a parameter
+			if (keyIndex < 0 || keyIndex + 1 >= tokenCount || tokens[keyIndex + 1].parent != keyIndex)
 			{
-				fprintf(stdout, "SW install Request : %s, %s, %s, %s, %s\n", uid, type, revision, url, pszTimestamp);	
+				rc = 1;
+				continue;
 			}
 
-			free(pszCommand);
+			char*	pszKey = mqtt_JsonString(szPayload, &tokens[keyIndex]);
+			char*	pszValue = mqtt_JsonString(szPayload, &tokens[keyIndex + 1]);
 
-			if (uid)
+			snprintf(key, sizeof(key), "%s.%s", pszId, pszKey);
+
+			if (userCb && userCb->pfnUserCommandHandler)
 			{
-				free(uid);
+				printf("calling user handler");
+				userCb->pfnUserCommandHandler(topic, key, pszValue, pszTimestamp, userCb->pUserCommandContext);
 			}
-			if (type)
+			else
 			{
-				free(type);
+				fprintf(stdout, "Command[%d] : %s, %s, %s, %s\n", i, topic, key, pszValue, pszTimestamp);	
 			}
-			if (pszTimestamp)
+		}
+
+		mqtt_avPublishAck(mqttObject, pszUid, rc, (char *) "");
+		return;
+	}
+
+	command = mqtt_JsonFind(szPayload, tokens, task, "swinstall");
+	if (command >= 0)
+	{
+		char*	uid = mqtt_avGetValue(szPayload, tokens, task, "uid");
+		char*	pszTimestamp = mqtt_avGetValue(szPayload, tokens, task, "timestamp");
+		char*	type = mqtt_avGetValue(szPayload, tokens, command, "type");
+		char*	revision = mqtt_avGetValue(szPayload, tokens, command, "revision");
+		char*	url = mqtt_avGetValue(szPayload, tokens, command, "url");
+
+		if (userCb && userCb->pfnUserSWInstallHandler)
+		{
+			userCb->pfnUserSWInstallHandler(uid, type, revision, url, pszTimestamp, userCb->pUserSWInstallContext);
+		}
+		else
+		{
+			fprintf(stdout, "SW install Request : %s, %s, %s, %s, %s\n", uid, type, revision, url, pszTimestamp);	
+		}
+
+		//automatic download : <directory>/<uid>, acked by the download engine when done
+		//the uid comes from the broker : it must name a file of the directory, nothing above nor hidden
+		//the package is verified when the request carries its sha256, written unchecked otherwise
+		mqtt_avDownload_t* avDownload = (mqtt_avDownload_t *) mqtt_GetProcessHookContext(mqttObject, mqtt_avProcessDownload);
+
+		if (avDownload && strlen(avDownload->directory) > 0 && avDownload->download.state != MQTT_DOWNLOAD_RUNNING)
+		{
+			char	szTarget[sizeof(avDownload->directory) + sizeof(avDownload->uid) + 1];
+			char*	sha256 = mqtt_avGetValue(szPayload, tokens, command, "sha256");
+
+			if (uid[0] == '\0' || uid[0] == '.' || strchr(uid, '/') != NULL)
 			{
-				free(pszTimestamp);
+				mqtt_avPublishAck(mqttObject, uid, 1, (char *) "invalid uid");
+				return;
 			}
-			if (revision)
+
+			snprintf(szTarget, sizeof(szTarget), "%s/%s", avDownload->directory, uid);
+			if (mqtt_avStartDownload(mqttObject, uid, url, szTarget, sha256) != SUCCESS)
 			{
-				free(revision);
+				mqtt_avPublishAck(mqttObject, uid, 1, (char *) "download not started");
 			}
-			if (url)
+		}
+	}
+}
+
+//-------------------------------------------------------------------------------------------------------
+void mqtt_avOnIncomingMessage(MessageData* md)
+{
+	/*
+		This is a callback function (handler), invoked by MQTT client whenever there is an incoming message
+		It performs the following actions :
+		  - tokenize the incoming MQTT JSON-formatted message once : [{task}, {task}...] or {task}
+		  - call the user handlers for each command parameter or software install request
+		  - queue the command acks, sent in one array by mqtt_ProcessEvent after the receive loop
+		Topic, payload and tokens are held in the instance arena, released once dispatched
+	*/
+
+	MQTTMessage* message = md->message;
+	MQTTString*  topicName = md->topicName;
+	Client*      client = md->client;
+
+	mqtt_instance_st * mqttObject = (mqtt_instance_st *) client->userCtxData;
+
+	int payloadLen = (int)message->payloadlen;
+
+	mqtt_avAcks_t* acks = mqtt_avGetAcks(mqttObject);
+
+	mqtt_arenaMark_t mark = mqtt_ArenaMark(mqttObject);
+
+	char* topic = (char *) mqtt_ArenaAlloc(mqttObject, topicName->lenstring.len + 1);
+	char* szPayload = (char *) mqtt_ArenaAlloc(mqttObject, payloadLen + 1);
+
+	if (!topic || !szPayload)
+	{
+		printf("\nIncoming data dropped, no memory for %d bytes\n", payloadLen);
+		fflush(stdout);
+		mqttObject->arena.dropped++;
+		mqtt_ArenaRelease(mqttObject, mark);
+		return;
+	}
+
+	memcpy(topic, topicName->lenstring.data, topicName->lenstring.len);
+	topic[topicName->lenstring.len] = 0;
+
+	printf("\nIncoming data from topic %s(%d) : Length(%d)\n", topic, topicName->lenstring.len, payloadLen);
+	printf("%.*s\n", payloadLen, (char*)message->payload);
+
+	memcpy(szPayload, (char*)message->payload, payloadLen);
+	szPayload[payloadLen] = 0;
+
+	//decode JSON payload
+
+	if (acks)
+	{
+		acks->receiving = 1;
+	}
+
+	//as many tokens as the payload holds : a task array is not bounded
+	int maxTokens = mqtt_JsonCountTokens(szPayload, (size_t) payloadLen);
+	mqtt_jsonToken_t* tokens = (maxTokens > 0) ? (mqtt_jsonToken_t *) mqtt_ArenaAlloc(mqttObject, maxTokens * sizeof(mqtt_jsonToken_t)) : NULL;
+	int tokenCount = tokens ? mqtt_JsonTokenize(szPayload, (size_t) payloadLen, tokens, maxTokens) : MQTT_JSON_ERROR_NOMEM;
+
+	if (maxTokens > 0 && !tokens)
+	{
+		fprintf(stdout, "Incoming data dropped, no memory for %d tokens\n", maxTokens);
+		mqttObject->arena.dropped++;
+	}
+	else if (tokenCount <= 0)
+	{
+		fprintf(stdout, "invalid JSON payload : %d\n", tokenCount);
+	}
+	else if (tokens[0].type == MQTT_JSON_ARRAY)
+	{
+		int i;
+		for (i=0; i<tokens[0].size; i++)
+		{
+			int task = mqtt_JsonChild(tokens, 0, i);
+
+			if (tokens[task].type == MQTT_JSON_OBJECT)
 			{
-				free(url);
+				mqtt_avOnTask(mqttObject, topic, szPayload, tokens, tokenCount, task);
 			}
 		}
 	}
-
-	if (topic)
+	else if (tokens[0].type == MQTT_JSON_OBJECT)
 	{
-		free(topic);
+		mqtt_avOnTask(mqttObject, topic, szPayload, tokens, tokenCount, 0);
 	}
-	if (szPayload)
+
+	if (acks)
 	{
-		free(szPayload);
+		acks->receiving = 0;
 	}
 
+	mqtt_ArenaRelease(mqttObject, mark);
+
 	fflush(stdout);
 }
 
@@ -336,7 +880,7 @@ void mqtt_avSubscribeAirVantageTopic(mqtt_instance_st* mqttObject)
 
 	printf("Subscribing to topic %s... ", pTopic);
 	int rc = MQTTSubscribe(&mqttObject->mqttClient, pTopic, mqttObject->mqttConfig.qoS, mqtt_avOnIncomingMessage);
-	printf("%s\n", rc == 0 ? "OK" : "Failed");
+	printf("%s\n", rc == 0 ? "OK" : (rc == BUFFER_OVERFLOW ? "Failed (topic filter too long)" : "Failed"));
 	//printf("Subscribed %d\n", rc);
 	fflush(stdout);
 
@@ -381,5 +925,11 @@ void mqtt_avSetSoftwareInstallRequestHandler(mqtt_instance_st * mqttObject, soft
 	userCb->pUserSWInstallContext = pUserContext;
 }
 
+//-------------------------------------------------------------------------------------------------------
+void mqtt_avSetDownloadProgressHandler(mqtt_instance_st * mqttObject, downloadProgressHandler pHandler, void * pUserContext)
+{
+	mqtt_ctxData_t* userCb =  (mqtt_ctxData_t*) mqtt_avCreateUserData(mqttObject);
 
-
+	userCb->pfnUserDownloadHandler = pHandler;
+	userCb->pUserDownloadContext = pUserContext;
+}
@@ -8,6 +8,11 @@
 		- Receive AirVantage commands along with command parameters
 		- Receive Software/Firmware Installation (FOTA/SOTA) Request from AirVantage
 		- ACKing the SW installation request
+		- Buffering timestamped samples, published as one multi-timestamp message (see mqttSeries.h)
+		  when the series policy (sample count, payload size, age of the oldest sample) is due, or as
+		  binary batches on a topic of the application (see mqttCodec.h)
+		- Downloading the SW installation packages (see mqttDownload.h), resumed after a link loss,
+		  with progress reported to the application and the operation acked when done
 
 	Communication with AirVantage performed over MQTT prococol, with ot without secured transport : TLS
 
@@ -60,6 +65,17 @@ void mqtt_avSubscribeAirVantageTopic(mqtt_instance_st* mqttObject);
 int mqtt_avPublishAck(mqtt_instance_st * mqttObject, const char* szUid, int nAck, const char* szMessage);
 int mqtt_avPublishData(mqtt_instance_st * mqttObject, const char* szKey, const char* szValue);
 
+int mqtt_avBufferSample(mqtt_instance_st * mqttObject, const char* szKey, const char* szValue, unsigned long long timestamp);
+int mqtt_avPublishSeries(mqtt_instance_st * mqttObject);
+int mqtt_avSetSeriesPolicy(mqtt_instance_st * mqttObject, int maxSamples, int maxBytes, int maxAgeMs);
+int mqtt_avSetSeriesCodec(mqtt_instance_st * mqttObject, int binary, const char* szTopicName);
+
+int mqtt_avStartDownload(mqtt_instance_st * mqttObject, const char* szUid, const char* szUrl, const char* szTargetFile, const char* szSha256);
+int mqtt_avCancelDownload(mqtt_instance_st * mqttObject);
+int mqtt_avSetDownloadDirectory(mqtt_instance_st * mqttObject, const char* szDirectory);
+int mqtt_avIsDownloadUid(mqtt_instance_st * mqttObject, const char* szUid);
+void mqtt_avSetDownloadProgressHandler(mqtt_instance_st * mqttObject, downloadProgressHandler pHandler, void * pUserContext);
+
 /*
   you can use functions in mqttGeneric interface :
    mqtt_StartSession
@@ -15,10 +15,9 @@
 #include <memory.h>
 
 #include "swir_json.h"
+#include "mqttJson.h"
 
 
-#define JSON_MAX_PAYLOAD_SIZE	2048
-
 #define JSON_KEY_VAL_SEPARATOR	':'
 #define JSON_KEY_VAL_END_MARKER	','
 #define JSON_QUOTE				'\"'
@@ -30,34 +29,35 @@
 
 char* swirjson_szSerialize(const char* szKey, const char* szValue, unsigned long ulTimestamp)
 {
-	char	szPayload[JSON_MAX_PAYLOAD_SIZE];
+	mqtt_jsonWriter_t	writer;
 
-	memset(szPayload, 0, sizeof(szPayload));
+	mqtt_JsonWriterInit(&writer, NULL, 0, 1);
 
 	if (ulTimestamp == 0)
 	{
-		//sprintf(szPayload, "[{\"%s\": [{\"timestamp\" : 1426939843000, \"value\" : \"%s\"}]}]", szKey, szValue);
-		//sprintf(szPayload, "[{\"%s\": [{\"timestamp\" : \"\", \"value\" : \"%s\"}]}]", szKey, szValue);
-		sprintf(szPayload, "\"%s\":\"%s\"", szKey, szValue);	
+		//"key":"value"
+		mqtt_JsonWriteKeyValue(&writer, szKey, szValue);
 	}
 	else
 	{
-		//sprintf(szPayload, "[{\"%s\": [{\"timestamp\" : %lu, \"value\" : \"%s\"}]}]", szKey, ulTimestamp, szValue);
-		sprintf(szPayload, "\"%lu000\":{\"%s\":\"%s\"}", ulTimestamp, szKey, szValue);
+		//"timestamp000":{"key":"value"}
+		char	szTimestamp[32];
+
+		snprintf(szTimestamp, sizeof(szTimestamp), "%lu000", ulTimestamp);
+		mqtt_JsonWriteKey(&writer, szTimestamp);
+		mqtt_JsonBeginObject(&writer);
+		mqtt_JsonWriteKeyValue(&writer, szKey, szValue);
+		mqtt_JsonEndObject(&writer);
 	}
 
-	char*	pszJson = (char*) malloc(strlen(szPayload)+1);
-
-	strcpy(pszJson, szPayload);
-
-	return pszJson;
+	return mqtt_JsonWriterDetach(&writer);
 }
 
 char* swirjson_fSerialize(char* szKey, float fValue, unsigned long ulTimestamp)
 {
 	char szValue[16];
 
-	sprintf(szValue, "%.2f", fValue);
+	snprintf(szValue, sizeof(szValue), "%.2f", fValue);
 
 	return swirjson_szSerialize(szKey, szValue, ulTimestamp);
 }
@@ -66,55 +66,56 @@ char* swirjson_nSerialize(char* szKey, int nValue, unsigned long ulTimestamp)
 {
 	char szValue[16];
 
-	sprintf(szValue, "%d", nValue);
+	snprintf(szValue, sizeof(szValue), "%d", nValue);
 
 	return swirjson_szSerialize(szKey, szValue, ulTimestamp);
 }
 
 char* swirjson_lstSerialize(char* szKey, int nValueCount, char** pszValueList, unsigned long* pulTimestampList)
 {
-        char*	szPayload = (char *) malloc(JSON_MAX_PAYLOAD_SIZE);
-
-		memset(szPayload, 0, JSON_MAX_PAYLOAD_SIZE);
-
-        sprintf(szPayload, "{\"%s\": [", szKey);
-
-        int i = 0;
-        for (i=0; i<nValueCount; i++)
-        {
-            if (pulTimestampList == NULL)
-            {
-				sprintf(szPayload, "%s {\"timestamp\" : \"\", \"value\" : \"%s\"}", szPayload, pszValueList[i]);	//format 2, not working
-				//sprintf(szPayload, "{\"%s\":%s}", szKey, szValue);		//format 1
-            }
-            else if (pulTimestampList[i] == 0)
-	        {
-		        sprintf(szPayload, "%s {\"timestamp\" : \"\", \"value\" : \"%s\"}", szPayload, pszValueList[i]);	//format 2, not working
-		        //sprintf(szPayload, "{\"%s\":%s}", szKey, szValue);		//format 1
-	        }
-	        else
-	        {
-	        	sprintf(szPayload, "%s {\"timestamp\" : %lu, \"value\" : \"%s\"}", szPayload, pulTimestampList[i], pszValueList[i]);	//format 2, not working
-	        	//sprintf(szPayload, "{\"%lu\":{\"%s\":%s}}", ulTimestamp, szKey, szValue);		//format 1
-            }
-            free(pszValueList[i]);
-            
-            if (i < nValueCount-1)
-            {
-                strcat(szPayload, ",");
-            }
-    }
-
-        strcat(szPayload, "]}");
-
-        return szPayload;
+	//{"key": [{"timestamp" : ts or "", "value" : "value"}, ...]}, the values of the list are freed
+	mqtt_jsonWriter_t	writer;
+	int					i;
+
+	mqtt_JsonWriterInit(&writer, NULL, 0, 1);
+
+	mqtt_JsonBeginObject(&writer);
+	mqtt_JsonWriteKey(&writer, szKey);
+	mqtt_JsonBeginArray(&writer);
+
+	for (i=0; i<nValueCount; i++)
+	{
+		mqtt_JsonBeginObject(&writer);
+
+		mqtt_JsonWriteKey(&writer, "timestamp");
+		if (pulTimestampList == NULL || pulTimestampList[i] == 0)
+		{
+			mqtt_JsonWriteString(&writer, "");
+		}
+		else
+		{
+			mqtt_JsonWriteNumber(&writer, "%lu", pulTimestampList[i]);
+		}
+		mqtt_JsonWriteKeyValue(&writer, "value", pszValueList[i]);
+
+		mqtt_JsonEndObject(&writer);
+
+		free(pszValueList[i]);
+	}
+
+	mqtt_JsonEndArray(&writer);
+	mqtt_JsonEndObject(&writer);
+
+	return mqtt_JsonWriterDetach(&writer);
 }
 
-char * swirjson_getValue(char* szJson, int nKeyIndex, char* szSearchKey)
+int swirjson_findValue(const char* szJson, int nKeyIndex, char* szSearchKey, int* pnValueLen)
 {
 	//use case 1 : nKeyIndex = -1 --> search by KeyName using szSearchKey as input
 	//use case 2 : nKeyIndex > -1 --> search by index, szSearchKey, as output, will be filled with the keyName indexed by nIndexKey 
-	char *	pszValue = NULL;
+	//returns the offset of the value in szJson and its length in pnValueLen, -1 if not found
+	int		nValuePos = -1;
+	int		nJsonLen = (int)strlen(szJson);
 
 	char	cChar, cOpen, cClose;
 	int		nState = 0, nPos = 0, nObjectCount = 0;
@@ -169,7 +170,7 @@ char * swirjson_getValue(char* szJson, int nKeyIndex, char* szSearchKey)
 				else if (!isspace(cChar))
 				{
 					//error, unexpected character
-					return pszValue;
+					return nValuePos;
 				}
 				break;
 			case 3:	//detecting value starter
@@ -259,18 +260,8 @@ char * swirjson_getValue(char* szJson, int nKeyIndex, char* szSearchKey)
 
 		if (bFound)
 		{
-			if (nValEndPos >= nValStartPos)
-			{
-				int nLen = nValEndPos - nValStartPos + 1;
-				pszValue = (char *) malloc(nLen + 1);
-				memset(pszValue, 0, nLen + 1);
-				memcpy(pszValue, szJson+nValStartPos, nLen);
-			}
-			else
-			{
-				pszValue = (char *) malloc(1);
-				*pszValue = 0;
-			}
+			nValuePos = nValStartPos;
+			*pnValueLen = (nValEndPos >= nValStartPos) ? nValEndPos - nValStartPos + 1 : 0;
 			if (nKeyIndex > -1 && szSearchKey)
 			{
 				//return the KeyName
@@ -282,7 +273,24 @@ char * swirjson_getValue(char* szJson, int nKeyIndex, char* szSearchKey)
 
 		nPos++;
 
-	} while (nPos <= (int)strlen(szJson));
+	} while (nPos <= nJsonLen);
+
+	return nValuePos;
+}
+
+char * swirjson_getValue(char* szJson, int nKeyIndex, char* szSearchKey)
+{
+	int		nLen = 0;
+	int		nPos = swirjson_findValue(szJson, nKeyIndex, szSearchKey, &nLen);
+
+	if (nPos < 0)
+	{
+		return NULL;
+	}
+
+	char *	pszValue = (char *) malloc(nLen + 1);
+	memcpy(pszValue, szJson+nPos, nLen);
+	pszValue[nLen] = 0;
 
 	return pszValue;
 }
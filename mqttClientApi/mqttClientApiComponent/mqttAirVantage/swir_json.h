@@ -18,6 +18,7 @@ char*		swirjson_fSerialize(char* szKey, float fValue, unsigned long ulTimestamp)
 char*		swirjson_nSerialize(char* szKey, int nValue, unsigned long ulTimestamp);
 char*		swirjson_lstSerialize(char* szKey, int nValueCount, char** pszValueList, unsigned long* pulTimestampList);
 char *		swirjson_getValue(char* szJson, int nKeyIndex, char* szSearchKey);
+int			swirjson_findValue(const char* szJson, int nKeyIndex, char* szSearchKey, int* pnValueLen);
 
 
 #endif	//_SWIR_JSON_H_
@@ -15,24 +15,34 @@
 
 
 #include "le_info_interface.h"
+#include "le_data_interface.h"
 
 #include "mqttAirVantage.h"
+#include "mqttShared.h"
+#include "mqttJwt.h"
+#include "mqttSched.h"
+#include "mqttCompress.h"
+#include "tlsKeyCache.h"
 
 
-#define MAX_INSTANCE                    5
+#define INITIAL_INSTANCE_CAPACITY       8
 
 typedef struct 
 {
-    mqtt_config_t                       mqttConfig;
     mqtt_instance_st*                   mqttObject;
+    mqtt_attachment_st*                 attachment;     // not NULL if the mqtt object is a shared session
 } ST_MQTT_CLIENT;
 
 
 
 //--------------------------------------------------------------------------------------------------
 /**
- *  This mqtt client manager can handle up to MAX_INSTANCE instances of mqtt client
- *  client instace #0 is reserved for CLI
+ *  This mqtt client manager pre-allocates INITIAL_INSTANCE_CAPACITY instances of mqtt client,
+ *  the pool and the reference map grow on demand when more instances are created.
+ *  The configuration is only held by the mqtt object, packet buffers and TLS context are allocated
+ *  while a session is started.
+ *  Instances created with CreateShared attach to a mqtt object shared with other instances having
+ *  the same broker identity (see mqttShared.h).
  */
 //--------------------------------------------------------------------------------------------------
 
@@ -45,6 +55,35 @@ le_ref_MapRef_t             g_MqttClientRefMap;
 
 #define GET_MQTT_OBJECT(mqttClientRef) ST_MQTT_CLIENT* mqttClientPtr = le_ref_Lookup(g_MqttClientRefMap, mqttClientRef)
 
+//--------------------------------------------------------------------------------------------------
+/**
+ *  Topics registered on an instance, the encoded topic is held by the mqtt object
+ */
+//--------------------------------------------------------------------------------------------------
+typedef struct
+{
+    mqttClient_InstanceRef_t            mqttClientRef;
+    mqtt_topic_st*                      topic;
+} ST_MQTT_TOPIC;
+
+// Pool from which ST_MQTT_TOPIC objects are allocated.
+le_mem_PoolRef_t            g_MqttTopicPool;
+
+// Safe Reference Map for ST_MQTT_TOPIC objects.
+le_ref_MapRef_t             g_MqttTopicRefMap;
+
+//--------------------------------------------------------------------------------------------------
+/**
+ *  Data link state, reported by le_data to all the instances (see mqtt_SetLinkState) : sessions are
+ *  paused while the bearer is down and resumed when it is back, the retry timer runs while a resume
+ *  is pending.
+ */
+//--------------------------------------------------------------------------------------------------
+bool                        g_BearerUp = true;
+uint64_t                    g_BearerUps;
+uint64_t                    g_BearerDowns;
+le_timer_Ref_t              g_LinkRetryTimer;
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 
@@ -70,6 +109,11 @@ mqttClient_IncomingMessageHandlerRef_t mqttClient_AddIncomingMessageHandler
             mqtt_avSetCommandHandler(mqttClientPtr->mqttObject, (incomingMessageHandler) handlerPtr, contextPtr);
         }
         //else
+        if (mqttClientPtr->attachment)
+        {
+            mqtt_SharedSetCommandHandler(mqttClientPtr->attachment, (incomingMessageHandler) handlerPtr, contextPtr);
+        }
+        else
         {
             mqtt_SetCommandHandler(mqttClientPtr->mqttObject, (incomingMessageHandler) handlerPtr, contextPtr);
         }
@@ -101,6 +145,11 @@ void mqttClient_RemoveIncomingMessageHandler
             mqtt_avSetCommandHandler(mqttClientPtr->mqttObject, NULL, NULL);
         }
         //else
+        if (mqttClientPtr->attachment)
+        {
+            mqtt_SharedSetCommandHandler(mqttClientPtr->attachment, NULL, NULL);
+        }
+        else
         {
             mqtt_SetCommandHandler(mqttClientPtr->mqttObject, NULL, NULL);
         }
@@ -160,39 +209,113 @@ void mqttClient_RemoveAvSoftwareInstallHandler
 }
 
 
-//-------------------------------------------------------------------------
-le_result_t mqttClient_ProcessEvent
+//--------------------------------------------------------------------------------------------------
+/**
+ * This function adds a handler for the package download progress
+ */
+//--------------------------------------------------------------------------------------------------
+mqttClient_AvDownloadProgressHandlerRef_t mqttClient_AddAvDownloadProgressHandler
 (
-    mqttClient_InstanceRef_t    mqttClientRef
+    mqttClient_InstanceRef_t                    mqttClientRef,
+    mqttClient_AvDownloadProgressHandlerFunc_t  handlerPtr,
+    void*                                       contextPtr
 )
 {
     GET_MQTT_OBJECT(mqttClientRef);
 
     if (mqttClientPtr != NULL && mqttClientPtr->mqttObject != NULL)
     {
-        int ret = mqtt_ProcessEvent(mqttClientPtr->mqttObject, 1000);
+        mqtt_avSetDownloadProgressHandler(mqttClientPtr->mqttObject, (downloadProgressHandler) handlerPtr, contextPtr);
 
-        if (ret >= -1)  //paho : FAILURE, SUCCESS, or packet_type
-        {
-            return LE_OK;
-        }
+        return (mqttClient_AvDownloadProgressHandlerRef_t) mqttClientRef;
     }
 
-    return LE_FAULT;
+    return NULL;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+/**
+ * This function removes a handler for the package download progress
+ */
+//--------------------------------------------------------------------------------------------------
+void mqttClient_RemoveAvDownloadProgressHandler
+(
+    mqttClient_AvDownloadProgressHandlerRef_t downloadHandlerRef
+)
+{
+    GET_MQTT_OBJECT(downloadHandlerRef);
+
+    if (mqttClientPtr != NULL && mqttClientPtr->mqttObject != NULL)
+    {
+        mqtt_avSetDownloadProgressHandler(mqttClientPtr->mqttObject, NULL, NULL);
+    }
+}
+
+
+//--------------------------------------------------------------------------------------------------
+/**
+ * This function adds a handler for batched incoming messages
+ */
+//--------------------------------------------------------------------------------------------------
+mqttClient_IncomingMessageBatchHandlerRef_t mqttClient_AddIncomingMessageBatchHandler
+(
+    mqttClient_InstanceRef_t                        mqttClientRef,
+    mqttClient_IncomingMessageBatchHandlerFunc_t    handlerPtr,
+    void*                                           contextPtr
+)
+{
+    GET_MQTT_OBJECT(mqttClientRef);
+
+    if (mqttClientPtr != NULL && mqttClientPtr->mqttObject != NULL && mqttClientPtr->attachment == NULL)
+    {
+        mqtt_SetBatchHandler(mqttClientPtr->mqttObject, (incomingBatchHandler) handlerPtr, contextPtr);
+
+        return (mqttClient_IncomingMessageBatchHandlerRef_t) mqttClientRef;
+    }
+
+    return NULL;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+/**
+ * This function removes a handler for batched incoming messages
+ */
+//--------------------------------------------------------------------------------------------------
+void mqttClient_RemoveIncomingMessageBatchHandler
+(
+    mqttClient_IncomingMessageBatchHandlerRef_t batchHandlerRef
+)
+{
+    GET_MQTT_OBJECT(batchHandlerRef);
+
+    if (mqttClientPtr != NULL && mqttClientPtr->mqttObject != NULL)
+    {
+        mqtt_SetBatchHandler(mqttClientPtr->mqttObject, NULL, NULL);
+    }
 }
 
+
 //-------------------------------------------------------------------------
-le_result_t mqttClient_Subscribe
+le_result_t mqttClient_SetInboundBatching
 (
     mqttClient_InstanceRef_t    mqttClientRef,
-    const char*                 topicName
+    uint32_t                    maxMessages,
+    uint32_t                    maxDelayMs
 )
 {
     GET_MQTT_OBJECT(mqttClientRef);
 
+    if (mqttClientPtr != NULL && mqttClientPtr->attachment != NULL)
+    {
+        // batches are not demultiplexed between the instances of a shared session
+        return LE_UNAVAILABLE;
+    }
+
     if (mqttClientPtr != NULL && mqttClientPtr->mqttObject != NULL)
     {
-        int ret = mqtt_SubscribeTopic(mqttClientPtr->mqttObject, topicName);
+        int ret = mqtt_SetInboundBatching(mqttClientPtr->mqttObject, (int) maxMessages, (int) maxDelayMs);
 
         if (0 == ret)
         {
@@ -204,17 +327,18 @@ le_result_t mqttClient_Subscribe
 }
 
 //-------------------------------------------------------------------------
-le_result_t mqttClient_Unsubscribe
+le_result_t mqttClient_SetOfflineStore
 (
     mqttClient_InstanceRef_t    mqttClientRef,
-    const char*                 topicName
+    const char*                 directory,
+    uint32_t                    maxKBytes
 )
 {
     GET_MQTT_OBJECT(mqttClientRef);
 
     if (mqttClientPtr != NULL && mqttClientPtr->mqttObject != NULL)
     {
-        int ret = mqtt_UnsubscribeTopic(mqttClientPtr->mqttObject, topicName);
+        int ret = mqtt_SetOfflineStore(mqttClientPtr->mqttObject, directory, (size_t) maxKBytes * 1024);
 
         if (0 == ret)
         {
@@ -226,18 +350,19 @@ le_result_t mqttClient_Unsubscribe
 }
 
 //-------------------------------------------------------------------------
-le_result_t mqttClient_AvPublish
+le_result_t mqttClient_SetRateLimit
 (
-    mqttClient_InstanceRef_t        mqttClientRef,
-    const char *                    key,
-    const char *                    value
+    mqttClient_InstanceRef_t    mqttClientRef,
+    const char*                 topicPrefix,
+    uint32_t                    messagesPerSec,
+    uint32_t                    bytesPerSec
 )
 {
     GET_MQTT_OBJECT(mqttClientRef);
 
     if (mqttClientPtr != NULL && mqttClientPtr->mqttObject != NULL)
     {
-        int ret = mqtt_avPublishData(mqttClientPtr->mqttObject, key, value);
+        int ret = mqtt_SetRateLimit(mqttClientPtr->mqttObject, topicPrefix, messagesPerSec, bytesPerSec);
 
         if (0 == ret)
         {
@@ -249,19 +374,20 @@ le_result_t mqttClient_AvPublish
 }
 
 //-------------------------------------------------------------------------
-le_result_t mqttClient_AvAck
+le_result_t mqttClient_SetDeadband
 (
-    mqttClient_InstanceRef_t        mqttClientRef,
-    const char *                    uid,
-    int32_t                         errorCode,
-    const char *                    message
+    mqttClient_InstanceRef_t    mqttClientRef,
+    const char*                 key,
+    double                      absolute,
+    double                      percent,
+    uint32_t                    maxSilenceMs
 )
 {
     GET_MQTT_OBJECT(mqttClientRef);
 
     if (mqttClientPtr != NULL && mqttClientPtr->mqttObject != NULL)
     {
-        int ret = mqtt_avPublishAck(mqttClientPtr->mqttObject, uid, errorCode, message);
+        int ret = mqtt_SetDeadband(mqttClientPtr->mqttObject, key, absolute, percent, maxSilenceMs);
 
         if (0 == ret)
         {
@@ -273,19 +399,19 @@ le_result_t mqttClient_AvAck
 }
 
 //-------------------------------------------------------------------------
-le_result_t mqttClient_Publish
+le_result_t mqttClient_SetAggregation
 (
     mqttClient_InstanceRef_t    mqttClientRef,
-    const uint8_t *             data,
-    size_t                      dataSize,
-    const char *                topicName
+    const char*                 topicName,
+    const char*                 key,
+    uint32_t                    windowMs
 )
 {
     GET_MQTT_OBJECT(mqttClientRef);
 
     if (mqttClientPtr != NULL && mqttClientPtr->mqttObject != NULL)
     {
-        int ret = mqtt_PublishData(mqttClientPtr->mqttObject, (const char *) data, dataSize, topicName);
+        int ret = mqtt_SetAggregation(mqttClientPtr->mqttObject, topicName, key, windowMs);
 
         if (0 == ret)
         {
@@ -297,47 +423,19 @@ le_result_t mqttClient_Publish
 }
 
 //-------------------------------------------------------------------------
-le_result_t mqttClient_PublishKeyValue
+le_result_t mqttClient_SetCompression
 (
-    mqttClient_InstanceRef_t        mqttClientRef,
-    const char *                    key,
-    const char *                    value,
-    const char *                    topicName
+    mqttClient_InstanceRef_t    mqttClientRef,
+    const char*                 topicPrefix,
+    mqttClient_Compression_t    codec,
+    uint32_t                    minSize
 )
 {
     GET_MQTT_OBJECT(mqttClientRef);
 
     if (mqttClientPtr != NULL && mqttClientPtr->mqttObject != NULL)
     {
-        int ret = 1;
-
-        bool noTopic = false;
-        if (topicName != NULL && strlen(topicName) == 0)
-        {
-            noTopic = true;
-        }
-        else if (topicName == NULL)
-        {
-            noTopic = true;
-        }
-
-        if (noTopic && mqtt_avIsAirVantageBroker(mqttClientPtr->mqttObject))
-        {
-            ret = mqtt_avPublishData(mqttClientPtr->mqttObject, key, value);
-        }
-        else
-        {
-            if (noTopic)
-            {
-                char    defaultTopic[] = "LegatoMqttClient";
-
-                ret = mqtt_PublishKeyValue(mqttClientPtr->mqttObject, key, value, defaultTopic);   
-            }
-            else
-            {
-                ret = mqtt_PublishKeyValue(mqttClientPtr->mqttObject, key, value, topicName);
-            }
-        }
+        int ret = mqtt_SetCompression(mqttClientPtr->mqttObject, topicPrefix, (int) codec, minSize);
 
         if (0 == ret)
         {
@@ -349,122 +447,101 @@ le_result_t mqttClient_PublishKeyValue
 }
 
 //-------------------------------------------------------------------------
-uint8_t * readFile(const char * filename, long * lDataSize)
+le_result_t mqttClient_SetWakeSlots
+(
+    mqttClient_InstanceRef_t    mqttClientRef,
+    uint32_t                    slotMs
+)
 {
-    FILE*           file = NULL;
-    uint8_t*        pFileBuffer = NULL;
-
-    *lDataSize = 0;
+    GET_MQTT_OBJECT(mqttClientRef);
 
-    LE_INFO("Loading binary file %s...", filename);
-    file = fopen(filename, "r");
-    if (NULL == file)
+    if (mqttClientPtr != NULL && mqttClientPtr->mqttObject != NULL)
     {
-        LE_INFO("Cannot open file %s...", filename);
-        return NULL;
-    }
-
-    fseek(file, 0, SEEK_END);
-    *lDataSize = ftell(file);
-    fseek(file, 0, SEEK_SET);
+        int ret = mqtt_SetWakeSlots(mqttClientPtr->mqttObject, slotMs);
 
-    LE_INFO("allocating %ld bytes...", *lDataSize);
-    pFileBuffer = (uint8_t *) malloc(*lDataSize);
-
-    if (pFileBuffer)
-    {
-        memset(pFileBuffer, 0, *lDataSize);
-        fread(pFileBuffer, 1, *lDataSize, file);
+        if (0 == ret)
+        {
+            return LE_OK;
+        }
     }
 
-    fclose(file);
-    return pFileBuffer;
+    return LE_FAULT;
 }
 
-
 //-------------------------------------------------------------------------
-le_result_t mqttClient_PublishFileContent
+le_result_t mqttClient_SetMessageTtl
 (
-    mqttClient_InstanceRef_t        mqttClientRef,
-    const char *                    filename,
-    const char *                    topicName
+    mqttClient_InstanceRef_t    mqttClientRef,
+    const char*                 topicPrefix,
+    uint32_t                    ttlMs,
+    const char*                 summaryTopic
 )
 {
-    le_result_t ret = LE_FAULT;
-
     GET_MQTT_OBJECT(mqttClientRef);
 
     if (mqttClientPtr != NULL && mqttClientPtr->mqttObject != NULL)
     {
-        bool noTopic = false;
-        if (topicName != NULL && strlen(topicName) == 0)
-        {
-            noTopic = true;
-        }
-        else if (topicName == NULL)
-        {
-            noTopic = true;
-        }
-
-        if (noTopic)
-        {
-            return ret;
-        }
+        int ret = mqtt_SetMessageTtl(mqttClientPtr->mqttObject, topicPrefix, ttlMs, summaryTopic);
 
-        
-        long     lDataSize = 0;
-        uint8_t* pData = readFile(filename, &lDataSize);
-        if (pData)
+        if (0 == ret)
         {
-            ret = mqttClient_Publish(mqttClientRef, pData, (size_t)lDataSize, topicName);
-
-            free(pData);
+            return LE_OK;
         }
     }
 
-    return ret;
+    return LE_FAULT;
 }
 
 //-------------------------------------------------------------------------
-bool mqttClient_IsConnected
+le_result_t mqttClient_ProcessEvent
 (
-    mqttClient_InstanceRef_t       mqttClientRef
+    mqttClient_InstanceRef_t    mqttClientRef
 )
 {
     GET_MQTT_OBJECT(mqttClientRef);
 
     if (mqttClientPtr != NULL && mqttClientPtr->mqttObject != NULL)
     {
-        return mqtt_IsConnected(mqttClientPtr->mqttObject);
+        int ret = mqtt_ProcessEvent(mqttClientPtr->mqttObject, 1000);
+
+        if (ret >= -1)  //paho : FAILURE, SUCCESS, or packet_type
+        {
+            return LE_OK;
+        }
     }
 
-    return false;
+    return LE_FAULT;
 }
 
 //-------------------------------------------------------------------------
-le_result_t mqttClient_StartSession
+le_result_t mqttClient_Subscribe
 (
-    mqttClient_InstanceRef_t       mqttClientRef
+    mqttClient_InstanceRef_t    mqttClientRef,
+    const char*                 topicName
 )
 {
     GET_MQTT_OBJECT(mqttClientRef);
 
-    LE_INFO("StartSession called");
-    if (mqttClientPtr != NULL)
+    if (mqttClientPtr != NULL && mqttClientPtr->mqttObject != NULL)
     {
-        if (mqttClientPtr->mqttObject != NULL)
+        int ret;
+
+        if (mqttClientPtr->attachment)
         {
-            int ret = mqtt_StartSession(mqttClientPtr->mqttObject);
-            if (0 == ret)
-            {
-                if (mqtt_avIsAirVantageBroker(mqttClientPtr->mqttObject))
-                {
-                    //Set handler for AirVantage incoming message/command/SW-install
-                    mqtt_avSubscribeAirVantageTopic(mqttClientPtr->mqttObject);
-                }
+            ret = mqtt_SharedSubscribe(mqttClientPtr->attachment, topicName);
+        }
+        else
+        {
+            ret = mqtt_SubscribeTopic(mqttClientPtr->mqttObject, topicName);
+        }
 
-                return LE_OK;
-            }
+        if (0 == ret)
+        {
+            return LE_OK;
+        }
+        else if (BUFFER_OVERFLOW == ret)
+        {
+            return LE_OVERFLOW;
         }
     }
 
@@ -472,22 +549,30 @@ le_result_t mqttClient_StartSession
 }
 
 //-------------------------------------------------------------------------
-le_result_t mqttClient_StopSession
+le_result_t mqttClient_Unsubscribe
 (
-    mqttClient_InstanceRef_t       mqttClientRef
+    mqttClient_InstanceRef_t    mqttClientRef,
+    const char*                 topicName
 )
 {
     GET_MQTT_OBJECT(mqttClientRef);
 
-    if (mqttClientPtr != NULL)
+    if (mqttClientPtr != NULL && mqttClientPtr->mqttObject != NULL)
     {
-        if (mqttClientPtr->mqttObject != NULL)
+        int ret;
+
+        if (mqttClientPtr->attachment)
         {
-            int ret = mqtt_StopSession(mqttClientPtr->mqttObject);
-            if (0 == ret)
-            {
-                return LE_OK;
-            }
+            ret = mqtt_SharedUnsubscribe(mqttClientPtr->attachment, topicName);
+        }
+        else
+        {
+            ret = mqtt_UnsubscribeTopic(mqttClientPtr->mqttObject, topicName);
+        }
+
+        if (0 == ret)
+        {
+            return LE_OK;
         }
     }
 
@@ -495,19 +580,688 @@ le_result_t mqttClient_StopSession
 }
 
 //-------------------------------------------------------------------------
-le_result_t mqttClient_SetTls
+le_result_t mqttClient_AvPublish
 (
-    mqttClient_InstanceRef_t    mqttClientRef,
-    const char*                 rootCAFile,
-    const char*                 certificateFile,
-    const char*                 privateKeyFile
+    mqttClient_InstanceRef_t        mqttClientRef,
+    const char *                    key,
+    const char *                    value
 )
 {
     GET_MQTT_OBJECT(mqttClientRef);
 
     if (mqttClientPtr != NULL && mqttClientPtr->mqttObject != NULL)
     {
-        mqtt_SetTls(mqttClientPtr->mqttObject, rootCAFile, certificateFile, privateKeyFile);
+        int ret = mqtt_avPublishData(mqttClientPtr->mqttObject, key, value);
+
+        if (0 == ret)
+        {
+            return LE_OK;
+        }
+    }
+
+    return LE_FAULT;
+}
+
+//-------------------------------------------------------------------------
+le_result_t mqttClient_AvAck
+(
+    mqttClient_InstanceRef_t        mqttClientRef,
+    const char *                    uid,
+    int32_t                         errorCode,
+    const char *                    message
+)
+{
+    GET_MQTT_OBJECT(mqttClientRef);
+
+    if (mqttClientPtr != NULL && mqttClientPtr->mqttObject != NULL)
+    {
+        if (mqtt_avIsDownloadUid(mqttClientPtr->mqttObject, uid))
+        {
+            // acked once by the download engine when the package download ends
+            LE_INFO("AvAck of %s left to the download", uid);
+            return LE_OK;
+        }
+
+        int ret = mqtt_avPublishAck(mqttClientPtr->mqttObject, uid, errorCode, message);
+
+        if (0 == ret)
+        {
+            return LE_OK;
+        }
+    }
+
+    return LE_FAULT;
+}
+
+//-------------------------------------------------------------------------
+le_result_t mqttClient_AvBufferSample
+(
+    mqttClient_InstanceRef_t        mqttClientRef,
+    const char *                    key,
+    const char *                    value,
+    uint64_t                        timestamp
+)
+{
+    GET_MQTT_OBJECT(mqttClientRef);
+
+    if (mqttClientPtr != NULL && mqttClientPtr->mqttObject != NULL)
+    {
+        int ret = mqtt_avBufferSample(mqttClientPtr->mqttObject, key, value, timestamp);
+
+        if (0 == ret)
+        {
+            return LE_OK;
+        }
+    }
+
+    return LE_FAULT;
+}
+
+//-------------------------------------------------------------------------
+le_result_t mqttClient_AvPublishSeries
+(
+    mqttClient_InstanceRef_t        mqttClientRef
+)
+{
+    GET_MQTT_OBJECT(mqttClientRef);
+
+    if (mqttClientPtr != NULL && mqttClientPtr->mqttObject != NULL)
+    {
+        int ret = mqtt_avPublishSeries(mqttClientPtr->mqttObject);
+
+        if (0 == ret)
+        {
+            return LE_OK;
+        }
+    }
+
+    return LE_FAULT;
+}
+
+//-------------------------------------------------------------------------
+le_result_t mqttClient_AvSetSeriesPolicy
+(
+    mqttClient_InstanceRef_t        mqttClientRef,
+    uint32_t                        maxSamples,
+    uint32_t                        maxBytes,
+    uint32_t                        maxAgeMs
+)
+{
+    GET_MQTT_OBJECT(mqttClientRef);
+
+    if (mqttClientPtr == NULL || mqttClientPtr->mqttObject == NULL)
+    {
+        return LE_FAULT;
+    }
+
+    if (maxSamples == 0 || maxSamples > 0xFFFF || maxBytes == 0 || maxBytes > 0x7FFFFFFF || maxAgeMs > 0x7FFFFFFF)
+    {
+        return LE_BAD_PARAMETER;
+    }
+
+    int ret = mqtt_avSetSeriesPolicy(mqttClientPtr->mqttObject, (int) maxSamples, (int) maxBytes, (int) maxAgeMs);
+
+    if (0 == ret)
+    {
+        return LE_OK;
+    }
+
+    return LE_FAULT;
+}
+
+//-------------------------------------------------------------------------
+le_result_t mqttClient_AvSetSeriesCodec
+(
+    mqttClient_InstanceRef_t        mqttClientRef,
+    mqttClient_SeriesCodec_t        codec,
+    const char *                    topicName
+)
+{
+    GET_MQTT_OBJECT(mqttClientRef);
+
+    if (mqttClientPtr == NULL || mqttClientPtr->mqttObject == NULL)
+    {
+        return LE_FAULT;
+    }
+
+    if (codec == MQTTCLIENT_SERIES_CODEC_BINARY && (topicName == NULL || topicName[0] == '\0'))
+    {
+        return LE_BAD_PARAMETER;
+    }
+
+    int ret = mqtt_avSetSeriesCodec(mqttClientPtr->mqttObject, codec == MQTTCLIENT_SERIES_CODEC_BINARY, topicName);
+
+    if (0 == ret)
+    {
+        return LE_OK;
+    }
+
+    return LE_FAULT;
+}
+
+//-------------------------------------------------------------------------
+le_result_t mqttClient_AvStartDownload
+(
+    mqttClient_InstanceRef_t        mqttClientRef,
+    const char *                    uid,
+    const char *                    url,
+    const char *                    targetFile,
+    const char *                    sha256
+)
+{
+    GET_MQTT_OBJECT(mqttClientRef);
+
+    if (mqttClientPtr != NULL && mqttClientPtr->mqttObject != NULL)
+    {
+        int ret = mqtt_avStartDownload(mqttClientPtr->mqttObject, uid, url, targetFile, sha256);
+
+        if (0 == ret)
+        {
+            return LE_OK;
+        }
+    }
+
+    return LE_FAULT;
+}
+
+//-------------------------------------------------------------------------
+le_result_t mqttClient_AvCancelDownload
+(
+    mqttClient_InstanceRef_t        mqttClientRef
+)
+{
+    GET_MQTT_OBJECT(mqttClientRef);
+
+    if (mqttClientPtr != NULL && mqttClientPtr->mqttObject != NULL)
+    {
+        int ret = mqtt_avCancelDownload(mqttClientPtr->mqttObject);
+
+        if (0 == ret)
+        {
+            return LE_OK;
+        }
+    }
+
+    return LE_FAULT;
+}
+
+//-------------------------------------------------------------------------
+le_result_t mqttClient_AvSetAutoDownload
+(
+    mqttClient_InstanceRef_t        mqttClientRef,
+    const char *                    directory
+)
+{
+    GET_MQTT_OBJECT(mqttClientRef);
+
+    if (mqttClientPtr != NULL && mqttClientPtr->mqttObject != NULL)
+    {
+        int ret = mqtt_avSetDownloadDirectory(mqttClientPtr->mqttObject, directory);
+
+        if (0 == ret)
+        {
+            return LE_OK;
+        }
+    }
+
+    return LE_FAULT;
+}
+
+//-------------------------------------------------------------------------
+le_result_t mqttClient_Publish
+(
+    mqttClient_InstanceRef_t    mqttClientRef,
+    const uint8_t *             data,
+    size_t                      dataSize,
+    const char *                topicName
+)
+{
+    GET_MQTT_OBJECT(mqttClientRef);
+
+    if (mqttClientPtr != NULL && mqttClientPtr->mqttObject != NULL)
+    {
+        int ret = mqtt_PublishData(mqttClientPtr->mqttObject, (const char *) data, dataSize, topicName);
+
+        if (0 == ret)
+        {
+            return LE_OK;
+        }
+    }
+
+    return LE_FAULT;
+}
+
+//-------------------------------------------------------------------------
+le_result_t mqttClient_PublishWithPriority
+(
+    mqttClient_InstanceRef_t    mqttClientRef,
+    const uint8_t *             data,
+    size_t                      dataSize,
+    const char *                topicName,
+    mqttClient_Priority_t       priority
+)
+{
+    GET_MQTT_OBJECT(mqttClientRef);
+
+    if (mqttClientPtr != NULL && mqttClientPtr->mqttObject != NULL)
+    {
+        // the classes of the API are in the order of mqtt_priority_t
+        int ret = mqtt_PublishWithPriority(mqttClientPtr->mqttObject, (const char *) data, dataSize, topicName, (int) priority);
+
+        if (0 == ret)
+        {
+            return LE_OK;
+        }
+    }
+
+    return LE_FAULT;
+}
+
+//-------------------------------------------------------------------------
+le_result_t mqttClient_PublishWithTtl
+(
+    mqttClient_InstanceRef_t    mqttClientRef,
+    const uint8_t *             data,
+    size_t                      dataSize,
+    const char *                topicName,
+    mqttClient_Priority_t       priority,
+    uint32_t                    ttlMs
+)
+{
+    GET_MQTT_OBJECT(mqttClientRef);
+
+    if (mqttClientPtr != NULL && mqttClientPtr->mqttObject != NULL)
+    {
+        int ret = mqtt_PublishWithTtl(mqttClientPtr->mqttObject, (const char *) data, dataSize, topicName, (int) priority, ttlMs);
+
+        if (0 == ret)
+        {
+            return LE_OK;
+        }
+    }
+
+    return LE_FAULT;
+}
+
+//-------------------------------------------------------------------------
+le_result_t mqttClient_PublishCompressed
+(
+    mqttClient_InstanceRef_t    mqttClientRef,
+    const uint8_t *             data,
+    size_t                      dataSize,
+    const char *                topicName,
+    mqttClient_Compression_t    codec
+)
+{
+    GET_MQTT_OBJECT(mqttClientRef);
+
+    if (mqttClientPtr != NULL && mqttClientPtr->mqttObject != NULL)
+    {
+        int ret = mqtt_PublishCompressed(mqttClientPtr->mqttObject, (const char *) data, dataSize, topicName, (int) codec);
+
+        if (0 == ret)
+        {
+            return LE_OK;
+        }
+    }
+
+    return LE_FAULT;
+}
+
+//-------------------------------------------------------------------------
+mqttClient_TopicRef_t mqttClient_RegisterTopic
+(
+    mqttClient_InstanceRef_t    mqttClientRef,
+    const char *                topicName,
+    int32_t                     qoS,
+    bool                        retain
+)
+{
+    GET_MQTT_OBJECT(mqttClientRef);
+
+    if (mqttClientPtr != NULL && mqttClientPtr->mqttObject != NULL)
+    {
+        mqtt_topic_st* topic = mqtt_RegisterTopic(mqttClientPtr->mqttObject, topicName, qoS, retain);
+
+        if (topic)
+        {
+            ST_MQTT_TOPIC* topicPtr = le_mem_ForceAlloc(g_MqttTopicPool);
+
+            topicPtr->mqttClientRef = mqttClientRef;
+            topicPtr->topic = topic;
+
+            return le_ref_CreateRef(g_MqttTopicRefMap, topicPtr);
+        }
+    }
+
+    return NULL;
+}
+
+//-------------------------------------------------------------------------
+le_result_t mqttClient_UnregisterTopic
+(
+    mqttClient_TopicRef_t       topicRef
+)
+{
+    ST_MQTT_TOPIC* topicPtr = le_ref_Lookup(g_MqttTopicRefMap, topicRef);
+
+    if (topicPtr != NULL)
+    {
+        GET_MQTT_OBJECT(topicPtr->mqttClientRef);
+
+        if (mqttClientPtr != NULL && mqttClientPtr->mqttObject != NULL)
+        {
+            mqtt_UnregisterTopic(mqttClientPtr->mqttObject, topicPtr->topic);
+        }
+
+        le_ref_DeleteRef(g_MqttTopicRefMap, topicRef);
+        le_mem_Release(topicPtr);
+
+        return LE_OK;
+    }
+
+    return LE_FAULT;
+}
+
+//-------------------------------------------------------------------------
+static void ReleaseTopics
+(
+    mqttClient_InstanceRef_t    mqttClientRef
+)
+{
+    bool found = true;
+
+    // the map is not modified while iterating, search again after each release
+    while (found)
+    {
+        le_ref_IterRef_t    iterRef = le_ref_GetIterator(g_MqttTopicRefMap);
+        mqttClient_TopicRef_t topicRef = NULL;
+
+        found = false;
+        while (le_ref_NextNode(iterRef) == LE_OK)
+        {
+            ST_MQTT_TOPIC*  topicPtr = (ST_MQTT_TOPIC*) le_ref_GetValue(iterRef);
+
+            if (topicPtr->mqttClientRef == mqttClientRef)
+            {
+                topicRef = (mqttClient_TopicRef_t) le_ref_GetSafeRef(iterRef);
+                found = true;
+                break;
+            }
+        }
+
+        if (found)
+        {
+            mqttClient_UnregisterTopic(topicRef);
+        }
+    }
+}
+
+//-------------------------------------------------------------------------
+le_result_t mqttClient_PublishToTopic
+(
+    mqttClient_TopicRef_t       topicRef,
+    const uint8_t *             data,
+    size_t                      dataSize
+)
+{
+    ST_MQTT_TOPIC* topicPtr = le_ref_Lookup(g_MqttTopicRefMap, topicRef);
+
+    if (topicPtr != NULL)
+    {
+        GET_MQTT_OBJECT(topicPtr->mqttClientRef);
+
+        if (mqttClientPtr != NULL && mqttClientPtr->mqttObject != NULL)
+        {
+            int ret = mqtt_PublishToTopic(mqttClientPtr->mqttObject, topicPtr->topic, (const char *) data, dataSize);
+
+            if (0 == ret)
+            {
+                return LE_OK;
+            }
+        }
+    }
+
+    return LE_FAULT;
+}
+
+//-------------------------------------------------------------------------
+le_result_t mqttClient_PublishKeyValue
+(
+    mqttClient_InstanceRef_t        mqttClientRef,
+    const char *                    key,
+    const char *                    value,
+    const char *                    topicName
+)
+{
+    GET_MQTT_OBJECT(mqttClientRef);
+
+    if (mqttClientPtr != NULL && mqttClientPtr->mqttObject != NULL)
+    {
+        int ret = 1;
+
+        bool noTopic = false;
+        if (topicName != NULL && strlen(topicName) == 0)
+        {
+            noTopic = true;
+        }
+        else if (topicName == NULL)
+        {
+            noTopic = true;
+        }
+
+        if (noTopic && mqtt_avIsAirVantageBroker(mqttClientPtr->mqttObject))
+        {
+            ret = mqtt_avPublishData(mqttClientPtr->mqttObject, key, value);
+        }
+        else
+        {
+            if (noTopic)
+            {
+                char    defaultTopic[] = "LegatoMqttClient";
+
+                ret = mqtt_PublishKeyValue(mqttClientPtr->mqttObject, key, value, defaultTopic);   
+            }
+            else
+            {
+                ret = mqtt_PublishKeyValue(mqttClientPtr->mqttObject, key, value, topicName);
+            }
+        }
+
+        if (0 == ret)
+        {
+            return LE_OK;
+        }
+    }
+
+    return LE_FAULT;
+}
+
+//-------------------------------------------------------------------------
+le_result_t mqttClient_PublishFileContent
+(
+    mqttClient_InstanceRef_t        mqttClientRef,
+    const char *                    filename,
+    const char *                    topicName
+)
+{
+    le_result_t ret = LE_FAULT;
+
+    GET_MQTT_OBJECT(mqttClientRef);
+
+    if (mqttClientPtr != NULL && mqttClientPtr->mqttObject != NULL)
+    {
+        bool noTopic = false;
+        if (topicName != NULL && strlen(topicName) == 0)
+        {
+            noTopic = true;
+        }
+        else if (topicName == NULL)
+        {
+            noTopic = true;
+        }
+
+        if (noTopic)
+        {
+            return ret;
+        }
+
+        LE_INFO("Loading binary file %s...", filename);
+
+        // bulk class : telemetry and alarms are not held behind a large upload
+        if (0 == mqtt_PublishFile(mqttClientPtr->mqttObject, filename, topicName, MQTT_PRIORITY_BULK, MQTT_COMPRESSION_TOPIC))
+        {
+            ret = LE_OK;
+        }
+    }
+
+    return ret;
+}
+
+//-------------------------------------------------------------------------
+le_result_t mqttClient_PublishFileCompressed
+(
+    mqttClient_InstanceRef_t        mqttClientRef,
+    const char *                    filename,
+    const char *                    topicName,
+    mqttClient_Compression_t        codec
+)
+{
+    GET_MQTT_OBJECT(mqttClientRef);
+
+    if (mqttClientPtr == NULL || mqttClientPtr->mqttObject == NULL)
+    {
+        return LE_FAULT;
+    }
+
+    if (topicName == NULL || topicName[0] == '\0')
+    {
+        return LE_BAD_PARAMETER;
+    }
+
+    // the codecs of the API are in the order of mqtt_compression_t
+    int ret = mqtt_PublishFile(mqttClientPtr->mqttObject, filename, topicName, MQTT_PRIORITY_BULK, (int) codec);
+
+    if (0 == ret)
+    {
+        return LE_OK;
+    }
+
+    return LE_FAULT;
+}
+
+//-------------------------------------------------------------------------
+bool mqttClient_IsConnected
+(
+    mqttClient_InstanceRef_t       mqttClientRef
+)
+{
+    GET_MQTT_OBJECT(mqttClientRef);
+
+    if (mqttClientPtr != NULL && mqttClientPtr->mqttObject != NULL)
+    {
+        return mqtt_IsConnected(mqttClientPtr->mqttObject);
+    }
+
+    return false;
+}
+
+//-------------------------------------------------------------------------
+le_result_t mqttClient_StartSession
+(
+    mqttClient_InstanceRef_t       mqttClientRef
+)
+{
+    GET_MQTT_OBJECT(mqttClientRef);
+
+    LE_INFO("StartSession called");
+    if (mqttClientPtr != NULL)
+    {
+        if (mqttClientPtr->mqttObject != NULL)
+        {
+            bool wasConnected = mqtt_IsConnected(mqttClientPtr->mqttObject);
+            int  ret;
+
+            //a token used as password may have expired while the session was stopped
+            mqtt_JwtRenewIfDue(mqttClientPtr->mqttObject);
+
+            if (mqttClientPtr->attachment)
+            {
+                ret = mqtt_SharedStartSession(mqttClientPtr->attachment);
+            }
+            else
+            {
+                ret = mqtt_StartSession(mqttClientPtr->mqttObject);
+            }
+
+            if (0 == ret)
+            {
+                if (!wasConnected && mqtt_avIsAirVantageBroker(mqttClientPtr->mqttObject))
+                {
+                    //Set handler for AirVantage incoming message/command/SW-install
+                    mqtt_avSubscribeAirVantageTopic(mqttClientPtr->mqttObject);
+                }
+
+                return LE_OK;
+            }
+
+            if (MQTT_DEFERRED == ret)
+            {
+                //started by the service once the bearer is back, see LinkRetryTimerHandler
+                return LE_WOULD_BLOCK;
+            }
+        }
+    }
+
+    return LE_FAULT;
+}
+
+//-------------------------------------------------------------------------
+le_result_t mqttClient_StopSession
+(
+    mqttClient_InstanceRef_t       mqttClientRef
+)
+{
+    GET_MQTT_OBJECT(mqttClientRef);
+
+    if (mqttClientPtr != NULL)
+    {
+        if (mqttClientPtr->mqttObject != NULL)
+        {
+            int ret;
+
+            if (mqttClientPtr->attachment)
+            {
+                ret = mqtt_SharedStopSession(mqttClientPtr->attachment);
+            }
+            else
+            {
+                ret = mqtt_StopSession(mqttClientPtr->mqttObject);
+            }
+            if (0 == ret)
+            {
+                return LE_OK;
+            }
+        }
+    }
+
+    return LE_FAULT;
+}
+
+//-------------------------------------------------------------------------
+le_result_t mqttClient_SetTls
+(
+    mqttClient_InstanceRef_t    mqttClientRef,
+    const char*                 rootCAFile,
+    const char*                 certificateFile,
+    const char*                 privateKeyFile
+)
+{
+    GET_MQTT_OBJECT(mqttClientRef);
+
+    if (mqttClientPtr != NULL && mqttClientPtr->mqttObject != NULL)
+    {
+        mqtt_SetTls(mqttClientPtr->mqttObject, rootCAFile, certificateFile, privateKeyFile);
 
         return LE_OK;
     }
@@ -516,7 +1270,7 @@ le_result_t mqttClient_SetTls
 }
 
 //-------------------------------------------------------------------------
-mqttClient_InstanceRef_t mqttClient_Create
+static mqttClient_InstanceRef_t CreateInstance
 (
     const char*   brokerUrl,
     int32_t       portNumber,
@@ -525,32 +1279,58 @@ mqttClient_InstanceRef_t mqttClient_Create
     const char*   username,
     const char*   secret,
     int32_t       keepAlive,
-    int32_t       qoS
+    int32_t       qoS,
+    bool          shared
 )
 {
     ST_MQTT_CLIENT* mqttClientPtr = le_mem_ForceAlloc(g_MqttClientPool);
  
     memset(mqttClientPtr, 0, sizeof(ST_MQTT_CLIENT));
- 
-    strcpy(mqttClientPtr->mqttConfig.serverUrl, brokerUrl);
-    mqttClientPtr->mqttConfig.serverPort = portNumber;
-    mqttClientPtr->mqttConfig.useTLS = useTLS;
-    strcpy(mqttClientPtr->mqttConfig.deviceId, deviceId);
-    strcpy(mqttClientPtr->mqttConfig.username, username);
-    strcpy(mqttClientPtr->mqttConfig.secret, secret);
-    mqttClientPtr->mqttConfig.keepAlive = keepAlive;
-    mqttClientPtr->mqttConfig.qoS = qoS;
 
-    if (mqtt_avIsAirVantageUrl(mqttClientPtr->mqttConfig.serverUrl))
+    mqtt_config_t   mqttConfig;
+
+    memset(&mqttConfig, 0, sizeof(mqttConfig));
+ 
+    strcpy(mqttConfig.serverUrl, brokerUrl);
+    mqttConfig.serverPort = portNumber;
+    mqttConfig.useTLS = useTLS;
+    strcpy(mqttConfig.deviceId, deviceId);
+    strcpy(mqttConfig.username, username);
+    strcpy(mqttConfig.secret, secret);
+    mqttConfig.keepAlive = keepAlive;
+    mqttConfig.qoS = qoS;
+
+    if (mqtt_avIsAirVantageUrl(mqttConfig.serverUrl))
     {
-        if (strlen(mqttClientPtr->mqttConfig.username) == 0)
+        if (strlen(mqttConfig.username) == 0)
         {
-            strcpy(mqttClientPtr->mqttConfig.username, mqttClientPtr->mqttConfig.deviceId);
+            strcpy(mqttConfig.username, mqttConfig.deviceId);
         }
     }
 
 
-    mqttClientPtr->mqttObject = mqtt_CreateInstance(&mqttClientPtr->mqttConfig);
+    if (shared)
+    {
+        mqttClientPtr->attachment = mqtt_SharedAttach(&mqttConfig);
+        mqttClientPtr->mqttObject = mqtt_SharedGetInstance(mqttClientPtr->attachment);
+        LE_INFO("Attached to shared session : %d instance(s)", mqtt_SharedGetAttachmentCount(mqttClientPtr->attachment));
+    }
+    else
+    {
+        mqttClientPtr->mqttObject = mqtt_CreateInstance(&mqttConfig);
+    }
+
+    if (mqttClientPtr->mqttObject == NULL)
+    {
+        LE_ERROR("Cannot create the MQTT instance for %s:%d", brokerUrl, portNumber);
+        le_mem_Release(mqttClientPtr);
+        return NULL;
+    }
+
+    if (!g_BearerUp)
+    {
+        mqtt_SetLinkState(mqttClientPtr->mqttObject, 0);
+    }
 
     // Create and return a Safe Reference for this new ST_MQTT_CLIENT object.
     mqttClient_InstanceRef_t clientRef = le_ref_CreateRef(g_MqttClientRefMap, mqttClientPtr);
@@ -559,6 +1339,38 @@ mqttClient_InstanceRef_t mqttClient_Create
     return clientRef;
 }
 
+//-------------------------------------------------------------------------
+mqttClient_InstanceRef_t mqttClient_Create
+(
+    const char*   brokerUrl,
+    int32_t       portNumber,
+    int32_t       useTLS,
+    const char*   deviceId,
+    const char*   username,
+    const char*   secret,
+    int32_t       keepAlive,
+    int32_t       qoS
+)
+{
+    return CreateInstance(brokerUrl, portNumber, useTLS, deviceId, username, secret, keepAlive, qoS, false);
+}
+
+//-------------------------------------------------------------------------
+mqttClient_InstanceRef_t mqttClient_CreateShared
+(
+    const char*   brokerUrl,
+    int32_t       portNumber,
+    int32_t       useTLS,
+    const char*   deviceId,
+    const char*   username,
+    const char*   secret,
+    int32_t       keepAlive,
+    int32_t       qoS
+)
+{
+    return CreateInstance(brokerUrl, portNumber, useTLS, deviceId, username, secret, keepAlive, qoS, true);
+}
+
 //-------------------------------------------------------------------------
 le_result_t mqttClient_Delete
 (
@@ -570,7 +1382,18 @@ le_result_t mqttClient_Delete
     if (mqttClientPtr != NULL && mqttClientPtr->mqttObject != NULL)
     {
         LE_INFO("Deleting MQTT instance mqttClientRef : %p", mqttClientRef);
-        mqttClientPtr->mqttObject = mqtt_DeleteInstance(mqttClientPtr->mqttObject);
+        ReleaseTopics(mqttClientRef);
+
+        if (mqttClientPtr->attachment)
+        {
+            mqtt_SharedDetach(mqttClientPtr->attachment);
+            mqttClientPtr->attachment = NULL;
+            mqttClientPtr->mqttObject = NULL;
+        }
+        else
+        {
+            mqttClientPtr->mqttObject = mqtt_DeleteInstance(mqttClientPtr->mqttObject);
+        }
 
         LE_INFO("Deleting mqttClientRef : %p", mqttClientRef);
         le_ref_DeleteRef(g_MqttClientRefMap, mqttClientRef);
@@ -624,20 +1447,280 @@ le_result_t mqttClient_GetConfig
         *keepAlive = mqttConfig.keepAlive;
         *qoS = mqttConfig.qoS;
     }
+    else if (mqttClientPtr->mqttObject != NULL)
+    {
+        mqtt_config_t   mqttConfig;
+
+        mqtt_GetConfig(mqttClientPtr->mqttObject, &mqttConfig);
+
+        strcpy(broker, mqttConfig.serverUrl);
+        *portNumber = mqttConfig.serverPort;
+        *useTLS = mqttConfig.useTLS;
+        strcpy(deviceId, mqttConfig.deviceId);
+        strcpy(username, mqttConfig.username);
+        strcpy(secret, mqttConfig.secret);
+        *keepAlive = mqttConfig.keepAlive;
+        *qoS = mqttConfig.qoS;
+    }
     else
     {
-        strcpy(broker, mqttClientPtr->mqttConfig.serverUrl);
-        *portNumber = mqttClientPtr->mqttConfig.serverPort;
-        *useTLS = mqttClientPtr->mqttConfig.useTLS;
-        strcpy(deviceId, mqttClientPtr->mqttConfig.deviceId);
-        strcpy(username, mqttClientPtr->mqttConfig.username);
-        strcpy(secret, mqttClientPtr->mqttConfig.secret);
-        *keepAlive = mqttClientPtr->mqttConfig.keepAlive;
-        *qoS = mqttClientPtr->mqttConfig.qoS;
+        return LE_FAULT;
+    }
+
+    return LE_OK;
+}
+
+//------------------------------------------------------------------
+le_result_t mqttClient_GetStat
+(
+    mqttClient_InstanceRef_t        mqttClientRef,
+    const char*                     statName,
+    uint64_t*                       valuePtr
+)
+{
+    *valuePtr = 0;
+
+    if (mqttClientRef == NULL)
+    {
+        //service wide statistics, aggregated over all instances
+        le_ref_IterRef_t    iterRef = le_ref_GetIterator(g_MqttClientRefMap);
+        uint64_t            count = 0;
+        le_result_t         ret = LE_OK;
+
+        while (le_ref_NextNode(iterRef) == LE_OK)
+        {
+            ST_MQTT_CLIENT*     clientPtr = (ST_MQTT_CLIENT*) le_ref_GetValue(iterRef);
+            unsigned long long  value = 0;
+
+            count++;
+
+            if (strcmp(statName, "instance.count") == 0)
+            {
+                continue;
+            }
+
+            if (clientPtr->attachment && !mqtt_SharedIsFirstAttachment(clientPtr->attachment))
+            {
+                // the shared instance is counted once, through the first of its attachments
+                continue;
+            }
+
+            if (clientPtr->mqttObject && 0 == mqtt_GetStat(clientPtr->mqttObject, statName, &value))
+            {
+                *valuePtr += value;
+            }
+            else
+            {
+                ret = LE_NOT_FOUND;
+            }
+        }
+
+        if (strcmp(statName, "instance.count") == 0)
+        {
+            *valuePtr = count;
+            return LE_OK;
+        }
+
+        if (strcmp(statName, "link.up") == 0 || strcmp(statName, "link.down") == 0)
+        {
+            // bearer transitions seen by the service, with or without instances
+            *valuePtr = (statName[5] == 'u') ? g_BearerUps : g_BearerDowns;
+            return LE_OK;
+        }
+
+        if (strcmp(statName, "memory.bytes") == 0)
+        {
+            *valuePtr += count * sizeof(ST_MQTT_CLIENT);
+        }
+
+        return ret;
+    }
+
+    GET_MQTT_OBJECT(mqttClientRef);
+
+    if (mqttClientPtr != NULL && mqttClientPtr->mqttObject != NULL)
+    {
+        unsigned long long  value = 0;
+
+        if (0 == mqtt_GetStat(mqttClientPtr->mqttObject, statName, &value))
+        {
+            *valuePtr = (uint64_t) value;
+
+            if (strcmp(statName, "memory.bytes") == 0)
+            {
+                if (mqttClientPtr->attachment)
+                {
+                    // the shared session is accounted evenly to the attached instances
+                    *valuePtr = *valuePtr / mqtt_SharedGetAttachmentCount(mqttClientPtr->attachment) + sizeof(mqtt_attachment_st);
+                }
+                *valuePtr += sizeof(ST_MQTT_CLIENT);
+            }
+
+            return LE_OK;
+        }
+
+        return LE_NOT_FOUND;
+    }
+
+    return LE_FAULT;
+}
+
+//------------------------------------------------------------------
+le_result_t mqttClient_SetKeyTableDirectory
+(
+    const char*                     directory
+)
+{
+    if (tlsKeyCache_set_table_directory(directory) != 0)
+    {
+        LE_ERROR("Invalid key table directory %s", directory);
+        return LE_FAULT;
+    }
+
+    return LE_OK;
+}
+
+//------------------------------------------------------------------
+le_result_t mqttClient_SetJwtRollover
+(
+    mqttClient_InstanceRef_t        mqttClientRef,
+    const char*                     privateKeyFile,
+    const char*                     audience,
+    uint32_t                        validitySec
+)
+{
+    GET_MQTT_OBJECT(mqttClientRef);
+
+    if (mqttClientPtr != NULL && mqttClientPtr->mqttObject != NULL)
+    {
+        if (0 == mqtt_JwtSetRollover(mqttClientPtr->mqttObject, privateKeyFile, audience, (int) validitySec))
+        {
+            return LE_OK;
+        }
+    }
+
+    return LE_FAULT;
+}
+
+//------------------------------------------------------------------
+le_result_t mqttClient_CreateJwt
+(
+    const char*                     privateKeyFile,
+    const char*                     audience,
+    uint32_t                        validitySec,
+    char*                           jwt,
+    size_t                          jwtLen
+)
+{
+    int     len = mqtt_JwtCreate(privateKeyFile, audience, (int) validitySec, jwt, jwtLen);
+
+    if (len < 0)
+    {
+        LE_ERROR("Failed to sign JWT with %s", privateKeyFile);
+        return LE_FAULT;
     }
 
     return LE_OK;
 }
+//--------------------------------------------------------------------------------------------------
+/**
+ *  Sessions waiting for the bearer are resumed here, outside the le_data callback, one connection
+ *  attempt per tick : the blocking connects of the instances do not pile up in one callback, and the
+ *  backlog of a resumed session is sent by its ProcessEvent calls.
+ */
+//--------------------------------------------------------------------------------------------------
+static void LinkRetryTimerHandler
+(
+    le_timer_Ref_t  timerRef
+)
+{
+    le_ref_IterRef_t    iterRef = le_ref_GetIterator(g_MqttClientRefMap);
+    unsigned long       nextMs = 0;
+    bool                attempted = false;
+
+    while (le_ref_NextNode(iterRef) == LE_OK)
+    {
+        ST_MQTT_CLIENT*     clientPtr = (ST_MQTT_CLIENT*) le_ref_GetValue(iterRef);
+
+        if (clientPtr->mqttObject)
+        {
+            // shared sessions are seen once per attachment, the first one makes the attempt
+            unsigned long retryMs = mqtt_LinkRetryDelay(clientPtr->mqttObject);
+
+            if (retryMs == 1 && !attempted)
+            {
+                retryMs = mqtt_LinkRetry(clientPtr->mqttObject);
+                attempted = true;
+            }
+
+            if (retryMs > 0 && (nextMs == 0 || retryMs < nextMs))
+            {
+                nextMs = retryMs;
+            }
+        }
+    }
+
+    le_timer_Stop(g_LinkRetryTimer);
+
+    if (nextMs > 0)
+    {
+        le_timer_SetMsInterval(g_LinkRetryTimer, nextMs);
+        le_timer_Start(g_LinkRetryTimer);
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+/**
+ *  Event callback for data connection state changes : the state of the instances is updated at
+ *  once, the sessions are resumed by the retry timer.
+ */
+//--------------------------------------------------------------------------------------------------
+static void DcsStateHandler
+(
+    const char* intfName,
+    bool        isConnected,
+    void*       contextPtr
+)
+{
+    if (isConnected == g_BearerUp)
+    {
+        return;
+    }
+
+    LE_INFO("Data connection %s %s", intfName, isConnected ? "up, resuming MQTT sessions" : "down, pausing MQTT sessions");
+
+    g_BearerUp = isConnected;
+    if (isConnected)
+    {
+        g_BearerUps++;
+    }
+    else
+    {
+        g_BearerDowns++;
+    }
+
+    le_ref_IterRef_t    iterRef = le_ref_GetIterator(g_MqttClientRefMap);
+
+    while (le_ref_NextNode(iterRef) == LE_OK)
+    {
+        ST_MQTT_CLIENT*     clientPtr = (ST_MQTT_CLIENT*) le_ref_GetValue(iterRef);
+
+        if (clientPtr->mqttObject)
+        {
+            // shared sessions are seen once per attachment, only the first call changes their state
+            mqtt_SetLinkState(clientPtr->mqttObject, isConnected);
+        }
+    }
+
+    le_timer_Stop(g_LinkRetryTimer);
+
+    if (isConnected)
+    {
+        le_timer_SetMsInterval(g_LinkRetryTimer, 1);
+        le_timer_Start(g_LinkRetryTimer);
+    }
+}
+
 //--------------------------------------------------------------------------------------------------
 /**
  *  Main function.
@@ -649,10 +1732,19 @@ COMPONENT_INIT
 
     // Create the ST_MQTT_CLIENT object pool.
     g_MqttClientPool = le_mem_CreatePool("stMqttClient", sizeof(ST_MQTT_CLIENT));
-    le_mem_ExpandPool(g_MqttClientPool, MAX_INSTANCE);
+    le_mem_ExpandPool(g_MqttClientPool, INITIAL_INSTANCE_CAPACITY);
  
     // Create the Safe Reference Map to use for ST_MQTT_CLIENT object Safe References.
-    g_MqttClientRefMap = le_ref_CreateMap("MqttClientMap", MAX_INSTANCE);
+    // The size is a hint, the map grows with the number of instances.
+    g_MqttClientRefMap = le_ref_CreateMap("MqttClientMap", INITIAL_INSTANCE_CAPACITY);
+
+    g_MqttTopicPool = le_mem_CreatePool("stMqttTopic", sizeof(ST_MQTT_TOPIC));
+    g_MqttTopicRefMap = le_ref_CreateMap("MqttTopicMap", INITIAL_INSTANCE_CAPACITY);
+
+    // Follow the bearer without requesting it, the data connection is requested by the client apps
+    g_LinkRetryTimer = le_timer_Create("MqttLinkRetry");
+    le_timer_SetHandler(g_LinkRetryTimer, LinkRetryTimerHandler);
+    le_data_AddConnectionStateHandler(DcsStateHandler, NULL);
 
 
     LE_INFO("MQTT Client Service started");
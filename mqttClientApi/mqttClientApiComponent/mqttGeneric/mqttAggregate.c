@@ -0,0 +1,299 @@
+/*******************************************************************************************************************
+
+ MQTT windowed aggregation
+
+	Count, min, max and mean of numeric samples over tumbling windows, see mqttAggregate.h
+
+*******************************************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <sys/time.h>
+
+#include "mqttAggregate.h"
+#include "mqttFilter.h"
+
+//-------------------------------------------------------------------------------------------------------
+static unsigned long long mqtt_AggregateNow(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return (unsigned long long) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+//-------------------------------------------------------------------------------------------------------
+//most specific rule matching the sample, NULL if it is not aggregated
+static const mqtt_aggregateRule_t* mqtt_AggregateRule(mqtt_aggregate_st* aggregate, const char* topicName, const char* key)
+{
+	const mqtt_aggregateRule_t*	best = NULL;
+	int							bestScore = -1;
+	int							i;
+
+	for (i=0; i<aggregate->ruleCount; i++)
+	{
+		const mqtt_aggregateRule_t* rule = &aggregate->rules[i];
+
+		if ((rule->topicName[0] && strcmp(rule->topicName, topicName) != 0) || (rule->key[0] && strcmp(rule->key, key) != 0))
+		{
+			continue;
+		}
+
+		int score = (rule->key[0] ? 2 : 0) + (rule->topicName[0] ? 1 : 0);
+
+		if (score > bestScore)
+		{
+			best = rule;
+			bestScore = score;
+		}
+	}
+
+	return best;
+}
+
+//-------------------------------------------------------------------------------------------------------
+static mqtt_aggregateEntry_st* mqtt_AggregateFind(mqtt_aggregate_st* aggregate, unsigned int hash, const char* topicName, const char* key)
+{
+	mqtt_aggregateEntry_st* entry = aggregate->buckets[hash & (MQTT_AGGREGATE_BUCKETS - 1)];
+
+	while (entry && (entry->hash != hash || strcmp(entry->name, topicName) != 0 || strcmp(entry->name + strlen(entry->name) + 1, key) != 0))
+	{
+		entry = entry->next;
+	}
+
+	return entry;
+}
+
+//-------------------------------------------------------------------------------------------------------
+//hands a closed window of the entry to its serializer
+static void mqtt_AggregateEmit(mqtt_aggregate_st* aggregate, mqtt_instance_st* mqttObject, mqtt_aggregateEntry_st* entry, const mqtt_window_t* window)
+{
+	aggregate->windows++;
+
+	entry->pfnEmit(mqttObject, entry->name, entry->name + strlen(entry->name) + 1, window);
+}
+
+//-------------------------------------------------------------------------------------------------------
+mqtt_aggregate_st* mqtt_AggregateCreate(void)
+{
+	mqtt_aggregate_st* aggregate = (mqtt_aggregate_st *) malloc(sizeof(mqtt_aggregate_st));
+
+	if (aggregate)
+	{
+		memset(aggregate, 0, sizeof(mqtt_aggregate_st));
+	}
+
+	return aggregate;
+}
+
+//-------------------------------------------------------------------------------------------------------
+void mqtt_AggregateDelete(mqtt_aggregate_st* aggregate)
+{
+	int i;
+
+	if (!aggregate)
+	{
+		return;
+	}
+
+	//windows still open are lost with the instance
+	for (i=0; i<MQTT_AGGREGATE_BUCKETS; i++)
+	{
+		while (aggregate->buckets[i])
+		{
+			mqtt_aggregateEntry_st* entry = aggregate->buckets[i];
+
+			aggregate->buckets[i] = entry->next;
+			free(entry);
+		}
+	}
+
+	free(aggregate);
+}
+
+//-------------------------------------------------------------------------------------------------------
+//windowMs 0 removes the rule, the windows already open end as they were started
+int mqtt_AggregateSetWindow(mqtt_aggregate_st* aggregate, const char* topicName, const char* key, unsigned long windowMs)
+{
+	int i;
+
+	if (topicName == NULL)
+	{
+		topicName = "";
+	}
+	if (key == NULL)
+	{
+		key = "";
+	}
+
+	if (strlen(topicName) >= MQTT_AGGREGATE_NAME_SIZE || strlen(key) >= MQTT_AGGREGATE_NAME_SIZE)
+	{
+		return FAILURE;
+	}
+
+	for (i=0; i<aggregate->ruleCount; i++)
+	{
+		if (strcmp(aggregate->rules[i].topicName, topicName) == 0 && strcmp(aggregate->rules[i].key, key) == 0)
+		{
+			break;
+		}
+	}
+
+	if (windowMs == 0)
+	{
+		if (i < aggregate->ruleCount)
+		{
+			aggregate->ruleCount--;
+			memmove(&aggregate->rules[i], &aggregate->rules[i + 1], (aggregate->ruleCount - i) * sizeof(mqtt_aggregateRule_t));
+		}
+		return SUCCESS;
+	}
+
+	if (i == MQTT_AGGREGATE_MAX_RULES)
+	{
+		fprintf(stdout, "mqttAggregate : no more than %d rules\n", MQTT_AGGREGATE_MAX_RULES);
+		fflush(stdout);
+		return FAILURE;
+	}
+
+	if (i == aggregate->ruleCount)
+	{
+		strcpy(aggregate->rules[i].topicName, topicName);
+		strcpy(aggregate->rules[i].key, key);
+		aggregate->ruleCount++;
+	}
+	aggregate->rules[i].windowMs = windowMs;
+
+	return SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------------------------
+//returns 1 if the sample is aggregated (not to be published), 0 if it is to be published as is
+int mqtt_AggregateAdd(mqtt_aggregate_st* aggregate, mqtt_instance_st* mqttObject, const char* topicName, const char* key, const char* value, mqtt_windowHandler pfnEmit)
+{
+	double number;
+
+	if (aggregate == NULL || aggregate->ruleCount == 0)
+	{
+		return 0;
+	}
+
+	const mqtt_aggregateRule_t* rule = mqtt_AggregateRule(aggregate, topicName, key);
+
+	if (rule == NULL || !mqtt_FilterIsNumber(value, &number))
+	{
+		return 0;
+	}
+
+	unsigned int			hash = mqtt_FilterHash(topicName, key);
+	mqtt_aggregateEntry_st*	entry = mqtt_AggregateFind(aggregate, hash, topicName, key);
+
+	if (entry == NULL)
+	{
+		size_t nameLen = strlen(topicName) + 1 + strlen(key) + 1;
+
+		if (aggregate->entryCount >= MQTT_AGGREGATE_MAX_ENTRIES ||
+			(entry = (mqtt_aggregateEntry_st *) malloc(sizeof(mqtt_aggregateEntry_st) + nameLen)) == NULL)
+		{
+			return 0;
+		}
+
+		memset(&entry->window, 0, sizeof(mqtt_window_t));
+		entry->hash = hash;
+		strcpy(entry->name, topicName);
+		strcpy(entry->name + strlen(topicName) + 1, key);
+
+		entry->next = aggregate->buckets[hash & (MQTT_AGGREGATE_BUCKETS - 1)];
+		aggregate->buckets[hash & (MQTT_AGGREGATE_BUCKETS - 1)] = entry;
+		aggregate->entryCount++;
+		aggregate->entryBytes += sizeof(mqtt_aggregateEntry_st) + nameLen;
+	}
+
+	//the summary goes out the way the last sample came
+	entry->pfnEmit = pfnEmit;
+
+	unsigned long long	now = mqtt_AggregateNow();
+	mqtt_window_t		closed = entry->window;
+	mqtt_window_t*		window = &entry->window;
+
+	if (window->count > 0 && now >= window->end)
+	{
+		window->count = 0;
+	}
+	else
+	{
+		closed.count = 0;
+	}
+
+	if (window->count == 0)
+	{
+		window->start = now - now % rule->windowMs;
+		window->end = window->start + rule->windowMs;
+		window->count = 1;
+		window->min = number;
+		window->max = number;
+		window->mean = number;
+	}
+	else
+	{
+		window->count++;
+		window->mean += (number - window->mean) / window->count;
+		if (number < window->min)
+		{
+			window->min = number;
+		}
+		if (number > window->max)
+		{
+			window->max = number;
+		}
+	}
+	aggregate->samples++;
+
+	//once the entry is consistent : the serializer may publish
+	if (closed.count > 0)
+	{
+		mqtt_AggregateEmit(aggregate, mqttObject, entry, &closed);
+	}
+
+	return 1;
+}
+
+//-------------------------------------------------------------------------------------------------------
+//emits the windows ended, run by mqtt_ProcessEvent
+void mqtt_AggregateFlush(mqtt_aggregate_st* aggregate, mqtt_instance_st* mqttObject)
+{
+	unsigned long long	now;
+	int					i;
+
+	if (aggregate == NULL || aggregate->entryCount == 0)
+	{
+		return;
+	}
+
+	now = mqtt_AggregateNow();
+
+	for (i=0; i<MQTT_AGGREGATE_BUCKETS; i++)
+	{
+		//entries added by an emission are inserted ahead of the one being visited
+		mqtt_aggregateEntry_st* entry;
+
+		for (entry = aggregate->buckets[i]; entry; entry = entry->next)
+		{
+			if (entry->window.count > 0 && now >= entry->window.end)
+			{
+				mqtt_window_t closed = entry->window;
+
+				entry->window.count = 0;
+				mqtt_AggregateEmit(aggregate, mqttObject, entry, &closed);
+			}
+		}
+	}
+}
+
+//-------------------------------------------------------------------------------------------------------
+size_t mqtt_AggregateFootprint(mqtt_aggregate_st* aggregate)
+{
+	return aggregate ? sizeof(mqtt_aggregate_st) + aggregate->entryBytes : 0;
+}
@@ -0,0 +1,90 @@
+/*******************************************************************************************************************
+
+ MQTT windowed aggregation
+
+	Numeric key/value samples of the keys (or topics) configured for aggregation are not published one by
+	one : they are summarized over tumbling windows and one record per window is published instead.
+
+		- a rule gives the window of the samples of a topic and a key, "" matching any topic or any key.
+		  The most specific rule applies (topic and key, then key, then topic)
+		- windows are aligned on multiples of their length since the epoch : a window is
+		  [start, start + windowMs[ and samples are counted in the window of the time they are published
+		- a window holds its count, min, max and mean (running mean), whatever the number of samples
+		- a window is emitted by the first sample after its end, or by mqtt_ProcessEvent once ended.
+		  Emission goes through the serializer of the publish path the samples came from (generic JSON
+		  object on the topic, AirVantage time series)
+		- non numeric values are published as they come
+
+	The table is bounded (MQTT_AGGREGATE_MAX_ENTRIES (topic, key) pairs), the samples of the keys beyond
+	are published as they come. Entries are kept with the instance : emitting never frees one, so that a
+	sample published by an emission handler (or a callback it triggers) is safe.
+
+	View of the stack :
+	_________________________
+
+	 mqttGeneric / mqttAirVantage interfaces
+	_________________________
+
+	 mqttAggregate  <--- this file
+	_________________________
+
+	 mqttJson / mqttSeries
+	_________________________
+
+*******************************************************************************************************************/
+
+#ifndef _MQTT_AGGREGATE_H_
+#define _MQTT_AGGREGATE_H_
+
+#include "mqttGeneric.h"
+
+#define		MQTT_AGGREGATE_MAX_RULES		16
+#define		MQTT_AGGREGATE_NAME_SIZE		128
+#define		MQTT_AGGREGATE_MAX_ENTRIES		256
+#define		MQTT_AGGREGATE_BUCKETS			64		//power of 2, the table does not grow
+
+typedef struct {
+	unsigned long			count;
+	double					min;
+	double					max;
+	double					mean;
+	unsigned long long		start;					//ms since epoch
+	unsigned long long		end;					//ms since epoch, excluded
+} mqtt_window_t;
+
+typedef void (*mqtt_windowHandler)(mqtt_instance_st* mqttObject, const char* topicName, const char* key, const mqtt_window_t* window);
+
+typedef struct {
+	char					topicName[MQTT_AGGREGATE_NAME_SIZE];	//"" : any topic
+	char					key[MQTT_AGGREGATE_NAME_SIZE];			//"" : any key
+	unsigned long			windowMs;
+} mqtt_aggregateRule_t;
+
+typedef struct mqtt_aggregateEntry_st {
+	struct mqtt_aggregateEntry_st*	next;
+	unsigned int					hash;
+	mqtt_windowHandler				pfnEmit;		//serializer of the publish path
+	mqtt_window_t					window;			//count 0 : no window open
+	char							name[];			//topic, NUL, key, NUL
+} mqtt_aggregateEntry_st;
+
+typedef struct mqtt_aggregate_st {
+	mqtt_aggregateRule_t		rules[MQTT_AGGREGATE_MAX_RULES];
+	int							ruleCount;
+	mqtt_aggregateEntry_st*		buckets[MQTT_AGGREGATE_BUCKETS];
+	unsigned long				entryCount;
+	size_t						entryBytes;
+	unsigned long				samples;		//samples aggregated
+	unsigned long				windows;		//summaries emitted
+} mqtt_aggregate_st;
+
+mqtt_aggregate_st* mqtt_AggregateCreate(void);
+void mqtt_AggregateDelete(mqtt_aggregate_st* aggregate);
+
+int  mqtt_AggregateSetWindow(mqtt_aggregate_st* aggregate, const char* topicName, const char* key, unsigned long windowMs);
+int  mqtt_AggregateAdd(mqtt_aggregate_st* aggregate, mqtt_instance_st* mqttObject, const char* topicName, const char* key, const char* value, mqtt_windowHandler pfnEmit);
+void mqtt_AggregateFlush(mqtt_aggregate_st* aggregate, mqtt_instance_st* mqttObject);
+
+size_t mqtt_AggregateFootprint(mqtt_aggregate_st* aggregate);
+
+#endif	//_MQTT_AGGREGATE_H_
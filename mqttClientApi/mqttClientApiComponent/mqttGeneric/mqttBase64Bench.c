@@ -0,0 +1,380 @@
+/*******************************************************************************************************************
+
+ base64 benchmark
+
+	Checks the SIMD kernels of mbedtls base64 against its scalar code (random lengths, both alphabets,
+	PEM line breaks, corrupted input, buffer sizing), then prints the time to parse a certificate bundle
+	and the time spent decoding its PEM bodies with both on this device :
+
+		make mqttBase64Bench && ./mqttBase64Bench [certificate file or directory] [cases]
+
+*******************************************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+//scalar reference : base64.c built again without its kernels, under other names
+#define		MBEDTLS_BASE64_NO_SIMD
+#define		mbedtls_base64_encode			scalar_base64_encode
+#define		mbedtls_base64_decode			scalar_base64_decode
+#define		mbedtls_base64url_encode		scalar_base64url_encode
+#define		mbedtls_base64url_decode		scalar_base64url_decode
+#define		mbedtls_base64_self_test		scalar_base64_self_test
+#include "../mbedtls/library/base64.c"
+#undef		mbedtls_base64_encode
+#undef		mbedtls_base64_decode
+#undef		mbedtls_base64url_encode
+#undef		mbedtls_base64url_decode
+#undef		mbedtls_base64_self_test
+
+//kernels of the library
+#undef		MBEDTLS_BASE64_H
+#include "mbedtls/base64.h"
+#include "mbedtls/x509_crt.h"
+
+#define		BENCH_MAX_LEN			4096
+#define		BENCH_RUNS				5
+#define		BENCH_DEFAULT_CERTS		"/etc/ssl/certs"
+#define		BENCH_GUARD				0xA5
+
+typedef int (*bench_codec_t)(unsigned char* dst, size_t dlen, size_t* olen, const unsigned char* src, size_t slen);
+
+typedef struct {
+	const char*				name;
+	bench_codec_t			simd;
+	bench_codec_t			scalar;
+} bench_pair_t;
+
+static const bench_pair_t	g_encoders[2] = {
+	{ "base64 encode", mbedtls_base64_encode, scalar_base64_encode },
+	{ "base64url encode", mbedtls_base64url_encode, scalar_base64url_encode }
+};
+
+static const bench_pair_t	g_decoders[2] = {
+	{ "base64 decode", mbedtls_base64_decode, scalar_base64_decode },
+	{ "base64url decode", mbedtls_base64url_decode, scalar_base64url_decode }
+};
+
+static const char			g_noise[] = "= \r\n-_+/A.\x80";
+
+//-------------------------------------------------------------------------------------------------------
+static unsigned long long bench_NowUs(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return (unsigned long long) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+//-------------------------------------------------------------------------------------------------------
+//both paths on the same input, into buffers of dlen bytes : same result, length and output, nothing
+//written past dlen (guard byte)
+static int bench_Compare(const bench_pair_t* pair, const unsigned char* src, size_t slen, size_t dlen)
+{
+	unsigned char*	simd = (unsigned char *) malloc(dlen + 1);
+	unsigned char*	scalar = (unsigned char *) malloc(dlen + 1);
+	size_t			simdLen = 0, scalarLen = 0;
+	int				mismatch;
+
+	simd[dlen] = scalar[dlen] = BENCH_GUARD;
+
+	int simdRc = pair->simd(dlen ? simd : NULL, dlen, &simdLen, src, slen);
+	int scalarRc = pair->scalar(dlen ? scalar : NULL, dlen, &scalarLen, src, slen);
+
+	mismatch = simdRc != scalarRc || simdLen != scalarLen || (simdRc == 0 && memcmp(simd, scalar, simdLen) != 0) ||
+			   simd[dlen] != BENCH_GUARD || scalar[dlen] != BENCH_GUARD;
+
+	if (mismatch)
+	{
+		fprintf(stdout, "%s : %lu bytes into %lu, rc %d / %d, olen %lu / %lu\n", pair->name, (unsigned long) slen, (unsigned long) dlen,
+				simdRc, scalarRc, (unsigned long) simdLen, (unsigned long) scalarLen);
+	}
+
+	free(simd);
+	free(scalar);
+
+	return mismatch;
+}
+
+//-------------------------------------------------------------------------------------------------------
+//encoded text of random bytes, with PEM line breaks and damage now and then
+static size_t bench_Text(const bench_pair_t* encoder, unsigned char* text, size_t size, size_t len)
+{
+	static unsigned char	bytes[BENCH_MAX_LEN];
+	static unsigned char	encoded[BENCH_MAX_LEN * 2];
+	size_t					encodedLen = 0;
+	size_t					textLen = 0;
+	size_t					lineLen = (rand() % 2) ? 64 : 16 * (1 + rand() % 8);
+	const char*				eol = (rand() % 2) ? "\n" : "\r\n";
+	size_t					i;
+
+	for (i=0; i<len; i++)
+	{
+		bytes[i] = (unsigned char) rand();
+	}
+	encoder->scalar(encoded, sizeof(encoded), &encodedLen, bytes, len);
+
+	for (i=0; i<encodedLen && textLen + 3 < size; i++)
+	{
+		if (i > 0 && i % lineLen == 0 && rand() % 4 != 0)
+		{
+			textLen += (size_t) sprintf((char *) text + textLen, "%s", eol);
+		}
+		text[textLen++] = encoded[i];
+	}
+
+	switch (rand() % 8)
+	{
+		case 0 :
+			//a stray character
+			if (textLen > 0)
+			{
+				text[rand() % textLen] = (unsigned char) g_noise[rand() % (sizeof(g_noise) - 1)];
+			}
+			break;
+
+		case 1 :
+			//truncated
+			textLen = textLen ? (size_t) rand() % textLen : 0;
+			break;
+
+		case 2 :
+			//trailing spaces
+			while (textLen < size && rand() % 3 != 0)
+			{
+				text[textLen++] = ' ';
+			}
+			break;
+	}
+
+	return textLen;
+}
+
+//-------------------------------------------------------------------------------------------------------
+static int bench_Differential(int cases)
+{
+	static unsigned char	bytes[BENCH_MAX_LEN];
+	static unsigned char	text[BENCH_MAX_LEN * 3];
+	int						mismatches = 0;
+	int						i, alphabet;
+
+	srand(1);
+
+	for (i=0; i<cases; i++)
+	{
+		//short lengths around the block sizes first, then any up to BENCH_MAX_LEN
+		size_t len = (i < cases / 2) ? (size_t) rand() % 200 : (size_t) rand() % BENCH_MAX_LEN;
+		size_t j, textLen, needed = 0;
+
+		for (alphabet=0; alphabet<2; alphabet++)
+		{
+			for (j=0; j<len; j++)
+			{
+				bytes[j] = (unsigned char) rand();
+			}
+
+			g_encoders[alphabet].scalar(NULL, 0, &needed, bytes, len);
+			mismatches += bench_Compare(&g_encoders[alphabet], bytes, len, needed);
+			mismatches += bench_Compare(&g_encoders[alphabet], bytes, len, needed ? needed - 1 : 0);
+
+			textLen = bench_Text(&g_encoders[alphabet], text, sizeof(text), len);
+
+			g_decoders[alphabet].scalar(NULL, 0, &needed, text, textLen);
+			mismatches += bench_Compare(&g_decoders[alphabet], text, textLen, needed);
+			mismatches += bench_Compare(&g_decoders[alphabet], text, textLen, needed ? needed - 1 : 0);
+			mismatches += bench_Compare(&g_decoders[alphabet], text, textLen, 0);
+		}
+
+		if (mismatches > 10)
+		{
+			break;
+		}
+	}
+
+	return mismatches;
+}
+
+//-------------------------------------------------------------------------------------------------------
+static void bench_AppendFile(const char* path, char** bundle, size_t* bundleLen)
+{
+	FILE*	file = fopen(path, "rb");
+	char	chunk[4096];
+	size_t	n;
+
+	while (file && (n = fread(chunk, 1, sizeof(chunk), file)) > 0)
+	{
+		char* grown = (char *) realloc(*bundle, *bundleLen + n + 1);
+
+		if (grown == NULL)
+		{
+			break;
+		}
+		*bundle = grown;
+		memcpy(*bundle + *bundleLen, chunk, n);
+		*bundleLen += n;
+		(*bundle)[*bundleLen] = '\0';
+	}
+
+	if (file)
+	{
+		fclose(file);
+	}
+}
+
+//-------------------------------------------------------------------------------------------------------
+//content of the bundle, or of the certificates of the directory
+static char* bench_LoadCerts(const char* path, int isDir, size_t* bundleLen)
+{
+	char*	bundle = NULL;
+
+	*bundleLen = 0;
+
+	if (!isDir)
+	{
+		bench_AppendFile(path, &bundle, bundleLen);
+		return bundle;
+	}
+
+	DIR* dir = opendir(path);
+	struct dirent* entry;
+
+	while (dir && (entry = readdir(dir)) != NULL)
+	{
+		char		filePath[1024];
+		struct stat	st;
+
+		snprintf(filePath, sizeof(filePath), "%s/%s", path, entry->d_name);
+
+		if (stat(filePath, &st) == 0 && S_ISREG(st.st_mode))
+		{
+			bench_AppendFile(filePath, &bundle, bundleLen);
+		}
+	}
+
+	if (dir)
+	{
+		closedir(dir);
+	}
+
+	return bundle;
+}
+
+//-------------------------------------------------------------------------------------------------------
+//PEM bodies of the bundle decoded as pem.c does (size, then decode), best of BENCH_RUNS
+static unsigned long long bench_DecodeBodies(const char* bundle, bench_codec_t decode, unsigned long* bodies, unsigned long* bytes)
+{
+	static const char	szBegin[] = "-----BEGIN CERTIFICATE-----";
+	static const char	szEnd[] = "-----END CERTIFICATE-----";
+	unsigned long long	best = 0;
+	int					run;
+
+	for (run=0; run<BENCH_RUNS; run++)
+	{
+		const char*			begin = bundle;
+		unsigned long long	start = bench_NowUs();
+
+		*bodies = *bytes = 0;
+
+		while ((begin = strstr(begin, szBegin)) != NULL)
+		{
+			const char*		body = begin + sizeof(szBegin) - 1;
+			const char*		end = strstr(body, szEnd);
+			unsigned char	der[8192];
+			size_t			len = 0;
+
+			if (end == NULL)
+			{
+				break;
+			}
+
+			if (decode(NULL, 0, &len, (const unsigned char *) body, (size_t) (end - body)) == MBEDTLS_ERR_BASE64_BUFFER_TOO_SMALL &&
+				len <= sizeof(der) && decode(der, len, &len, (const unsigned char *) body, (size_t) (end - body)) == 0)
+			{
+				(*bodies)++;
+				*bytes += (unsigned long) (end - body);
+			}
+
+			begin = end;
+		}
+
+		if (run == 0 || bench_NowUs() - start < best)
+		{
+			best = bench_NowUs() - start;
+		}
+	}
+
+	return best;
+}
+
+//-------------------------------------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+	const char*			path = (argc > 1) ? argv[1] : BENCH_DEFAULT_CERTS;
+	int					cases = (argc > 2) ? atoi(argv[2]) : 20000;
+	struct stat			st;
+	unsigned long long	parseUs = 0;
+	unsigned long		bodies = 0, bytes = 0;
+	size_t				bundleLen;
+	int					certs = 0;
+	int					run;
+
+	if (cases <= 0 || stat(path, &st) != 0)
+	{
+		fprintf(stdout, "usage : %s [certificate file or directory] [cases]\n", argv[0]);
+		return 1;
+	}
+
+	int mismatches = bench_Differential(cases);
+
+	fprintf(stdout, "SIMD / scalar : %d cases, %s\n", cases, mismatches ? "with mismatches" : "identical");
+
+	for (run=0; run<BENCH_RUNS; run++)
+	{
+		mbedtls_x509_crt	chain;
+		unsigned long long	start = bench_NowUs();
+
+		mbedtls_x509_crt_init(&chain);
+		int rc = S_ISDIR(st.st_mode) ? mbedtls_x509_crt_parse_path(&chain, path) : mbedtls_x509_crt_parse_file(&chain, path);
+		unsigned long long elapsed = bench_NowUs() - start;
+
+		if (run == 0 || elapsed < parseUs)
+		{
+			parseUs = elapsed;
+		}
+
+		//rc > 0 : certificates which could not be parsed
+		if (rc >= 0)
+		{
+			mbedtls_x509_crt* crt;
+
+			for (certs=0, crt=&chain; crt && crt->raw.len > 0; crt=crt->next)
+			{
+				certs++;
+			}
+		}
+		mbedtls_x509_crt_free(&chain);
+	}
+
+	char* bundle = bench_LoadCerts(path, S_ISDIR(st.st_mode), &bundleLen);
+
+	fprintf(stdout, "parse %s : %d certificates, %.2f ms (best of %d)\n", path, certs, parseUs / 1000.0, BENCH_RUNS);
+
+	if (bundle)
+	{
+		unsigned long long simdUs = bench_DecodeBodies(bundle, mbedtls_base64_decode, &bodies, &bytes);
+		unsigned long long scalarUs = bench_DecodeBodies(bundle, scalar_base64_decode, &bodies, &bytes);
+
+		fprintf(stdout, "PEM bodies    : %lu, %lu bytes\n", bodies, bytes);
+		fprintf(stdout, "SIMD          : %.2f ms, %6.1f MB/s\n", simdUs / 1000.0, (double) bytes / (simdUs ? simdUs : 1));
+		fprintf(stdout, "scalar        : %.2f ms, %6.1f MB/s\n", scalarUs / 1000.0, (double) bytes / (scalarUs ? scalarUs : 1));
+	}
+
+	free(bundle);
+
+	return mismatches ? 1 : 0;
+}
@@ -0,0 +1,629 @@
+/*******************************************************************************************************************
+
+ MQTT binary telemetry codec
+
+	Encoder and decoder of the compact batch of timestamped samples, see mqttCodec.h
+
+*******************************************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mqttCodec.h"
+
+#define		CODEC_MAGIC				"MQC"
+#define		CODEC_MAX_INTEGER		(1LL << 62)		//deltas of larger integers could overflow
+
+//-------------------------------------------------------------------------------------------------------
+static int mqtt_CodecLeadingZeros(unsigned long long x)
+{
+#if defined(__GNUC__)
+	return __builtin_clzll(x);
+#else
+	int n = 0;
+
+	while (!(x & 0x8000000000000000ULL))
+	{
+		x <<= 1;
+		n++;
+	}
+
+	return n;
+#endif
+}
+
+static int mqtt_CodecTrailingZeros(unsigned long long x)
+{
+#if defined(__GNUC__)
+	return __builtin_ctzll(x);
+#else
+	int n = 0;
+
+	while (!(x & 1))
+	{
+		x >>= 1;
+		n++;
+	}
+
+	return n;
+#endif
+}
+
+static unsigned long long mqtt_CodecZigzag(long long v)
+{
+	return ((unsigned long long) v << 1) ^ (unsigned long long) (v >> 63);
+}
+
+static long long mqtt_CodecUnzigzag(unsigned long long z)
+{
+	return (long long) ((z >> 1) ^ (0 - (z & 1)));
+}
+
+//-------------------------------------------------------------------------------------------------------
+//writes the n low bits of value (n <= 64), most significant first
+static void mqtt_BitPut(mqtt_bitWriter_t* out, unsigned long long value, int n)
+{
+	if (n > 32)
+	{
+		mqtt_BitPut(out, value >> 32, n - 32);
+		n = 32;
+	}
+
+	out->acc = (out->acc << n) | (value & ((1ULL << n) - 1));
+	out->accBits += n;
+
+	while (out->accBits >= 8)
+	{
+		out->accBits -= 8;
+
+		if (out->len < out->size)
+		{
+			out->buffer[out->len++] = (unsigned char) (out->acc >> out->accBits);
+		}
+		else
+		{
+			out->error = 1;
+		}
+	}
+
+	out->acc &= (1ULL << out->accBits) - 1;
+}
+
+static void mqtt_BitAlign(mqtt_bitWriter_t* out)
+{
+	if (out->accBits)
+	{
+		mqtt_BitPut(out, 0, 8 - out->accBits);
+	}
+}
+
+static void mqtt_BitVarint(mqtt_bitWriter_t* out, unsigned long long value)
+{
+	while (value >= 0x80)
+	{
+		mqtt_BitPut(out, (value & 0x7F) | 0x80, 8);
+		value >>= 7;
+	}
+	mqtt_BitPut(out, value, 8);
+}
+
+static void mqtt_BitBytes(mqtt_bitWriter_t* out, const char* data, size_t len)
+{
+	//aligned : copied as is
+	if (out->len + len > out->size)
+	{
+		out->error = 1;
+		return;
+	}
+
+	memcpy(out->buffer + out->len, data, len);
+	out->len += len;
+}
+
+//-------------------------------------------------------------------------------------------------------
+typedef struct {
+	const unsigned char*	data;
+	size_t					len;
+	size_t					pos;
+	unsigned long long		acc;
+	int						accBits;
+	int						error;					//truncated or malformed batch
+} mqtt_bitReader_t;
+
+static unsigned long long mqtt_BitGet(mqtt_bitReader_t* in, int n)
+{
+	unsigned long long value = 0;
+
+	if (n > 32)
+	{
+		value = mqtt_BitGet(in, n - 32) << 32;
+		n = 32;
+	}
+
+	while (in->accBits < n)
+	{
+		if (in->pos >= in->len)
+		{
+			in->error = 1;
+			return 0;
+		}
+		in->acc = (in->acc << 8) | in->data[in->pos++];
+		in->accBits += 8;
+	}
+
+	in->accBits -= n;
+	value |= (in->acc >> in->accBits) & ((1ULL << n) - 1);
+	in->acc &= (1ULL << in->accBits) - 1;
+
+	return value;
+}
+
+static void mqtt_BitSkipToByte(mqtt_bitReader_t* in)
+{
+	//the bits left in the accumulator are the padding of the current byte
+	in->acc = 0;
+	in->accBits = 0;
+}
+
+static unsigned long long mqtt_BitGetVarint(mqtt_bitReader_t* in)
+{
+	unsigned long long	value = 0;
+	int					shift;
+
+	for (shift = 0; shift < 64 && !in->error; shift += 7)
+	{
+		unsigned long long byte = mqtt_BitGet(in, 8);
+
+		value |= (byte & 0x7F) << shift;
+		if (!(byte & 0x80))
+		{
+			return value;
+		}
+	}
+
+	in->error = 1;
+
+	return 0;
+}
+
+//-------------------------------------------------------------------------------------------------------
+static int mqtt_CodecIsInteger(const char* value, long long* integer)
+{
+	const char* p = value;
+
+	if (*p == '-')
+	{
+		p++;
+	}
+
+	//canonical : decoded as the same text
+	if (*p < '0' || *p > '9' || (p[0] == '0' && p[1] != '\0') || (value[0] == '-' && p[0] == '0'))
+	{
+		return 0;
+	}
+
+	char* end;
+
+	*integer = strtoll(value, &end, 10);
+
+	return *end == '\0' && *integer < CODEC_MAX_INTEGER && *integer > -CODEC_MAX_INTEGER;
+}
+
+static int mqtt_CodecIsNumber(const char* value, double* number)
+{
+	char* end;
+
+	//decimal only : no blanks, no hexadecimal
+	if (!strchr("+-.0123456789", value[0]) || value[0] == '\0' || strpbrk(value, "xX"))
+	{
+		return 0;
+	}
+
+	*number = strtod(value, &end);
+
+	//x - x is not 0 for infinities and NaN
+	return end != value && *end == '\0' && (*number - *number) == 0;
+}
+
+//-------------------------------------------------------------------------------------------------------
+mqtt_codecType_t mqtt_CodecNarrow(mqtt_codecType_t type, const char* value)
+{
+	long long	integer;
+	double		number;
+
+	if (type == MQTT_CODEC_INTEGER && mqtt_CodecIsInteger(value, &integer))
+	{
+		return MQTT_CODEC_INTEGER;
+	}
+
+	if (type != MQTT_CODEC_TEXT && mqtt_CodecIsNumber(value, &number))
+	{
+		return MQTT_CODEC_FLOAT;
+	}
+
+	return MQTT_CODEC_TEXT;
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_CodecBegin(mqtt_codecEncoder_t* encoder, unsigned char* buffer, size_t size, unsigned int keyCount)
+{
+	memset(encoder, 0, sizeof(mqtt_codecEncoder_t));
+
+	encoder->out.buffer = buffer;
+	encoder->out.size = size;
+	encoder->keysLeft = keyCount;
+
+	mqtt_BitBytes(&encoder->out, CODEC_MAGIC, 3);
+	mqtt_BitPut(&encoder->out, MQTT_CODEC_VERSION, 8);
+	mqtt_BitVarint(&encoder->out, keyCount);
+
+	return encoder->out.error ? MQTT_CODEC_ERROR : MQTT_CODEC_OK;
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_CodecBeginKey(mqtt_codecEncoder_t* encoder, const char* key, unsigned int sampleCount, mqtt_codecType_t type)
+{
+	size_t keyLen = strlen(key);
+
+	if (encoder->keysLeft == 0 || encoder->samplesLeft > 0)
+	{
+		return MQTT_CODEC_ERROR;
+	}
+
+	encoder->keysLeft--;
+	encoder->samplesLeft = sampleCount;
+	encoder->type = type;
+	encoder->started = 0;
+	encoder->prevDelta = 0;
+	encoder->prevInteger = 0;
+
+	mqtt_BitVarint(&encoder->out, keyLen);
+	mqtt_BitBytes(&encoder->out, key, keyLen);
+	mqtt_BitVarint(&encoder->out, sampleCount);
+	mqtt_BitPut(&encoder->out, (unsigned long long) type, 8);
+
+	return encoder->out.error ? MQTT_CODEC_ERROR : MQTT_CODEC_OK;
+}
+
+//-------------------------------------------------------------------------------------------------------
+static void mqtt_CodecPutTimestamp(mqtt_codecEncoder_t* encoder, unsigned long long timestamp)
+{
+	mqtt_bitWriter_t* out = &encoder->out;
+
+	if (!encoder->started)
+	{
+		mqtt_BitVarint(out, timestamp);
+	}
+	else
+	{
+		long long			delta = (long long) (timestamp - encoder->prevTimestamp);
+		long long			dod = (long long) ((unsigned long long) delta - (unsigned long long) encoder->prevDelta);
+		unsigned long long	zz = mqtt_CodecZigzag(dod);
+
+		if (zz == 0)
+		{
+			mqtt_BitPut(out, 0, 1);
+		}
+		else if (zz < (1ULL << 7))
+		{
+			mqtt_BitPut(out, 0x2, 2);
+			mqtt_BitPut(out, zz, 7);
+		}
+		else if (zz < (1ULL << 9))
+		{
+			mqtt_BitPut(out, 0x6, 3);
+			mqtt_BitPut(out, zz, 9);
+		}
+		else if (zz < (1ULL << 12))
+		{
+			mqtt_BitPut(out, 0xE, 4);
+			mqtt_BitPut(out, zz, 12);
+		}
+		else if (zz < (1ULL << 32))
+		{
+			mqtt_BitPut(out, 0x1E, 5);
+			mqtt_BitPut(out, zz, 32);
+		}
+		else
+		{
+			mqtt_BitPut(out, 0x1F, 5);
+			mqtt_BitPut(out, zz, 64);
+		}
+
+		encoder->prevDelta = delta;
+	}
+
+	encoder->prevTimestamp = timestamp;
+}
+
+//-------------------------------------------------------------------------------------------------------
+static void mqtt_CodecPutFloat(mqtt_codecEncoder_t* encoder, double number)
+{
+	mqtt_bitWriter_t*	out = &encoder->out;
+	unsigned long long	bits;
+
+	memcpy(&bits, &number, sizeof(bits));
+
+	if (!encoder->started)
+	{
+		mqtt_BitPut(out, bits, 64);
+		encoder->prevLeading = -1;
+	}
+	else
+	{
+		unsigned long long x = bits ^ encoder->prevBits;
+
+		if (x == 0)
+		{
+			mqtt_BitPut(out, 0, 1);
+		}
+		else
+		{
+			int leading = mqtt_CodecLeadingZeros(x);
+			int trailing = mqtt_CodecTrailingZeros(x);
+
+			if (leading > 31)
+			{
+				leading = 31;
+			}
+
+			if (encoder->prevLeading >= 0 && leading >= encoder->prevLeading && trailing >= encoder->prevTrailing)
+			{
+				//within the window of the previous XOR
+				mqtt_BitPut(out, 0x2, 2);
+				mqtt_BitPut(out, x >> encoder->prevTrailing, 64 - encoder->prevLeading - encoder->prevTrailing);
+			}
+			else
+			{
+				int meaningful = 64 - leading - trailing;
+
+				mqtt_BitPut(out, 0x3, 2);
+				mqtt_BitPut(out, (unsigned long long) leading, 5);
+				mqtt_BitPut(out, (unsigned long long) (meaningful - 1), 6);
+				mqtt_BitPut(out, x >> trailing, meaningful);
+
+				encoder->prevLeading = leading;
+				encoder->prevTrailing = trailing;
+			}
+		}
+	}
+
+	encoder->prevBits = bits;
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_CodecAddSample(mqtt_codecEncoder_t* encoder, unsigned long long timestamp, const char* value)
+{
+	mqtt_bitWriter_t*	out = &encoder->out;
+	long long			integer = 0;
+	double				number = 0;
+
+	if (encoder->samplesLeft == 0)
+	{
+		return MQTT_CODEC_ERROR;
+	}
+
+	if ((encoder->type == MQTT_CODEC_INTEGER && !mqtt_CodecIsInteger(value, &integer)) ||
+		(encoder->type == MQTT_CODEC_FLOAT && !mqtt_CodecIsNumber(value, &number)))
+	{
+		//not narrowed with mqtt_CodecNarrow
+		return MQTT_CODEC_ERROR;
+	}
+
+	mqtt_CodecPutTimestamp(encoder, timestamp);
+
+	if (encoder->type == MQTT_CODEC_INTEGER)
+	{
+		mqtt_BitVarint(out, mqtt_CodecZigzag(integer - encoder->prevInteger));
+		encoder->prevInteger = integer;
+	}
+	else if (encoder->type == MQTT_CODEC_FLOAT)
+	{
+		mqtt_CodecPutFloat(encoder, number);
+	}
+	else
+	{
+		size_t len = strlen(value);
+
+		if (encoder->started && len == encoder->prevTextLen && memcmp(value, encoder->prevText, len) == 0)
+		{
+			mqtt_BitPut(out, 0, 1);
+		}
+		else
+		{
+			//aligned, so that the decoder returns the text in place
+			mqtt_BitPut(out, 1, 1);
+			mqtt_BitAlign(out);
+			mqtt_BitVarint(out, len);
+			mqtt_BitBytes(out, value, len);
+		}
+
+		encoder->prevText = value;
+		encoder->prevTextLen = len;
+	}
+
+	encoder->started = 1;
+
+	if (--encoder->samplesLeft == 0)
+	{
+		mqtt_BitAlign(out);
+	}
+
+	return out->error ? MQTT_CODEC_ERROR : MQTT_CODEC_OK;
+}
+
+//-------------------------------------------------------------------------------------------------------
+//returns the size of the batch, 0 if the buffer was too small or keys or samples are missing
+size_t mqtt_CodecEnd(mqtt_codecEncoder_t* encoder)
+{
+	if (encoder->out.error || encoder->keysLeft > 0 || encoder->samplesLeft > 0)
+	{
+		return 0;
+	}
+
+	return encoder->out.len;
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_CodecDecode(const unsigned char* data, size_t len, mqtt_codecSampleHandler pfnSample, void* context)
+{
+	mqtt_bitReader_t	in;
+	unsigned long long	keyCount;
+
+	memset(&in, 0, sizeof(in));
+	in.data = data;
+	in.len = len;
+
+	if (len < 4 || memcmp(data, CODEC_MAGIC, 3) != 0 || data[3] != MQTT_CODEC_VERSION)
+	{
+		return MQTT_CODEC_ERROR;
+	}
+	in.pos = 4;
+
+	keyCount = mqtt_BitGetVarint(&in);
+
+	while (keyCount-- > 0 && !in.error)
+	{
+		size_t				keyLen = (size_t) mqtt_BitGetVarint(&in);
+		const char*			key = (const char *) data + in.pos;
+
+		if (keyLen > len - in.pos)
+		{
+			return MQTT_CODEC_ERROR;
+		}
+		in.pos += keyLen;
+
+		unsigned long long	count = mqtt_BitGetVarint(&in);
+		mqtt_codecType_t	type = (mqtt_codecType_t) mqtt_BitGet(&in, 8);
+		mqtt_codecValue_t	value;
+		unsigned long long	timestamp = 0;
+		long long			delta = 0;
+		unsigned long long	bits = 0;
+		int					leading = -1;			//no XOR window yet
+		int					trailing = 0;
+		unsigned long long	i;
+
+		if (type > MQTT_CODEC_TEXT)
+		{
+			return MQTT_CODEC_ERROR;
+		}
+
+		memset(&value, 0, sizeof(value));
+		value.type = type;
+
+		for (i=0; i<count && !in.error; i++)
+		{
+			if (i == 0)
+			{
+				timestamp = mqtt_BitGetVarint(&in);
+			}
+			else
+			{
+				int ones = 0;
+
+				while (ones < 5 && mqtt_BitGet(&in, 1))
+				{
+					ones++;
+				}
+
+				static const int dodBits[6] = { 0, 7, 9, 12, 32, 64 };
+				long long dod = ones ? mqtt_CodecUnzigzag(mqtt_BitGet(&in, dodBits[ones])) : 0;
+
+				delta = (long long) ((unsigned long long) delta + (unsigned long long) dod);
+				timestamp += (unsigned long long) delta;
+			}
+
+			if (type == MQTT_CODEC_INTEGER)
+			{
+				//wraps instead of overflowing on a corrupted batch
+				value.integer = (long long) ((unsigned long long) value.integer + (unsigned long long) mqtt_CodecUnzigzag(mqtt_BitGetVarint(&in)));
+			}
+			else if (type == MQTT_CODEC_FLOAT)
+			{
+				if (i == 0)
+				{
+					bits = mqtt_BitGet(&in, 64);
+				}
+				else if (mqtt_BitGet(&in, 1))
+				{
+					if (mqtt_BitGet(&in, 1))
+					{
+						leading = (int) mqtt_BitGet(&in, 5);
+						trailing = 64 - leading - ((int) mqtt_BitGet(&in, 6) + 1);
+						if (trailing < 0)
+						{
+							return MQTT_CODEC_ERROR;
+						}
+					}
+					else if (leading < 0)
+					{
+						return MQTT_CODEC_ERROR;
+					}
+					bits ^= mqtt_BitGet(&in, 64 - leading - trailing) << trailing;
+				}
+				memcpy(&value.number, &bits, sizeof(bits));
+			}
+			else if (mqtt_BitGet(&in, 1))
+			{
+				mqtt_BitSkipToByte(&in);
+				value.textLen = (size_t) mqtt_BitGetVarint(&in);
+				value.text = (const char *) data + in.pos;
+
+				if (value.textLen > len - in.pos)
+				{
+					return MQTT_CODEC_ERROR;
+				}
+				in.pos += value.textLen;
+			}
+			else if (i == 0)
+			{
+				//no previous value
+				return MQTT_CODEC_ERROR;
+			}
+
+			if (in.error)
+			{
+				break;
+			}
+
+			pfnSample(key, keyLen, timestamp, &value, context);
+		}
+
+		mqtt_BitSkipToByte(&in);
+	}
+
+	return in.error ? MQTT_CODEC_ERROR : MQTT_CODEC_OK;
+}
+
+//-------------------------------------------------------------------------------------------------------
+//value as text : returns its length, -1 if the buffer is too small
+int mqtt_CodecFormatValue(const mqtt_codecValue_t* value, char* buffer, size_t size)
+{
+	int len;
+
+	if (value->type == MQTT_CODEC_INTEGER)
+	{
+		len = snprintf(buffer, size, "%lld", value->integer);
+	}
+	else if (value->type == MQTT_CODEC_FLOAT)
+	{
+		//shortest text decoded as the same number
+		len = snprintf(buffer, size, "%.15g", value->number);
+		if (len > 0 && (size_t) len < size && strtod(buffer, NULL) != value->number)
+		{
+			len = snprintf(buffer, size, "%.17g", value->number);
+		}
+	}
+	else
+	{
+		len = (int) value->textLen;
+		if ((size_t) len < size)
+		{
+			memcpy(buffer, value->text, value->textLen);
+			buffer[len] = '\0';
+		}
+	}
+
+	return (len >= 0 && (size_t) len < size) ? len : -1;
+}
@@ -0,0 +1,114 @@
+/*******************************************************************************************************************
+
+ MQTT binary telemetry codec
+
+	Compact payload of a batch of timestamped key/value samples, alternative to the multi-timestamp JSON of
+	mqttSeries. Samples are stored per key (column) :
+
+		- the key is written once : the batch starts with its dictionary
+		- timestamps : the first one as a varint, then the delta of delta of each one (Gorilla), in bits :
+			'0' : 0,  '10' + 7 bits,  '110' + 9 bits,  '1110' + 12 bits,  '11110' + 32 bits,  '11111' + 64 bits
+		  (zigzag values). Samples taken at a steady rate cost 1 bit
+		- values : the type of the column is the narrowest of its values
+			- integer : canonical decimal integers, delta to the previous one as a zigzag varint
+			- float : finite numbers, XOR to the previous one (Gorilla) :
+				'0' : same value,
+				'10' + the meaningful bits, within the leading and trailing zeros of the previous XOR,
+				'11' + leading zeros (5 bits) + meaningful length - 1 (6 bits) + the meaningful bits
+			  the first value is written in 64 bits. The value decoded is the number, not its text
+			  ("20.50" is decoded as 20.5)
+			- text : '0' : same as the previous value, '1' + padding to a byte + varint length + bytes
+			  (aligned : the decoder hands the text in place)
+
+	Batch :
+		["MQC"][version : 1 byte][key count : varint]
+		per key : [key length : varint][key][sample count : varint][column type : 1 byte]
+		          [bits : per sample its timestamp then its value, padded to a byte]
+
+	The first timestamp of a key is a varint, as are the integer deltas : they are written in the bit
+	stream as whole bytes, not aligned.
+
+	Typical sensor batches are 13 to 17 times smaller than their JSON (repeated keys and decimal text are
+	gone, a steady timestamp is 1 bit) : 14.4 for 4 keys x 64 samples with mqttCodecBench.c, which also
+	gives the encode throughput.
+
+	mqttCodec.c and mqttCodec.h only need the C library : the decoder builds as is in a backend or in a
+	subscriber of this client.
+
+	View of the stack :
+	_________________________
+
+	 mqttSeries / mqttAirVantage interface
+	_________________________
+
+	 mqttCodec  <--- this file
+	_________________________
+
+*******************************************************************************************************************/
+
+#ifndef _MQTT_CODEC_H_
+#define _MQTT_CODEC_H_
+
+#include <stddef.h>
+
+#define		MQTT_CODEC_OK					0
+#define		MQTT_CODEC_ERROR				-1
+
+#define		MQTT_CODEC_VERSION				1
+
+typedef enum {
+	MQTT_CODEC_INTEGER = 0,
+	MQTT_CODEC_FLOAT,
+	MQTT_CODEC_TEXT
+} mqtt_codecType_t;
+
+typedef struct {
+	unsigned char*			buffer;
+	size_t					size;
+	size_t					len;
+	unsigned long long		acc;					//bits not written yet, fewer than 8 between calls
+	int						accBits;
+	int						error;					//buffer too small
+} mqtt_bitWriter_t;
+
+typedef struct {
+	mqtt_bitWriter_t		out;
+	unsigned int			keysLeft;
+
+	//column being written
+	unsigned int			samplesLeft;
+	mqtt_codecType_t		type;
+	unsigned long long		prevTimestamp;
+	long long				prevDelta;
+	long long				prevInteger;
+	unsigned long long		prevBits;				//float : previous value
+	int						prevLeading;
+	int						prevTrailing;
+	const char*				prevText;
+	size_t					prevTextLen;
+	int						started;				//first sample of the column written
+} mqtt_codecEncoder_t;
+
+typedef struct {
+	mqtt_codecType_t		type;
+	long long				integer;
+	double					number;
+	const char*				text;					//in the batch, not NUL terminated
+	size_t					textLen;
+} mqtt_codecValue_t;
+
+typedef void (*mqtt_codecSampleHandler)(const char* key, size_t keyLen, unsigned long long timestamp, const mqtt_codecValue_t* value, void* context);
+
+//encoder : values are narrowed to a column type first, then each key is written with all its samples
+mqtt_codecType_t mqtt_CodecNarrow(mqtt_codecType_t type, const char* value);
+
+int    mqtt_CodecBegin(mqtt_codecEncoder_t* encoder, unsigned char* buffer, size_t size, unsigned int keyCount);
+int    mqtt_CodecBeginKey(mqtt_codecEncoder_t* encoder, const char* key, unsigned int sampleCount, mqtt_codecType_t type);
+int    mqtt_CodecAddSample(mqtt_codecEncoder_t* encoder, unsigned long long timestamp, const char* value);
+size_t mqtt_CodecEnd(mqtt_codecEncoder_t* encoder);
+
+//decoder : the handler is called for each sample, key by key
+int    mqtt_CodecDecode(const unsigned char* data, size_t len, mqtt_codecSampleHandler pfnSample, void* context);
+int    mqtt_CodecFormatValue(const mqtt_codecValue_t* value, char* buffer, size_t size);
+
+#endif	//_MQTT_CODEC_H_
@@ -0,0 +1,176 @@
+/*******************************************************************************************************************
+
+ MQTT binary telemetry codec benchmark
+
+	Builds a typical sensor batch (a few keys sampled at a steady rate), encodes it as JSON (mqttSeries)
+	and as a binary batch (mqttCodec), checks the batch decodes to the same samples, then prints the
+	size ratio and the encode throughput of both on this device :
+
+		make mqttCodecBench && ./mqttCodecBench [samples per key] [iterations]
+
+*******************************************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "mqttSeries.h"
+#include "mqttCodec.h"
+
+#define		BENCH_KEYS				4
+#define		BENCH_PERIOD_MS			1000
+
+typedef struct {
+	mqtt_series_t*			series;
+	int						key;				//key being decoded
+	int						index;				//sample of the series expected next
+	int						decoded;
+	int						mismatches;
+} bench_check_t;
+
+static const char* g_keys[BENCH_KEYS] = { "temperature", "humidity", "battery", "state" };
+
+//-------------------------------------------------------------------------------------------------------
+static unsigned long long bench_NowUs(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return (unsigned long long) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+//-------------------------------------------------------------------------------------------------------
+static void bench_Fill(mqtt_series_t* series, int samplesPerKey)
+{
+	unsigned long long	timestamp = 1500000000000ULL;
+	double				temperature = 21.5;
+	int					humidity = 45;
+	double				battery = 3.95;
+	int					i;
+	char				szValue[32];
+
+	srand(1);
+
+	for (i=0; i<samplesPerKey; i++)
+	{
+		//a little jitter from time to time
+		unsigned long long ts = timestamp + (rand() % 8 == 0 ? rand() % 20 : 0);
+
+		temperature += (rand() % 5 - 2) * 0.1;
+		sprintf(szValue, "%.1f", temperature);
+		mqtt_SeriesAdd(series, g_keys[0], szValue, ts);
+
+		humidity += rand() % 3 - 1;
+		sprintf(szValue, "%d", humidity);
+		mqtt_SeriesAdd(series, g_keys[1], szValue, ts);
+
+		if (rand() % 10 == 0)
+		{
+			battery -= 0.01;
+		}
+		sprintf(szValue, "%.2f", battery);
+		mqtt_SeriesAdd(series, g_keys[2], szValue, ts);
+
+		mqtt_SeriesAdd(series, g_keys[3], (rand() % 20 == 0) ? "moving" : "idle", ts);
+
+		timestamp += BENCH_PERIOD_MS;
+	}
+}
+
+//-------------------------------------------------------------------------------------------------------
+static void bench_Check(const char* key, size_t keyLen, unsigned long long timestamp, const mqtt_codecValue_t* value, void* context)
+{
+	bench_check_t*	check = (bench_check_t *) context;
+	mqtt_series_t*	series = check->series;
+	char			szValue[64];
+
+	if (check->key < 0 || strlen(series->pool + series->keys[check->key]) != keyLen ||
+		strncmp(series->pool + series->keys[check->key], key, keyLen) != 0)
+	{
+		//next key : its samples start over
+		check->key++;
+		check->index = 0;
+	}
+
+	//next sample of the key in the series
+	while (check->index < series->count && series->samples[check->index].key != check->key)
+	{
+		check->index++;
+	}
+
+	if (check->key >= series->keyCount || check->index == series->count ||
+		mqtt_CodecFormatValue(value, szValue, sizeof(szValue)) < 0 ||
+		series->samples[check->index].timestamp != timestamp ||
+		(value->type == MQTT_CODEC_TEXT ? strcmp(series->pool + series->samples[check->index].value, szValue) != 0 :
+		 strtod(series->pool + series->samples[check->index].value, NULL) != strtod(szValue, NULL)))
+	{
+		check->mismatches++;
+		return;
+	}
+
+	check->decoded++;
+	check->index++;
+}
+
+//-------------------------------------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+	int					samplesPerKey = (argc > 1) ? atoi(argv[1]) : 64;
+	int					iterations = (argc > 2) ? atoi(argv[2]) : 10000;
+	mqtt_series_t		series;
+	mqtt_jsonWriter_t	writer;
+	unsigned char*		batch;
+	size_t				batchSize, batchLen = 0, jsonLen = 0;
+	unsigned long long	start, jsonUs, binaryUs;
+	int					i;
+
+	if (samplesPerKey <= 0 || iterations <= 0 ||
+		mqtt_SeriesInit(&series, samplesPerKey * BENCH_KEYS, (size_t) samplesPerKey * BENCH_KEYS * 80, 0) != SUCCESS)
+	{
+		fprintf(stdout, "usage : %s [samples per key] [iterations]\n", argv[0]);
+		return 1;
+	}
+
+	bench_Fill(&series, samplesPerKey);
+
+	batchSize = series.payloadBytes + 16 + 2 * (size_t) series.keyCount;
+	batch = (unsigned char *) malloc(batchSize);
+
+	start = bench_NowUs();
+	for (i=0; i<iterations; i++)
+	{
+		mqtt_JsonWriterInit(&writer, NULL, 0, 1);
+		mqtt_SeriesWrite(&series, &writer);
+		jsonLen = writer.len;
+		mqtt_JsonWriterFree(&writer);
+	}
+	jsonUs = bench_NowUs() - start;
+
+	start = bench_NowUs();
+	for (i=0; i<iterations; i++)
+	{
+		batchLen = mqtt_SeriesEncode(&series, batch, batchSize);
+	}
+	binaryUs = bench_NowUs() - start;
+
+	bench_check_t check = { &series, -1, 0, 0, 0 };
+
+	if (mqtt_CodecDecode(batch, batchLen, bench_Check, &check) != MQTT_CODEC_OK || check.decoded != series.count)
+	{
+		check.mismatches++;
+	}
+
+	fprintf(stdout, "%d keys x %d samples\n", series.keyCount, samplesPerKey);
+	fprintf(stdout, "JSON   : %6lu bytes, %8.1f batches/s, %6.1f MB/s of JSON\n",
+			(unsigned long) jsonLen, iterations * 1e6 / (jsonUs ? jsonUs : 1), (double) jsonLen * iterations / (jsonUs ? jsonUs : 1));
+	fprintf(stdout, "binary : %6lu bytes, %8.1f batches/s, %6.1f Msamples/s\n",
+			(unsigned long) batchLen, iterations * 1e6 / (binaryUs ? binaryUs : 1), (double) series.count * iterations / (binaryUs ? binaryUs : 1));
+	fprintf(stdout, "ratio  : %.1f, decoded %s\n", batchLen ? (double) jsonLen / batchLen : 0, check.mismatches ? "with mismatches" : "identical");
+
+	free(batch);
+	mqtt_SeriesFree(&series);
+
+	return check.mismatches ? 1 : 0;
+}
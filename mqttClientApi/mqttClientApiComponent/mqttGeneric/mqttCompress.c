@@ -0,0 +1,707 @@
+/*******************************************************************************************************************
+
+ MQTT payload compression
+
+	Per topic policy, LZ and deflate codecs of the outbound payloads, decompression of the inbound ones,
+	see mqttCompress.h
+
+*******************************************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <time.h>
+#include <zlib.h>
+
+#include "MQTTClient.h"
+#include "mqttCompress.h"
+
+#define		COMPRESS_MAGIC				"\0MZ"
+#define		COMPRESS_STORED				0x8000		//LZ block stored as is
+
+#define		LZ_HASH_BITS				12
+#define		LZ_MIN_MATCH				4
+#define		LZ_LAST_LITERALS			5			//LZ4 : a block ends with literals
+#define		LZ_MATCH_LIMIT				12			//LZ4 : no match starts in the last bytes of a block
+
+#define		DEFLATE_LEVEL				6
+#define		DEFLATE_WINDOW_BITS			12
+#define		DEFLATE_MEM_LEVEL			5
+
+typedef struct {
+	unsigned short			table[1 << LZ_HASH_BITS];	//position + 1 of the last occurrence of a hash, 0 : none
+	unsigned char			block[MQTT_COMPRESS_BLOCK_SIZE];
+	size_t					blockLen;
+} mqtt_lzState_t;
+
+//-------------------------------------------------------------------------------------------------------
+static unsigned long long mqtt_CompressCpuUs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+
+	return (unsigned long long) ts.tv_sec * 1000000 + (unsigned long long) ts.tv_nsec / 1000;
+}
+
+//-------------------------------------------------------------------------------------------------------
+mqtt_compress_st* mqtt_CompressCreate(void)
+{
+	mqtt_compress_st* compress = (mqtt_compress_st *) malloc(sizeof(mqtt_compress_st));
+
+	if (compress)
+	{
+		memset(compress, 0, sizeof(mqtt_compress_st));
+	}
+
+	return compress;
+}
+
+//-------------------------------------------------------------------------------------------------------
+void mqtt_CompressDelete(mqtt_compress_st* compress)
+{
+	free(compress);
+}
+
+//-------------------------------------------------------------------------------------------------------
+//the rule of the same prefix is replaced
+int mqtt_CompressSetRule(mqtt_compress_st* compress, const char* topicPrefix, mqtt_compression_t codec, size_t minSize)
+{
+	int i;
+
+	if (topicPrefix == NULL)
+	{
+		topicPrefix = "";
+	}
+
+	if (strlen(topicPrefix) >= MQTT_COMPRESS_PREFIX_SIZE || codec < MQTT_COMPRESSION_NONE || codec >= MQTT_COMPRESSION_COUNT)
+	{
+		return FAILURE;
+	}
+
+	for (i=0; i<compress->ruleCount && strcmp(compress->rules[i].prefix, topicPrefix) != 0; i++);
+
+	if (i == MQTT_COMPRESS_MAX_RULES)
+	{
+		fprintf(stdout, "mqttCompress : no more than %d rules\n", MQTT_COMPRESS_MAX_RULES);
+		fflush(stdout);
+		return FAILURE;
+	}
+
+	if (i == compress->ruleCount)
+	{
+		strcpy(compress->rules[i].prefix, topicPrefix);
+		compress->ruleCount++;
+	}
+	compress->rules[i].codec = codec;
+	compress->rules[i].minSize = minSize;
+
+	return SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------------------------
+//codec applied to a payload of the topic : MQTT_COMPRESSION_NONE if it is to be sent as it is
+mqtt_compression_t mqtt_CompressSelect(mqtt_compress_st* compress, const char* topicName, mqtt_compression_t codec, size_t dataLen)
+{
+	const mqtt_compressRule_t*	rule = NULL;
+	size_t						ruleLen = 0;
+	int							i;
+
+	for (i=0; compress && i<compress->ruleCount; i++)
+	{
+		size_t prefixLen = strlen(compress->rules[i].prefix);
+
+		if (strncmp(topicName, compress->rules[i].prefix, prefixLen) == 0 && (rule == NULL || prefixLen > ruleLen))
+		{
+			rule = &compress->rules[i];
+			ruleLen = prefixLen;
+		}
+	}
+
+	if (codec == MQTT_COMPRESSION_TOPIC)
+	{
+		codec = rule ? rule->codec : MQTT_COMPRESSION_NONE;
+	}
+
+	if (codec <= MQTT_COMPRESSION_NONE || codec >= MQTT_COMPRESSION_COUNT ||
+		dataLen < (rule ? rule->minSize : MQTT_COMPRESS_MIN_SIZE) || dataLen <= MQTT_COMPRESS_HEADER_SIZE ||
+		dataLen > 0xFFFFFFFFUL)
+	{
+		return MQTT_COMPRESSION_NONE;
+	}
+
+	return codec;
+}
+
+//-------------------------------------------------------------------------------------------------------
+//room for needed more bytes of output
+static int mqtt_CompressReserve(mqtt_compressStream_t* stream, size_t needed)
+{
+	if (stream->len + needed <= stream->size)
+	{
+		return SUCCESS;
+	}
+
+	if (!stream->growable)
+	{
+		stream->error = 1;
+		return FAILURE;
+	}
+
+	size_t			size = stream->size * 2 > stream->len + needed ? stream->size * 2 : stream->len + needed + 1024;
+	unsigned char*	buffer = (unsigned char *) (stream->owned ? realloc(stream->buffer, size) : malloc(size));
+
+	if (buffer == NULL)
+	{
+		stream->error = 1;
+		return FAILURE;
+	}
+
+	if (!stream->owned && stream->len > 0)
+	{
+		memcpy(buffer, stream->buffer, stream->len);
+	}
+
+	stream->buffer = buffer;
+	stream->size = size;
+	stream->owned = 1;
+
+	return SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------------------------
+static unsigned int mqtt_LzHash(const unsigned char* p)
+{
+	unsigned int v = (unsigned int) p[0] | ((unsigned int) p[1] << 8) | ((unsigned int) p[2] << 16) | ((unsigned int) p[3] << 24);
+
+	return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+static unsigned char* mqtt_LzWriteLength(unsigned char* op, size_t len)
+{
+	while (len >= 255)
+	{
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = (unsigned char) len;
+
+	return op;
+}
+
+//-------------------------------------------------------------------------------------------------------
+//a sequence : token, literals (and their length), match offset and length
+static int mqtt_LzFits(const unsigned char* op, const unsigned char* end, size_t litLen, size_t matchLen)
+{
+	return (size_t) (end - op) >= 1 + litLen / 255 + 1 + litLen + 2 + matchLen / 255 + 1;
+}
+
+//LZ4 block of src in dst, returns its length, 0 if it does not fit in dstSize
+static size_t mqtt_LzCompressBlock(unsigned short* table, const unsigned char* src, size_t srcLen, unsigned char* dst, size_t dstSize)
+{
+	unsigned char*	op = dst;
+	unsigned char*	end = dst + dstSize;
+	size_t			ip = 0;
+	size_t			anchor = 0;
+	unsigned int	misses = 0;
+
+	memset(table, 0, sizeof(unsigned short) << LZ_HASH_BITS);
+
+	while (srcLen >= LZ_MATCH_LIMIT + 1 && ip <= srcLen - LZ_MATCH_LIMIT)
+	{
+		unsigned int	h = mqtt_LzHash(src + ip);
+		size_t			ref = table[h];
+
+		table[h] = (unsigned short) (ip + 1);
+
+		if (ref == 0 || memcmp(src + ref - 1, src + ip, LZ_MIN_MATCH) != 0)
+		{
+			//incompressible data is skipped faster
+			ip += 1 + (misses++ >> 5);
+			continue;
+		}
+		ref--;
+		misses = 0;
+
+		size_t matchLen = LZ_MIN_MATCH;
+		size_t litLen = ip - anchor;
+
+		while (ip + matchLen < srcLen - LZ_LAST_LITERALS && src[ref + matchLen] == src[ip + matchLen])
+		{
+			matchLen++;
+		}
+
+		if (!mqtt_LzFits(op, end, litLen, matchLen))
+		{
+			return 0;
+		}
+
+		unsigned char* token = op++;
+
+		*token = (unsigned char) ((litLen < 15 ? litLen : 15) << 4);
+		if (litLen >= 15)
+		{
+			op = mqtt_LzWriteLength(op, litLen - 15);
+		}
+		memcpy(op, src + anchor, litLen);
+		op += litLen;
+
+		*op++ = (unsigned char) (ip - ref);
+		*op++ = (unsigned char) ((ip - ref) >> 8);
+
+		*token |= (unsigned char) (matchLen - LZ_MIN_MATCH < 15 ? matchLen - LZ_MIN_MATCH : 15);
+		if (matchLen - LZ_MIN_MATCH >= 15)
+		{
+			op = mqtt_LzWriteLength(op, matchLen - LZ_MIN_MATCH - 15);
+		}
+
+		ip += matchLen;
+		anchor = ip;
+	}
+
+	//last literals
+	size_t litLen = srcLen - anchor;
+
+	if (!mqtt_LzFits(op, end, litLen, 0))
+	{
+		return 0;
+	}
+
+	*op++ = (unsigned char) ((litLen < 15 ? litLen : 15) << 4);
+	if (litLen >= 15)
+	{
+		op = mqtt_LzWriteLength(op, litLen - 15);
+	}
+	memcpy(op, src + anchor, litLen);
+	op += litLen;
+
+	return (size_t) (op - dst);
+}
+
+//-------------------------------------------------------------------------------------------------------
+//returns the length decoded, -1 if the block is malformed or does not fit
+static long mqtt_LzDecompressBlock(const unsigned char* src, size_t srcLen, unsigned char* dst, size_t dstSize)
+{
+	size_t ip = 0;
+	size_t op = 0;
+
+	while (ip < srcLen)
+	{
+		unsigned int	token = src[ip++];
+		size_t			len = token >> 4;
+		unsigned int	byte;
+
+		if (len == 15)
+		{
+			do {
+				if (ip >= srcLen)
+				{
+					return -1;
+				}
+				byte = src[ip++];
+				len += byte;
+			} while (byte == 255);
+		}
+
+		if (len > srcLen - ip || len > dstSize - op)
+		{
+			return -1;
+		}
+		memcpy(dst + op, src + ip, len);
+		ip += len;
+		op += len;
+
+		if (ip == srcLen)
+		{
+			break;
+		}
+
+		if (srcLen - ip < 2)
+		{
+			return -1;
+		}
+
+		size_t offset = (size_t) src[ip] | ((size_t) src[ip + 1] << 8);
+
+		ip += 2;
+		if (offset == 0 || offset > op)
+		{
+			return -1;
+		}
+
+		len = token & 0x0F;
+		if (len == 15)
+		{
+			do {
+				if (ip >= srcLen)
+				{
+					return -1;
+				}
+				byte = src[ip++];
+				len += byte;
+			} while (byte == 255);
+		}
+		len += LZ_MIN_MATCH;
+
+		if (len > dstSize - op)
+		{
+			return -1;
+		}
+
+		//may overlap : copied byte by byte
+		size_t i;
+		for (i=0; i<len; i++, op++)
+		{
+			dst[op] = dst[op - offset];
+		}
+	}
+
+	return (long) op;
+}
+
+//-------------------------------------------------------------------------------------------------------
+static int mqtt_LzFlush(mqtt_compressStream_t* stream, mqtt_lzState_t* lz, const unsigned char* data, size_t len)
+{
+	//a growable output takes the worst case, a fixed one what is left
+	if (stream->growable && mqtt_CompressReserve(stream, 2 + len + len / 255 + 16) != SUCCESS)
+	{
+		return FAILURE;
+	}
+
+	unsigned char*	out = stream->buffer + stream->len;
+	size_t			room = stream->size - stream->len;
+	size_t			blockLen = room > 2 ? mqtt_LzCompressBlock(lz->table, data, len, out + 2, room - 2) : 0;
+
+	if (blockLen == 0 || blockLen >= len)
+	{
+		if (room < 2 + len)
+		{
+			stream->error = 1;
+			return FAILURE;
+		}
+		memcpy(out + 2, data, len);
+		blockLen = len | COMPRESS_STORED;
+	}
+
+	out[0] = (unsigned char) (blockLen >> 8);
+	out[1] = (unsigned char) blockLen;
+	stream->len += 2 + (blockLen & ~COMPRESS_STORED);
+
+	return SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------------------------
+static int mqtt_DeflateRun(mqtt_compressStream_t* stream, int flush)
+{
+	z_stream* z = (z_stream *) stream->state;
+
+	for (;;)
+	{
+		if (stream->len == stream->size && mqtt_CompressReserve(stream, 1024) != SUCCESS)
+		{
+			return FAILURE;
+		}
+
+		z->next_out = stream->buffer + stream->len;
+		z->avail_out = (uInt) (stream->size - stream->len);
+
+		int rc = deflate(z, flush);
+
+		stream->len = stream->size - z->avail_out;
+
+		if (rc == Z_STREAM_END)
+		{
+			return SUCCESS;
+		}
+		if (rc != Z_OK && rc != Z_BUF_ERROR)
+		{
+			stream->error = 1;
+			return FAILURE;
+		}
+		if (flush == Z_NO_FLUSH && z->avail_in == 0 && z->avail_out > 0)
+		{
+			return SUCCESS;
+		}
+	}
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_CompressBegin(mqtt_compressStream_t* stream, mqtt_compression_t codec, unsigned long totalLen, unsigned char* buffer, size_t size, int growable)
+{
+	memset(stream, 0, sizeof(mqtt_compressStream_t));
+
+	stream->codec = codec;
+	stream->buffer = buffer;
+	stream->size = buffer ? size : 0;
+	stream->growable = growable;
+	stream->totalLen = totalLen;
+
+	if (codec == MQTT_COMPRESSION_LZ)
+	{
+		mqtt_lzState_t* lz = (mqtt_lzState_t *) malloc(sizeof(mqtt_lzState_t));
+
+		if (lz)
+		{
+			lz->blockLen = 0;
+		}
+		stream->state = lz;
+	}
+	else if (codec == MQTT_COMPRESSION_DEFLATE)
+	{
+		z_stream* z = (z_stream *) malloc(sizeof(z_stream));
+
+		if (z)
+		{
+			memset(z, 0, sizeof(z_stream));
+			if (deflateInit2(z, DEFLATE_LEVEL, Z_DEFLATED, DEFLATE_WINDOW_BITS, DEFLATE_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK)
+			{
+				free(z);
+				z = NULL;
+			}
+		}
+		stream->state = z;
+	}
+
+	if (stream->state == NULL || mqtt_CompressReserve(stream, MQTT_COMPRESS_HEADER_SIZE) != SUCCESS)
+	{
+		stream->error = 1;
+		return FAILURE;
+	}
+
+	unsigned char* header = stream->buffer;
+
+	memcpy(header, COMPRESS_MAGIC, 3);
+	header[3] = (unsigned char) codec;
+	header[4] = (unsigned char) (totalLen >> 24);
+	header[5] = (unsigned char) (totalLen >> 16);
+	header[6] = (unsigned char) (totalLen >> 8);
+	header[7] = (unsigned char) totalLen;
+	stream->len = MQTT_COMPRESS_HEADER_SIZE;
+
+	return SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_CompressWrite(mqtt_compressStream_t* stream, const void* data, size_t len)
+{
+	const unsigned char*	p = (const unsigned char *) data;
+	unsigned long long		start = mqtt_CompressCpuUs();
+
+	if (stream->error || len > stream->totalLen - stream->written)
+	{
+		stream->error = 1;
+		return FAILURE;
+	}
+	stream->written += len;
+
+	if (stream->codec == MQTT_COMPRESSION_LZ)
+	{
+		mqtt_lzState_t* lz = (mqtt_lzState_t *) stream->state;
+
+		while (len > 0 && !stream->error)
+		{
+			if (lz->blockLen == 0 && len >= MQTT_COMPRESS_BLOCK_SIZE)
+			{
+				//whole blocks are compressed where they are
+				mqtt_LzFlush(stream, lz, p, MQTT_COMPRESS_BLOCK_SIZE);
+				p += MQTT_COMPRESS_BLOCK_SIZE;
+				len -= MQTT_COMPRESS_BLOCK_SIZE;
+				continue;
+			}
+
+			size_t n = MQTT_COMPRESS_BLOCK_SIZE - lz->blockLen < len ? MQTT_COMPRESS_BLOCK_SIZE - lz->blockLen : len;
+
+			memcpy(lz->block + lz->blockLen, p, n);
+			lz->blockLen += n;
+			p += n;
+			len -= n;
+
+			if (lz->blockLen == MQTT_COMPRESS_BLOCK_SIZE)
+			{
+				mqtt_LzFlush(stream, lz, lz->block, lz->blockLen);
+				lz->blockLen = 0;
+			}
+		}
+	}
+	else
+	{
+		z_stream* z = (z_stream *) stream->state;
+
+		z->next_in = (Bytef *) p;
+		z->avail_in = (uInt) len;
+		mqtt_DeflateRun(stream, Z_NO_FLUSH);
+	}
+
+	stream->cpuUs += mqtt_CompressCpuUs() - start;
+
+	return stream->error ? FAILURE : SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------------------------
+//returns the length of the compressed payload, 0 if it failed (output full, length not the one announced)
+size_t mqtt_CompressEnd(mqtt_compressStream_t* stream, mqtt_compress_st* compress)
+{
+	unsigned long long start = mqtt_CompressCpuUs();
+
+	if (stream->error || stream->written != stream->totalLen)
+	{
+		return 0;
+	}
+
+	if (stream->codec == MQTT_COMPRESSION_LZ)
+	{
+		mqtt_lzState_t* lz = (mqtt_lzState_t *) stream->state;
+
+		if (lz->blockLen > 0)
+		{
+			mqtt_LzFlush(stream, lz, lz->block, lz->blockLen);
+			lz->blockLen = 0;
+		}
+	}
+	else
+	{
+		mqtt_DeflateRun(stream, Z_FINISH);
+	}
+
+	stream->cpuUs += mqtt_CompressCpuUs() - start;
+
+	//not smaller : sent as it is
+	if (stream->error || stream->len >= stream->totalLen)
+	{
+		return 0;
+	}
+
+	if (compress)
+	{
+		mqtt_compressStats_t* stats = &compress->stats[stream->codec];
+
+		stats->messages++;
+		stats->bytesIn += stream->totalLen;
+		stats->bytesOut += stream->len;
+		stats->cpuUs += stream->cpuUs;
+	}
+
+	return stream->len;
+}
+
+//-------------------------------------------------------------------------------------------------------
+void mqtt_CompressFree(mqtt_compressStream_t* stream)
+{
+	if (stream->codec == MQTT_COMPRESSION_DEFLATE && stream->state)
+	{
+		deflateEnd((z_stream *) stream->state);
+	}
+	free(stream->state);
+	stream->state = NULL;
+
+	if (stream->owned)
+	{
+		free(stream->buffer);
+	}
+	stream->buffer = NULL;
+	stream->owned = 0;
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_IsCompressed(const void* data, size_t len)
+{
+	const unsigned char* p = (const unsigned char *) data;
+
+	return len >= MQTT_COMPRESS_HEADER_SIZE && memcmp(p, COMPRESS_MAGIC, 3) == 0 &&
+		   p[3] > MQTT_COMPRESSION_NONE && p[3] < MQTT_COMPRESSION_COUNT;
+}
+
+//-------------------------------------------------------------------------------------------------------
+//original length of a compressed payload, -1 if the payload is not compressed
+long mqtt_CompressedLength(const void* data, size_t len)
+{
+	const unsigned char* p = (const unsigned char *) data;
+
+	if (!mqtt_IsCompressed(data, len))
+	{
+		return -1;
+	}
+
+	return (long) (((unsigned long) p[4] << 24) | ((unsigned long) p[5] << 16) | ((unsigned long) p[6] << 8) | p[7]);
+}
+
+//-------------------------------------------------------------------------------------------------------
+//out : at least the original length
+int mqtt_Decompress(const void* data, size_t len, unsigned char* out, size_t outSize)
+{
+	const unsigned char*	p = (const unsigned char *) data;
+	long					total = mqtt_CompressedLength(data, len);
+	size_t					ip = MQTT_COMPRESS_HEADER_SIZE;
+
+	if (total < 0 || (size_t) total > outSize)
+	{
+		return FAILURE;
+	}
+
+	if (p[3] == MQTT_COMPRESSION_LZ)
+	{
+		size_t op = 0;
+
+		while (ip < len)
+		{
+			if (len - ip < 2)
+			{
+				return FAILURE;
+			}
+
+			size_t	blockLen = ((size_t) p[ip] << 8) | p[ip + 1];
+			int		stored = (blockLen & COMPRESS_STORED) != 0;
+
+			blockLen &= ~COMPRESS_STORED;
+			ip += 2;
+
+			if (blockLen > len - ip)
+			{
+				return FAILURE;
+			}
+
+			if (stored)
+			{
+				if (blockLen > (size_t) total - op)
+				{
+					return FAILURE;
+				}
+				memcpy(out + op, p + ip, blockLen);
+				op += blockLen;
+			}
+			else
+			{
+				size_t	room = (size_t) total - op < MQTT_COMPRESS_BLOCK_SIZE ? (size_t) total - op : MQTT_COMPRESS_BLOCK_SIZE;
+				long	n = mqtt_LzDecompressBlock(p + ip, blockLen, out + op, room);
+
+				if (n < 0)
+				{
+					return FAILURE;
+				}
+				op += (size_t) n;
+			}
+			ip += blockLen;
+		}
+
+		return op == (size_t) total ? SUCCESS : FAILURE;
+	}
+
+	z_stream	z;
+	int			rc;
+
+	memset(&z, 0, sizeof(z));
+	if (inflateInit(&z) != Z_OK)
+	{
+		return FAILURE;
+	}
+
+	z.next_in = (Bytef *) (p + ip);
+	z.avail_in = (uInt) (len - ip);
+	z.next_out = out;
+	z.avail_out = (uInt) total;
+
+	rc = inflate(&z, Z_FINISH);
+	inflateEnd(&z);
+
+	return (rc == Z_STREAM_END && z.total_out == (uLong) total) ? SUCCESS : FAILURE;
+}
@@ -0,0 +1,114 @@
+/*******************************************************************************************************************
+
+ MQTT payload compression
+
+	Outbound payloads (large JSON documents, log files...) may be compressed before they are sent :
+
+		- per topic : a rule gives the codec of the topics starting with its prefix (the longest prefix
+		  applies, "" being the whole instance) and the size below which payloads are sent as they are.
+		  A rule with MQTT_COMPRESSION_NONE exempts the topics of its prefix
+		- per call : the codec is given with the payload, the size threshold of the topic still applies
+		- a payload which does not get smaller is sent as it is
+		- files are compressed while they are read : the memory used is the state of the codec and the
+		  compressed payload, not the file
+
+	Codecs :
+		- MQTT_COMPRESSION_LZ : fast LZ77, blocks of up to 16 KB compressed apart, 24 KB of state
+		- MQTT_COMPRESSION_DEFLATE : zlib stream (RFC 1950), 4 KB window, about 40 KB of state.
+		  Smaller payloads than LZ, for several times the CPU
+
+	A compressed payload is flagged by its header, so that it is told apart on reception :
+		[0x00 'M' 'Z'][codec : 1 byte][original length : 4 bytes, big endian][body]
+	LZ body : per block [length : 2 bytes, big endian, bit 15 set : stored as is][block]
+	          a compressed block is a LZ4 block (lz4 tools decode it)
+	Deflate body : the zlib stream
+
+	Inbound payloads starting with the header are decompressed before they are delivered (up to
+	MQTT_COMPRESS_MAX_INFLATED bytes, larger ones are delivered as received).
+
+	View of the stack :
+	_________________________
+
+	 mqttGeneric interface
+	_________________________
+
+	 mqttCompress  <--- this file
+	_________________________
+
+	 mqttSched / mqttStore / paho
+	_________________________
+
+*******************************************************************************************************************/
+
+#ifndef _MQTT_COMPRESS_H_
+#define _MQTT_COMPRESS_H_
+
+#include <stddef.h>
+
+#define		MQTT_COMPRESS_MAX_RULES			8
+#define		MQTT_COMPRESS_PREFIX_SIZE		128
+#define		MQTT_COMPRESS_MIN_SIZE			256			//default threshold of the calls without a rule
+#define		MQTT_COMPRESS_HEADER_SIZE		8
+#define		MQTT_COMPRESS_BLOCK_SIZE		16384		//LZ block
+#define		MQTT_COMPRESS_MAX_INFLATED		262144
+
+typedef enum {
+	MQTT_COMPRESSION_TOPIC = -1,						//codec of the topic rule
+	MQTT_COMPRESSION_NONE = 0,
+	MQTT_COMPRESSION_LZ,
+	MQTT_COMPRESSION_DEFLATE,
+	MQTT_COMPRESSION_COUNT
+} mqtt_compression_t;
+
+typedef struct {
+	char					prefix[MQTT_COMPRESS_PREFIX_SIZE];
+	mqtt_compression_t		codec;
+	size_t					minSize;
+} mqtt_compressRule_t;
+
+typedef struct {
+	unsigned long			messages;
+	unsigned long long		bytesIn;
+	unsigned long long		bytesOut;
+	unsigned long long		cpuUs;					//thread CPU time spent compressing
+} mqtt_compressStats_t;
+
+typedef struct mqtt_compress_st {
+	mqtt_compressRule_t		rules[MQTT_COMPRESS_MAX_RULES];
+	int						ruleCount;
+	mqtt_compressStats_t	stats[MQTT_COMPRESSION_COUNT];
+	unsigned long			skipped;				//payloads sent as they are : not smaller once compressed
+	unsigned long			inflated;				//inbound payloads decompressed
+} mqtt_compress_st;
+
+//compression of one payload, written in pieces
+typedef struct {
+	mqtt_compression_t		codec;
+	unsigned char*			buffer;
+	size_t					size;
+	size_t					len;
+	int						growable;				//grows on the heap when full, otherwise error
+	int						owned;					//buffer allocated by the stream
+	int						error;
+	unsigned long			totalLen;				//original length, announced in the header
+	unsigned long			written;
+	void*					state;					//codec state
+	unsigned long long		cpuUs;
+} mqtt_compressStream_t;
+
+mqtt_compress_st* mqtt_CompressCreate(void);
+void mqtt_CompressDelete(mqtt_compress_st* compress);
+
+int  mqtt_CompressSetRule(mqtt_compress_st* compress, const char* topicPrefix, mqtt_compression_t codec, size_t minSize);
+mqtt_compression_t mqtt_CompressSelect(mqtt_compress_st* compress, const char* topicName, mqtt_compression_t codec, size_t dataLen);
+
+int    mqtt_CompressBegin(mqtt_compressStream_t* stream, mqtt_compression_t codec, unsigned long totalLen, unsigned char* buffer, size_t size, int growable);
+int    mqtt_CompressWrite(mqtt_compressStream_t* stream, const void* data, size_t len);
+size_t mqtt_CompressEnd(mqtt_compressStream_t* stream, mqtt_compress_st* compress);
+void   mqtt_CompressFree(mqtt_compressStream_t* stream);
+
+int  mqtt_IsCompressed(const void* data, size_t len);
+long mqtt_CompressedLength(const void* data, size_t len);
+int  mqtt_Decompress(const void* data, size_t len, unsigned char* out, size_t outSize);
+
+#endif	//_MQTT_COMPRESS_H_
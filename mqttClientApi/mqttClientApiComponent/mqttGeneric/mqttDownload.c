@@ -0,0 +1,612 @@
+/*******************************************************************************************************************
+
+ MQTT package download
+
+	Streams a file from a http:// or https:// url into a target file, see mqttDownload.h
+
+	HTTP/1.0 requests are used so that the body is never chunked : Content-Length (200) or
+	Content-Range (206) give the size of the response.
+
+*******************************************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <ctype.h>
+#include <memory.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "mqttDownload.h"
+
+#define		HTTP_PORT					80
+#define		HTTPS_PORT					443
+#define		HTTP_WRITE_TIMEOUT_MS		2000
+#define		HTTP_HEADER_READ_MS			100		//one read of the response headers, within MQTT_DOWNLOAD_TIMEOUT_MS
+
+#define		MQTT_DOWNLOAD_REQUEST_NONE		0
+#define		MQTT_DOWNLOAD_REQUEST_RUNNING	1
+#define		MQTT_DOWNLOAD_REQUEST_DONE		2		//the thread is to be joined
+
+//-------------------------------------------------------------------------------------------------------
+static int mqtt_DownloadParseUrl(mqtt_download_t* download, const char* url)
+{
+	//http[s]://host[:port][/path]
+	const char*	p;
+	size_t		hostLen;
+
+	if (strncasecmp(url, "https://", 8) == 0)
+	{
+		download->useTLS = 1;
+		download->port = HTTPS_PORT;
+		url += 8;
+	}
+	else if (strncasecmp(url, "http://", 7) == 0)
+	{
+		download->useTLS = 0;
+		download->port = HTTP_PORT;
+		url += 7;
+	}
+	else
+	{
+		return FAILURE;
+	}
+
+	hostLen = strcspn(url, ":/");
+	if (hostLen == 0 || hostLen >= sizeof(download->host))
+	{
+		return FAILURE;
+	}
+	memcpy(download->host, url, hostLen);
+	download->host[hostLen] = 0;
+
+	p = url + hostLen;
+	if (*p == ':')
+	{
+		download->port = atoi(p + 1);
+		if (download->port <= 0 || download->port > 0xFFFF)
+		{
+			return FAILURE;
+		}
+		p += 1 + strcspn(p + 1, "/");
+	}
+
+	if (*p == 0)
+	{
+		p = "/";
+	}
+	if (strlen(p) >= sizeof(download->path))
+	{
+		return FAILURE;
+	}
+	strcpy(download->path, p);
+
+	return SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------------------------
+static int mqtt_DownloadParseSha256(mqtt_download_t* download, const char* sha256Hex)
+{
+	int i;
+
+	download->verify = 0;
+
+	if (sha256Hex == NULL || sha256Hex[0] == 0)
+	{
+		return SUCCESS;
+	}
+
+	if (strlen(sha256Hex) != 64)
+	{
+		return FAILURE;
+	}
+
+	for (i=0; i<32; i++)
+	{
+		unsigned int byte;
+
+		if (!isxdigit((unsigned char) sha256Hex[2*i]) || !isxdigit((unsigned char) sha256Hex[2*i+1]) ||
+			sscanf(sha256Hex + 2*i, "%2x", &byte) != 1)
+		{
+			return FAILURE;
+		}
+		download->expectedSha256[i] = (unsigned char) byte;
+	}
+
+	download->verify = 1;
+
+	return SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------------------------
+static void mqtt_DownloadDisconnect(mqtt_download_t* download)
+{
+	if (download->connected)
+	{
+		download->network.disconnect(&download->network);
+		download->connected = 0;
+	}
+	download->buffered = 0;
+}
+
+//-------------------------------------------------------------------------------------------------------
+static void mqtt_DownloadStop(mqtt_download_t* download, mqtt_downloadState_t state, int error)
+{
+	mqtt_DownloadDisconnect(download);
+
+	if (download->file)
+	{
+		fclose(download->file);
+		download->file = NULL;
+	}
+
+	if (state == MQTT_DOWNLOAD_DONE)
+	{
+		mbedtls_sha256_finish(&download->sha, download->sha256);
+
+		if (download->verify && memcmp(download->sha256, download->expectedSha256, 32) != 0)
+		{
+			state = MQTT_DOWNLOAD_FAILED;
+			error = MQTT_DOWNLOAD_ERROR_DIGEST;
+		}
+	}
+	mbedtls_sha256_free(&download->sha);
+
+	download->state = state;
+	download->error = error;
+
+	fprintf(stdout, "Download of %s : %s, %llu bytes\n", download->target,
+			state == MQTT_DOWNLOAD_DONE ? "done" : mqtt_DownloadErrorString(error), download->received);
+	fflush(stdout);
+}
+
+//-------------------------------------------------------------------------------------------------------
+static void mqtt_DownloadRetry(mqtt_download_t* download)
+{
+	//link lost : try again later, the request resumes at download->received
+	mqtt_DownloadDisconnect(download);
+
+	if (++download->retries > MQTT_DOWNLOAD_MAX_RETRIES)
+	{
+		mqtt_DownloadStop(download, MQTT_DOWNLOAD_FAILED, MQTT_DOWNLOAD_ERROR_NETWORK);
+		return;
+	}
+
+	int shift = download->retries - 1 < 5 ? download->retries - 1 : 5;
+
+	fprintf(stdout, "Download of %s interrupted at %llu bytes, retry %d/%d\n", download->target, download->received,
+			download->retries, MQTT_DOWNLOAD_MAX_RETRIES);
+	fflush(stdout);
+
+	countdown_ms(&download->retryTimer, MQTT_DOWNLOAD_RETRY_MS << shift);
+}
+
+//-------------------------------------------------------------------------------------------------------
+static int mqtt_DownloadRestart(mqtt_download_t* download)
+{
+	//the server sent the whole file : start over
+	if (ftruncate(fileno(download->file), 0) != 0 || fseek(download->file, 0, SEEK_SET) != 0)
+	{
+		return FAILURE;
+	}
+
+	mbedtls_sha256_starts(&download->sha, 0);
+	download->received = 0;
+
+	return SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------------------------
+static int mqtt_DownloadReadHeaders(mqtt_download_t* download)
+{
+	/*
+		Headers are read in the chunk buffer as they come, the first bytes of the body read with them are
+		moved to the start of the buffer (download->buffered)
+	*/
+	char*	headers = (char *) download->chunk;
+	int		len = 0;
+	int		headerLen = 0;
+	char*	line;
+	Timer	deadline;
+
+	download->httpStatus = 0;
+	download->contentLength = -1;
+	download->rangeStart = -1;
+	download->rangeTotal = -1;
+
+	InitTimer(&deadline);
+	countdown_ms(&deadline, MQTT_DOWNLOAD_TIMEOUT_MS);
+
+	while (headerLen == 0 && len < MQTT_DOWNLOAD_CHUNK_SIZE - 1 && !expired(&deadline))
+	{
+		int rc = download->network.mqttread(&download->network, (unsigned char *) headers + len, MQTT_DOWNLOAD_CHUNK_SIZE - 1 - len, HTTP_HEADER_READ_MS);
+		int	i;
+
+		if (rc == CON_EOF)
+		{
+			return FAILURE;
+		}
+		if (rc <= 0)
+		{
+			continue;
+		}
+
+		//the end of the headers may straddle two reads
+		for (i = (len > 3 ? len - 3 : 0); i + 4 <= len + rc; i++)
+		{
+			if (memcmp(headers + i, "\r\n\r\n", 4) == 0)
+			{
+				headerLen = i + 4;
+				break;
+			}
+		}
+		len += rc;
+	}
+
+	if (headerLen == 0)
+	{
+		return FAILURE;
+	}
+
+	char body = headers[headerLen];
+
+	headers[headerLen] = 0;
+
+	if (sscanf(headers, "HTTP/%*d.%*d %d", &download->httpStatus) != 1)
+	{
+		return FAILURE;
+	}
+
+	for (line = strstr(headers, "\r\n"); line && line[2]; line = strstr(line + 2, "\r\n"))
+	{
+		const char* field = line + 2;
+
+		if (strncasecmp(field, "Content-Length:", 15) == 0)
+		{
+			download->contentLength = atoll(field + 15);
+		}
+		else if (strncasecmp(field, "Content-Range:", 14) == 0)
+		{
+			//bytes start-end/total or bytes */total
+			const char* range = field + 14 + strspn(field + 14, " ");
+			const char* slash = strchr(range, '/');
+
+			if (strncasecmp(range, "bytes ", 6) == 0 && isdigit((unsigned char) range[6]))
+			{
+				download->rangeStart = atoll(range + 6);
+			}
+			if (slash && isdigit((unsigned char) slash[1]))
+			{
+				download->rangeTotal = atoll(slash + 1);
+			}
+		}
+	}
+
+	headers[headerLen] = body;
+	download->buffered = len - headerLen;
+	memmove(download->chunk, download->chunk + headerLen, (size_t) download->buffered);
+
+	return SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------------------------
+static int mqtt_DownloadRequest(mqtt_download_t* download)
+{
+	/*
+		Connects and sends the request for the bytes not received yet, then reads the response headers.
+		Runs in the request thread : only the network and the response fields are written, the response
+		is handled by mqtt_DownloadResponse once the thread is joined. FAILURE : the link should be retried
+	*/
+	char*		request = (char *) download->chunk;
+	int			len;
+
+	NewNetwork(&download->network, download->useTLS);
+
+	fprintf(stdout, "Download : connecting to %s:%d...\n", download->host, download->port);
+	fflush(stdout);
+
+	if (download->network.connect(&download->network, download->host, download->port, download->tlsRootCA, "", "") != 0)
+	{
+		download->network.disconnect(&download->network);
+		return FAILURE;
+	}
+	download->connected = 1;
+
+	len = snprintf(request, MQTT_DOWNLOAD_CHUNK_SIZE, "GET %s HTTP/1.0\r\nHost: %s\r\n", download->path, download->host);
+	if (download->received > 0)
+	{
+		len += snprintf(request + len, MQTT_DOWNLOAD_CHUNK_SIZE - len, "Range: bytes=%llu-\r\n", download->received);
+	}
+	len += snprintf(request + len, MQTT_DOWNLOAD_CHUNK_SIZE - len, "\r\n");
+
+	if (download->network.mqttwrite(&download->network, (unsigned char *) request, len, HTTP_WRITE_TIMEOUT_MS) != len ||
+		mqtt_DownloadReadHeaders(download) != SUCCESS)
+	{
+		mqtt_DownloadDisconnect(download);
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------------------------
+static void* mqtt_DownloadRequestThread(void* context)
+{
+	mqtt_download_t* download = (mqtt_download_t *) context;
+
+	download->requestRc = mqtt_DownloadRequest(download);
+
+	__atomic_store_n(&download->requesting, MQTT_DOWNLOAD_REQUEST_DONE, __ATOMIC_RELEASE);
+
+	return NULL;
+}
+
+//-------------------------------------------------------------------------------------------------------
+static void mqtt_DownloadJoin(mqtt_download_t* download)
+{
+	if (download->requesting != MQTT_DOWNLOAD_REQUEST_NONE)
+	{
+		pthread_join(download->requestThread, NULL);
+		download->requesting = MQTT_DOWNLOAD_REQUEST_NONE;
+	}
+}
+
+//-------------------------------------------------------------------------------------------------------
+static int mqtt_DownloadResponse(mqtt_download_t* download)
+{
+	/*
+		Returns SUCCESS when the body is ready to be read (download->remaining),
+		FAILURE when the link should be retried, the download is stopped on a fatal error.
+	*/
+	int			status = download->httpStatus;
+	long long	contentLength = download->contentLength;
+
+	if (status == 200 && contentLength >= 0)
+	{
+		if (download->received > 0 && mqtt_DownloadRestart(download) != SUCCESS)
+		{
+			mqtt_DownloadStop(download, MQTT_DOWNLOAD_FAILED, MQTT_DOWNLOAD_ERROR_FILE);
+			return FAILURE;
+		}
+		download->total = (unsigned long long) contentLength;
+		download->remaining = (unsigned long long) contentLength;
+	}
+	else if (status == 206 && contentLength >= 0 && download->rangeStart == (long long) download->received)
+	{
+		download->total = (download->rangeTotal >= 0) ? (unsigned long long) download->rangeTotal : download->received + contentLength;
+		download->remaining = (unsigned long long) contentLength;
+	}
+	else if (status == 416 && download->rangeTotal == (long long) download->received)
+	{
+		//the target file is already complete
+		download->total = download->received;
+		download->remaining = 0;
+	}
+	else if (status >= 500)
+	{
+		mqtt_DownloadDisconnect(download);
+		return FAILURE;
+	}
+	else
+	{
+		fprintf(stdout, "Download : unexpected HTTP response %d\n", status);
+		mqtt_DownloadStop(download, MQTT_DOWNLOAD_FAILED, MQTT_DOWNLOAD_ERROR_HTTP);
+		return FAILURE;
+	}
+
+	if ((unsigned long long) download->buffered > download->remaining)
+	{
+		download->buffered = (int) download->remaining;
+	}
+	countdown_ms(&download->idleTimer, MQTT_DOWNLOAD_TIMEOUT_MS);
+
+	return SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------------------------
+static int mqtt_DownloadResumeFile(mqtt_download_t* download)
+{
+	//hash what was received before a restart, the request resumes after it
+	FILE*	file = fopen(download->target, "r+b");
+	size_t	len;
+
+	if (!file)
+	{
+		return FAILURE;
+	}
+
+	while ((len = fread(download->chunk, 1, MQTT_DOWNLOAD_CHUNK_SIZE, file)) > 0)
+	{
+		mbedtls_sha256_update(&download->sha, download->chunk, len);
+		download->received += len;
+	}
+
+	download->file = file;
+
+	return SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_DownloadStart(mqtt_download_t* download, const char* url, const char* targetFile, const char* sha256Hex, const char* rootCA)
+{
+	if (download->state == MQTT_DOWNLOAD_RUNNING)
+	{
+		return FAILURE;
+	}
+
+	mqtt_DownloadJoin(download);
+	memset(download, 0, offsetof(mqtt_download_t, chunk));
+
+	if (strlen(targetFile) == 0 || strlen(targetFile) >= sizeof(download->target) ||
+		mqtt_DownloadParseUrl(download, url) != SUCCESS || mqtt_DownloadParseSha256(download, sha256Hex) != SUCCESS)
+	{
+		download->state = MQTT_DOWNLOAD_FAILED;
+		download->error = MQTT_DOWNLOAD_ERROR_URL;
+		return FAILURE;
+	}
+
+	strcpy(download->target, targetFile);
+	if (rootCA && strlen(rootCA) < sizeof(download->tlsRootCA))
+	{
+		strcpy(download->tlsRootCA, rootCA);
+	}
+
+	mbedtls_sha256_init(&download->sha);
+	mbedtls_sha256_starts(&download->sha, 0);
+
+	//without a digest to check the content against, a file left by someone else is not resumed
+	if (!download->verify || mqtt_DownloadResumeFile(download) != SUCCESS)
+	{
+		download->file = fopen(download->target, "w+b");
+	}
+
+	if (!download->file)
+	{
+		mbedtls_sha256_free(&download->sha);
+		download->state = MQTT_DOWNLOAD_FAILED;
+		download->error = MQTT_DOWNLOAD_ERROR_FILE;
+		return FAILURE;
+	}
+
+	InitTimer(&download->retryTimer);
+	download->state = MQTT_DOWNLOAD_RUNNING;
+
+	return SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_DownloadStep(mqtt_download_t* download)
+{
+	Timer budget;
+
+	if (download->state != MQTT_DOWNLOAD_RUNNING)
+	{
+		return download->state;
+	}
+
+	if (__atomic_load_n(&download->requesting, __ATOMIC_ACQUIRE) == MQTT_DOWNLOAD_REQUEST_RUNNING)
+	{
+		//connection or headers still on their way
+		return download->state;
+	}
+
+	if (download->requesting == MQTT_DOWNLOAD_REQUEST_DONE)
+	{
+		mqtt_DownloadJoin(download);
+
+		if (download->requestRc != SUCCESS || mqtt_DownloadResponse(download) != SUCCESS)
+		{
+			if (download->state == MQTT_DOWNLOAD_RUNNING)
+			{
+				mqtt_DownloadRetry(download);
+			}
+			return download->state;
+		}
+	}
+	else if (!download->connected)
+	{
+		if (!expired(&download->retryTimer))
+		{
+			return download->state;
+		}
+
+		download->requesting = MQTT_DOWNLOAD_REQUEST_RUNNING;
+		if (pthread_create(&download->requestThread, NULL, mqtt_DownloadRequestThread, download) != 0)
+		{
+			download->requesting = MQTT_DOWNLOAD_REQUEST_NONE;
+			mqtt_DownloadRetry(download);
+		}
+		return download->state;
+	}
+
+	InitTimer(&budget);
+	countdown_ms(&budget, MQTT_DOWNLOAD_STEP_MS);
+
+	while (download->remaining > 0 && !expired(&budget))
+	{
+		int len = download->remaining < MQTT_DOWNLOAD_CHUNK_SIZE ? (int) download->remaining : MQTT_DOWNLOAD_CHUNK_SIZE;
+		int rc;
+
+		if (download->buffered > 0)
+		{
+			//body bytes which came with the headers
+			rc = download->buffered;
+			download->buffered = 0;
+		}
+		else
+		{
+			int timeout = left_ms(&budget);
+
+			rc = download->network.mqttread(&download->network, download->chunk, len, timeout > 0 ? timeout : 1);
+		}
+
+		if (rc > 0)
+		{
+			if (fwrite(download->chunk, 1, (size_t) rc, download->file) != (size_t) rc)
+			{
+				mqtt_DownloadStop(download, MQTT_DOWNLOAD_FAILED, MQTT_DOWNLOAD_ERROR_FILE);
+				return download->state;
+			}
+
+			mbedtls_sha256_update(&download->sha, download->chunk, (size_t) rc);
+			download->received += (unsigned long long) rc;
+			download->remaining -= (unsigned long long) rc;
+			download->retries = 0;
+			countdown_ms(&download->idleTimer, MQTT_DOWNLOAD_TIMEOUT_MS);
+		}
+		else if (rc == CON_EOF || expired(&download->idleTimer))
+		{
+			//connection closed or silent for too long, bytes not read are requested again
+			mqtt_DownloadRetry(download);
+			return download->state;
+		}
+		else
+		{
+			//nothing more for now, the next step goes on
+			break;
+		}
+	}
+
+	if (download->remaining == 0)
+	{
+		if (fflush(download->file) != 0)
+		{
+			mqtt_DownloadStop(download, MQTT_DOWNLOAD_FAILED, MQTT_DOWNLOAD_ERROR_FILE);
+		}
+		else
+		{
+			mqtt_DownloadStop(download, MQTT_DOWNLOAD_DONE, 0);
+		}
+	}
+
+	return download->state;
+}
+
+//-------------------------------------------------------------------------------------------------------
+void mqtt_DownloadCancel(mqtt_download_t* download)
+{
+	//waits for a request in progress (bounded by the connection time-outs)
+	mqtt_DownloadJoin(download);
+
+	//the partial file is kept, it can be resumed by a download with the same SHA-256
+	if (download->state == MQTT_DOWNLOAD_RUNNING)
+	{
+		mqtt_DownloadStop(download, MQTT_DOWNLOAD_FAILED, MQTT_DOWNLOAD_ERROR_CANCELLED);
+	}
+}
+
+//-------------------------------------------------------------------------------------------------------
+const char* mqtt_DownloadErrorString(int error)
+{
+	switch (error)
+	{
+		case MQTT_DOWNLOAD_ERROR_URL:			return "invalid url";
+		case MQTT_DOWNLOAD_ERROR_FILE:			return "cannot write package file";
+		case MQTT_DOWNLOAD_ERROR_HTTP:			return "unexpected HTTP response";
+		case MQTT_DOWNLOAD_ERROR_NETWORK:		return "network error";
+		case MQTT_DOWNLOAD_ERROR_DIGEST:		return "SHA-256 mismatch";
+		case MQTT_DOWNLOAD_ERROR_CANCELLED:		return "cancelled";
+	}
+
+	return "";
+}
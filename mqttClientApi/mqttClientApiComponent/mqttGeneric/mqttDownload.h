@@ -0,0 +1,111 @@
+/*******************************************************************************************************************
+
+ MQTT package download
+
+	Streams a file from a http:// or https:// url into a target file, over the Network layer used
+	by the MQTT sessions (plain socket or tlsSocket).
+
+		- step driven : mqtt_DownloadStep reads the body for MQTT_DOWNLOAD_STEP_MS at most, it is
+		  meant to be called from mqtt_ProcessEvent (process hook) so that the MQTT session keeps running
+		- the blocking part of a request (name resolution, TCP connect, TLS handshake, request and
+		  response headers) runs in a thread of its own : the steps only check whether it is done
+		- memory is flat : one chunk buffer held by the download, whatever the package size
+		- SHA-256 is computed incrementally on the bytes written to the file
+		- a lost link is retried with backoff, the request resumes at the first missing byte (Range)
+		- with an expected SHA-256, an existing target file is resumed as well (after a restart)
+
+	View of the stack :
+	_________________________
+
+	 mqttAirVantage interface
+	_________________________
+
+	 mqttDownload  <--- this file
+	_________________________
+
+	 mqttGeneric interface
+	_________________________
+
+	 paho (Network)
+	_________________________
+
+	 TLSinterface
+	_________________________
+
+*******************************************************************************************************************/
+
+#ifndef _MQTT_DOWNLOAD_H_
+#define _MQTT_DOWNLOAD_H_
+
+#include <stdio.h>
+#include <pthread.h>
+
+#include "mqttGeneric.h"
+#include "mbedtls/sha256.h"
+
+#define		MQTT_DOWNLOAD_CHUNK_SIZE			4096
+#define		MQTT_DOWNLOAD_STEP_MS				50		//bounded work per mqtt_ProcessEvent
+#define		MQTT_DOWNLOAD_TIMEOUT_MS			5000	//no byte received for this long : the link is considered lost
+#define		MQTT_DOWNLOAD_MAX_RETRIES			10		//consecutive attempts without progress
+#define		MQTT_DOWNLOAD_RETRY_MS				1000	//first backoff, doubled up to 32 s
+
+#define		MQTT_DOWNLOAD_ERROR_URL				-1		//invalid url or SHA-256
+#define		MQTT_DOWNLOAD_ERROR_FILE			-2		//cannot write the target file
+#define		MQTT_DOWNLOAD_ERROR_HTTP			-3		//unexpected HTTP status or headers
+#define		MQTT_DOWNLOAD_ERROR_NETWORK			-4		//retries exhausted
+#define		MQTT_DOWNLOAD_ERROR_DIGEST			-5		//SHA-256 mismatch
+#define		MQTT_DOWNLOAD_ERROR_CANCELLED		-6
+
+typedef enum {
+	MQTT_DOWNLOAD_IDLE = 0,
+	MQTT_DOWNLOAD_RUNNING,
+	MQTT_DOWNLOAD_DONE,
+	MQTT_DOWNLOAD_FAILED
+} mqtt_downloadState_t;
+
+typedef struct {
+	mqtt_downloadState_t	state;
+	int						error;				//MQTT_DOWNLOAD_ERROR_xxx when failed
+
+	char					host[128];
+	int						port;
+	int						useTLS;
+	char					path[512];
+	char					target[256];
+	char					tlsRootCA[128];
+
+	int						verify;				//expectedSha256 is set
+	unsigned char			expectedSha256[32];
+	unsigned char			sha256[32];			//digest of the file once done
+
+	Network					network;
+	int						connected;
+	FILE*					file;
+	mbedtls_sha256_context	sha;
+
+	pthread_t				requestThread;
+	int						requesting;			//MQTT_DOWNLOAD_REQUEST_xxx, see mqtt_DownloadStep
+	int						requestRc;
+	int						httpStatus;			//response headers of the last request
+	long long				contentLength;
+	long long				rangeStart;
+	long long				rangeTotal;
+	int						buffered;			//body bytes read with the headers, at the start of chunk
+
+	unsigned long long		received;			//bytes written to the target file
+	unsigned long long		total;				//package size, 0 if not known yet
+	unsigned long long		remaining;			//bytes left in the current response
+	int						retries;
+	Timer					retryTimer;
+	Timer					idleTimer;			//reset by every byte received
+
+	unsigned char			chunk[MQTT_DOWNLOAD_CHUNK_SIZE];
+} mqtt_download_t;
+
+int  mqtt_DownloadStart(mqtt_download_t* download, const char* url, const char* targetFile, const char* sha256Hex, const char* rootCA);
+int  mqtt_DownloadStep(mqtt_download_t* download);
+void mqtt_DownloadCancel(mqtt_download_t* download);
+
+const char* mqtt_DownloadErrorString(int error);
+
+#endif	//_MQTT_DOWNLOAD_H_
@@ -0,0 +1,331 @@
+/*******************************************************************************************************************
+
+ MQTT package download test
+
+	Runs the download engine (mqttDownload) against a local HTTP/1.0 stand-in server : complete download,
+	link lost in the middle of the body (resumed with Range), resume of a partial file after a restart,
+	slow server (steps stay within their budget), SHA-256 mismatch and missing package :
+
+		make mqttDownloadTest && ./mqttDownloadTest
+
+*******************************************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "mqttDownload.h"
+
+#define		TEST_PACKAGE_SIZE		(300 * 1024)
+#define		TEST_TARGET				"mqttDownloadTest.bin"
+#define		TEST_STEP_LIMIT_MS		(MQTT_DOWNLOAD_STEP_MS + 100)
+
+typedef struct {
+	int						listener;
+	int						port;
+	int						dropAfter;			//bytes of body sent before the next response is cut, 0 : none
+	int						stallMs;			//pause between two pieces of the body
+	int						requests;
+	int						ranges;				//requests with a Range header
+} test_server_t;
+
+static test_server_t		g_server;
+static unsigned char		g_package[TEST_PACKAGE_SIZE];
+static char					g_sha256[65];
+static int					g_failures = 0;
+
+//-------------------------------------------------------------------------------------------------------
+static unsigned long long test_NowMs(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return (unsigned long long) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+//-------------------------------------------------------------------------------------------------------
+static void test_Check(int condition, const char* what)
+{
+	fprintf(stdout, "%s : %s\n", condition ? "PASS" : "FAIL", what);
+	fflush(stdout);
+
+	if (!condition)
+	{
+		g_failures++;
+	}
+}
+
+//-------------------------------------------------------------------------------------------------------
+static void test_Send(int sock, const void* data, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t n = send(sock, data, len, MSG_NOSIGNAL);
+
+		if (n <= 0)
+		{
+			return;
+		}
+		data = (const char *) data + n;
+		len -= (size_t) n;
+	}
+}
+
+//-------------------------------------------------------------------------------------------------------
+static void test_Serve(int sock)
+{
+	char		request[2048];
+	int			len = 0;
+	long		from = 0;
+	char		header[256];
+	char		path[256] = "";
+
+	while (len < (int) sizeof(request) - 1 && (len < 4 || memcmp(request + len - 4, "\r\n\r\n", 4) != 0))
+	{
+		if (recv(sock, request + len, 1, 0) != 1)
+		{
+			return;
+		}
+		len++;
+	}
+	request[len] = 0;
+
+	g_server.requests++;
+	sscanf(request, "GET %255s", path);
+
+	const char* range = strstr(request, "Range: bytes=");
+	if (range)
+	{
+		g_server.ranges++;
+		from = atol(range + 13);
+	}
+
+	if (strcmp(path, "/package.bin") != 0)
+	{
+		len = snprintf(header, sizeof(header), "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n\r\n");
+		test_Send(sock, header, (size_t) len);
+		return;
+	}
+
+	if (from >= TEST_PACKAGE_SIZE)
+	{
+		len = snprintf(header, sizeof(header), "HTTP/1.0 416 Range Not Satisfiable\r\nContent-Range: bytes */%d\r\n\r\n", TEST_PACKAGE_SIZE);
+		test_Send(sock, header, (size_t) len);
+		return;
+	}
+
+	if (range)
+	{
+		len = snprintf(header, sizeof(header), "HTTP/1.0 206 Partial Content\r\nContent-Length: %ld\r\nContent-Range: bytes %ld-%d/%d\r\n\r\n",
+						TEST_PACKAGE_SIZE - from, from, TEST_PACKAGE_SIZE - 1, TEST_PACKAGE_SIZE);
+	}
+	else
+	{
+		len = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Length: %d\r\n\r\n", TEST_PACKAGE_SIZE);
+	}
+	test_Send(sock, header, (size_t) len);
+
+	long end = TEST_PACKAGE_SIZE;
+	if (g_server.dropAfter > 0)
+	{
+		end = from + g_server.dropAfter < end ? from + g_server.dropAfter : end;
+		g_server.dropAfter = 0;
+	}
+
+	while (from < end)
+	{
+		long piece = (end - from) < 8192 ? (end - from) : 8192;
+
+		test_Send(sock, g_package + from, (size_t) piece);
+		from += piece;
+
+		if (g_server.stallMs > 0)
+		{
+			usleep(1000 * g_server.stallMs);
+		}
+	}
+}
+
+//-------------------------------------------------------------------------------------------------------
+static void* test_ServerThread(void* context)
+{
+	for (;;)
+	{
+		int sock = accept(g_server.listener, NULL, NULL);
+
+		if (sock < 0)
+		{
+			break;
+		}
+
+		test_Serve(sock);
+		close(sock);
+	}
+
+	return NULL;
+}
+
+//-------------------------------------------------------------------------------------------------------
+static int test_StartServer(void)
+{
+	struct sockaddr_in	addr;
+	socklen_t			addrLen = sizeof(addr);
+	pthread_t			thread;
+	int					one = 1;
+
+	g_server.listener = socket(AF_INET, SOCK_STREAM, 0);
+	setsockopt(g_server.listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = 0;
+
+	if (bind(g_server.listener, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(g_server.listener, 4) != 0 ||
+		getsockname(g_server.listener, (struct sockaddr *) &addr, &addrLen) != 0)
+	{
+		return FAILURE;
+	}
+	g_server.port = ntohs(addr.sin_port);
+
+	return pthread_create(&thread, NULL, test_ServerThread, NULL) == 0 ? SUCCESS : FAILURE;
+}
+
+//-------------------------------------------------------------------------------------------------------
+static void test_MakePackage(void)
+{
+	unsigned char	digest[32];
+	int				i;
+
+	srand(1);
+	for (i=0; i<TEST_PACKAGE_SIZE; i++)
+	{
+		g_package[i] = (unsigned char) rand();
+	}
+
+	mbedtls_sha256(g_package, TEST_PACKAGE_SIZE, digest, 0);
+	for (i=0; i<32; i++)
+	{
+		sprintf(g_sha256 + 2*i, "%02x", digest[i]);
+	}
+}
+
+//-------------------------------------------------------------------------------------------------------
+static int test_TargetMatches(void)
+{
+	static unsigned char	content[TEST_PACKAGE_SIZE + 1];
+	FILE*					file = fopen(TEST_TARGET, "rb");
+	size_t					len = 0;
+
+	if (file)
+	{
+		len = fread(content, 1, sizeof(content), file);
+		fclose(file);
+	}
+
+	return len == TEST_PACKAGE_SIZE && memcmp(content, g_package, TEST_PACKAGE_SIZE) == 0;
+}
+
+//-------------------------------------------------------------------------------------------------------
+static int test_Run(mqtt_download_t* download, const char* path, const char* sha256, unsigned long long* maxStepMs)
+{
+	char				url[128];
+	unsigned long long	deadline = test_NowMs() + 60000;
+
+	snprintf(url, sizeof(url), "http://127.0.0.1:%d%s", g_server.port, path);
+
+	*maxStepMs = 0;
+
+	if (mqtt_DownloadStart(download, url, TEST_TARGET, sha256, "") != SUCCESS)
+	{
+		return download->state;
+	}
+
+	while (download->state == MQTT_DOWNLOAD_RUNNING && test_NowMs() < deadline)
+	{
+		unsigned long long start = test_NowMs();
+
+		mqtt_DownloadStep(download);
+
+		if (test_NowMs() - start > *maxStepMs)
+		{
+			*maxStepMs = test_NowMs() - start;
+		}
+
+		//the MQTT session would be served here
+		usleep(1000);
+	}
+
+	mqtt_DownloadCancel(download);
+
+	return download->state;
+}
+
+//-------------------------------------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+	static mqtt_download_t	download;
+	unsigned long long		maxStepMs;
+	int						state;
+
+	test_MakePackage();
+
+	if (test_StartServer() != SUCCESS)
+	{
+		fprintf(stdout, "cannot start the HTTP stand-in\n");
+		return 1;
+	}
+
+	//complete download, checked against its digest
+	remove(TEST_TARGET);
+	state = test_Run(&download, "/package.bin", g_sha256, &maxStepMs);
+	test_Check(state == MQTT_DOWNLOAD_DONE && test_TargetMatches(), "complete download");
+	test_Check(maxStepMs <= TEST_STEP_LIMIT_MS, "steps within their budget");
+
+	//link lost in the middle of the body : resumed at the first missing byte
+	remove(TEST_TARGET);
+	g_server.requests = g_server.ranges = 0;
+	g_server.dropAfter = 100000;
+	state = test_Run(&download, "/package.bin", g_sha256, &maxStepMs);
+	test_Check(state == MQTT_DOWNLOAD_DONE && test_TargetMatches(), "download resumed after a link loss");
+	test_Check(g_server.requests == 2 && g_server.ranges == 1, "one ranged request after the link loss");
+
+	//partial file left by a restart : only the missing bytes are requested
+	FILE* file = fopen(TEST_TARGET, "wb");
+	fwrite(g_package, 1, TEST_PACKAGE_SIZE / 3, file);
+	fclose(file);
+	g_server.requests = g_server.ranges = 0;
+	state = test_Run(&download, "/package.bin", g_sha256, &maxStepMs);
+	test_Check(state == MQTT_DOWNLOAD_DONE && test_TargetMatches() && g_server.ranges == 1, "partial file resumed");
+
+	//slow server : the steps return while the body trickles in
+	remove(TEST_TARGET);
+	g_server.stallMs = 20;
+	state = test_Run(&download, "/package.bin", "", &maxStepMs);
+	g_server.stallMs = 0;
+	test_Check(state == MQTT_DOWNLOAD_DONE && test_TargetMatches(), "download from a slow server");
+	test_Check(maxStepMs <= TEST_STEP_LIMIT_MS, "steps within their budget on a slow server");
+
+	//content not matching the expected digest
+	remove(TEST_TARGET);
+	state = test_Run(&download, "/package.bin", "0000000000000000000000000000000000000000000000000000000000000000", &maxStepMs);
+	test_Check(state == MQTT_DOWNLOAD_FAILED && download.error == MQTT_DOWNLOAD_ERROR_DIGEST, "SHA-256 mismatch detected");
+
+	//missing package
+	remove(TEST_TARGET);
+	state = test_Run(&download, "/missing.bin", "", &maxStepMs);
+	test_Check(state == MQTT_DOWNLOAD_FAILED && download.error == MQTT_DOWNLOAD_ERROR_HTTP, "missing package reported");
+
+	remove(TEST_TARGET);
+
+	fprintf(stdout, "%s\n", g_failures == 0 ? "all tests passed" : "tests failed");
+
+	return g_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,165 @@
+/*******************************************************************************************************************
+
+ MQTT message time-to-live
+
+	Per topic TTL rules and summaries of the expired messages, see mqttExpiry.h
+
+*******************************************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <sys/time.h>
+
+#include "MQTTClient.h"
+#include "mqttExpiry.h"
+
+//-------------------------------------------------------------------------------------------------------
+mqtt_expiry_st* mqtt_ExpiryCreate(void)
+{
+	mqtt_expiry_st* expiry = (mqtt_expiry_st *) malloc(sizeof(mqtt_expiry_st));
+
+	if (expiry)
+	{
+		memset(expiry, 0, sizeof(mqtt_expiry_st));
+	}
+
+	return expiry;
+}
+
+//-------------------------------------------------------------------------------------------------------
+void mqtt_ExpiryDelete(mqtt_expiry_st* expiry)
+{
+	free(expiry);
+}
+
+//-------------------------------------------------------------------------------------------------------
+//wall clock : the deadlines of the offline store hold across a restart
+unsigned long long mqtt_ExpiryNow(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return (unsigned long long) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_ExpirySetRule(mqtt_expiry_st* expiry, const char* topicPrefix, unsigned long ttlMs, const char* summaryTopic)
+{
+	int i;
+
+	if (topicPrefix == NULL)
+	{
+		topicPrefix = "";
+	}
+	if (summaryTopic == NULL)
+	{
+		summaryTopic = "";
+	}
+
+	if (strlen(topicPrefix) >= MQTT_EXPIRY_PREFIX_SIZE || strlen(summaryTopic) >= MQTT_EXPIRY_PREFIX_SIZE)
+	{
+		return FAILURE;
+	}
+
+	for (i=0; i<expiry->ruleCount && strcmp(expiry->rules[i].prefix, topicPrefix) != 0; i++);
+
+	if (i == MQTT_EXPIRY_MAX_RULES)
+	{
+		fprintf(stdout, "mqttExpiry : no more than %d rules\n", MQTT_EXPIRY_MAX_RULES);
+		fflush(stdout);
+		return FAILURE;
+	}
+
+	if (i == expiry->ruleCount)
+	{
+		memset(&expiry->rules[i], 0, sizeof(mqtt_expiryRule_t));
+		strcpy(expiry->rules[i].prefix, topicPrefix);
+		expiry->ruleCount++;
+	}
+	expiry->rules[i].ttlMs = ttlMs;
+	strcpy(expiry->rules[i].summaryTopic, summaryTopic);
+
+	return SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------------------------
+//longest prefix matching the topic, NULL if none
+static mqtt_expiryRule_t* mqtt_ExpiryRule(mqtt_expiry_st* expiry, const char* topicName)
+{
+	mqtt_expiryRule_t*	rule = NULL;
+	size_t				ruleLen = 0;
+	int					i;
+
+	for (i=0; expiry && i<expiry->ruleCount; i++)
+	{
+		size_t prefixLen = strlen(expiry->rules[i].prefix);
+
+		if (strncmp(topicName, expiry->rules[i].prefix, prefixLen) == 0 && (rule == NULL || prefixLen > ruleLen))
+		{
+			rule = &expiry->rules[i];
+			ruleLen = prefixLen;
+		}
+	}
+
+	return rule;
+}
+
+//-------------------------------------------------------------------------------------------------------
+//TTL of a message of the topic : ttlMs when given, otherwise the one of the rule of the topic, 0 never expires
+unsigned long mqtt_ExpiryTtl(mqtt_expiry_st* expiry, const char* topicName, long ttlMs)
+{
+	if (ttlMs >= 0)
+	{
+		return (unsigned long) ttlMs;
+	}
+
+	mqtt_expiryRule_t* rule = mqtt_ExpiryRule(expiry, topicName);
+
+	return rule ? rule->ttlMs : 0;
+}
+
+//-------------------------------------------------------------------------------------------------------
+//an expired message of the topic, gathered in the summary of its rule
+void mqtt_ExpiryCount(mqtt_expiry_st* expiry, const char* topicName, unsigned long long queuedAt)
+{
+	mqtt_expiryRule_t* rule = mqtt_ExpiryRule(expiry, topicName);
+
+	if (rule == NULL || rule->summaryTopic[0] == '\0')
+	{
+		return;
+	}
+
+	if (rule->pending == 0 || queuedAt < rule->first)
+	{
+		rule->first = queuedAt;
+	}
+	if (rule->pending == 0 || queuedAt > rule->last)
+	{
+		rule->last = queuedAt;
+	}
+	rule->pending++;
+}
+
+//-------------------------------------------------------------------------------------------------------
+//the summaries gathered are handed over and reset first : the handler may publish, and purge again
+void mqtt_ExpiryFlush(mqtt_expiry_st* expiry, mqtt_expirySummaryHandler pfnSummary, void* context)
+{
+	int i;
+
+	for (i=0; expiry && i<expiry->ruleCount; i++)
+	{
+		mqtt_expiryRule_t rule = expiry->rules[i];
+
+		if (rule.pending == 0)
+		{
+			continue;
+		}
+
+		expiry->rules[i].pending = 0;
+		expiry->summaries++;
+
+		pfnSummary(context, &rule);
+	}
+}
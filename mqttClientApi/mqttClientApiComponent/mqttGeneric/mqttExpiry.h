@@ -0,0 +1,78 @@
+/*******************************************************************************************************************
+
+ MQTT message time-to-live
+
+	Outbound messages waiting in the priority queues or in the offline store may carry a deadline : past it,
+	they are dropped instead of sent, so that a device coming back after an outage sends current data first
+	instead of replaying hours of samples.
+
+		- the TTL of a message is given when it is published, or by the rule of its topic : a rule gives
+		  the TTL of the topics starting with its prefix (the longest prefix applies), a TTL of 0 never
+		  expires and exempts the topics of its prefix
+		- the deadline is taken from the wall clock when the message is queued (queued time + TTL) : it holds
+		  across a restart for the messages of the offline store
+		- priority queues : messages with a deadline are indexed in a min-heap of their deadlines, a purge
+		  removes the expired ones in O(log n) each, without walking the queues
+		- offline store : records are in the order they were appended, an expired record is skipped (not
+		  sent) when the drain reaches it
+		- a rule with a summary topic counts the messages of its prefix which expired : a summary record is
+		  published on the summary topic once the purge is done, or once connected again when offline (the
+		  count goes on meanwhile, a single summary per rule covers the whole outage),
+		  {"prefix" : "...", "expired" : n, "first" : ms, "last" : ms} (queued times of the oldest and the
+		  newest of them). Summaries never expire
+
+	View of the stack :
+	_________________________
+
+	 mqttGeneric interface
+	_________________________
+
+	 mqttExpiry  <--- this file
+	_________________________
+
+	 mqttSched / mqttStore
+	_________________________
+
+	 paho
+	_________________________
+
+*******************************************************************************************************************/
+
+#ifndef _MQTT_EXPIRY_H_
+#define _MQTT_EXPIRY_H_
+
+#include <stddef.h>
+
+#define		MQTT_EXPIRY_MAX_RULES			8
+#define		MQTT_EXPIRY_PREFIX_SIZE			128
+#define		MQTT_TTL_TOPIC					-1			//TTL of the rule of the topic
+
+typedef struct {
+	char					prefix[MQTT_EXPIRY_PREFIX_SIZE];
+	unsigned long			ttlMs;						//0 : never expires
+	char					summaryTopic[MQTT_EXPIRY_PREFIX_SIZE];	//"" : expired messages are dropped silently
+
+	unsigned long			pending;					//expired since the last summary
+	unsigned long long		first;						//queued time of the oldest of them, ms
+	unsigned long long		last;						//queued time of the newest of them, ms
+} mqtt_expiryRule_t;
+
+typedef struct mqtt_expiry_st {
+	mqtt_expiryRule_t		rules[MQTT_EXPIRY_MAX_RULES];
+	int						ruleCount;
+	unsigned long			summaries;					//summary records published
+} mqtt_expiry_st;
+
+typedef void (*mqtt_expirySummaryHandler)(void* context, const mqtt_expiryRule_t* rule);
+
+mqtt_expiry_st* mqtt_ExpiryCreate(void);
+void mqtt_ExpiryDelete(mqtt_expiry_st* expiry);
+
+int  mqtt_ExpirySetRule(mqtt_expiry_st* expiry, const char* topicPrefix, unsigned long ttlMs, const char* summaryTopic);
+unsigned long mqtt_ExpiryTtl(mqtt_expiry_st* expiry, const char* topicName, long ttlMs);
+
+unsigned long long mqtt_ExpiryNow(void);
+void mqtt_ExpiryCount(mqtt_expiry_st* expiry, const char* topicName, unsigned long long queuedAt);
+void mqtt_ExpiryFlush(mqtt_expiry_st* expiry, mqtt_expirySummaryHandler pfnSummary, void* context);
+
+#endif	//_MQTT_EXPIRY_H_
@@ -0,0 +1,379 @@
+/*******************************************************************************************************************
+
+ MQTT report-by-exception filter
+
+	Deadbands per key, last value published per (topic, key), see mqttFilter.h
+
+*******************************************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <sys/time.h>
+
+#include "MQTTClient.h"
+#include "mqttFilter.h"
+
+//-------------------------------------------------------------------------------------------------------
+static unsigned long long mqtt_FilterNow(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return (unsigned long long) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+//-------------------------------------------------------------------------------------------------------
+//FNV-1a of topic, NUL, key
+unsigned int mqtt_FilterHash(const char* topicName, const char* key)
+{
+	unsigned int hash = 2166136261u;
+
+	while (*topicName)
+	{
+		hash = (hash ^ (unsigned char) *topicName++) * 16777619u;
+	}
+	hash *= 16777619u;
+	while (*key)
+	{
+		hash = (hash ^ (unsigned char) *key++) * 16777619u;
+	}
+
+	return hash;
+}
+
+//-------------------------------------------------------------------------------------------------------
+//value parsed as a finite number, surrounding spaces allowed
+int mqtt_FilterIsNumber(const char* value, double* number)
+{
+	char* end;
+
+	*number = strtod(value, &end);
+
+	if (end == value)
+	{
+		return 0;
+	}
+
+	while (*end == ' ')
+	{
+		end++;
+	}
+
+	//x - x is not 0 for infinities and NaN, which are compared as strings
+	return *end == '\0' && (*number - *number) == 0;
+}
+
+//-------------------------------------------------------------------------------------------------------
+static const mqtt_deadband_t* mqtt_FilterRule(mqtt_filter_st* filter, const char* key)
+{
+	const mqtt_deadband_t*	fallback = NULL;
+	int						i;
+
+	for (i=0; i<filter->ruleCount; i++)
+	{
+		if (filter->rules[i].key[0] == '\0')
+		{
+			fallback = &filter->rules[i];
+		}
+		else if (strcmp(filter->rules[i].key, key) == 0)
+		{
+			return &filter->rules[i];
+		}
+	}
+
+	return fallback;
+}
+
+//-------------------------------------------------------------------------------------------------------
+static mqtt_filterEntry_st** mqtt_FilterFind(mqtt_filter_st* filter, unsigned int hash, const char* topicName, const char* key)
+{
+	mqtt_filterEntry_st** pp = &filter->buckets[hash & (filter->bucketCount - 1)];
+
+	while (*pp)
+	{
+		mqtt_filterEntry_st* entry = *pp;
+
+		if (entry->hash == hash && strcmp(entry->name, topicName) == 0 && strcmp(entry->name + strlen(entry->name) + 1, key) == 0)
+		{
+			break;
+		}
+		pp = &entry->next;
+	}
+
+	return pp;
+}
+
+//-------------------------------------------------------------------------------------------------------
+//doubles the buckets when the chains get longer than 2 on average
+static void mqtt_FilterGrow(mqtt_filter_st* filter)
+{
+	unsigned int			count = filter->bucketCount * 2;
+	mqtt_filterEntry_st**	buckets = (mqtt_filterEntry_st **) calloc(count, sizeof(mqtt_filterEntry_st *));
+	unsigned int			i;
+
+	if (buckets == NULL)
+	{
+		//keeps working with longer chains
+		return;
+	}
+
+	for (i=0; i<filter->bucketCount; i++)
+	{
+		while (filter->buckets[i])
+		{
+			mqtt_filterEntry_st* entry = filter->buckets[i];
+
+			filter->buckets[i] = entry->next;
+			entry->next = buckets[entry->hash & (count - 1)];
+			buckets[entry->hash & (count - 1)] = entry;
+		}
+	}
+
+	free(filter->buckets);
+	filter->footprint += (count - filter->bucketCount) * sizeof(mqtt_filterEntry_st *);
+	filter->buckets = buckets;
+	filter->bucketCount = count;
+}
+
+//-------------------------------------------------------------------------------------------------------
+static void mqtt_FilterFreeEntry(mqtt_filter_st* filter, mqtt_filterEntry_st* entry)
+{
+	filter->footprint -= sizeof(mqtt_filterEntry_st) + strlen(entry->name) + 1 + strlen(entry->name + strlen(entry->name) + 1) + 1 + entry->valueSize;
+	filter->entryCount--;
+	free(entry->value);
+	free(entry);
+}
+
+//-------------------------------------------------------------------------------------------------------
+mqtt_filter_st* mqtt_FilterCreate(void)
+{
+	mqtt_filter_st* filter = (mqtt_filter_st *) malloc(sizeof(mqtt_filter_st));
+
+	if (filter == NULL)
+	{
+		return NULL;
+	}
+
+	memset(filter, 0, sizeof(mqtt_filter_st));
+
+	filter->buckets = (mqtt_filterEntry_st **) calloc(MQTT_FILTER_MIN_BUCKETS, sizeof(mqtt_filterEntry_st *));
+	if (filter->buckets == NULL)
+	{
+		free(filter);
+		return NULL;
+	}
+	filter->bucketCount = MQTT_FILTER_MIN_BUCKETS;
+	filter->footprint = MQTT_FILTER_MIN_BUCKETS * sizeof(mqtt_filterEntry_st *);
+
+	return filter;
+}
+
+//-------------------------------------------------------------------------------------------------------
+void mqtt_FilterDelete(mqtt_filter_st* filter)
+{
+	unsigned int i;
+
+	if (!filter)
+	{
+		return;
+	}
+
+	for (i=0; i<filter->bucketCount; i++)
+	{
+		while (filter->buckets[i])
+		{
+			mqtt_filterEntry_st* entry = filter->buckets[i];
+
+			filter->buckets[i] = entry->next;
+			mqtt_FilterFreeEntry(filter, entry);
+		}
+	}
+
+	free(filter->buckets);
+	free(filter);
+}
+
+//-------------------------------------------------------------------------------------------------------
+//a negative deadband removes the rule of the key, the values of its entries are kept
+int mqtt_FilterSetDeadband(mqtt_filter_st* filter, const char* key, double absolute, double percent, unsigned long maxSilenceMs)
+{
+	int i;
+
+	if (key == NULL)
+	{
+		key = "";
+	}
+
+	if (strlen(key) >= MQTT_FILTER_KEY_SIZE)
+	{
+		return FAILURE;
+	}
+
+	for (i=0; i<filter->ruleCount && strcmp(filter->rules[i].key, key) != 0; i++);
+
+	if (absolute < 0 || percent < 0)
+	{
+		if (i < filter->ruleCount)
+		{
+			filter->ruleCount--;
+			memmove(&filter->rules[i], &filter->rules[i + 1], (filter->ruleCount - i) * sizeof(mqtt_deadband_t));
+		}
+		return SUCCESS;
+	}
+
+	if (i == MQTT_FILTER_MAX_RULES)
+	{
+		fprintf(stdout, "mqttFilter : no more than %d deadbands\n", MQTT_FILTER_MAX_RULES);
+		fflush(stdout);
+		return FAILURE;
+	}
+
+	if (i == filter->ruleCount)
+	{
+		strcpy(filter->rules[i].key, key);
+		filter->ruleCount++;
+	}
+
+	filter->rules[i].absolute = absolute;
+	filter->rules[i].percent = percent;
+	filter->rules[i].maxSilenceMs = maxSilenceMs;
+
+	return SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------------------------
+//returns 1 if the sample is to be published (it becomes the last value published), 0 if it is suppressed
+int mqtt_FilterPass(mqtt_filter_st* filter, const char* topicName, const char* key, const char* value)
+{
+	if (filter == NULL)
+	{
+		return 1;
+	}
+
+	const mqtt_deadband_t* rule = mqtt_FilterRule(filter, key);
+
+	if (rule == NULL)
+	{
+		return 1;
+	}
+
+	unsigned long long		now = mqtt_FilterNow();
+	unsigned int			hash = mqtt_FilterHash(topicName, key);
+	mqtt_filterEntry_st**	pp = mqtt_FilterFind(filter, hash, topicName, key);
+	mqtt_filterEntry_st*	entry = *pp;
+	double					number = 0;
+	int						isNumber = mqtt_FilterIsNumber(value, &number);
+
+	if (entry && (rule->maxSilenceMs == 0 || now - entry->publishedAt < rule->maxSilenceMs))
+	{
+		int changed;
+
+		if (isNumber && entry->isNumber)
+		{
+			double delta = (number > entry->number) ? number - entry->number : entry->number - number;
+			double band = rule->percent * ((entry->number < 0) ? -entry->number : entry->number) / 100;
+
+			if (band < rule->absolute)
+			{
+				band = rule->absolute;
+			}
+
+			changed = (band > 0) ? (delta > band) : (delta != 0);
+		}
+		else
+		{
+			changed = strcmp(value, entry->value) != 0;
+		}
+
+		if (!changed)
+		{
+			filter->suppressed++;
+			return 0;
+		}
+	}
+
+	size_t valueLen = strlen(value) + 1;
+
+	if (entry == NULL)
+	{
+		size_t nameLen = strlen(topicName) + 1 + strlen(key) + 1;
+
+		if (filter->entryCount >= MQTT_FILTER_MAX_ENTRIES)
+		{
+			return 1;
+		}
+
+		entry = (mqtt_filterEntry_st *) malloc(sizeof(mqtt_filterEntry_st) + nameLen);
+		if (entry == NULL)
+		{
+			return 1;
+		}
+
+		entry->hash = hash;
+		entry->value = NULL;
+		entry->valueSize = 0;
+		strcpy(entry->name, topicName);
+		strcpy(entry->name + strlen(topicName) + 1, key);
+		entry->next = NULL;
+		*pp = entry;
+
+		filter->entryCount++;
+		filter->footprint += sizeof(mqtt_filterEntry_st) + nameLen;
+	}
+
+	if (valueLen > entry->valueSize)
+	{
+		char* grown = (char *) realloc(entry->value, valueLen);
+
+		if (grown == NULL)
+		{
+			//published, the key is not tracked anymore
+			*pp = entry->next;
+			mqtt_FilterFreeEntry(filter, entry);
+			return 1;
+		}
+
+		filter->footprint += valueLen - entry->valueSize;
+		entry->value = grown;
+		entry->valueSize = valueLen;
+	}
+
+	memcpy(entry->value, value, valueLen);
+	entry->isNumber = isNumber;
+	entry->number = number;
+	entry->publishedAt = now;
+
+	if (filter->entryCount > 2 * filter->bucketCount)
+	{
+		mqtt_FilterGrow(filter);
+	}
+
+	return 1;
+}
+
+//-------------------------------------------------------------------------------------------------------
+void mqtt_FilterForget(mqtt_filter_st* filter, const char* topicName, const char* key)
+{
+	if (filter == NULL)
+	{
+		return;
+	}
+
+	mqtt_filterEntry_st** pp = mqtt_FilterFind(filter, mqtt_FilterHash(topicName, key), topicName, key);
+
+	if (*pp)
+	{
+		mqtt_filterEntry_st* entry = *pp;
+
+		*pp = entry->next;
+		mqtt_FilterFreeEntry(filter, entry);
+	}
+}
+
+//-------------------------------------------------------------------------------------------------------
+size_t mqtt_FilterFootprint(mqtt_filter_st* filter)
+{
+	return filter ? sizeof(mqtt_filter_st) + filter->footprint : 0;
+}
@@ -0,0 +1,86 @@
+/*******************************************************************************************************************
+
+ MQTT report-by-exception filter
+
+	Key/value samples whose value did not move since the last one published are not published : the
+	filter keeps the last value published per (topic, key) in a hash table and checks each new sample
+	before it is serialized.
+
+		- a deadband rule applies to a key, the empty key being the default of the keys without a rule.
+		  Keys without a rule (and no default) are not filtered
+		- numeric values : the sample is published when it moves away from the last value published by
+		  more than the deadband, the larger of the absolute deadband and the percentage of the last value.
+		  Both 0 : any change is published
+		- other values : the sample is published when it differs from the last value published
+		- maxSilenceMs (0 : none) : a sample is published anyway once the last one published is that old,
+		  as a heartbeat telling the value is still current
+		- a sample whose publication failed is forgotten : the next one is published whatever its value
+
+	The table is bounded (MQTT_FILTER_MAX_ENTRIES), the samples of the keys beyond are not filtered.
+
+	View of the stack :
+	_________________________
+
+	 mqttGeneric interface
+	_________________________
+
+	 mqttFilter  <--- this file
+	_________________________
+
+	 mqttJson / paho
+	_________________________
+
+*******************************************************************************************************************/
+
+#ifndef _MQTT_FILTER_H_
+#define _MQTT_FILTER_H_
+
+#include <stddef.h>
+
+#define		MQTT_FILTER_MAX_RULES			16
+#define		MQTT_FILTER_KEY_SIZE			128
+#define		MQTT_FILTER_MAX_ENTRIES			1024		//(topic, key) pairs tracked
+#define		MQTT_FILTER_MIN_BUCKETS			32
+
+typedef struct {
+	char					key[MQTT_FILTER_KEY_SIZE];	//"" : default
+	double					absolute;
+	double					percent;
+	unsigned long			maxSilenceMs;
+} mqtt_deadband_t;
+
+typedef struct mqtt_filterEntry_st {
+	struct mqtt_filterEntry_st*	next;
+	unsigned int				hash;
+	unsigned long long			publishedAt;			//ms
+	int							isNumber;
+	double						number;
+	char*						value;					//last value published
+	size_t						valueSize;				//allocated
+	char						name[];					//topic, NUL, key, NUL
+} mqtt_filterEntry_st;
+
+typedef struct mqtt_filter_st {
+	mqtt_deadband_t			rules[MQTT_FILTER_MAX_RULES];
+	int						ruleCount;
+	mqtt_filterEntry_st**	buckets;
+	unsigned int			bucketCount;				//power of 2
+	unsigned long			entryCount;
+	unsigned long			suppressed;					//samples not published
+	size_t					footprint;					//entries and their values
+} mqtt_filter_st;
+
+mqtt_filter_st* mqtt_FilterCreate(void);
+void mqtt_FilterDelete(mqtt_filter_st* filter);
+
+int  mqtt_FilterSetDeadband(mqtt_filter_st* filter, const char* key, double absolute, double percent, unsigned long maxSilenceMs);
+int  mqtt_FilterPass(mqtt_filter_st* filter, const char* topicName, const char* key, const char* value);
+void mqtt_FilterForget(mqtt_filter_st* filter, const char* topicName, const char* key);
+
+size_t mqtt_FilterFootprint(mqtt_filter_st* filter);
+
+//shared with the other per (topic, key) stages
+unsigned int mqtt_FilterHash(const char* topicName, const char* key);
+int  mqtt_FilterIsNumber(const char* value, double* number);
+
+#endif	//_MQTT_FILTER_H_
@@ -36,8 +36,20 @@
 
 #include <stdio.h>
 #include <memory.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "mqttGeneric.h"
+#include "mqttStore.h"
+#include "mqttSched.h"
+#include "mqttLimit.h"
+#include "mqttFilter.h"
+#include "mqttAggregate.h"
+#include "mqttCompress.h"
+#include "mqttWake.h"
+#include "mqttExpiry.h"
+#include "tlsSocket.h"
 
 /*---------- Default parameters ---------------------------------*/
 #define 	TIMEOUT_MS					5000	//time-out for MQTT connection
@@ -49,11 +61,23 @@
 #define		DEFAULT_QOS					QOS0
 #define		DEFAULT_USE_TLS				0
 #define		DEFAULT_YIELD_TIMEOUT		1000	//allow 1 second for checking incoming packet & sending keep-alive
+#define		ROLLOVER_DRAIN_MS			100		//delivery of the packets received by the old session before it is closed
+#define		LINK_RETRY_MS				1000	//first backoff of a session resumed by the link, doubled up to LINK_RETRY_MAX_MS
+#define		LINK_RETRY_MAX_MS			64000
+#define		LINK_DRAIN_MS				2000	//time budget of a backlog drain once a session is resumed
 #define		DEFAULT_DEVICE_NAME			"mqttGeneric"
 #define		DEFAULT_USER_NAME			"username"
 #define		DEFAULT_SECRET				"noSecret"
 
 #define		USER_DATA_INDEX				0
+#define		FILE_CHUNK_SIZE				2048	//file read per compression step
+
+#define		ARENA_ALIGN(size)			(((size) + 7) & ~((size_t) 7))
+
+typedef struct mqtt_arenaBlock {
+	struct mqtt_arenaBlock*		next;
+	unsigned long long			data[];			//keeps the user data aligned
+} mqtt_arenaBlock_t;
 
 void mqtt_GetDefaultConfig(mqtt_config_t* mqttConfig)
 {
@@ -68,13 +92,9 @@ void mqtt_GetDefaultConfig(mqtt_config_t* mqttConfig)
 }
 
 //-------------------------------------------------------------------------------------------------------
-mqtt_instance_st * mqtt_CreateInstance(mqtt_config_t* mqttConfig)
+//unset fields take their default, as the instance created with the configuration would have them
+void mqtt_NormalizeConfig(mqtt_config_t* mqttConfig)
 {
-	mqtt_instance_st * mqttObject = (mqtt_instance_st *) malloc(sizeof(mqtt_instance_st));
-
-	memset(mqttObject, 0, sizeof(mqtt_instance_st));
-
-	
 	if (mqttConfig->serverPort <= 0)
 	{
 		mqttConfig->serverPort = DEFAULT_PORT;
@@ -94,6 +114,23 @@ mqtt_instance_st * mqtt_CreateInstance(mqtt_config_t* mqttConfig)
 	{
 		mqttConfig->qoS = DEFAULT_QOS;	
 	}
+}
+
+//-------------------------------------------------------------------------------------------------------
+mqtt_instance_st * mqtt_CreateInstance(mqtt_config_t* mqttConfig)
+{
+	mqtt_instance_st * mqttObject = (mqtt_instance_st *) malloc(sizeof(mqtt_instance_st));
+
+	if (!mqttObject)
+	{
+		fprintf(stdout, "mqtt_CreateInstance : out of memory\n");
+		fflush(stdout);
+		return NULL;
+	}
+
+	memset(mqttObject, 0, sizeof(mqtt_instance_st));
+
+	mqtt_NormalizeConfig(mqttConfig);
 
 	memcpy(&mqttObject->mqttConfig, mqttConfig, sizeof(mqtt_config_t));
 
@@ -165,6 +202,26 @@ mqtt_instance_st* mqtt_DeleteInstance(mqtt_instance_st* mqttObject)
 				free(userData);
 			}
 		}
+		if (mqttObject->inboundBatch.buffer)
+		{
+			free(mqttObject->inboundBatch.buffer);
+		}
+		while (mqttObject->hooks)
+		{
+			mqtt_RemoveProcessHook(mqttObject, mqttObject->hooks->pfnProcess);
+		}
+		while (mqttObject->topics)
+		{
+			mqtt_UnregisterTopic(mqttObject, mqttObject->topics);
+		}
+		mqtt_StoreClose(mqttObject->store);
+		mqtt_SchedDelete(mqttObject->sched);
+		mqtt_LimitDelete(mqttObject->limit);
+		mqtt_FilterDelete(mqttObject->filter);
+		mqtt_AggregateDelete(mqttObject->aggregate);
+		mqtt_CompressDelete(mqttObject->compress);
+		mqtt_WakeDelete(mqttObject->wake);
+		mqtt_ExpiryDelete(mqttObject->expiry);
 		//fprintf(stdout, "mqtt_DeleteInstance : freeing instance %p", mqttObject);
 		//fflush(stdout);
 		free(mqttObject);
@@ -173,262 +230,2154 @@ mqtt_instance_st* mqtt_DeleteInstance(mqtt_instance_st* mqttObject)
 	return NULL;
 }
 //-------------------------------------------------------------------------------------------------------
-int mqtt_PublishData(mqtt_instance_st * mqttObject, const char* data, size_t dataLen, const char* topicName)
+//store-and-forward : while offline, or behind stored messages, a message goes to the store (order is kept)
+static int mqtt_StoreFirst(mqtt_instance_st * mqttObject)
 {
+	return mqttObject->store && (!mqtt_IsConnected(mqttObject) || mqtt_StorePending(mqttObject->store) > 0);
+}
 
-	//printf("Sending Data: %s\n", data);
-
-	MQTTMessage		msg;
-	msg.qos = mqttObject->mqttConfig.qoS;
-	msg.retained = 0;
-	msg.dup = 0;
-	msg.id = 0;
-	msg.payload = (void *) data;
-	msg.payloadlen = dataLen;
+static int mqtt_StoreMessage(mqtt_instance_st * mqttObject, const char* topicName, int qoS, int retained, const char* data, size_t dataLen)
+{
+	if (mqtt_StoreAppend(mqttObject->store, topicName, qoS, retained, data, dataLen, mqtt_ExpiryTtl(mqttObject->expiry, topicName, MQTT_TTL_TOPIC)) != SUCCESS)
+	{
+		return FAILURE;
+	}
 
-	fprintf(stdout, "Publishing data on %s : %s ... ", topicName, data);
+	fprintf(stdout, "Message on %s stored, %lu to send\n", topicName, mqtt_StorePending(mqttObject->store));
 	fflush(stdout);
 
-	int rc = MQTTPublish(&mqttObject->mqttClient, topicName, &msg);
-	if (rc != SUCCESS)
+	if (mqtt_IsConnected(mqttObject))
 	{
-		fprintf(stdout, "publish error: %d\n", rc);
-		
+		mqtt_StoreDrain(mqttObject->store, &mqttObject->mqttClient, mqttObject->limit, mqttObject->expiry);
 	}
-	else
+
+	return SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------------------------
+//wake-up slots : paho arms the ping timer on each packet sent, which gives the last one of the instance
+static unsigned long long mqtt_WakeReport(mqtt_instance_st * mqttObject, unsigned long long now)
+{
+	unsigned long long keepAliveMs = (unsigned long long) mqttObject->mqttClient.keepAliveInterval * 1000;
+	unsigned long long dueAt = now + left_ms(&mqttObject->mqttClient.ping_timer);
+
+	if (keepAliveMs > 0 && dueAt > keepAliveMs)
 	{
-		fprintf(stdout, "OK\n");
+		mqtt_WakeActivity(dueAt - keepAliveMs);
 	}
-	fflush(stdout);
 
-	return rc;
+	return dueAt;
 }
 
-//-------------------------------------------------------------------------------------------------------
-int  mqtt_PublishKeyValue(mqtt_instance_st * mqttObject, const char* szKey, const char* szValue, const char* topicName)
+//deferrable messages wait for the next slot while the radio sleeps, urgent ones wake it up for all
+static int mqtt_WakeHolds(mqtt_instance_st * mqttObject)
 {
-	char * message = malloc(strlen(szKey) + strlen(szValue) + 10);
+	mqtt_wake_st*	wake = mqttObject->wake;
+	mqtt_sched_st*	sched = mqttObject->sched;
+
+	if (!wake || !sched ||
+		sched->queues[MQTT_PRIORITY_ALARM].count > 0 || sched->queues[MQTT_PRIORITY_COMMAND_ACK].count > 0)
+	{
+		return 0;
+	}
 
-	sprintf(message, "{\"%s\":\"%s\"}", szKey, szValue);	
+	unsigned long long now = mqtt_WakeNow();
 
-	int rc = mqtt_PublishData(mqttObject, message, strlen(message), topicName);
+	mqtt_WakeReport(mqttObject, now);
 
-	free(message);
+	if (mqtt_WakeRadioAwake(now) || (wake->releaseAt > 0 && now >= wake->releaseAt))
+	{
+		return 0;
+	}
 
-	return rc;
+	if (wake->releaseAt == 0)
+	{
+		wake->releaseAt = mqtt_WakeNextSlot(wake, now);
+	}
+
+	return 1;
 }
 
 //-------------------------------------------------------------------------------------------------------
-void mqtt_GetConfig(mqtt_instance_st * mqttObject, mqtt_config_t* mqttConfig)
+//queued messages sent if nothing of a higher class (or throttled) is waiting, held for a wake-up slot otherwise
+static void mqtt_RunQueued(mqtt_instance_st * mqttObject)
 {
-
-	memcpy(mqttConfig, &mqttObject->mqttConfig, sizeof(mqtt_config_t));
+	if (mqtt_IsConnected(mqttObject))
+	{
+		if (mqtt_WakeHolds(mqttObject))
+		{
+			mqttObject->wake->held++;
+		}
+		else
+		{
+			//expired messages are not sent, their summaries go out with mqtt_ProcessEvent
+			mqtt_SchedExpire(mqttObject->sched, mqttObject->expiry);
+			mqtt_SchedRun(mqttObject->sched, &mqttObject->mqttClient, mqttObject->limit);
+		}
+	}
 }
 
 //-------------------------------------------------------------------------------------------------------
-int mqtt_ProcessEvent(mqtt_instance_st * mqttObject, unsigned waitDelayMs)
+//priority queues : the message is copied, then sent if nothing of a higher class (or throttled) is waiting
+//ttlMs : MQTT_TTL_TOPIC for the TTL of the rule of the topic, 0 never expires
+static int mqtt_QueueMessageTtl(mqtt_instance_st * mqttObject, mqtt_priority_t priority, const char* topicName, int qoS, int retained, const char* data, size_t dataLen, long ttlMs)
 {
-	int timeout = DEFAULT_YIELD_TIMEOUT;
+	if (!mqttObject->sched && (mqttObject->sched = mqtt_SchedCreate()) == NULL)
+	{
+		return FAILURE;
+	}
 
-	if (waitDelayMs > 0)
+	if (mqtt_SchedPush(mqttObject->sched, priority, topicName, qoS, retained, data, dataLen, mqtt_ExpiryTtl(mqttObject->expiry, topicName, ttlMs)) != SUCCESS)
 	{
-		timeout = (int) waitDelayMs;
+		return FAILURE;
 	}
 
-	return MQTTYield(&mqttObject->mqttClient, timeout);
+	mqtt_RunQueued(mqttObject);
+
+	return SUCCESS;
+}
+
+static int mqtt_QueueMessage(mqtt_instance_st * mqttObject, mqtt_priority_t priority, const char* topicName, int qoS, int retained, const char* data, size_t dataLen)
+{
+	return mqtt_QueueMessageTtl(mqttObject, priority, topicName, qoS, retained, data, dataLen, MQTT_TTL_TOPIC);
 }
 
 //-------------------------------------------------------------------------------------------------------
-int mqtt_StartSession(mqtt_instance_st * mqttObject)
+//priority queues : the file is read straight into its queued message, then sent like mqtt_QueueMessage
+static int mqtt_QueueFile(mqtt_instance_st * mqttObject, mqtt_priority_t priority, const char* topicName, FILE* file, size_t size)
 {
-	int 			rc = 0;
-	
-	int				nMaxRetry = 3;
-	int				nRetry = 0;
+	char*					data;
+	mqtt_schedMessage_st*	message;
 
+	if (!mqttObject->sched && (mqttObject->sched = mqtt_SchedCreate()) == NULL)
+	{
+		return FAILURE;
+	}
 
-	mqttObject->mqttClient.userCtxData = (void *) mqttObject;
+	message = mqtt_SchedReserve(mqttObject->sched, priority, topicName, mqttObject->mqttConfig.qoS, 0, size,
+								mqtt_ExpiryTtl(mqttObject->expiry, topicName, MQTT_TTL_TOPIC), &data);
+	if (!message)
+	{
+		return FAILURE;
+	}
 
-	for (nRetry=0; nRetry<nMaxRetry; nRetry++)
+	if (fread(data, 1, size, file) != size)
 	{
-		fprintf(stdout, "mqtt_StartSession... connecting...");
-		mqttObject->network.connect(&mqttObject->network, mqttObject->mqttConfig.serverUrl, mqttObject->mqttConfig.serverPort,
-										mqttObject->mqttConfig.tlsRootCA, mqttObject->mqttConfig.tlsCertificate, mqttObject->mqttConfig.tlsPrivateKey);
+		mqtt_SchedDiscard(message);
+		return FAILURE;
+	}
 
-		MQTTClient(&mqttObject->mqttClient, &mqttObject->network, TIMEOUT_MS, mqttObject->mqttBuffer, sizeof(mqttObject->mqttBuffer), mqttObject->mqttReadBuffer, sizeof(mqttObject->mqttReadBuffer));
-	 
-		mqttObject->data.willFlag = 0;
-		mqttObject->data.MQTTVersion = MQTT_VERSION;
-		mqttObject->data.clientID.cstring = mqttObject->mqttConfig.deviceId;
-		mqttObject->data.username.cstring = mqttObject->mqttConfig.username;
-		mqttObject->data.password.cstring = mqttObject->mqttConfig.secret;
+	if (mqtt_SchedCommit(mqttObject->sched, message) != SUCCESS)
+	{
+		return FAILURE;
+	}
 
-		mqttObject->data.keepAliveInterval = mqttObject->mqttConfig.keepAlive;
-		mqttObject->data.cleansession = 1;
+	mqtt_RunQueued(mqttObject);
 
-		fprintf(stdout, "  clientId : %s\n", mqttObject->mqttConfig.deviceId);
-		fprintf(stdout, "  username : %s\n", mqttObject->mqttConfig.username);
+	return SUCCESS;
+}
 
-		fprintf(stdout, "Attempting (%d/%d) to connect to tcp://%s:%d... ", nRetry+1, nMaxRetry, mqttObject->mqttConfig.serverUrl, mqttObject->mqttConfig.serverPort);
+//-------------------------------------------------------------------------------------------------------
+//summary of the messages of a TTL rule which expired, queued as telemetry and never expiring
+static void mqtt_PublishExpired(void* context, const mqtt_expiryRule_t* rule)
+{
+	mqtt_instance_st*	mqttObject = (mqtt_instance_st *) context;
+	char				buffer[MQTT_EXPIRY_PREFIX_SIZE + 128];
+	mqtt_jsonWriter_t	writer;
+
+	mqtt_JsonWriterInit(&writer, buffer, sizeof(buffer), 0);
+
+	mqtt_JsonBeginObject(&writer);
+	mqtt_JsonWriteKeyValue(&writer, "prefix", rule->prefix);
+	mqtt_JsonWriteKey(&writer, "expired");
+	mqtt_JsonWriteNumber(&writer, "%lu", rule->pending);
+	mqtt_JsonWriteKey(&writer, "first");
+	mqtt_JsonWriteNumber(&writer, "%llu", rule->first);
+	mqtt_JsonWriteKey(&writer, "last");
+	mqtt_JsonWriteNumber(&writer, "%llu", rule->last);
+	mqtt_JsonEndObject(&writer);
+
+	if (!writer.error)
+	{
+		mqtt_QueueMessageTtl(mqttObject, MQTT_PRIORITY_TELEMETRY, rule->summaryTopic, mqttObject->mqttConfig.qoS, 0, writer.buffer, writer.len, 0);
+	}
+}
 
-		fflush(stdout);
-	
-		rc = MQTTConnect(&mqttObject->mqttClient, &mqttObject->data);
-		//printf("Connected %d\n", rc);
-		fprintf(stdout, "%s\n", rc == SUCCESS ? "OK" : "Failed");
-	    fflush(stdout);
+//messages past their deadline are dropped from the priority queues, then the summaries are published
+//while offline, the counts of the rules keep accumulating : one summary per rule once connected
+static void mqtt_ExpireQueued(mqtt_instance_st * mqttObject)
+{
+	if (mqttObject->expiry)
+	{
+		mqtt_SchedExpire(mqttObject->sched, mqttObject->expiry);
 
-		if (rc == SUCCESS) 
-		{
-			//connected			
-			break;
-		}
-		else
+		if (mqtt_IsConnected(mqttObject))
 		{
-			MQTTDisconnect(&mqttObject->mqttClient);
-			mqttObject->network.disconnect(&mqttObject->network);
+			mqtt_ExpiryFlush(mqttObject->expiry, mqtt_PublishExpired, mqttObject);
 		}
 	}
+}
 
-	if (rc != SUCCESS)
-	{
-		fprintf(stdout, "Failed to connect to %s\n", mqttObject->mqttConfig.serverUrl);
-		fflush(stdout);
-	}
-
-	return rc;
+//rate limited : the messages go through the telemetry queue, those throttled wait there (bounded)
+static int mqtt_RateLimited(mqtt_instance_st * mqttObject)
+{
+	return mqttObject->limit && mqttObject->limit->ruleCount > 0;
 }
 
 //-------------------------------------------------------------------------------------------------------
-void* mqtt_CreateUserData(mqtt_instance_st * mqttObject)
+//compression stage : the payload is compressed in the arena when the codec (or the rule of the topic) asks
+//for it, returns 1 with the compressed payload, 0 if it is to be sent as it is
+static int mqtt_Pack(mqtt_instance_st * mqttObject, const char* topicName, mqtt_compression_t codec, const char** data, size_t* dataLen)
 {
-	mqtt_ctxData_t* userCb =  (mqtt_ctxData_t*) mqtt_GetUserData(mqttObject, USER_DATA_INDEX);
+	mqtt_compressStream_t	stream;
+	size_t					len = 0;
 
-	if (!userCb)
+	//compressed once : the stages below get the compressed payload
+	if (mqtt_IsCompressed(*data, *dataLen) ||
+		(codec = mqtt_CompressSelect(mqttObject->compress, topicName, codec, *dataLen)) == MQTT_COMPRESSION_NONE ||
+		(!mqttObject->compress && (mqttObject->compress = mqtt_CompressCreate()) == NULL))
 	{
-		mqtt_ctxData_t * userData = (mqtt_ctxData_t *) malloc(sizeof(mqtt_ctxData_t));
-		memset(userData, 0, sizeof(mqtt_ctxData_t));
+		return 0;
+	}
 
-		mqtt_SetUserData(mqttObject, userData, USER_DATA_INDEX);
+	//smaller than the payload, or sent as it is
+	mqtt_arenaMark_t	mark = mqtt_ArenaMark(mqttObject);
+	unsigned char*		buffer = (unsigned char *) mqtt_ArenaAlloc(mqttObject, *dataLen - 1);
+
+	if (buffer && mqtt_CompressBegin(&stream, codec, (unsigned long) *dataLen, buffer, *dataLen - 1, 0) == SUCCESS &&
+		mqtt_CompressWrite(&stream, *data, *dataLen) == SUCCESS)
+	{
+		len = mqtt_CompressEnd(&stream, mqttObject->compress);
+	}
+	if (buffer)
+	{
+		mqtt_CompressFree(&stream);
 	}
 
-	return mqtt_GetUserData(mqttObject, USER_DATA_INDEX);
-}
+	if (len == 0)
+	{
+		mqttObject->compress->skipped++;
+		mqtt_ArenaRelease(mqttObject, mark);
+		return 0;
+	}
 
-//-------------------------------------------------------------------------------------------------------
-void mqtt_SetCommandHandler(mqtt_instance_st * mqttObject, incomingMessageHandler pHandler, void * pUserContext)
-{
-	
-	mqtt_ctxData_t* userCb =  (mqtt_ctxData_t*) mqtt_CreateUserData(mqttObject);
-	
-	userCb->pfnUserCommandHandler = pHandler;
-	userCb->pUserCommandContext = pUserContext;
-}
+	*data = (const char *) buffer;
+	*dataLen = len;
 
-//-------------------------------------------------------------------------------------------------------
-void mqtt_SetSoftwareInstallRequestHandler(mqtt_instance_st * mqttObject, softwareInstallRequestHandler pHandler, void * pUserContext)
-{
-	mqtt_ctxData_t* userCb =  (mqtt_ctxData_t*) mqtt_CreateUserData(mqttObject);
-	
-	userCb->pfnUserSWInstallHandler = pHandler;
-	userCb->pUserSWInstallContext = pUserContext;
+	return 1;
 }
 
 //-------------------------------------------------------------------------------------------------------
-void mqtt_OnIncomingMessage(MessageData* md)
+static int mqtt_PublishCodec(mqtt_instance_st * mqttObject, const char* data, size_t dataLen, const char* topicName, mqtt_compression_t codec)
 {
-	/*
-		This is a callback function (handler), invoked by MQTT client whenever there is an incoming message
-		It performs the following actions :
-		  - deserialize the incoming MQTT JSON-formatted message
-		  - call convertDataToCSV()
-	*/
-
-	MQTTMessage* message = md->message;
-	MQTTString*  topicName = md->topicName;
-	Client*      client = md->client;
+	mqtt_arenaMark_t mark = mqtt_ArenaMark(mqttObject);
 
-	mqtt_instance_st * mqttObject = (mqtt_instance_st *) client->userCtxData;
+	if (mqtt_Pack(mqttObject, topicName, codec, &data, &dataLen))
+	{
+		//the compressed payload goes the same way
+		int rc = mqtt_PublishCodec(mqttObject, data, dataLen, topicName, MQTT_COMPRESSION_NONE);
 
-	int payloadLen = (int)message->payloadlen;
+		mqtt_ArenaRelease(mqttObject, mark);
+		return rc;
+	}
 
-	char* topic = malloc(topicName->lenstring.len + 1);
-	memcpy(topic, topicName->lenstring.data, topicName->lenstring.len);
-	topic[topicName->lenstring.len] = 0;
+	if (mqtt_StoreFirst(mqttObject))
+	{
+		return mqtt_StoreMessage(mqttObject, topicName, mqttObject->mqttConfig.qoS, 0, data, dataLen);
+	}
 
-	fprintf(stdout, "\nIncoming data from topic %s :\n", topic);
-	fprintf(stdout, "%.*s\n", payloadLen, (char*)message->payload);
+	if (mqtt_RateLimited(mqttObject))
+	{
+		return mqtt_QueueMessage(mqttObject, MQTT_PRIORITY_TELEMETRY, topicName, mqttObject->mqttConfig.qoS, 0, data, dataLen);
+	}
 
-	char* szPayload = (char *) malloc(payloadLen + 1);
+	//printf("Sending Data: %s\n", data);
 
-	memcpy(szPayload, (char*)message->payload, payloadLen);
-	szPayload[payloadLen] = 0;
+	MQTTMessage		msg;
+	msg.qos = mqttObject->mqttConfig.qoS;
+	msg.retained = 0;
+	msg.dup = 0;
+	msg.id = 0;
+	msg.payload = (void *) data;
+	msg.payloadlen = dataLen;
 
-	mqtt_ctxData_t* userCb =  (mqtt_ctxData_t*) mqtt_GetUserData(mqttObject, USER_DATA_INDEX);
+	fprintf(stdout, "Publishing data on %s : %s ... ", topicName, data);
+	fflush(stdout);
 
-	if (userCb && userCb->pfnUserCommandHandler)
+	int rc = MQTTPublish(&mqttObject->mqttClient, topicName, &msg);
+	if (rc != SUCCESS)
 	{
-		userCb->pfnUserCommandHandler(topic, "", szPayload, "", userCb->pUserCommandContext);
-	}
+		fprintf(stdout, "publish error: %d\n", rc);
 
-	if (topic)
-	{
-		free(topic);
+		if (mqttObject->store)
+		{
+			//not acknowledged : sent again from the store
+			rc = mqtt_StoreMessage(mqttObject, topicName, mqttObject->mqttConfig.qoS, 0, data, dataLen);
+		}
 	}
-	if (szPayload)
+	else
 	{
-		free(szPayload);
+		fprintf(stdout, "OK\n");
 	}
+	fflush(stdout);
+
+	return rc;
 }
 
 //-------------------------------------------------------------------------------------------------------
-int mqtt_SubscribeTopic(mqtt_instance_st * mqttObject, const char* topicName)
+int mqtt_PublishData(mqtt_instance_st * mqttObject, const char* data, size_t dataLen, const char* topicName)
 {
-	fprintf(stdout, "Subscribing to topic %s... ", topicName);
-	int rc = MQTTSubscribe(&mqttObject->mqttClient, topicName, mqttObject->mqttConfig.qoS, mqtt_OnIncomingMessage);
-	fprintf(stdout, "%s\n", rc == 0 ? "OK" : "Failed");
-	//fprintf(stdout, "Subscribed %d\n", rc);
-	fflush(stdout);
-
-	return rc;
+	return mqtt_PublishCodec(mqttObject, data, dataLen, topicName, MQTT_COMPRESSION_TOPIC);
 }
 
+//-------------------------------------------------------------------------------------------------------
+int mqtt_PublishCompressed(mqtt_instance_st * mqttObject, const char* data, size_t dataLen, const char* topicName, int codec)
+{
+	return mqtt_PublishCodec(mqttObject, data, dataLen, topicName, (mqtt_compression_t) codec);
+}
 
 //-------------------------------------------------------------------------------------------------------
-int mqtt_UnsubscribeTopic(mqtt_instance_st * mqttObject, const char* topicName)
+int mqtt_PublishWithPriority(mqtt_instance_st * mqttObject, const char* data, size_t dataLen, const char* topicName, int priority)
 {
-	fprintf(stdout, "Unsubscribing to %s\n", topicName);
-	int rc = MQTTUnsubscribe(&mqttObject->mqttClient, topicName);
-	fprintf(stdout, "Unsubscribed %d\n", rc);
-	fflush(stdout);
+	mqtt_arenaMark_t	mark = mqtt_ArenaMark(mqttObject);
+
+	mqtt_Pack(mqttObject, topicName, MQTT_COMPRESSION_TOPIC, &data, &dataLen);
+
+	//sent now if nothing of a higher class is waiting, otherwise by the following runs
+	int rc = mqtt_QueueMessage(mqttObject, (mqtt_priority_t) priority, topicName, mqttObject->mqttConfig.qoS, 0, data, dataLen);
+
+	mqtt_ArenaRelease(mqttObject, mark);
 
 	return rc;
 }
 
 //-------------------------------------------------------------------------------------------------------
-int mqtt_StopSession(mqtt_instance_st * mqttObject)
+//as mqtt_PublishWithPriority, dropped instead of sent once ttlMs has elapsed (0 : never expires)
+int mqtt_PublishWithTtl(mqtt_instance_st * mqttObject, const char* data, size_t dataLen, const char* topicName, int priority, unsigned long ttlMs)
 {
-	//fprintf(stdout, "Disconnecting MQTT session");
-	//fflush(stdout);
-	int rc = MQTTDisconnect(&mqttObject->mqttClient);
+	mqtt_arenaMark_t	mark = mqtt_ArenaMark(mqttObject);
 
-	//fprintf(stdout, "Disconnecting Network : %p", &mqttObject->network);
-	//fflush(stdout);
-	if (mqttObject->network.disconnect)
-	{
-		mqttObject->network.disconnect(&mqttObject->network);
-	}
+	mqtt_Pack(mqttObject, topicName, MQTT_COMPRESSION_TOPIC, &data, &dataLen);
+
+	int rc = mqtt_QueueMessageTtl(mqttObject, (mqtt_priority_t) priority, topicName, mqttObject->mqttConfig.qoS, 0, data, dataLen, (long) ttlMs);
+
+	mqtt_ArenaRelease(mqttObject, mark);
 
 	return rc;
 }
 
 //-------------------------------------------------------------------------------------------------------
-int mqtt_IsConnected(mqtt_instance_st * mqttObject)
+//the file is compressed while it is read (codec or rule of the topic), then queued in the priority class
+//offline, it is refused unless the offline store is enabled
+int mqtt_PublishFile(mqtt_instance_st * mqttObject, const char* fileName, const char* topicName, int priority, int codec)
 {
-	if (mqttObject)
+	if (!mqtt_IsConnected(mqttObject) && !mqttObject->store)
 	{
-		return mqttObject->mqttClient.isconnected;
+		fprintf(stdout, "Not connected, file %s not sent\n", fileName);
+		fflush(stdout);
+		return FAILURE;
+	}
+
+	FILE*				file = fopen(fileName, "rb");
+	struct stat			st;
+	int					rc = FAILURE;
+
+	if (file == NULL)
+	{
+		fprintf(stdout, "Cannot open file %s\n", fileName);
+		fflush(stdout);
+		return FAILURE;
+	}
+
+	if (fstat(fileno(file), &st) != 0 || st.st_size < 0 || st.st_size > MQTT_FILE_MAX_SIZE)
+	{
+		fprintf(stdout, "File %s : no more than %d bytes\n", fileName, MQTT_FILE_MAX_SIZE);
+		fflush(stdout);
+		fclose(file);
+		return FAILURE;
+	}
+
+	//a log still written to is sent up to its size when opened
+	size_t				size = (size_t) st.st_size;
+	mqtt_compression_t	selected = mqtt_CompressSelect(mqttObject->compress, topicName, (mqtt_compression_t) codec, size);
+	int					packed = 0;
+
+	if (selected != MQTT_COMPRESSION_NONE && (mqttObject->compress || (mqttObject->compress = mqtt_CompressCreate()) != NULL))
+	{
+		mqtt_arenaMark_t		mark = mqtt_ArenaMark(mqttObject);
+		char*					chunk = (char *) mqtt_ArenaAlloc(mqttObject, FILE_CHUNK_SIZE);
+		mqtt_compressStream_t	stream;
+		size_t					left = size;
+		size_t					len = 0;
+
+		if (chunk && mqtt_CompressBegin(&stream, selected, (unsigned long) size, NULL, 0, 1) == SUCCESS)
+		{
+			while (left > 0)
+			{
+				size_t n = fread(chunk, 1, left < FILE_CHUNK_SIZE ? left : FILE_CHUNK_SIZE, file);
+
+				if (n == 0 || mqtt_CompressWrite(&stream, chunk, n) != SUCCESS)
+				{
+					break;
+				}
+				left -= n;
+			}
+
+			len = mqtt_CompressEnd(&stream, mqttObject->compress);
+			if (len > 0)
+			{
+				packed = 1;
+				rc = mqtt_QueueMessage(mqttObject, (mqtt_priority_t) priority, topicName, mqttObject->mqttConfig.qoS, 0, (const char *) stream.buffer, len);
+			}
+		}
+		if (chunk)
+		{
+			mqtt_CompressFree(&stream);
+		}
+
+		mqtt_ArenaRelease(mqttObject, mark);
+
+		if (!packed)
+		{
+			//read again, sent as it is
+			mqttObject->compress->skipped++;
+			rewind(file);
+		}
+	}
+
+	if (!packed)
+	{
+		rc = mqtt_QueueFile(mqttObject, (mqtt_priority_t) priority, topicName, file, size);
+	}
+
+	fclose(file);
+
+	return rc;
+}
+
+//-------------------------------------------------------------------------------------------------------
+void* mqtt_ArenaAlloc(mqtt_instance_st * mqttObject, size_t size)
+{
+	mqtt_arena_t* arena = &mqttObject->arena;
+
+	size = ARENA_ALIGN(size);
+
+	if (arena->base && arena->used + size <= MQTT_ARENA_SIZE)
+	{
+		void* ptr = arena->base + arena->used;
+
+		arena->used += size;
+		if (arena->used > arena->peak)
+		{
+			arena->peak = arena->used;
+		}
+
+		return ptr;
+	}
+
+	//does not fit (or no session started) : heap block released with the mark
+	mqtt_arenaBlock_t* block = (mqtt_arenaBlock_t *) malloc(sizeof(mqtt_arenaBlock_t) + size);
+
+	if (!block)
+	{
+		return NULL;
+	}
+
+	block->next = (mqtt_arenaBlock_t *) arena->overflow;
+	arena->overflow = block;
+	arena->heapFallbacks++;
+
+	return block->data;
+}
+
+//-------------------------------------------------------------------------------------------------------
+mqtt_arenaMark_t mqtt_ArenaMark(mqtt_instance_st * mqttObject)
+{
+	mqtt_arenaMark_t mark;
+
+	mark.used = mqttObject->arena.used;
+	mark.overflow = mqttObject->arena.overflow;
+
+	return mark;
+}
+
+//-------------------------------------------------------------------------------------------------------
+void mqtt_ArenaRelease(mqtt_instance_st * mqttObject, mqtt_arenaMark_t mark)
+{
+	mqtt_arena_t* arena = &mqttObject->arena;
+
+	while (arena->overflow && arena->overflow != mark.overflow)
+	{
+		mqtt_arenaBlock_t* block = (mqtt_arenaBlock_t *) arena->overflow;
+
+		arena->overflow = block->next;
+		free(block);
+	}
+
+	if (mark.used < arena->used)
+	{
+		arena->used = mark.used;
+	}
+}
+
+//-------------------------------------------------------------------------------------------------------
+void mqtt_InitJsonWriter(mqtt_instance_st * mqttObject, mqtt_jsonWriter_t* writer, const char* topicName)
+{
+	/*
+		The JSON is written in the MQTT send buffer, after room for the publish header of topicName
+		(no room needed for a registered topic : topicName NULL), so that the payload is not copied again.
+		A payload larger than the send buffer moves to the heap.
+	*/
+	Client*	client = &mqttObject->mqttClient;
+	size_t	offset = topicName ? (size_t) MQTTPublishHeaderLength(topicName, mqttObject->mqttConfig.qoS) : 0;
+
+	if (client->buf && offset < client->buf_size)
+	{
+		mqtt_JsonWriterInit(writer, (char *) client->buf + offset, client->buf_size - offset, 1);
+	}
+	else
+	{
+		mqtt_JsonWriterInit(writer, NULL, 0, 1);
+	}
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_PublishJson(mqtt_instance_st * mqttObject, mqtt_jsonWriter_t* writer, const char* topicName)
+{
+	int rc = FAILURE;
+
+	if (!writer->error && mqtt_CompressSelect(mqttObject->compress, topicName, MQTT_COMPRESSION_TOPIC, writer->len) != MQTT_COMPRESSION_NONE)
+	{
+		//compressed out of the send buffer
+		rc = mqtt_PublishData(mqttObject, writer->buffer, writer->len, topicName);
+	}
+	else if (!writer->error && mqtt_StoreFirst(mqttObject))
+	{
+		rc = mqtt_StoreMessage(mqttObject, topicName, mqttObject->mqttConfig.qoS, 0, writer->buffer, writer->len);
+	}
+	else if (!writer->error && mqtt_RateLimited(mqttObject))
+	{
+		rc = mqtt_QueueMessage(mqttObject, MQTT_PRIORITY_TELEMETRY, topicName, mqttObject->mqttConfig.qoS, 0, writer->buffer, writer->len);
+	}
+	else if (!writer->error && !writer->owned && writer->buffer)
+	{
+		MQTTMessage		msg;
+		msg.qos = mqttObject->mqttConfig.qoS;
+		msg.retained = 0;
+		msg.dup = 0;
+		msg.id = 0;
+		msg.payload = writer->buffer;
+		msg.payloadlen = writer->len;
+
+		fprintf(stdout, "Publishing data on %s : %s ... ", topicName, writer->buffer);
+
+		int offset = (int) (writer->buffer - (char *) mqttObject->mqttClient.buf);
+
+		rc = MQTTPublishInPlace(&mqttObject->mqttClient, topicName, &msg, offset);
+		fprintf(stdout, "%s\n", rc == SUCCESS ? "OK" : "publish error");
+		fflush(stdout);
+
+		if (rc != SUCCESS && mqttObject->store)
+		{
+			//the header was written before the payload, which is left as is
+			rc = mqtt_StoreMessage(mqttObject, topicName, mqttObject->mqttConfig.qoS, 0, writer->buffer, writer->len);
+		}
+	}
+	else if (!writer->error)
+	{
+		rc = mqtt_PublishData(mqttObject, writer->buffer, writer->len, topicName);
+	}
+
+	mqtt_JsonWriterFree(writer);
+
+	return rc;
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_PublishJsonToTopic(mqtt_instance_st * mqttObject, mqtt_jsonWriter_t* writer, mqtt_topic_st* topic)
+{
+	int rc = FAILURE;
+
+	if (!writer->error)
+	{
+		//the topic header is held by the handle, the payload is sent from where it was written
+		rc = mqtt_PublishToTopic(mqttObject, topic, writer->buffer, writer->len);
+	}
+
+	mqtt_JsonWriterFree(writer);
+
+	return rc;
+}
+
+//-------------------------------------------------------------------------------------------------------
+//summary of an aggregated key : {"key" : {"count" : n, "min" : x, "max" : x, "mean" : x, "start" : ms, "end" : ms}}
+static void mqtt_PublishWindow(mqtt_instance_st* mqttObject, const char* topicName, const char* key, const mqtt_window_t* window)
+{
+	mqtt_jsonWriter_t	writer;
+
+	mqtt_InitJsonWriter(mqttObject, &writer, topicName);
+
+	mqtt_JsonBeginObject(&writer);
+	mqtt_JsonWriteKey(&writer, key);
+	mqtt_JsonBeginObject(&writer);
+	mqtt_JsonWriteKey(&writer, "count");
+	mqtt_JsonWriteNumber(&writer, "%lu", window->count);
+	mqtt_JsonWriteKey(&writer, "min");
+	mqtt_JsonWriteNumber(&writer, "%.10g", window->min);
+	mqtt_JsonWriteKey(&writer, "max");
+	mqtt_JsonWriteNumber(&writer, "%.10g", window->max);
+	mqtt_JsonWriteKey(&writer, "mean");
+	mqtt_JsonWriteNumber(&writer, "%.10g", window->mean);
+	mqtt_JsonWriteKey(&writer, "start");
+	mqtt_JsonWriteNumber(&writer, "%llu", window->start);
+	mqtt_JsonWriteKey(&writer, "end");
+	mqtt_JsonWriteNumber(&writer, "%llu", window->end);
+	mqtt_JsonEndObject(&writer);
+	mqtt_JsonEndObject(&writer);
+
+	mqtt_PublishJson(mqttObject, &writer, topicName);
+}
+
+//-------------------------------------------------------------------------------------------------------
+int  mqtt_PublishKeyValue(mqtt_instance_st * mqttObject, const char* szKey, const char* szValue, const char* topicName)
+{
+	mqtt_jsonWriter_t	writer;
+
+	if (mqtt_AggregateAdd(mqttObject->aggregate, mqttObject, topicName, szKey, szValue, mqtt_PublishWindow))
+	{
+		//part of the summary of its window
+		return SUCCESS;
+	}
+
+	if (!mqtt_FilterPass(mqttObject->filter, topicName, szKey, szValue))
+	{
+		//within the deadband of the last value published
+		return SUCCESS;
+	}
+
+	mqtt_InitJsonWriter(mqttObject, &writer, topicName);
+
+	mqtt_JsonBeginObject(&writer);
+	mqtt_JsonWriteKeyValue(&writer, szKey, szValue);
+	mqtt_JsonEndObject(&writer);
+
+	int rc = mqtt_PublishJson(mqttObject, &writer, topicName);
+
+	if (rc != SUCCESS)
+	{
+		mqtt_FilterForget(mqttObject->filter, topicName, szKey);
+	}
+
+	return rc;
+}
+
+//-------------------------------------------------------------------------------------------------------
+mqtt_topic_st* mqtt_RegisterTopic(mqtt_instance_st * mqttObject, const char* topicName, int qoS, int retain)
+{
+	if (qoS < QOS0 || qoS > QOS2)
+	{
+		qoS = mqttObject->mqttConfig.qoS;
+	}
+
+	mqtt_topic_st* topic = (mqtt_topic_st *) malloc(sizeof(mqtt_topic_st) + strlen(topicName) + 1);
+
+	if (topic == NULL)
+	{
+		return NULL;
+	}
+
+	if (MQTTPrepareTopic(&topic->handle, topicName, (enum QoS) qoS, retain ? 1 : 0) != SUCCESS)
+	{
+		free(topic);
+		return NULL;
+	}
+
+	strcpy(topic->name, topicName);
+	topic->next = mqttObject->topics;
+	mqttObject->topics = topic;
+
+	return topic;
+}
+
+//-------------------------------------------------------------------------------------------------------
+void mqtt_UnregisterTopic(mqtt_instance_st * mqttObject, mqtt_topic_st* topic)
+{
+	mqtt_topic_st** pp = &mqttObject->topics;
+
+	while (*pp && *pp != topic)
+	{
+		pp = &(*pp)->next;
+	}
+
+	if (*pp)
+	{
+		*pp = topic->next;
+		MQTTReleaseTopic(&topic->handle);
+		free(topic);
+	}
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_PublishToTopic(mqtt_instance_st * mqttObject, mqtt_topic_st* topic, const char* data, size_t dataLen)
+{
+	mqtt_arenaMark_t mark = mqtt_ArenaMark(mqttObject);
+
+	if (mqtt_Pack(mqttObject, topic->name, MQTT_COMPRESSION_TOPIC, &data, &dataLen))
+	{
+		int rc = mqtt_PublishToTopic(mqttObject, topic, data, dataLen);
+
+		mqtt_ArenaRelease(mqttObject, mark);
+		return rc;
+	}
+
+	if (mqtt_StoreFirst(mqttObject))
+	{
+		return mqtt_StoreMessage(mqttObject, topic->name, topic->handle.qos, topic->handle.retained, data, dataLen);
+	}
+
+	if (mqtt_RateLimited(mqttObject))
+	{
+		return mqtt_QueueMessage(mqttObject, MQTT_PRIORITY_TELEMETRY, topic->name, topic->handle.qos, topic->handle.retained, data, dataLen);
+	}
+
+	MQTTMessage		msg;
+	msg.dup = 0;
+	msg.id = 0;
+	msg.payload = (void *) data;
+	msg.payloadlen = dataLen;
+
+	int rc = MQTTPublishTopic(&mqttObject->mqttClient, &topic->handle, &msg);
+	if (rc != SUCCESS)
+	{
+		fprintf(stdout, "publish error: %d\n", rc);
+		fflush(stdout);
+
+		if (mqttObject->store)
+		{
+			rc = mqtt_StoreMessage(mqttObject, topic->name, topic->handle.qos, topic->handle.retained, data, dataLen);
+		}
+	}
+
+	return rc;
+}
+
+//-------------------------------------------------------------------------------------------------------
+int  mqtt_PublishKeyValueToTopic(mqtt_instance_st * mqttObject, mqtt_topic_st* topic, const char* szKey, const char* szValue)
+{
+	mqtt_jsonWriter_t	writer;
+
+	if (mqtt_AggregateAdd(mqttObject->aggregate, mqttObject, topic->name, szKey, szValue, mqtt_PublishWindow) ||
+		!mqtt_FilterPass(mqttObject->filter, topic->name, szKey, szValue))
+	{
+		return SUCCESS;
+	}
+
+	mqtt_InitJsonWriter(mqttObject, &writer, NULL);
+
+	mqtt_JsonBeginObject(&writer);
+	mqtt_JsonWriteKeyValue(&writer, szKey, szValue);
+	mqtt_JsonEndObject(&writer);
+
+	int rc = mqtt_PublishJsonToTopic(mqttObject, &writer, topic);
+
+	if (rc != SUCCESS)
+	{
+		mqtt_FilterForget(mqttObject->filter, topic->name, szKey);
+	}
+
+	return rc;
+}
+
+//-------------------------------------------------------------------------------------------------------
+void mqtt_GetConfig(mqtt_instance_st * mqttObject, mqtt_config_t* mqttConfig)
+{
+
+	memcpy(mqttConfig, &mqttObject->mqttConfig, sizeof(mqtt_config_t));
+}
+
+//-------------------------------------------------------------------------------------------------------
+static int mqtt_QueuedToSend(mqtt_instance_st * mqttObject)
+{
+	return (mqtt_SchedQueued(mqttObject->sched) > 0 || mqtt_StorePending(mqttObject->store) > 0) && mqtt_IsConnected(mqttObject);
+}
+
+static void mqtt_SendQueued(mqtt_instance_st * mqttObject)
+{
+	mqtt_ExpireQueued(mqttObject);
+
+	//prioritized messages go ahead of the backlog of the offline store
+	if (mqtt_SchedQueued(mqttObject->sched) > 0 && mqtt_IsConnected(mqttObject) && !mqtt_WakeHolds(mqttObject))
+	{
+		mqtt_SchedRun(mqttObject->sched, &mqttObject->mqttClient, mqttObject->limit);
+	}
+
+	if (mqtt_StorePending(mqttObject->store) > 0 && mqtt_IsConnected(mqttObject))
+	{
+		mqtt_StoreDrain(mqttObject->store, &mqttObject->mqttClient, mqttObject->limit, mqttObject->expiry);
+
+		//records skipped by the drain
+		mqtt_ExpiryFlush(mqttObject->expiry, mqtt_PublishExpired, mqttObject);
+	}
+}
+
+//while messages are throttled, the wait is cut in slices ending when the buckets allow the next one
+static int mqtt_YieldPaced(mqtt_instance_st * mqttObject, int timeout)
+{
+	Timer	period;
+
+	InitTimer(&period);
+	countdown_ms(&period, timeout);
+
+	for (;;)
+	{
+		int slice = left_ms(&period);
+		int waitMs = mqtt_LimitWaitMs(mqttObject->limit);
+
+		if (waitMs == 0 || waitMs >= slice || !mqtt_QueuedToSend(mqttObject))
+		{
+			return MQTTYield(&mqttObject->mqttClient, slice > 0 ? slice : 1);
+		}
+
+		//FAILURE is also returned when nothing was read, only the end of the connection stops the slices
+		int rc = MQTTYield(&mqttObject->mqttClient, waitMs);
+
+		if (rc == CON_EOF)
+		{
+			return rc;
+		}
+
+		mqtt_SendQueued(mqttObject);
+	}
+}
+
+//-------------------------------------------------------------------------------------------------------
+//keepalive ahead of time and messages held, on the slot or on a wake-up by the other instances
+//returns the ms to the next action, 0 if none
+static unsigned long mqtt_WakeRun(mqtt_instance_st * mqttObject)
+{
+	mqtt_wake_st*		wake = mqttObject->wake;
+	Client*				client = &mqttObject->mqttClient;
+	unsigned long long	nextAt = 0;
+
+	if (!wake || !mqtt_IsConnected(mqttObject))
+	{
+		return 0;
+	}
+
+	unsigned long long	now = mqtt_WakeNow();
+	unsigned long long	keepAliveMs = (unsigned long long) client->keepAliveInterval * 1000;
+	unsigned long long	dueAt = mqtt_WakeReport(mqttObject, now);
+
+	if (keepAliveMs > 0 && !client->ping_outstanding && dueAt > now)
+	{
+		unsigned long long pingAt = mqtt_WakePingAt(wake, now, dueAt, keepAliveMs);
+
+		if (pingAt <= now)
+		{
+			countdown_ms(&client->ping_timer, 0);
+
+			if (keepalive(client) == SUCCESS && client->ping_outstanding)
+			{
+				wake->pings++;
+			}
+		}
+		else if (pingAt < dueAt)
+		{
+			nextAt = pingAt;
+		}
+	}
+
+	if (wake->releaseAt > 0)
+	{
+		if (!mqtt_WakeHolds(mqttObject))
+		{
+			mqtt_SendQueued(mqttObject);
+			wake->releaseAt = 0;
+		}
+		else if (nextAt == 0 || wake->releaseAt < nextAt)
+		{
+			nextAt = wake->releaseAt;
+		}
+	}
+
+	return nextAt > now ? (unsigned long) (nextAt - now) : 0;
+}
+
+//with wake-up slots, the wait is cut at the next slot so that the traffic of the instance goes out on it
+static int mqtt_YieldWake(mqtt_instance_st * mqttObject, int timeout)
+{
+	Timer	period;
+
+	InitTimer(&period);
+	countdown_ms(&period, timeout);
+
+	for (;;)
+	{
+		unsigned long	nextMs = mqtt_WakeRun(mqttObject);
+		int				slice = left_ms(&period);
+
+		if (nextMs == 0 || nextMs >= (unsigned long) slice)
+		{
+			return mqtt_YieldPaced(mqttObject, slice > 0 ? slice : 1);
+		}
+
+		int rc = mqtt_YieldPaced(mqttObject, (int) nextMs);
+
+		if (rc == CON_EOF)
+		{
+			return rc;
+		}
+	}
+}
+
+//-------------------------------------------------------------------------------------------------------
+//backlog of the store and the priority queues sent at full speed (rate limits still apply)
+static void mqtt_DrainBacklog(mqtt_instance_st * mqttObject)
+{
+	Timer			budget;
+	unsigned long	left = mqtt_SchedQueued(mqttObject->sched) + mqtt_StorePending(mqttObject->store);
+
+	InitTimer(&budget);
+	countdown_ms(&budget, LINK_DRAIN_MS);
+
+	while (left > 0 && mqtt_IsConnected(mqttObject) && !expired(&budget))
+	{
+		mqtt_SendQueued(mqttObject);
+
+		unsigned long now = mqtt_SchedQueued(mqttObject->sched) + mqtt_StorePending(mqttObject->store);
+
+		if (now >= left)
+		{
+			//throttled, or the session is lost
+			break;
+		}
+		left = now;
+	}
+
+	mqttObject->link.draining = left > 0 && mqtt_IsConnected(mqttObject);
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_ProcessEvent(mqtt_instance_st * mqttObject, unsigned waitDelayMs)
+{
+	int timeout = DEFAULT_YIELD_TIMEOUT;
+
+	if (waitDelayMs > 0)
+	{
+		timeout = (int) waitDelayMs;
+	}
+
+	if (!mqttObject->mqttClient.readbuf && !mqttObject->link.resume)
+	{
+		//no session started, nor deferred until the link is back
+		return FAILURE;
+	}
+
+	if (mqttObject->link.resume)
+	{
+		unsigned long retryMs = mqtt_LinkRetry(mqttObject);
+
+		if (!mqtt_IsConnected(mqttObject))
+		{
+			mqtt_ExpireQueued(mqttObject);
+
+			//session waiting for the link : the wait of a yield, without polling the closed socket
+			usleep(1000 * ((retryMs > 0 && retryMs < (unsigned long) timeout) ? retryMs : (unsigned long) timeout));
+			return FAILURE;
+		}
+	}
+
+	int rc = mqtt_YieldWake(mqttObject, timeout);
+
+	mqtt_AggregateFlush(mqttObject->aggregate, mqttObject);
+
+	if (mqttObject->link.draining)
+	{
+		mqtt_DrainBacklog(mqttObject);
+	}
+	else
+	{
+		mqtt_SendQueued(mqttObject);
+	}
+
+	if (mqttObject->inboundBatch.count > 0 && expired(&mqttObject->inboundBatch.deadline))
+	{
+		mqtt_FlushInboundBatch(mqttObject);
+	}
+
+	mqtt_hook_st* hook = mqttObject->hooks;
+	while (hook)
+	{
+		//a hook may remove itself
+		mqtt_hook_st* next = hook->next;
+
+		hook->pfnProcess(mqttObject, hook->context);
+		hook = next;
+	}
+
+	return rc;
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_AddProcessHook(mqtt_instance_st * mqttObject, mqtt_processHook pfnProcess, mqtt_processHook pfnRelease, void* context)
+{
+	mqtt_hook_st* hook = (mqtt_hook_st *) malloc(sizeof(mqtt_hook_st));
+
+	if (hook == NULL)
+	{
+		return FAILURE;
+	}
+
+	hook->pfnProcess = pfnProcess;
+	hook->pfnRelease = pfnRelease;
+	hook->context = context;
+	hook->next = NULL;
+
+	//run in the order they were added
+	mqtt_hook_st** pp = &mqttObject->hooks;
+	while (*pp)
+	{
+		pp = &(*pp)->next;
+	}
+	*pp = hook;
+
+	return SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------------------------
+void* mqtt_GetProcessHookContext(mqtt_instance_st * mqttObject, mqtt_processHook pfnProcess)
+{
+	mqtt_hook_st* hook;
+
+	for (hook = mqttObject->hooks; hook; hook = hook->next)
+	{
+		if (hook->pfnProcess == pfnProcess)
+		{
+			return hook->context;
+		}
+	}
+
+	return NULL;
+}
+
+//-------------------------------------------------------------------------------------------------------
+void mqtt_RemoveProcessHook(mqtt_instance_st * mqttObject, mqtt_processHook pfnProcess)
+{
+	mqtt_hook_st** pp = &mqttObject->hooks;
+
+	while (*pp && (*pp)->pfnProcess != pfnProcess)
+	{
+		pp = &(*pp)->next;
+	}
+
+	if (*pp)
+	{
+		mqtt_hook_st* hook = *pp;
+
+		*pp = hook->next;
+		if (hook->pfnRelease)
+		{
+			hook->pfnRelease(mqttObject, hook->context);
+		}
+		free(hook);
+	}
+}
+
+//-------------------------------------------------------------------------------------------------------
+static int mqtt_AllocBuffers(mqtt_instance_st * mqttObject)
+{
+	//packet buffers are only needed while a session is started, idle instances do not hold them
+	if (!mqttObject->mqttBuffer)
+	{
+		mqttObject->mqttBuffer = (unsigned char *) malloc(MAX_OUTBOUND_PAYLOAD_SIZE);
+	}
+
+	if (!mqttObject->mqttReadBuffer)
+	{
+		mqttObject->mqttReadBuffer = (unsigned char *) malloc(MAX_INBOUND_PAYLOAD_SIZE);
+	}
+
+	if (!mqttObject->arena.base)
+	{
+		mqttObject->arena.base = (unsigned char *) malloc(MQTT_ARENA_SIZE);
+		mqttObject->arena.used = 0;
+	}
+
+	return (mqttObject->mqttBuffer && mqttObject->mqttReadBuffer && mqttObject->arena.base) ? SUCCESS : FAILURE;
+}
+
+//-------------------------------------------------------------------------------------------------------
+static void mqtt_FreeBuffers(mqtt_instance_st * mqttObject)
+{
+	if (mqttObject->mqttBuffer)
+	{
+		free(mqttObject->mqttBuffer);
+		mqttObject->mqttBuffer = NULL;
+	}
+
+	if (mqttObject->mqttReadBuffer)
+	{
+		free(mqttObject->mqttReadBuffer);
+		mqttObject->mqttReadBuffer = NULL;
+	}
+
+	if (mqttObject->arena.base)
+	{
+		free(mqttObject->arena.base);
+		mqttObject->arena.base = NULL;
+		mqttObject->arena.used = 0;
+	}
+
+	mqttObject->mqttClient.buf = NULL;
+	mqttObject->mqttClient.buf_size = 0;
+	mqttObject->mqttClient.readbuf = NULL;
+	mqttObject->mqttClient.readbuf_size = 0;
+}
+
+//-------------------------------------------------------------------------------------------------------
+static int mqtt_ConnectSession(mqtt_instance_st * mqttObject, int nMaxRetry)
+{
+	int 			rc = 0;
+	
+	int				nRetry = 0;
+
+	if (mqtt_AllocBuffers(mqttObject) != SUCCESS)
+	{
+		fprintf(stdout, "mqtt_StartSession... cannot allocate packet buffers\n");
+		fflush(stdout);
+		mqtt_FreeBuffers(mqttObject);
+		return FAILURE;
+	}
+
+
+	mqttObject->mqttClient.userCtxData = (void *) mqttObject;
+
+	for (nRetry=0; nRetry<nMaxRetry; nRetry++)
+	{
+		fprintf(stdout, "mqtt_StartSession... connecting...");
+		int netRc = mqttObject->network.connect(&mqttObject->network, mqttObject->mqttConfig.serverUrl, mqttObject->mqttConfig.serverPort,
+										mqttObject->mqttConfig.tlsRootCA, mqttObject->mqttConfig.tlsCertificate, mqttObject->mqttConfig.tlsPrivateKey);
+
+		MQTTClient(&mqttObject->mqttClient, &mqttObject->network, TIMEOUT_MS, mqttObject->mqttBuffer, MAX_OUTBOUND_PAYLOAD_SIZE, mqttObject->mqttReadBuffer, MAX_INBOUND_PAYLOAD_SIZE);
+	 
+		mqttObject->data.willFlag = 0;
+		mqttObject->data.MQTTVersion = MQTT_VERSION;
+		mqttObject->data.clientID.cstring = mqttObject->mqttConfig.deviceId;
+		mqttObject->data.username.cstring = mqttObject->mqttConfig.username;
+		mqttObject->data.password.cstring = mqttObject->mqttConfig.secret;
+
+		mqttObject->data.keepAliveInterval = mqttObject->mqttConfig.keepAlive;
+		mqttObject->data.cleansession = 1;
+
+		fprintf(stdout, "  clientId : %s\n", mqttObject->mqttConfig.deviceId);
+		fprintf(stdout, "  username : %s\n", mqttObject->mqttConfig.username);
+
+		fprintf(stdout, "Attempting (%d/%d) to connect to tcp://%s:%d... ", nRetry+1, nMaxRetry, mqttObject->mqttConfig.serverUrl, mqttObject->mqttConfig.serverPort);
+
+		fflush(stdout);
+	
+		//no CONNECT written on a socket which is not connected (SIGPIPE)
+		rc = (netRc == 0) ? MQTTConnect(&mqttObject->mqttClient, &mqttObject->data) : FAILURE;
+		//printf("Connected %d\n", rc);
+		fprintf(stdout, "%s\n", rc == SUCCESS ? "OK" : "Failed");
+	    fflush(stdout);
+
+		if (rc == SUCCESS) 
+		{
+			//connected			
+			break;
+		}
+		else
+		{
+			MQTTDisconnect(&mqttObject->mqttClient);
+			mqttObject->network.disconnect(&mqttObject->network);
+		}
+	}
+
+	if (rc != SUCCESS)
+	{
+		fprintf(stdout, "Failed to connect to %s\n", mqttObject->mqttConfig.serverUrl);
+		fflush(stdout);
+	}
+
+	return rc;
+}
+
+//-------------------------------------------------------------------------------------------------------
+//session lost with the link : connected again with the subscriptions of the lost session, at their QoS
+static int mqtt_ResumeSession(mqtt_instance_st * mqttObject, int nMaxRetry)
+{
+	MessageHandlers		handlers[MAX_MESSAGE_HANDLERS];
+	messageHandler		defaultHandler = mqttObject->mqttClient.defaultMessageHandler;
+	int					i;
+
+	memcpy(handlers, mqttObject->mqttClient.messageHandlers, sizeof(handlers));
+
+	int rc = mqtt_ConnectSession(mqttObject, nMaxRetry);
+
+	mqttObject->mqttClient.defaultMessageHandler = defaultHandler;
+
+	for (i=0; rc == SUCCESS && i<MAX_MESSAGE_HANDLERS; i++)
+	{
+		if (handlers[i].topicFilter[0] != '\0')
+		{
+			rc = MQTTSubscribe(&mqttObject->mqttClient, handlers[i].topicFilter, handlers[i].qos, handlers[i].fp);
+		}
+	}
+
+	if (rc != SUCCESS)
+	{
+		if (mqtt_IsConnected(mqttObject))
+		{
+			MQTTDisconnect(&mqttObject->mqttClient);
+			mqttObject->network.disconnect(&mqttObject->network);
+		}
+
+		//kept for the next attempt
+		memcpy(mqttObject->mqttClient.messageHandlers, handlers, sizeof(handlers));
+		return FAILURE;
+	}
+
+	fprintf(stdout, "Session resumed, %lu message(s) to send\n", mqtt_SchedQueued(mqttObject->sched) + mqtt_StorePending(mqttObject->store));
+	fflush(stdout);
+
+	mqttObject->link.resume = 0;
+	mqttObject->link.draining = 1;
+	mqttObject->link.retryMs = 0;
+	mqttObject->link.resumes++;
+
+	return SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_StartSession(mqtt_instance_st * mqttObject)
+{
+	if (mqttObject->link.down)
+	{
+		//no attempt on a link known to be down, the session is started once it is back
+		fprintf(stdout, "mqtt_StartSession... data link down, deferred\n");
+		fflush(stdout);
+		if (!mqtt_IsConnected(mqttObject))
+		{
+			mqttObject->link.resume = 1;
+		}
+		mqttObject->link.deferred++;
+		return MQTT_DEFERRED;
+	}
+
+	if (mqtt_IsConnected(mqttObject))
+	{
+		return SUCCESS;
+	}
+
+	if (mqttObject->link.resume)
+	{
+		return mqtt_ResumeSession(mqttObject, 3);
+	}
+
+	return mqtt_ConnectSession(mqttObject, 3);
+}
+
+//-------------------------------------------------------------------------------------------------------
+//delay of the next resume attempt : 0 none pending, 1 when due
+unsigned long mqtt_LinkRetryDelay(mqtt_instance_st * mqttObject)
+{
+	if (!mqttObject->link.resume || mqttObject->link.down)
+	{
+		return 0;
+	}
+
+	int left = left_ms(&mqttObject->link.retry);
+
+	return left > 1 ? (unsigned long) left : 1;
+}
+
+//-------------------------------------------------------------------------------------------------------
+//a session lost with the link is resumed when due (one attempt, the backlog is sent by mqtt_ProcessEvent),
+//returns the delay of the next attempt (0 : none)
+unsigned long mqtt_LinkRetry(mqtt_instance_st * mqttObject)
+{
+	if (!mqttObject->link.resume || mqttObject->link.down)
+	{
+		return 0;
+	}
+
+	if (!expired(&mqttObject->link.retry))
+	{
+		return mqtt_LinkRetryDelay(mqttObject);
+	}
+
+	if (mqtt_ResumeSession(mqttObject, 1) == SUCCESS)
+	{
+		return 0;
+	}
+
+	mqttObject->link.retryMs = mqttObject->link.retryMs ? mqttObject->link.retryMs * 2 : LINK_RETRY_MS;
+	if (mqttObject->link.retryMs > LINK_RETRY_MAX_MS)
+	{
+		mqttObject->link.retryMs = LINK_RETRY_MAX_MS;
+	}
+	countdown_ms(&mqttObject->link.retry, mqttObject->link.retryMs);
+
+	return mqttObject->link.retryMs;
+}
+
+//-------------------------------------------------------------------------------------------------------
+//the state only : the blocking connect of a resume is left to mqtt_ProcessEvent or mqtt_LinkRetry
+void mqtt_SetLinkState(mqtt_instance_st * mqttObject, int up)
+{
+	if (up && mqttObject->link.down)
+	{
+		mqttObject->link.down = 0;
+		mqttObject->link.ups++;
+
+		//the backoff of the attempts made before the link went down does not apply
+		mqttObject->link.retryMs = 0;
+		countdown_ms(&mqttObject->link.retry, 0);
+	}
+	else if (!up && !mqttObject->link.down)
+	{
+		mqttObject->link.down = 1;
+		mqttObject->link.downs++;
+
+		if (mqtt_IsConnected(mqttObject))
+		{
+			//the socket is dead : closed without DISCONNECT, the packet buffers and subscriptions are kept
+			mqtt_FlushInboundBatch(mqttObject);
+			mqttObject->network.disconnect(&mqttObject->network);
+			mqttObject->mqttClient.isconnected = 0;
+			mqttObject->link.resume = 1;
+			mqttObject->link.draining = 0;
+		}
+	}
+}
+
+//-------------------------------------------------------------------------------------------------------
+void* mqtt_CreateUserData(mqtt_instance_st * mqttObject)
+{
+	mqtt_ctxData_t* userCb =  (mqtt_ctxData_t*) mqtt_GetUserData(mqttObject, USER_DATA_INDEX);
+
+	if (!userCb)
+	{
+		mqtt_ctxData_t * userData = (mqtt_ctxData_t *) malloc(sizeof(mqtt_ctxData_t));
+		if (!userData)
+		{
+			return NULL;
+		}
+		memset(userData, 0, sizeof(mqtt_ctxData_t));
+
+		mqtt_SetUserData(mqttObject, userData, USER_DATA_INDEX);
+	}
+
+	return mqtt_GetUserData(mqttObject, USER_DATA_INDEX);
+}
+
+//-------------------------------------------------------------------------------------------------------
+void mqtt_SetCommandHandler(mqtt_instance_st * mqttObject, incomingMessageHandler pHandler, void * pUserContext)
+{
+	
+	mqtt_ctxData_t* userCb =  (mqtt_ctxData_t*) mqtt_CreateUserData(mqttObject);
+	
+	if (userCb)
+	{
+		userCb->pfnUserCommandHandler = pHandler;
+		userCb->pUserCommandContext = pUserContext;
+	}
+}
+
+//-------------------------------------------------------------------------------------------------------
+void mqtt_SetSoftwareInstallRequestHandler(mqtt_instance_st * mqttObject, softwareInstallRequestHandler pHandler, void * pUserContext)
+{
+	mqtt_ctxData_t* userCb =  (mqtt_ctxData_t*) mqtt_CreateUserData(mqttObject);
+	
+	if (userCb)
+	{
+		userCb->pfnUserSWInstallHandler = pHandler;
+		userCb->pUserSWInstallContext = pUserContext;
+	}
+}
+
+//-------------------------------------------------------------------------------------------------------
+void mqtt_SetBatchHandler(mqtt_instance_st * mqttObject, incomingBatchHandler pHandler, void * pUserContext)
+{
+	mqtt_ctxData_t* userCb =  (mqtt_ctxData_t*) mqtt_CreateUserData(mqttObject);
+
+	if (userCb)
+	{
+		userCb->pfnUserBatchHandler = pHandler;
+		userCb->pUserBatchContext = pUserContext;
+	}
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_SetInboundBatching(mqtt_instance_st * mqttObject, int maxMessages, int maxDelayMs)
+{
+	//deliver whatever has been accumulated with the previous settings
+	mqtt_FlushInboundBatch(mqttObject);
+
+	if (maxMessages <= 1)
+	{
+		//batching disabled, back to one event per message
+		if (mqttObject->inboundBatch.buffer)
+		{
+			free(mqttObject->inboundBatch.buffer);
+		}
+		memset(&mqttObject->inboundBatch, 0, sizeof(mqtt_inboundBatch_t));
+		return SUCCESS;
+	}
+
+	if (!mqttObject->inboundBatch.buffer)
+	{
+		mqttObject->inboundBatch.buffer = (unsigned char *) malloc(MAX_INBOUND_BATCH_SIZE);
+		if (!mqttObject->inboundBatch.buffer)
+		{
+			return FAILURE;
+		}
+	}
+
+	mqttObject->inboundBatch.maxMessages = maxMessages;
+	mqttObject->inboundBatch.maxDelayMs = (maxDelayMs > 0) ? maxDelayMs : DEFAULT_YIELD_TIMEOUT;
+
+	return SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------------------------
+void mqtt_FlushInboundBatch(mqtt_instance_st * mqttObject)
+{
+	mqtt_inboundBatch_t* batch = &mqttObject->inboundBatch;
+
+	if (batch->count == 0)
+	{
+		return;
+	}
+
+	mqtt_ctxData_t* userCb =  (mqtt_ctxData_t*) mqtt_GetUserData(mqttObject, USER_DATA_INDEX);
+
+	if (userCb && userCb->pfnUserBatchHandler)
+	{
+		userCb->pfnUserBatchHandler(batch->buffer, batch->used, (unsigned int) batch->count, userCb->pUserBatchContext);
+	}
+
+	batch->count = 0;
+	batch->used = 0;
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_SetOfflineStore(mqtt_instance_st * mqttObject, const char* directory, size_t maxBytes)
+{
+	//the messages already stored stay on disk, they are sent when the same directory is set again
+	mqtt_StoreClose(mqttObject->store);
+	mqttObject->store = NULL;
+
+	if (directory == NULL || strlen(directory) == 0 || maxBytes == 0)
+	{
+		return SUCCESS;
+	}
+
+	mqttObject->store = mqtt_StoreOpen(directory, maxBytes);
+
+	return mqttObject->store ? SUCCESS : FAILURE;
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_SetRateLimit(mqtt_instance_st * mqttObject, const char* topicPrefix, unsigned long messagesPerSec, unsigned long bytesPerSec)
+{
+	if (!mqttObject->limit && (mqttObject->limit = mqtt_LimitCreate()) == NULL)
+	{
+		return FAILURE;
+	}
+
+	return mqtt_LimitSet(mqttObject->limit, topicPrefix, messagesPerSec, bytesPerSec);
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_SetDeadband(mqtt_instance_st * mqttObject, const char* key, double absolute, double percent, unsigned long maxSilenceMs)
+{
+	if (!mqttObject->filter && (mqttObject->filter = mqtt_FilterCreate()) == NULL)
+	{
+		return FAILURE;
+	}
+
+	return mqtt_FilterSetDeadband(mqttObject->filter, key, absolute, percent, maxSilenceMs);
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_SetAggregation(mqtt_instance_st * mqttObject, const char* topicName, const char* key, unsigned long windowMs)
+{
+	if (!mqttObject->aggregate && (mqttObject->aggregate = mqtt_AggregateCreate()) == NULL)
+	{
+		return FAILURE;
+	}
+
+	return mqtt_AggregateSetWindow(mqttObject->aggregate, topicName, key, windowMs);
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_SetMessageTtl(mqtt_instance_st * mqttObject, const char* topicPrefix, unsigned long ttlMs, const char* summaryTopic)
+{
+	if (!mqttObject->expiry && (mqttObject->expiry = mqtt_ExpiryCreate()) == NULL)
+	{
+		return FAILURE;
+	}
+
+	//messages already queued keep their deadline
+	return mqtt_ExpirySetRule(mqttObject->expiry, topicPrefix, ttlMs, summaryTopic);
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_SetWakeSlots(mqtt_instance_st * mqttObject, unsigned long slotMs)
+{
+	if (slotMs == 0)
+	{
+		//messages held are sent by the next run
+		mqtt_WakeDelete(mqttObject->wake);
+		mqttObject->wake = NULL;
+		return SUCCESS;
+	}
+
+	if (!mqttObject->wake && (mqttObject->wake = mqtt_WakeCreate(slotMs)) == NULL)
+	{
+		return FAILURE;
+	}
+
+	mqttObject->wake->slotMs = slotMs;
+	mqttObject->wake->releaseAt = 0;
+
+	return SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_SetCompression(mqtt_instance_st * mqttObject, const char* topicPrefix, int codec, size_t minSize)
+{
+	if (!mqttObject->compress && (mqttObject->compress = mqtt_CompressCreate()) == NULL)
+	{
+		return FAILURE;
+	}
+
+	return mqtt_CompressSetRule(mqttObject->compress, topicPrefix, (mqtt_compression_t) codec, minSize);
+}
+
+//-------------------------------------------------------------------------------------------------------
+static int mqtt_QueueInboundMessage(mqtt_instance_st * mqttObject, MQTTString* topicName, MQTTMessage* message)
+{
+	mqtt_inboundBatch_t* batch = &mqttObject->inboundBatch;
+
+	size_t topicLen = (size_t) topicName->lenstring.len;
+	size_t payloadLen = message->payloadlen;
+	size_t recordLen = 6 + topicLen + payloadLen;
+
+	if (recordLen > MAX_INBOUND_BATCH_SIZE || topicLen > 0xFFFF)
+	{
+		//cannot fit in a batch, let the caller deliver it as a single message
+		mqtt_FlushInboundBatch(mqttObject);
+		return FAILURE;
+	}
+
+	if (batch->used + recordLen > MAX_INBOUND_BATCH_SIZE)
+	{
+		mqtt_FlushInboundBatch(mqttObject);
+	}
+
+	if (batch->count == 0)
+	{
+		countdown_ms(&batch->deadline, batch->maxDelayMs);
+	}
+
+	unsigned char* record = batch->buffer + batch->used;
+
+	record[0] = (unsigned char) (topicLen >> 8);
+	record[1] = (unsigned char) topicLen;
+	record[2] = (unsigned char) (payloadLen >> 24);
+	record[3] = (unsigned char) (payloadLen >> 16);
+	record[4] = (unsigned char) (payloadLen >> 8);
+	record[5] = (unsigned char) payloadLen;
+	memcpy(record + 6, topicName->lenstring.data, topicLen);
+	memcpy(record + 6 + topicLen, message->payload, payloadLen);
+
+	batch->used += recordLen;
+	batch->count++;
+
+	if (batch->count >= batch->maxMessages || expired(&batch->deadline))
+	{
+		mqtt_FlushInboundBatch(mqttObject);
+	}
+
+	return SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------------------------
+void mqtt_OnIncomingMessage(MessageData* md)
+{
+	/*
+		This is a callback function (handler), invoked by MQTT client whenever there is an incoming message
+		It performs the following actions :
+		  - deserialize the incoming MQTT JSON-formatted message
+		  - call convertDataToCSV()
+	*/
+
+	MQTTMessage* message = md->message;
+	MQTTString*  topicName = md->topicName;
+	Client*      client = md->client;
+
+	mqtt_instance_st * mqttObject = (mqtt_instance_st *) client->userCtxData;
+
+	mqtt_ctxData_t* userCb =  (mqtt_ctxData_t*) mqtt_GetUserData(mqttObject, USER_DATA_INDEX);
+
+	mqtt_arenaMark_t mark = mqtt_ArenaMark(mqttObject);
+
+	//compressed payload : delivered decompressed
+	MQTTMessage	inflatedMessage;
+	long		inflatedLen = mqtt_CompressedLength(message->payload, message->payloadlen);
+
+	if (inflatedLen >= 0 && inflatedLen <= MQTT_COMPRESS_MAX_INFLATED)
+	{
+		unsigned char* inflated = (unsigned char *) mqtt_ArenaAlloc(mqttObject, (size_t) inflatedLen + 1);
+
+		if (inflated && mqtt_Decompress(message->payload, message->payloadlen, inflated, (size_t) inflatedLen) == SUCCESS)
+		{
+			inflatedMessage = *message;
+			inflatedMessage.payload = inflated;
+			inflatedMessage.payloadlen = (size_t) inflatedLen;
+			message = &inflatedMessage;
+
+			if (mqttObject->compress || (mqttObject->compress = mqtt_CompressCreate()) != NULL)
+			{
+				mqttObject->compress->inflated++;
+			}
+		}
+	}
+
+	if (mqttObject->inboundBatch.maxMessages > 1 && userCb && userCb->pfnUserBatchHandler)
+	{
+		//batched delivery : no per-message copy nor handler call
+		if (mqtt_QueueInboundMessage(mqttObject, topicName, message) == SUCCESS)
+		{
+			mqtt_ArenaRelease(mqttObject, mark);
+			return;
+		}
+	}
+
+	int payloadLen = (int)message->payloadlen;
+
+	char* topic = mqtt_ArenaAlloc(mqttObject, topicName->lenstring.len + 1);
+	char* szPayload = (char *) mqtt_ArenaAlloc(mqttObject, payloadLen + 1);
+
+	if (!topic || !szPayload)
+	{
+		fprintf(stdout, "\nIncoming data dropped, no memory for %d bytes\n", payloadLen);
+		fflush(stdout);
+		mqttObject->arena.dropped++;
+		mqtt_ArenaRelease(mqttObject, mark);
+		return;
+	}
+
+	memcpy(topic, topicName->lenstring.data, topicName->lenstring.len);
+	topic[topicName->lenstring.len] = 0;
+
+	fprintf(stdout, "\nIncoming data from topic %s :\n", topic);
+	fprintf(stdout, "%.*s\n", payloadLen, (char*)message->payload);
+
+	memcpy(szPayload, (char*)message->payload, payloadLen);
+	szPayload[payloadLen] = 0;
+
+	if (userCb && userCb->pfnUserCommandHandler)
+	{
+		userCb->pfnUserCommandHandler(topic, "", szPayload, "", userCb->pUserCommandContext);
+	}
+
+	mqtt_ArenaRelease(mqttObject, mark);
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_SubscribeTopic(mqtt_instance_st * mqttObject, const char* topicName)
+{
+	fprintf(stdout, "Subscribing to topic %s... ", topicName);
+	int rc = MQTTSubscribe(&mqttObject->mqttClient, topicName, mqttObject->mqttConfig.qoS, mqtt_OnIncomingMessage);
+	fprintf(stdout, "%s\n", rc == 0 ? "OK" : (rc == BUFFER_OVERFLOW ? "Failed (topic filter too long)" : "Failed"));
+	//fprintf(stdout, "Subscribed %d\n", rc);
+	fflush(stdout);
+
+	return rc;
+}
+
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_UnsubscribeTopic(mqtt_instance_st * mqttObject, const char* topicName)
+{
+	fprintf(stdout, "Unsubscribing to %s\n", topicName);
+	int rc = MQTTUnsubscribe(&mqttObject->mqttClient, topicName);
+	fprintf(stdout, "Unsubscribed %d\n", rc);
+	fflush(stdout);
+
+	return rc;
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_StopSession(mqtt_instance_st * mqttObject)
+{
+	//do not hold back messages already received
+	mqtt_FlushInboundBatch(mqttObject);
+
+	//stopped by the user : not resumed by the link
+	mqttObject->link.resume = 0;
+	mqttObject->link.draining = 0;
+
+	//fprintf(stdout, "Disconnecting MQTT session");
+	//fflush(stdout);
+	int rc = MQTTDisconnect(&mqttObject->mqttClient);
+
+	//fprintf(stdout, "Disconnecting Network : %p", &mqttObject->network);
+	//fflush(stdout);
+	if (mqttObject->network.disconnect)
+	{
+		mqttObject->network.disconnect(&mqttObject->network);
+	}
+
+	mqtt_FreeBuffers(mqttObject);
+
+	return rc;
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_RolloverSession(mqtt_instance_st * mqttObject, const char* secret)
+{
+	/*
+		Make-before-break : replaces the session by a new one authenticated with secret (a renewed token...)
+		  - a second connection is opened and the subscriptions of the current session are made on it
+		  - the packets already received by the current session are delivered
+		  - the instance is switched to the new connection, then the old one is closed
+		On failure the current session is kept untouched.
+		Brokers enforcing unique client ids close the old connection as soon as the new one is accepted,
+		the subscriptions being in place, nothing is lost but what the broker had not sent yet.
+		Outbound packets are never in flight here : publishing waits for the broker acknowledgement.
+	*/
+	Network					network;
+	Client					client;
+	MQTTPacket_connectData	data;
+	unsigned char*			buffer;
+	unsigned char*			readBuffer;
+	char					password[sizeof(mqttObject->mqttConfig.secret)];
+	int						rc;
+	int						i;
+
+	if (strlen(secret) >= sizeof(password))
+	{
+		return FAILURE;
+	}
+	strcpy(password, secret);
+
+	if (!mqtt_IsConnected(mqttObject))
+	{
+		//nothing to keep up, the next session uses the new secret
+		strcpy(mqttObject->mqttConfig.secret, password);
+		return SUCCESS;
+	}
+
+	buffer = (unsigned char *) malloc(MAX_OUTBOUND_PAYLOAD_SIZE);
+	readBuffer = (unsigned char *) malloc(MAX_INBOUND_PAYLOAD_SIZE);
+
+	if (!buffer || !readBuffer)
+	{
+		free(buffer);
+		free(readBuffer);
+		return FAILURE;
+	}
+
+	fprintf(stdout, "mqtt_RolloverSession... connecting...");
+	fflush(stdout);
+
+	NewNetwork(&network, mqttObject->mqttConfig.useTLS);
+	rc = network.connect(&network, mqttObject->mqttConfig.serverUrl, mqttObject->mqttConfig.serverPort,
+							mqttObject->mqttConfig.tlsRootCA, mqttObject->mqttConfig.tlsCertificate, mqttObject->mqttConfig.tlsPrivateKey);
+
+	MQTTClient(&client, &network, TIMEOUT_MS, buffer, MAX_OUTBOUND_PAYLOAD_SIZE, readBuffer, MAX_INBOUND_PAYLOAD_SIZE);
+	client.userCtxData = (void *) mqttObject;
+	client.defaultMessageHandler = mqttObject->mqttClient.defaultMessageHandler;
+
+	memcpy(&data, &mqttObject->data, sizeof(MQTTPacket_connectData));
+	data.password.cstring = password;
+
+	if (rc == 0)
+	{
+		rc = MQTTConnect(&client, &data);
+	}
+
+	//each subscription with the QoS the broker granted it
+	for (i=0; rc == SUCCESS && i<MAX_MESSAGE_HANDLERS; i++)
+	{
+		if (mqttObject->mqttClient.messageHandlers[i].topicFilter[0] != '\0')
+		{
+			rc = MQTTSubscribe(&client, mqttObject->mqttClient.messageHandlers[i].topicFilter, mqttObject->mqttClient.messageHandlers[i].qos,
+								mqttObject->mqttClient.messageHandlers[i].fp);
+		}
+	}
+
+	fprintf(stdout, "%s\n", rc == SUCCESS ? "OK" : "Failed");
+	fflush(stdout);
+
+	if (rc != SUCCESS)
+	{
+		MQTTDisconnect(&client);
+		network.disconnect(&network);
+		free(buffer);
+		free(readBuffer);
+		return FAILURE;
+	}
+
+	MQTTYield(&mqttObject->mqttClient, ROLLOVER_DRAIN_MS);
+
+	//switch, the old session is moved out of the instance before being closed
+	Network			oldNetwork = mqttObject->network;
+	Client			oldClient = mqttObject->mqttClient;
+	unsigned char*	oldBuffer = mqttObject->mqttBuffer;
+	unsigned char*	oldReadBuffer = mqttObject->mqttReadBuffer;
+
+	mqttObject->network = network;
+	mqttObject->mqttClient = client;
+	mqttObject->mqttClient.ipstack = &mqttObject->network;
+	mqttObject->mqttBuffer = buffer;
+	mqttObject->mqttReadBuffer = readBuffer;
+	strcpy(mqttObject->mqttConfig.secret, password);
+	mqttObject->rollovers++;
+
+	oldClient.ipstack = &oldNetwork;
+	MQTTDisconnect(&oldClient);
+	oldNetwork.disconnect(&oldNetwork);
+	free(oldBuffer);
+	free(oldReadBuffer);
+
+	return SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_IsConnected(mqtt_instance_st * mqttObject)
+{
+	if (mqttObject)
+	{
+		return mqttObject->mqttClient.isconnected;
 	}
 	
 	return 0;
 }
+
+//-------------------------------------------------------------------------------------------------------
+size_t mqtt_GetMemoryFootprint(mqtt_instance_st * mqttObject)
+{
+	if (!mqttObject)
+	{
+		return 0;
+	}
+
+	size_t footprint = sizeof(mqtt_instance_st);
+
+	if (mqttObject->mqttBuffer)
+	{
+		footprint += MAX_OUTBOUND_PAYLOAD_SIZE;
+	}
+	if (mqttObject->mqttReadBuffer)
+	{
+		footprint += MAX_INBOUND_PAYLOAD_SIZE;
+	}
+	if (mqttObject->inboundBatch.buffer)
+	{
+		footprint += MAX_INBOUND_BATCH_SIZE;
+	}
+	if (mqttObject->arena.base)
+	{
+		footprint += MQTT_ARENA_SIZE;
+	}
+
+	mqtt_topic_st* topic;
+	for (topic = mqttObject->topics; topic; topic = topic->next)
+	{
+		footprint += sizeof(mqtt_topic_st) + strlen(topic->name) + 1 + topic->handle.buflen;
+	}
+
+	mqtt_hook_st* hook;
+	for (hook = mqttObject->hooks; hook; hook = hook->next)
+	{
+		footprint += sizeof(mqtt_hook_st);
+	}
+
+	int i;
+	for (i=0; i<MAX_USER_DATA; i++)
+	{
+		if (mqttObject->userCtxData[i])
+		{
+			footprint += sizeof(mqtt_ctxData_t);
+		}
+	}
+
+	if (mqttObject->store)
+	{
+		footprint += sizeof(mqtt_store_st);
+	}
+
+	footprint += mqtt_SchedFootprint(mqttObject->sched);
+
+	if (mqttObject->limit)
+	{
+		footprint += sizeof(mqtt_limit_st);
+	}
+
+	footprint += mqtt_FilterFootprint(mqttObject->filter);
+	footprint += mqtt_AggregateFootprint(mqttObject->aggregate);
+
+	if (mqttObject->compress)
+	{
+		footprint += sizeof(mqtt_compress_st);
+	}
+
+	if (mqttObject->wake)
+	{
+		footprint += sizeof(mqtt_wake_st);
+	}
+
+	if (mqttObject->expiry)
+	{
+		footprint += sizeof(mqtt_expiry_st);
+	}
+
+	if (mqttObject->network.useTLS && mqttObject->network.tlsSocketObject)
+	{
+		footprint += tlsSocket_get_footprint(mqttObject->network.tlsSocketObject);
+	}
+
+	return footprint;
+}
+
+//-------------------------------------------------------------------------------------------------------
+typedef unsigned long long (*mqtt_statGetter)(mqtt_instance_st * mqttObject);
+
+static unsigned long long mqtt_StatMemory(mqtt_instance_st * mqttObject)
+{
+	return (unsigned long long) mqtt_GetMemoryFootprint(mqttObject);
+}
+
+static unsigned long long mqtt_StatConnected(mqtt_instance_st * mqttObject)
+{
+	return (unsigned long long) mqtt_IsConnected(mqttObject);
+}
+
+static unsigned long long mqtt_StatArenaFallbacks(mqtt_instance_st * mqttObject)
+{
+	return (unsigned long long) mqttObject->arena.heapFallbacks;
+}
+
+static unsigned long long mqtt_StatArenaDropped(mqtt_instance_st * mqttObject)
+{
+	return (unsigned long long) mqttObject->arena.dropped;
+}
+
+static unsigned long long mqtt_StatArenaPeak(mqtt_instance_st * mqttObject)
+{
+	return (unsigned long long) mqttObject->arena.peak;
+}
+
+static unsigned long long mqtt_StatRollovers(mqtt_instance_st * mqttObject)
+{
+	return (unsigned long long) mqttObject->rollovers;
+}
+
+static unsigned long long mqtt_StatStorePending(mqtt_instance_st * mqttObject)
+{
+	return (unsigned long long) mqtt_StorePending(mqttObject->store);
+}
+
+static unsigned long long mqtt_StatStoreDropped(mqtt_instance_st * mqttObject)
+{
+	return mqttObject->store ? (unsigned long long) mqttObject->store->dropped : 0;
+}
+
+static unsigned long long mqtt_StatStorePoisoned(mqtt_instance_st * mqttObject)
+{
+	return mqttObject->store ? (unsigned long long) mqttObject->store->poisoned : 0;
+}
+
+static unsigned long long mqtt_StatSchedQueued(mqtt_instance_st * mqttObject)
+{
+	return (unsigned long long) mqtt_SchedQueued(mqttObject->sched);
+}
+
+static unsigned long long mqtt_StatSchedAlarmWait(mqtt_instance_st * mqttObject)
+{
+	return mqttObject->sched ? mqttObject->sched->maxWaitMs[MQTT_PRIORITY_ALARM] : 0;
+}
+
+static unsigned long long mqtt_StatLimitThrottled(mqtt_instance_st * mqttObject)
+{
+	return mqttObject->limit ? (unsigned long long) mqttObject->limit->throttled : 0;
+}
+
+static unsigned long long mqtt_StatFilterSuppressed(mqtt_instance_st * mqttObject)
+{
+	return mqttObject->filter ? (unsigned long long) mqttObject->filter->suppressed : 0;
+}
+
+static unsigned long long mqtt_StatFilterKeys(mqtt_instance_st * mqttObject)
+{
+	return mqttObject->filter ? (unsigned long long) mqttObject->filter->entryCount : 0;
+}
+
+static unsigned long long mqtt_StatAggregateSamples(mqtt_instance_st * mqttObject)
+{
+	return mqttObject->aggregate ? (unsigned long long) mqttObject->aggregate->samples : 0;
+}
+
+static unsigned long long mqtt_StatAggregateWindows(mqtt_instance_st * mqttObject)
+{
+	return mqttObject->aggregate ? (unsigned long long) mqttObject->aggregate->windows : 0;
+}
+
+static unsigned long long mqtt_StatCompress(mqtt_instance_st * mqttObject, mqtt_compression_t codec, int field)
+{
+	if (!mqttObject->compress)
+	{
+		return 0;
+	}
+
+	mqtt_compressStats_t* stats = &mqttObject->compress->stats[codec];
+
+	return field == 0 ? stats->bytesIn : field == 1 ? stats->bytesOut : stats->cpuUs;
+}
+
+static unsigned long long mqtt_StatLzIn(mqtt_instance_st * mqttObject)
+{
+	return mqtt_StatCompress(mqttObject, MQTT_COMPRESSION_LZ, 0);
+}
+
+static unsigned long long mqtt_StatLzOut(mqtt_instance_st * mqttObject)
+{
+	return mqtt_StatCompress(mqttObject, MQTT_COMPRESSION_LZ, 1);
+}
+
+static unsigned long long mqtt_StatLzCpu(mqtt_instance_st * mqttObject)
+{
+	return mqtt_StatCompress(mqttObject, MQTT_COMPRESSION_LZ, 2);
+}
+
+static unsigned long long mqtt_StatDeflateIn(mqtt_instance_st * mqttObject)
+{
+	return mqtt_StatCompress(mqttObject, MQTT_COMPRESSION_DEFLATE, 0);
+}
+
+static unsigned long long mqtt_StatDeflateOut(mqtt_instance_st * mqttObject)
+{
+	return mqtt_StatCompress(mqttObject, MQTT_COMPRESSION_DEFLATE, 1);
+}
+
+static unsigned long long mqtt_StatDeflateCpu(mqtt_instance_st * mqttObject)
+{
+	return mqtt_StatCompress(mqttObject, MQTT_COMPRESSION_DEFLATE, 2);
+}
+
+static unsigned long long mqtt_StatCompressSkipped(mqtt_instance_st * mqttObject)
+{
+	return mqttObject->compress ? (unsigned long long) mqttObject->compress->skipped : 0;
+}
+
+static unsigned long long mqtt_StatCompressInflated(mqtt_instance_st * mqttObject)
+{
+	return mqttObject->compress ? (unsigned long long) mqttObject->compress->inflated : 0;
+}
+
+static unsigned long long mqtt_StatLinkUps(mqtt_instance_st * mqttObject)
+{
+	return mqttObject->link.ups;
+}
+
+static unsigned long long mqtt_StatLinkDowns(mqtt_instance_st * mqttObject)
+{
+	return mqttObject->link.downs;
+}
+
+static unsigned long long mqtt_StatLinkResumes(mqtt_instance_st * mqttObject)
+{
+	return mqttObject->link.resumes;
+}
+
+static unsigned long long mqtt_StatLinkDeferred(mqtt_instance_st * mqttObject)
+{
+	return mqttObject->link.deferred;
+}
+
+static unsigned long long mqtt_StatWakePings(mqtt_instance_st * mqttObject)
+{
+	return mqttObject->wake ? (unsigned long long) mqttObject->wake->pings : 0;
+}
+
+static unsigned long long mqtt_StatWakeHeld(mqtt_instance_st * mqttObject)
+{
+	return mqttObject->wake ? (unsigned long long) mqttObject->wake->held : 0;
+}
+
+static unsigned long long mqtt_StatExpiredQueue(mqtt_instance_st * mqttObject)
+{
+	return mqttObject->sched ? (unsigned long long) mqttObject->sched->expired : 0;
+}
+
+static unsigned long long mqtt_StatExpiredStore(mqtt_instance_st * mqttObject)
+{
+	return mqttObject->store ? (unsigned long long) mqttObject->store->expired : 0;
+}
+
+static unsigned long long mqtt_StatExpiredSummaries(mqtt_instance_st * mqttObject)
+{
+	return mqttObject->expiry ? (unsigned long long) mqttObject->expiry->summaries : 0;
+}
+
+static const struct {
+	const char*			name;
+	mqtt_statGetter		getter;
+} g_mqttStats[] = {
+	{ "memory.bytes",		mqtt_StatMemory },
+	{ "session.connected",	mqtt_StatConnected },
+	{ "arena.fallbacks",	mqtt_StatArenaFallbacks },	//heap allocations of the publish and dispatch paths
+	{ "arena.peak",			mqtt_StatArenaPeak },
+	{ "arena.dropped",		mqtt_StatArenaDropped },	//incoming messages dropped, no memory to copy them
+	{ "session.rollovers",	mqtt_StatRollovers },		//sessions replaced without disconnection
+	{ "store.pending",		mqtt_StatStorePending },	//messages of the offline store not sent yet
+	{ "store.dropped",		mqtt_StatStoreDropped },	//messages evicted from the offline store
+	{ "store.poisoned",		mqtt_StatStorePoisoned },	//stored messages dropped after repeated failed publishes
+	{ "sched.queued",		mqtt_StatSchedQueued },		//prioritized messages waiting to be sent
+	{ "sched.alarm.maxwait",	mqtt_StatSchedAlarmWait },	//longest time an alarm waited in its queue, in ms
+	{ "limit.throttled",	mqtt_StatLimitThrottled },	//sends deferred by the rate limiter, each attempt counted
+	{ "filter.suppressed",	mqtt_StatFilterSuppressed },	//key/value samples within their deadband, not published
+	{ "filter.keys",		mqtt_StatFilterKeys },		//(topic, key) pairs whose last value is kept
+	{ "aggregate.samples",	mqtt_StatAggregateSamples },	//key/value samples summarized instead of published
+	{ "aggregate.windows",	mqtt_StatAggregateWindows },	//summaries emitted
+	{ "compress.lz.in",		mqtt_StatLzIn },			//payload bytes compressed, the ratio is in / out
+	{ "compress.lz.out",	mqtt_StatLzOut },
+	{ "compress.lz.cpuus",	mqtt_StatLzCpu },			//thread CPU time spent compressing, in us
+	{ "compress.deflate.in",	mqtt_StatDeflateIn },
+	{ "compress.deflate.out",	mqtt_StatDeflateOut },
+	{ "compress.deflate.cpuus",	mqtt_StatDeflateCpu },
+	{ "compress.skipped",	mqtt_StatCompressSkipped },	//payloads sent as they are, not smaller once compressed
+	{ "compress.inflated",	mqtt_StatCompressInflated },	//inbound payloads decompressed
+	{ "link.up",			mqtt_StatLinkUps },			//data link transitions, see mqtt_SetLinkState
+	{ "link.down",			mqtt_StatLinkDowns },
+	{ "link.resumed",		mqtt_StatLinkResumes },		//sessions started again once the link is back
+	{ "link.deferred",		mqtt_StatLinkDeferred },	//session starts refused while the link is down
+	{ "wake.pings",			mqtt_StatWakePings },		//keepalives sent ahead of time on a shared wake-up, see mqtt_SetWakeSlots
+	{ "wake.held",			mqtt_StatWakeHeld },		//deferrable messages queued while waiting for a slot
+	{ "expired.queue",		mqtt_StatExpiredQueue },	//messages of the priority queues dropped past their TTL, see mqtt_SetMessageTtl
+	{ "expired.store",		mqtt_StatExpiredStore },	//records of the offline store skipped past their TTL
+	{ "expired.summaries",	mqtt_StatExpiredSummaries },//summary records of the expired messages published
+};
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_GetStat(mqtt_instance_st * mqttObject, const char* statName, unsigned long long* value)
+{
+	size_t i;
+
+	for (i=0; i<sizeof(g_mqttStats)/sizeof(g_mqttStats[0]); i++)
+	{
+		if (strcmp(g_mqttStats[i].name, statName) == 0)
+		{
+			*value = g_mqttStats[i].getter(mqttObject);
+			return SUCCESS;
+		}
+	}
+
+	return FAILURE;
+}
@@ -38,6 +38,7 @@
 #define _MQTT_GENERIC_H_
 
 #include "MQTTClient.h"
+#include "mqttJson.h"
 
 #define MQTT_BROKER		"MqttBrokerUrl"
 #define	MQTT_PORT		"MqttBrokerPort"
@@ -49,6 +50,9 @@
 
 #define 	MAX_OUTBOUND_PAYLOAD_SIZE		1024	//Default payload buffer size
 #define 	MAX_INBOUND_PAYLOAD_SIZE		1024	//Default payload buffer size
+#define 	MAX_INBOUND_BATCH_SIZE			4096	//Size of the arena accumulating batched incoming messages
+#define 	MQTT_ARENA_SIZE					4096	//Scratch memory of the publish and dispatch paths
+#define 	MQTT_FILE_MAX_SIZE				262144	//Largest file accepted by mqtt_PublishFile
 
 #define		SIZE_DEVICE_ID					256
 
@@ -70,28 +74,143 @@ typedef struct
 
 #define MAX_USER_DATA       3
 
+/*
+	Batched inbound delivery (opt-in)
+	Incoming messages are packed back to back in the arena, each record being :
+		[topic length : 2 bytes, big endian][payload length : 4 bytes, big endian][topic][payload]
+	The batch is delivered when maxMessages are queued, when the arena is full or when maxDelayMs is elapsed
+*/
+typedef struct {
+	int						maxMessages;		//0 or 1 : batching disabled
+	int						maxDelayMs;
+	int						count;
+	size_t					used;
+	Timer					deadline;
+	unsigned char*			buffer;				//allocated when batching is enabled
+} mqtt_inboundBatch_t;
+
+/*
+	Data link (cellular bearer...) state, reported by the upper layer (le_data on Legato)
+	While the link is down no session is attempted and nothing is written : messages wait in the offline
+	store or the priority queues. A session lost with the link is resumed as soon as the link is back
+	(retried with backoff if it fails), then its backlog is sent at full speed. A session started while
+	the link is down is deferred (MQTT_DEFERRED) and started like a resumed one.
+	The resume is attempted by mqtt_ProcessEvent, or by mqtt_LinkRetry when mqtt_LinkRetryDelay is due :
+	mqtt_SetLinkState only records the state, it does not connect.
+*/
+#define		MQTT_DEFERRED					1		//mqtt_StartSession : started once the link is back
+
+typedef struct {
+	int						down;
+	int						resume;				//session to start again, lost with the link
+	int						draining;			//backlog being sent after a resume
+	unsigned long			retryMs;			//backoff of the next attempt, 0 : right away
+	Timer					retry;
+	unsigned long			ups;
+	unsigned long			downs;
+	unsigned long			resumes;			//sessions started again by the link
+	unsigned long			deferred;			//session starts deferred while the link is down
+} mqtt_link_t;
+
+/*
+	Per instance bump arena : scratch memory of the publish and dispatch paths (payload formatting,
+	topic and payload copies, decoded JSON values).
+	Users take a mark before allocating and release it when the message is done, so that nested users
+	(an ack published from a dispatched message) do not discard the memory of their caller.
+	Requests which do not fit fall back to the heap and are counted, steady state messaging should not.
+*/
+typedef struct {
+	unsigned char*			base;				//allocated while a session is started
+	size_t					used;
+	size_t					peak;
+	void*					overflow;			//heap blocks of the requests which did not fit
+	unsigned long			heapFallbacks;
+	unsigned long			dropped;			//incoming messages dropped, no memory to copy them
+} mqtt_arena_t;
+
+typedef struct {
+	size_t					used;
+	void*					overflow;
+} mqtt_arenaMark_t;
+
+/*
+	Registered topic : the topic is encoded once in the handle, publishing on it only patches
+	the remaining length and packet id, the payload is sent without copy
+*/
+typedef struct mqtt_topic_st {
+	MQTTTopicHandle			handle;
+	struct mqtt_topic_st*	next;
+	char					name[];				//topic name, for the messages stored while offline
+} mqtt_topic_st;
+
+struct mqtt_hook_st;
+struct mqtt_store_st;
+struct mqtt_sched_st;
+struct mqtt_limit_st;
+struct mqtt_filter_st;
+struct mqtt_aggregate_st;
+struct mqtt_compress_st;
+struct mqtt_wake_st;
+struct mqtt_expiry_st;
+
 typedef struct {
 	mqtt_config_t			mqttConfig;
 
 	Network 				network;
 	Client 					mqttClient;
 	MQTTPacket_connectData	data;
-	unsigned char			mqttBuffer[MAX_OUTBOUND_PAYLOAD_SIZE];
-	unsigned char			mqttReadBuffer[MAX_INBOUND_PAYLOAD_SIZE];
+	unsigned char*			mqttBuffer;			//allocated while a session is started, MAX_OUTBOUND_PAYLOAD_SIZE
+	unsigned char*			mqttReadBuffer;		//allocated while a session is started, MAX_INBOUND_PAYLOAD_SIZE
 	void*					userCtxData[MAX_USER_DATA];
+	mqtt_inboundBatch_t		inboundBatch;
+	mqtt_link_t				link;				//see mqtt_SetLinkState
+	mqtt_arena_t			arena;
+	mqtt_topic_st*			topics;				//registered topics, released with the instance
+	struct mqtt_hook_st*	hooks;				//deferred work run by mqtt_ProcessEvent
+	unsigned long			rollovers;			//sessions replaced by mqtt_RolloverSession
+	struct mqtt_store_st*	store;				//outbound store-and-forward queue, see mqtt_SetOfflineStore
+	struct mqtt_sched_st*	sched;				//priority queues, created by the first mqtt_PublishWithPriority
+	struct mqtt_limit_st*	limit;				//rate limiter, see mqtt_SetRateLimit
+	struct mqtt_filter_st*	filter;				//report-by-exception of key/value samples, see mqtt_SetDeadband
+	struct mqtt_aggregate_st*	aggregate;		//windowed summaries of key/value samples, see mqtt_SetAggregation
+	struct mqtt_compress_st*	compress;		//payload compression, see mqtt_SetCompression
+	struct mqtt_wake_st*	wake;				//shared wake-up slots, see mqtt_SetWakeSlots
+	struct mqtt_expiry_st*	expiry;				//message time-to-live, see mqtt_SetMessageTtl
 } mqtt_instance_st;
 
+/*
+	Process hooks : work deferred by the upper layers (flushing buffered data...), run by mqtt_ProcessEvent
+	once the incoming packets are handled, outside of the paho callbacks.
+	The context is owned by the hook : pfnRelease (optional) is called when the hook is removed or
+	the instance deleted.
+*/
+typedef void (*mqtt_processHook)(mqtt_instance_st* mqttObject, void* context);
+
+typedef struct mqtt_hook_st {
+	mqtt_processHook		pfnProcess;
+	mqtt_processHook		pfnRelease;
+	void*					context;
+	struct mqtt_hook_st*	next;
+} mqtt_hook_st;
+
 typedef void (*incomingMessageHandler)(const char* topic, const char* key, const char* value, const char* timestamp, void* pUserContext);
+typedef void (*incomingBatchHandler)(const unsigned char* batch, size_t batchLen, unsigned int messageCount, void* pUserContext);
 typedef void (*softwareInstallRequestHandler)(const char* uid, const char* type, const char* revision, const char* url, const char* timestamp, void * pUserContext);
+typedef void (*downloadProgressHandler)(const char* uid, unsigned long long received, unsigned long long total, int status, void * pUserContext);
 
 typedef struct {
 	incomingMessageHandler			pfnUserCommandHandler;
 	void*							pUserCommandContext;
 	softwareInstallRequestHandler	pfnUserSWInstallHandler;
 	void*							pUserSWInstallContext;
+	incomingBatchHandler			pfnUserBatchHandler;
+	void*							pUserBatchContext;
+	downloadProgressHandler			pfnUserDownloadHandler;
+	void*							pUserDownloadContext;
 } mqtt_ctxData_t;
 
 void mqtt_GetDefaultConfig(mqtt_config_t* mqttConfig);
+void mqtt_NormalizeConfig(mqtt_config_t* mqttConfig);
 
 mqtt_instance_st * mqtt_CreateInstance(mqtt_config_t* mqttConfig);
 void mqtt_SetTls(mqtt_instance_st* mqttObject, const char* rootCAFile, const char* certificateFile, const char * privateKeyFile);
@@ -103,16 +222,56 @@ void mqtt_GetConfig(mqtt_instance_st * mqttObject, mqtt_config_t* mqttConfig);
 int mqtt_StartSession(mqtt_instance_st * mqttObject);
 int mqtt_StopSession(mqtt_instance_st * mqttObject);
 int mqtt_IsConnected(mqtt_instance_st * mqttObject);
+int mqtt_RolloverSession(mqtt_instance_st * mqttObject, const char* secret);
+void mqtt_SetLinkState(mqtt_instance_st * mqttObject, int up);
+unsigned long mqtt_LinkRetryDelay(mqtt_instance_st * mqttObject);
+unsigned long mqtt_LinkRetry(mqtt_instance_st * mqttObject);
 
 int mqtt_SubscribeTopic(mqtt_instance_st * mqttObject, const char* topicName);
 int mqtt_UnsubscribeTopic(mqtt_instance_st * mqttObject, const char* topicName);
 
 int mqtt_ProcessEvent(mqtt_instance_st * mqttObject, unsigned waitDelayMs);
 
+int   mqtt_AddProcessHook(mqtt_instance_st * mqttObject, mqtt_processHook pfnProcess, mqtt_processHook pfnRelease, void* context);
+void* mqtt_GetProcessHookContext(mqtt_instance_st * mqttObject, mqtt_processHook pfnProcess);
+void  mqtt_RemoveProcessHook(mqtt_instance_st * mqttObject, mqtt_processHook pfnProcess);
+
+void* mqtt_ArenaAlloc(mqtt_instance_st * mqttObject, size_t size);
+mqtt_arenaMark_t mqtt_ArenaMark(mqtt_instance_st * mqttObject);
+void mqtt_ArenaRelease(mqtt_instance_st * mqttObject, mqtt_arenaMark_t mark);
+
+size_t mqtt_GetMemoryFootprint(mqtt_instance_st * mqttObject);
+int  mqtt_GetStat(mqtt_instance_st * mqttObject, const char* statName, unsigned long long* value);
+
 int  mqtt_PublishKeyValue(mqtt_instance_st * mqttObject, const char* szKey, const char* szValue, const char* topicName);
 int  mqtt_PublishData(mqtt_instance_st * mqttObject, const char* data, size_t dataLen, const char* topicName);
+int  mqtt_PublishWithPriority(mqtt_instance_st * mqttObject, const char* data, size_t dataLen, const char* topicName, int priority);	//mqtt_priority_t, see mqttSched.h
+int  mqtt_PublishWithTtl(mqtt_instance_st * mqttObject, const char* data, size_t dataLen, const char* topicName, int priority, unsigned long ttlMs);
+int  mqtt_PublishCompressed(mqtt_instance_st * mqttObject, const char* data, size_t dataLen, const char* topicName, int codec);	//mqtt_compression_t, see mqttCompress.h
+int  mqtt_PublishFile(mqtt_instance_st * mqttObject, const char* fileName, const char* topicName, int priority, int codec);
+
+mqtt_topic_st* mqtt_RegisterTopic(mqtt_instance_st * mqttObject, const char* topicName, int qoS, int retain);
+void mqtt_UnregisterTopic(mqtt_instance_st * mqttObject, mqtt_topic_st* topic);
+int  mqtt_PublishToTopic(mqtt_instance_st * mqttObject, mqtt_topic_st* topic, const char* data, size_t dataLen);
+int  mqtt_PublishKeyValueToTopic(mqtt_instance_st * mqttObject, mqtt_topic_st* topic, const char* szKey, const char* szValue);
+
+void mqtt_InitJsonWriter(mqtt_instance_st * mqttObject, mqtt_jsonWriter_t* writer, const char* topicName);
+int  mqtt_PublishJson(mqtt_instance_st * mqttObject, mqtt_jsonWriter_t* writer, const char* topicName);
+int  mqtt_PublishJsonToTopic(mqtt_instance_st * mqttObject, mqtt_jsonWriter_t* writer, mqtt_topic_st* topic);
 
 void mqtt_SetCommandHandler(mqtt_instance_st * mqttObject, incomingMessageHandler pHandler, void * pUserContext);
 void mqtt_SetSoftwareInstallRequestHandler(mqtt_instance_st * mqttObject, softwareInstallRequestHandler pHandler, void * pUserContext);
+void mqtt_SetBatchHandler(mqtt_instance_st * mqttObject, incomingBatchHandler pHandler, void * pUserContext);
+
+int  mqtt_SetInboundBatching(mqtt_instance_st * mqttObject, int maxMessages, int maxDelayMs);
+void mqtt_FlushInboundBatch(mqtt_instance_st * mqttObject);
+
+int  mqtt_SetOfflineStore(mqtt_instance_st * mqttObject, const char* directory, size_t maxBytes);
+int  mqtt_SetRateLimit(mqtt_instance_st * mqttObject, const char* topicPrefix, unsigned long messagesPerSec, unsigned long bytesPerSec);
+int  mqtt_SetDeadband(mqtt_instance_st * mqttObject, const char* key, double absolute, double percent, unsigned long maxSilenceMs);
+int  mqtt_SetAggregation(mqtt_instance_st * mqttObject, const char* topicName, const char* key, unsigned long windowMs);
+int  mqtt_SetCompression(mqtt_instance_st * mqttObject, const char* topicPrefix, int codec, size_t minSize);
+int  mqtt_SetWakeSlots(mqtt_instance_st * mqttObject, unsigned long slotMs);
+int  mqtt_SetMessageTtl(mqtt_instance_st * mqttObject, const char* topicPrefix, unsigned long ttlMs, const char* summaryTopic);
 
 #endif	//_MQTT_GENERIC_H_
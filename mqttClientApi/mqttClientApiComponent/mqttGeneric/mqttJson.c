@@ -0,0 +1,872 @@
+/*******************************************************************************************************************
+
+ MQTT JSON helpers
+
+	Single pass JSON tokenizer (jsmn style) and streaming JSON writer, see mqttJson.h
+
+	View of the stack :
+	_________________________
+
+	 mqttAirVantage interface
+	_________________________
+
+	 mqttJson  <--- this file
+	_________________________
+
+	 mqttGeneric interface
+	_________________________
+
+*******************************************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <memory.h>
+
+#include "mqttJson.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define MQTT_JSON_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define MQTT_JSON_NEON
+#endif
+
+//-------------------------------------------------------------------------------------------------------
+static mqtt_jsonToken_t* mqtt_JsonAllocToken(mqtt_jsonToken_t* tokens, int* count, int maxTokens, mqtt_jsonType_t type, int start, int end, int parent)
+{
+	if (*count >= maxTokens)
+	{
+		return NULL;
+	}
+
+	mqtt_jsonToken_t* token = &tokens[*count];
+
+	token->type = type;
+	token->start = start;
+	token->end = end;
+	token->size = 0;
+	token->parent = parent;
+	token->skip = *count + 1;
+
+	(*count)++;
+
+	if (parent >= 0)
+	{
+		tokens[parent].size++;
+	}
+
+	return token;
+}
+
+//-------------------------------------------------------------------------------------------------------
+//a child of an object is a key following a ',' (or the '{'), a key has a single value after its ':'
+static int mqtt_JsonCanAdd(const mqtt_jsonToken_t* tokens, int super, mqtt_jsonType_t type, int separated)
+{
+	if (super < 0)
+	{
+		return 1;
+	}
+
+	if (tokens[super].type == MQTT_JSON_OBJECT)
+	{
+		return type == MQTT_JSON_STRING && separated;
+	}
+
+	if (tokens[super].type == MQTT_JSON_STRING)
+	{
+		return tokens[super].size == 0;
+	}
+
+	return 1;
+}
+
+//-------------------------------------------------------------------------------------------------------
+//tokens mqtt_JsonTokenize allocates for the payload (an upper bound if it is not valid JSON)
+int mqtt_JsonCountTokens(const char* json, size_t len)
+{
+	int		count = 0;
+	size_t	pos;
+
+	for (pos = 0; pos < len && json[pos] != '\0'; pos++)
+	{
+		switch (json[pos])
+		{
+			case '{':
+			case '[':
+				count++;
+				break;
+
+			case '\"':
+				for (pos++; pos < len && json[pos] != '\0' && json[pos] != '\"'; pos++)
+				{
+					if (json[pos] == '\\' && pos + 1 < len)
+					{
+						pos++;
+					}
+				}
+				count++;
+				break;
+
+			case '}':
+			case ']':
+			case ':':
+			case ',':
+			case ' ':
+			case '\t':
+			case '\r':
+			case '\n':
+				break;
+
+			default:
+				while (pos + 1 < len && json[pos + 1] != '\0' && json[pos + 1] != ',' && json[pos + 1] != ']' && json[pos + 1] != '}'
+						&& json[pos + 1] != ' ' && json[pos + 1] != '\t' && json[pos + 1] != '\r' && json[pos + 1] != '\n')
+				{
+					pos++;
+				}
+				count++;
+				break;
+		}
+	}
+
+	return count;
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_JsonTokenize(const char* json, size_t len, mqtt_jsonToken_t* tokens, int maxTokens)
+{
+	int		count = 0;
+	int		super = -1;		//token receiving the next value : container or key
+	int		separated = 1;	//no key since the last '{' or ','
+	size_t	pos;
+
+	for (pos = 0; pos < len && json[pos] != '\0'; pos++)
+	{
+		char c = json[pos];
+
+		switch (c)
+		{
+			case '{':
+			case '[':
+				if (!mqtt_JsonCanAdd(tokens, super, (c == '{') ? MQTT_JSON_OBJECT : MQTT_JSON_ARRAY, separated))
+				{
+					return MQTT_JSON_ERROR_INVAL;
+				}
+				if (!mqtt_JsonAllocToken(tokens, &count, maxTokens, (c == '{') ? MQTT_JSON_OBJECT : MQTT_JSON_ARRAY, (int) pos, -1, super))
+				{
+					return MQTT_JSON_ERROR_NOMEM;
+				}
+				super = count - 1;
+				separated = 1;
+				break;
+
+			case '}':
+			case ']':
+			{
+				mqtt_jsonType_t type = (c == '}') ? MQTT_JSON_OBJECT : MQTT_JSON_ARRAY;
+				int i = super;
+
+				//from the current key, its value given, to its object
+				if (i >= 0 && tokens[i].type == MQTT_JSON_STRING)
+				{
+					if (tokens[i].size != 1)
+					{
+						return MQTT_JSON_ERROR_INVAL;
+					}
+					i = tokens[i].parent;
+				}
+				//an object is closed on the value of its last key, or empty
+				else if (i >= 0 && tokens[i].type == MQTT_JSON_OBJECT && tokens[i].size != 0)
+				{
+					return MQTT_JSON_ERROR_INVAL;
+				}
+
+				if (i < 0 || tokens[i].type != type || tokens[i].end >= 0)
+				{
+					return MQTT_JSON_ERROR_INVAL;
+				}
+
+				tokens[i].end = (int) pos + 1;
+				tokens[i].skip = count;
+				super = tokens[i].parent;
+				separated = 0;
+				break;
+			}
+
+			case '\"':
+			{
+				size_t start = pos + 1;
+
+				for (pos = start; pos < len && json[pos] != '\0' && json[pos] != '\"'; pos++)
+				{
+					if (json[pos] == '\\' && pos + 1 < len)
+					{
+						pos++;
+					}
+				}
+
+				if (pos >= len || json[pos] != '\"')
+				{
+					return MQTT_JSON_ERROR_PART;
+				}
+
+				if (!mqtt_JsonCanAdd(tokens, super, MQTT_JSON_STRING, separated))
+				{
+					return MQTT_JSON_ERROR_INVAL;
+				}
+				if (!mqtt_JsonAllocToken(tokens, &count, maxTokens, MQTT_JSON_STRING, (int) start, (int) pos, super))
+				{
+					return MQTT_JSON_ERROR_NOMEM;
+				}
+				separated = 0;
+				break;
+			}
+
+			case ':':
+				//the key just read, a direct child of the current object, without a value yet
+				if (count == 0 || tokens[count - 1].type != MQTT_JSON_STRING || tokens[count - 1].size != 0 ||
+					super < 0 || tokens[super].type != MQTT_JSON_OBJECT || tokens[count - 1].parent != super)
+				{
+					return MQTT_JSON_ERROR_INVAL;
+				}
+				super = count - 1;
+				break;
+
+			case ',':
+				if (super >= 0 && tokens[super].type == MQTT_JSON_STRING)
+				{
+					//value of a key completed, back to the object
+					if (tokens[super].size != 1)
+					{
+						return MQTT_JSON_ERROR_INVAL;
+					}
+					super = tokens[super].parent;
+				}
+				else if (super >= 0 && tokens[super].type == MQTT_JSON_OBJECT)
+				{
+					//a key without its value
+					return MQTT_JSON_ERROR_INVAL;
+				}
+				separated = 1;
+				break;
+
+			case ' ':
+			case '\t':
+			case '\r':
+			case '\n':
+				break;
+
+			default:
+			{
+				size_t start = pos;
+
+				while (pos < len && json[pos] != '\0' && json[pos] != ',' && json[pos] != ']' && json[pos] != '}'
+						&& json[pos] != ' ' && json[pos] != '\t' && json[pos] != '\r' && json[pos] != '\n')
+				{
+					pos++;
+				}
+
+				if (!mqtt_JsonCanAdd(tokens, super, MQTT_JSON_PRIMITIVE, separated))
+				{
+					return MQTT_JSON_ERROR_INVAL;
+				}
+				if (!mqtt_JsonAllocToken(tokens, &count, maxTokens, MQTT_JSON_PRIMITIVE, (int) start, (int) pos, super))
+				{
+					return MQTT_JSON_ERROR_NOMEM;
+				}
+				separated = 0;
+				pos--;
+				break;
+			}
+		}
+	}
+
+	int i;
+	for (i=0; i<count; i++)
+	{
+		if (tokens[i].end < 0)
+		{
+			return MQTT_JSON_ERROR_PART;
+		}
+	}
+
+	return count;
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_JsonEquals(const char* json, const mqtt_jsonToken_t* token, const char* str)
+{
+	size_t len = strlen(str);
+
+	return (token->type == MQTT_JSON_STRING || token->type == MQTT_JSON_PRIMITIVE)
+			&& (size_t) (token->end - token->start) == len
+			&& strncmp(json + token->start, str, len) == 0;
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_JsonFind(const char* json, const mqtt_jsonToken_t* tokens, int object, const char* key)
+{
+	//returns the index of the value of key in object, -1 if not found
+	if (object < 0 || tokens[object].type != MQTT_JSON_OBJECT)
+	{
+		return -1;
+	}
+
+	int i;
+	int k = object + 1;
+
+	for (i=0; i<tokens[object].size; i++)
+	{
+		if (mqtt_JsonEquals(json, &tokens[k], key))
+		{
+			return k + 1;
+		}
+		k = tokens[k + 1].skip;
+	}
+
+	return -1;
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_JsonChild(const mqtt_jsonToken_t* tokens, int parent, int childIndex)
+{
+	//returns the index of the nth element of an array or nth key of an object, -1 if out of range
+	if (parent < 0 || childIndex < 0 || childIndex >= tokens[parent].size)
+	{
+		return -1;
+	}
+
+	int i;
+	int k = parent + 1;
+
+	for (i=0; i<childIndex; i++)
+	{
+		k = (tokens[parent].type == MQTT_JSON_OBJECT) ? tokens[k + 1].skip : tokens[k].skip;
+	}
+
+	return k;
+}
+
+//-------------------------------------------------------------------------------------------------------
+char* mqtt_JsonString(char* json, const mqtt_jsonToken_t* token)
+{
+	//terminates the token in place, the JSON must not be tokenized again afterwards
+	json[token->end] = '\0';
+
+	return json + token->start;
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_JsonCopy(const char* json, const mqtt_jsonToken_t* token, char* buffer, size_t bufferSize)
+{
+	size_t len = (size_t) (token->end - token->start);
+
+	if (len + 1 > bufferSize)
+	{
+		return MQTT_JSON_ERROR_NOMEM;
+	}
+
+	memcpy(buffer, json + token->start, len);
+	buffer[len] = '\0';
+
+	return (int) len;
+}
+
+//-------------------------------------------------------------------------------------------------------
+void mqtt_JsonWriterInit(mqtt_jsonWriter_t* writer, char* buffer, size_t size, int growable)
+{
+	memset(writer, 0, sizeof(mqtt_jsonWriter_t));
+
+	writer->buffer = buffer;
+	writer->size = buffer ? size : 0;
+	writer->growable = growable;
+
+	if (writer->buffer && writer->size > 0)
+	{
+		writer->buffer[0] = '\0';
+	}
+}
+
+//-------------------------------------------------------------------------------------------------------
+void mqtt_JsonWriterFree(mqtt_jsonWriter_t* writer)
+{
+	if (writer->owned)
+	{
+		free(writer->buffer);
+	}
+
+	writer->buffer = NULL;
+	writer->size = 0;
+	writer->len = 0;
+	writer->owned = 0;
+}
+
+//-------------------------------------------------------------------------------------------------------
+char* mqtt_JsonWriterDetach(mqtt_jsonWriter_t* writer)
+{
+	//returns the heap buffer holding the JSON, to be freed by the caller
+	char* buffer = NULL;
+
+	if (!writer->error)
+	{
+		if (!writer->owned)
+		{
+			buffer = (char *) malloc(writer->len + 1);
+			if (buffer)
+			{
+				memcpy(buffer, writer->buffer ? writer->buffer : "", writer->len);
+				buffer[writer->len] = '\0';
+			}
+		}
+		else
+		{
+			buffer = writer->buffer;
+			writer->owned = 0;
+		}
+	}
+
+	mqtt_JsonWriterFree(writer);
+
+	return buffer;
+}
+
+//-------------------------------------------------------------------------------------------------------
+static int mqtt_JsonReserve(mqtt_jsonWriter_t* writer, size_t len)
+{
+	//room for len bytes and the terminating zero
+	if (writer->error)
+	{
+		return 0;
+	}
+
+	if (writer->len + len + 1 <= writer->size)
+	{
+		return 1;
+	}
+
+	if (!writer->growable)
+	{
+		writer->error = 1;
+		return 0;
+	}
+
+	size_t size = (writer->size > 0) ? writer->size * 2 : 256;
+
+	while (size < writer->len + len + 1)
+	{
+		size *= 2;
+	}
+
+	char* buffer = writer->owned ? (char *) realloc(writer->buffer, size) : (char *) malloc(size);
+
+	if (!buffer)
+	{
+		writer->error = 1;
+		return 0;
+	}
+
+	if (!writer->owned && writer->len > 0)
+	{
+		memcpy(buffer, writer->buffer, writer->len);
+	}
+
+	writer->buffer = buffer;
+	writer->size = size;
+	writer->owned = 1;
+
+	return 1;
+}
+
+//-------------------------------------------------------------------------------------------------------
+void mqtt_JsonWriteRaw(mqtt_jsonWriter_t* writer, const char* data, size_t len)
+{
+	if (mqtt_JsonReserve(writer, len))
+	{
+		memcpy(writer->buffer + writer->len, data, len);
+		writer->len += len;
+		writer->buffer[writer->len] = '\0';
+	}
+}
+
+//-------------------------------------------------------------------------------------------------------
+static void mqtt_JsonSeparator(mqtt_jsonWriter_t* writer)
+{
+	//before an item : ',' if the current container already has one, nothing right after a key
+	if (writer->afterKey)
+	{
+		writer->afterKey = 0;
+		return;
+	}
+
+	unsigned long bit = 1UL << writer->depth;
+
+	if (writer->hasItems & bit)
+	{
+		mqtt_JsonWriteRaw(writer, ",", 1);
+	}
+
+	writer->hasItems |= bit;
+}
+
+//-------------------------------------------------------------------------------------------------------
+static void mqtt_JsonBegin(mqtt_jsonWriter_t* writer, const char* marker)
+{
+	mqtt_JsonSeparator(writer);
+	mqtt_JsonWriteRaw(writer, marker, 1);
+
+	if (writer->depth + 1 >= MQTT_JSON_MAX_DEPTH)
+	{
+		writer->error = 1;
+		return;
+	}
+
+	writer->depth++;
+	writer->hasItems &= ~(1UL << writer->depth);
+}
+
+//-------------------------------------------------------------------------------------------------------
+static void mqtt_JsonEnd(mqtt_jsonWriter_t* writer, const char* marker)
+{
+	if (writer->depth > 0)
+	{
+		writer->depth--;
+	}
+
+	mqtt_JsonWriteRaw(writer, marker, 1);
+}
+
+//-------------------------------------------------------------------------------------------------------
+void mqtt_JsonBeginObject(mqtt_jsonWriter_t* writer)
+{
+	mqtt_JsonBegin(writer, "{");
+}
+
+//-------------------------------------------------------------------------------------------------------
+void mqtt_JsonEndObject(mqtt_jsonWriter_t* writer)
+{
+	mqtt_JsonEnd(writer, "}");
+}
+
+//-------------------------------------------------------------------------------------------------------
+void mqtt_JsonBeginArray(mqtt_jsonWriter_t* writer)
+{
+	mqtt_JsonBegin(writer, "[");
+}
+
+//-------------------------------------------------------------------------------------------------------
+void mqtt_JsonEndArray(mqtt_jsonWriter_t* writer)
+{
+	mqtt_JsonEnd(writer, "]");
+}
+
+//-------------------------------------------------------------------------------------------------------
+static size_t mqtt_JsonEscapeSpan(const unsigned char* p, size_t len)
+{
+	//number of leading bytes which need no escaping : not a control character, quote or backslash
+	size_t i = 0;
+
+#if defined(MQTT_JSON_SSE2)
+	const __m128i quote = _mm_set1_epi8('\"');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i control = _mm_set1_epi8(0x1F);
+
+	for (; i + 32 <= len; i += 32)
+	{
+		__m128i v0 = _mm_loadu_si128((const __m128i *) (p + i));
+		__m128i v1 = _mm_loadu_si128((const __m128i *) (p + i + 16));
+		__m128i m0 = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v0, quote), _mm_cmpeq_epi8(v0, backslash)),
+								  _mm_cmpeq_epi8(_mm_min_epu8(v0, control), v0));
+		__m128i m1 = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v1, quote), _mm_cmpeq_epi8(v1, backslash)),
+								  _mm_cmpeq_epi8(_mm_min_epu8(v1, control), v1));
+		unsigned int mask = (unsigned int) _mm_movemask_epi8(m0) | ((unsigned int) _mm_movemask_epi8(m1) << 16);
+
+		if (mask)
+		{
+			return i + (size_t) __builtin_ctz(mask);
+		}
+	}
+
+	for (; i + 16 <= len; i += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *) (p + i));
+		__m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+								 _mm_cmpeq_epi8(_mm_min_epu8(v, control), v));
+		unsigned int mask = (unsigned int) _mm_movemask_epi8(m);
+
+		if (mask)
+		{
+			return i + (size_t) __builtin_ctz(mask);
+		}
+	}
+#elif defined(MQTT_JSON_NEON)
+	const uint8x16_t quote = vdupq_n_u8('\"');
+	const uint8x16_t backslash = vdupq_n_u8('\\');
+	const uint8x16_t space = vdupq_n_u8(0x20);
+
+	for (; i + 16 <= len; i += 16)
+	{
+		uint8x16_t v = vld1q_u8(p + i);
+		uint64x2_t m = vreinterpretq_u64_u8(vorrq_u8(vorrq_u8(vceqq_u8(v, quote), vceqq_u8(v, backslash)), vcltq_u8(v, space)));
+
+		if (vgetq_lane_u64(m, 0) | vgetq_lane_u64(m, 1))
+		{
+			break;	//located by the scalar loop
+		}
+	}
+#endif
+
+	for (; i < len; i++)
+	{
+		if (p[i] < 0x20 || p[i] == '\"' || p[i] == '\\')
+		{
+			break;
+		}
+	}
+
+	return i;
+}
+
+//-------------------------------------------------------------------------------------------------------
+static size_t mqtt_JsonAsciiSpan(const unsigned char* p, size_t len)
+{
+	//number of leading ASCII bytes
+	size_t i = 0;
+
+#if defined(MQTT_JSON_SSE2)
+	for (; i + 16 <= len; i += 16)
+	{
+		unsigned int mask = (unsigned int) _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) (p + i)));
+
+		if (mask)
+		{
+			return i + (size_t) __builtin_ctz(mask);
+		}
+	}
+#elif defined(MQTT_JSON_NEON)
+	for (; i + 16 <= len; i += 16)
+	{
+		uint64x2_t v = vreinterpretq_u64_u8(vld1q_u8(p + i));
+
+		if ((vgetq_lane_u64(v, 0) | vgetq_lane_u64(v, 1)) & 0x8080808080808080ULL)
+		{
+			break;	//located by the scalar loop
+		}
+	}
+#endif
+
+	for (; i < len && p[i] < 0x80; i++)
+	{
+	}
+
+	return i;
+}
+
+//-------------------------------------------------------------------------------------------------------
+static size_t mqtt_JsonUtf8SequenceLength(const unsigned char* p, size_t len)
+{
+	//length of the valid UTF-8 sequence starting at p, 0 if invalid (overlong, surrogate, > U+10FFFF, truncated)
+	unsigned char c = p[0];
+
+	if (c < 0x80)
+	{
+		return 1;
+	}
+	if (c < 0xC2)
+	{
+		return 0;
+	}
+	if (c < 0xE0)
+	{
+		return (len >= 2 && (p[1] & 0xC0) == 0x80) ? 2 : 0;
+	}
+	if (c < 0xF0)
+	{
+		if (len < 3 || (p[1] & 0xC0) != 0x80 || (p[2] & 0xC0) != 0x80)
+		{
+			return 0;
+		}
+		if ((c == 0xE0 && p[1] < 0xA0) || (c == 0xED && p[1] > 0x9F))
+		{
+			return 0;
+		}
+		return 3;
+	}
+	if (c < 0xF5)
+	{
+		if (len < 4 || (p[1] & 0xC0) != 0x80 || (p[2] & 0xC0) != 0x80 || (p[3] & 0xC0) != 0x80)
+		{
+			return 0;
+		}
+		if ((c == 0xF0 && p[1] < 0x90) || (c == 0xF4 && p[1] > 0x8F))
+		{
+			return 0;
+		}
+		return 4;
+	}
+
+	return 0;
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_JsonIsValidUtf8(const char* str, size_t len)
+{
+	const unsigned char* p = (const unsigned char *) str;
+	size_t pos = 0;
+
+	while (pos < len)
+	{
+		pos += mqtt_JsonAsciiSpan(p + pos, len - pos);
+
+		if (pos < len)
+		{
+			size_t n = mqtt_JsonUtf8SequenceLength(p + pos, len - pos);
+
+			if (n == 0)
+			{
+				return 0;
+			}
+			pos += n;
+		}
+	}
+
+	return 1;
+}
+
+//-------------------------------------------------------------------------------------------------------
+static void mqtt_JsonWriteEscapeChar(mqtt_jsonWriter_t* writer, unsigned char c)
+{
+	static const char hex[] = "0123456789abcdef";
+
+	switch (c)
+	{
+		case '\"':	mqtt_JsonWriteRaw(writer, "\\\"", 2);	break;
+		case '\\':	mqtt_JsonWriteRaw(writer, "\\\\", 2);	break;
+		case '\n':	mqtt_JsonWriteRaw(writer, "\\n", 2);	break;
+		case '\r':	mqtt_JsonWriteRaw(writer, "\\r", 2);	break;
+		case '\t':	mqtt_JsonWriteRaw(writer, "\\t", 2);	break;
+		case '\b':	mqtt_JsonWriteRaw(writer, "\\b", 2);	break;
+		case '\f':	mqtt_JsonWriteRaw(writer, "\\f", 2);	break;
+		default:
+		{
+			char escape[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0x0F] };
+			mqtt_JsonWriteRaw(writer, escape, 6);
+			break;
+		}
+	}
+}
+
+//-------------------------------------------------------------------------------------------------------
+static void mqtt_JsonWriteSanitized(mqtt_jsonWriter_t* writer, const unsigned char* p, size_t len)
+{
+	//slow path for invalid UTF-8 : each invalid byte is replaced by U+FFFD
+	size_t pos = 0;
+	size_t run = 0;
+
+	while (pos < len)
+	{
+		size_t n = mqtt_JsonUtf8SequenceLength(p + pos, len - pos);
+
+		if (n == 1 && p[pos] >= 0x20 && p[pos] != '\"' && p[pos] != '\\')
+		{
+			pos++;
+			continue;
+		}
+		if (n > 1)
+		{
+			pos += n;
+			continue;
+		}
+
+		mqtt_JsonWriteRaw(writer, (const char *) p + run, pos - run);
+		if (n == 1)
+		{
+			mqtt_JsonWriteEscapeChar(writer, p[pos]);
+		}
+		else
+		{
+			mqtt_JsonWriteRaw(writer, "\\ufffd", 6);
+		}
+		pos++;
+		run = pos;
+	}
+
+	mqtt_JsonWriteRaw(writer, (const char *) p + run, pos - run);
+}
+
+//-------------------------------------------------------------------------------------------------------
+static void mqtt_JsonWriteEscaped(mqtt_jsonWriter_t* writer, const char* value)
+{
+	const unsigned char* p = (const unsigned char *) value;
+	size_t len = strlen(value);
+	size_t pos = 0;
+
+	mqtt_JsonWriteRaw(writer, "\"", 1);
+
+	if (!mqtt_JsonIsValidUtf8(value, len))
+	{
+		mqtt_JsonWriteSanitized(writer, p, len);
+	}
+	else
+	{
+		//copy the runs which need no escaping, 16/32 bytes per step with SIMD
+		while (pos < len)
+		{
+			size_t n = mqtt_JsonEscapeSpan(p + pos, len - pos);
+
+			mqtt_JsonWriteRaw(writer, (const char *) p + pos, n);
+			pos += n;
+
+			if (pos < len)
+			{
+				mqtt_JsonWriteEscapeChar(writer, p[pos]);
+				pos++;
+			}
+		}
+	}
+
+	mqtt_JsonWriteRaw(writer, "\"", 1);
+}
+
+//-------------------------------------------------------------------------------------------------------
+void mqtt_JsonWriteKey(mqtt_jsonWriter_t* writer, const char* key)
+{
+	mqtt_JsonSeparator(writer);
+	mqtt_JsonWriteEscaped(writer, key);
+	mqtt_JsonWriteRaw(writer, ":", 1);
+	writer->afterKey = 1;
+}
+
+//-------------------------------------------------------------------------------------------------------
+void mqtt_JsonWriteString(mqtt_jsonWriter_t* writer, const char* value)
+{
+	mqtt_JsonSeparator(writer);
+	mqtt_JsonWriteEscaped(writer, value ? value : "");
+}
+
+//-------------------------------------------------------------------------------------------------------
+void mqtt_JsonWriteNumber(mqtt_jsonWriter_t* writer, const char* format, ...)
+{
+	char		szNumber[32];
+	va_list		args;
+
+	va_start(args, format);
+	int len = vsnprintf(szNumber, sizeof(szNumber), format, args);
+	va_end(args);
+
+	if (len < 0 || len >= (int) sizeof(szNumber))
+	{
+		writer->error = 1;
+		return;
+	}
+
+	mqtt_JsonSeparator(writer);
+	mqtt_JsonWriteRaw(writer, szNumber, (size_t) len);
+}
+
+//-------------------------------------------------------------------------------------------------------
+void mqtt_JsonWriteKeyValue(mqtt_jsonWriter_t* writer, const char* key, const char* value)
+{
+	mqtt_JsonWriteKey(writer, key);
+	mqtt_JsonWriteString(writer, value);
+}
@@ -0,0 +1,101 @@
+/*******************************************************************************************************************
+
+ MQTT JSON helpers
+
+	Single pass JSON tokenizer (jsmn style) : the payload is scanned once into a flat array of tokens
+	supplied by the caller, then keys are looked up and children iterated on the token array.
+	No allocation is performed, values are referenced by their offsets in the payload.
+	mqtt_JsonCountTokens gives the number of tokens of a payload, to size the array beforehand.
+
+	Streaming JSON writer : values are appended with escaping into a caller buffer (such as the MQTT send
+	buffer) or into a heap buffer grown geometrically. Separators are inserted by the writer.
+	Strings are validated as UTF-8 (invalid bytes written as U+FFFD) and escaped, both scans use
+	SSE2 or NEON when available and fall back to scalar code otherwise.
+
+	Token layout :
+		- an object has one child per key, each key (string) has one child : its value (a key without
+		  its ':' and a single value is rejected, so the value of a key is always the token after it)
+		- an array has one child per element
+		- skip is the index of the token following the whole subtree, used to step over a value
+
+	View of the stack :
+	_________________________
+
+	 mqttAirVantage interface
+	_________________________
+
+	 mqttJson  <--- this file
+	_________________________
+
+	 mqttGeneric interface
+	_________________________
+
+*******************************************************************************************************************/
+
+#ifndef _MQTT_JSON_H_
+#define _MQTT_JSON_H_
+
+#include <stddef.h>
+
+#define		MQTT_JSON_ERROR_NOMEM		-1		//not enough tokens
+#define		MQTT_JSON_ERROR_INVAL		-2		//invalid character, or key without a single value
+#define		MQTT_JSON_ERROR_PART		-3		//incomplete JSON
+
+typedef enum {
+	MQTT_JSON_UNDEFINED = 0,
+	MQTT_JSON_OBJECT,
+	MQTT_JSON_ARRAY,
+	MQTT_JSON_STRING,
+	MQTT_JSON_PRIMITIVE
+} mqtt_jsonType_t;
+
+typedef struct {
+	mqtt_jsonType_t		type;
+	int					start;			//offset of the first character (after the quote for strings)
+	int					end;			//offset after the last character (on the closing quote for strings)
+	int					size;			//number of children
+	int					parent;
+	int					skip;			//index of the token after this subtree
+} mqtt_jsonToken_t;
+
+#define		MQTT_JSON_MAX_DEPTH			32
+
+typedef struct {
+	char*				buffer;
+	size_t				size;
+	size_t				len;
+	int					growable;		//switch to / grow a heap buffer when full
+	int					owned;			//buffer is allocated by the writer
+	int					error;			//sticky : overflow or allocation failure
+	int					depth;
+	int					afterKey;
+	unsigned long		hasItems;		//one bit per depth : a separator is needed before the next item
+} mqtt_jsonWriter_t;
+
+int  mqtt_JsonCountTokens(const char* json, size_t len);
+int  mqtt_JsonTokenize(const char* json, size_t len, mqtt_jsonToken_t* tokens, int maxTokens);
+
+int  mqtt_JsonFind(const char* json, const mqtt_jsonToken_t* tokens, int object, const char* key);
+int  mqtt_JsonChild(const mqtt_jsonToken_t* tokens, int parent, int childIndex);
+int  mqtt_JsonEquals(const char* json, const mqtt_jsonToken_t* token, const char* str);
+
+char* mqtt_JsonString(char* json, const mqtt_jsonToken_t* token);
+int  mqtt_JsonCopy(const char* json, const mqtt_jsonToken_t* token, char* buffer, size_t bufferSize);
+
+int  mqtt_JsonIsValidUtf8(const char* str, size_t len);
+
+void mqtt_JsonWriterInit(mqtt_jsonWriter_t* writer, char* buffer, size_t size, int growable);
+void mqtt_JsonWriterFree(mqtt_jsonWriter_t* writer);
+char* mqtt_JsonWriterDetach(mqtt_jsonWriter_t* writer);
+
+void mqtt_JsonWriteRaw(mqtt_jsonWriter_t* writer, const char* data, size_t len);
+void mqtt_JsonBeginObject(mqtt_jsonWriter_t* writer);
+void mqtt_JsonEndObject(mqtt_jsonWriter_t* writer);
+void mqtt_JsonBeginArray(mqtt_jsonWriter_t* writer);
+void mqtt_JsonEndArray(mqtt_jsonWriter_t* writer);
+void mqtt_JsonWriteKey(mqtt_jsonWriter_t* writer, const char* key);
+void mqtt_JsonWriteString(mqtt_jsonWriter_t* writer, const char* value);
+void mqtt_JsonWriteNumber(mqtt_jsonWriter_t* writer, const char* format, ...);
+void mqtt_JsonWriteKeyValue(mqtt_jsonWriter_t* writer, const char* key, const char* value);
+
+#endif	//_MQTT_JSON_H_
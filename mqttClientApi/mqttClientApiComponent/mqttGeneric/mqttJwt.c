@@ -0,0 +1,276 @@
+/*******************************************************************************************************************
+
+ MQTT JSON Web Token
+
+	Builds and signs a JWT in memory, see mqttJwt.h
+
+*******************************************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mqttJwt.h"
+#include "tlsKeyCache.h"
+
+#include "mbedtls/base64.h"
+#include "mbedtls/sha256.h"
+#include "mbedtls/ecdsa.h"
+#include "mbedtls/rsa.h"
+
+#define		JWT_HEADER_RS256		"{\"alg\":\"RS256\",\"typ\":\"JWT\"}"
+#define		JWT_HEADER_ES256		"{\"alg\":\"ES256\",\"typ\":\"JWT\"}"
+#define		JWT_MAX_CLAIMS			512
+
+typedef struct {
+	char					privateKeyFile[128];
+	char					audience[256];
+	int						validitySec;
+	Timer					renewAt;
+} mqtt_jwtRollover_t;
+
+//-------------------------------------------------------------------------------------------------------
+static int mqtt_JwtAppendBase64Url(char* jwt, size_t jwtSize, size_t* len, const unsigned char* data, size_t dataLen)
+{
+	size_t	written = 0;
+
+	if (mbedtls_base64url_encode((unsigned char *) jwt + *len, jwtSize - *len, &written, data, dataLen) != 0)
+	{
+		return FAILURE;
+	}
+
+	*len += written;
+
+	return SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------------------------
+static int mqtt_JwtSign(mbedtls_pk_context* pk, const unsigned char hash[32], unsigned char* signature, size_t* signatureLen)
+{
+	if (mbedtls_pk_get_type(pk) == MBEDTLS_PK_RSA)
+	{
+		mbedtls_rsa_context* rsa = mbedtls_pk_rsa(*pk);
+
+		if (mbedtls_rsa_pkcs1_sign(rsa, tlsKeyCache_random, NULL, MBEDTLS_RSA_PRIVATE, MBEDTLS_MD_SHA256, 32, hash, signature) != 0)
+		{
+			return FAILURE;
+		}
+		*signatureLen = rsa->len;
+
+		return SUCCESS;
+	}
+	else
+	{
+		//JWS wants r || s, 32 bytes each, instead of the DER sequence of mbedtls_pk_sign
+		mbedtls_ecp_keypair*	ec = mbedtls_pk_ec(*pk);
+		mbedtls_mpi				r, s;
+		int						rc = FAILURE;
+
+		mbedtls_mpi_init(&r);
+		mbedtls_mpi_init(&s);
+
+		if (mbedtls_ecdsa_sign_det(&ec->grp, &r, &s, &ec->d, hash, 32, MBEDTLS_MD_SHA256) == 0 &&
+			mbedtls_mpi_write_binary(&r, signature, 32) == 0 &&
+			mbedtls_mpi_write_binary(&s, signature + 32, 32) == 0)
+		{
+			*signatureLen = 64;
+			rc = SUCCESS;
+		}
+
+		mbedtls_mpi_free(&r);
+		mbedtls_mpi_free(&s);
+
+		return rc;
+	}
+}
+
+//-------------------------------------------------------------------------------------------------------
+static int mqtt_JwtBuild(mbedtls_pk_context* pk, const char* privateKeyFile, const char* audience, int validitySec, char* jwt, size_t jwtSize)
+{
+	const char*			header;
+	char				claims[JWT_MAX_CLAIMS];
+	mqtt_jsonWriter_t	writer;
+	unsigned char		hash[32];
+	unsigned char		signature[MBEDTLS_MPI_MAX_SIZE];
+	size_t				signatureLen = 0;
+	size_t				len = 0;
+	time_t				now = time(NULL);
+
+	if (mbedtls_pk_get_type(pk) == MBEDTLS_PK_RSA)
+	{
+		header = JWT_HEADER_RS256;
+	}
+	else if (mbedtls_pk_can_do(pk, MBEDTLS_PK_ECDSA) && mbedtls_pk_ec(*pk)->grp.id == MBEDTLS_ECP_DP_SECP256R1)
+	{
+		header = JWT_HEADER_ES256;
+	}
+	else
+	{
+		fprintf(stdout, "JWT : unsupported key type in %s\n", privateKeyFile);
+		return FAILURE;
+	}
+
+	if (validitySec <= 0)
+	{
+		validitySec = MQTT_JWT_DEFAULT_VALIDITY;
+	}
+
+	mqtt_JsonWriterInit(&writer, claims, sizeof(claims), 0);
+	mqtt_JsonBeginObject(&writer);
+	mqtt_JsonWriteKeyValue(&writer, "aud", audience);
+	mqtt_JsonWriteKey(&writer, "iat");
+	mqtt_JsonWriteNumber(&writer, "%lu", (unsigned long) now);
+	mqtt_JsonWriteKey(&writer, "exp");
+	mqtt_JsonWriteNumber(&writer, "%lu", (unsigned long) now + (unsigned long) validitySec);
+	mqtt_JsonEndObject(&writer);
+
+	if (writer.error || jwtSize == 0)
+	{
+		return FAILURE;
+	}
+
+	//header.claims is signed, then .signature appended
+	if (mqtt_JwtAppendBase64Url(jwt, jwtSize, &len, (const unsigned char *) header, strlen(header)) != SUCCESS || len + 1 >= jwtSize)
+	{
+		return FAILURE;
+	}
+	jwt[len++] = '.';
+
+	if (mqtt_JwtAppendBase64Url(jwt, jwtSize, &len, (const unsigned char *) claims, writer.len) != SUCCESS)
+	{
+		return FAILURE;
+	}
+
+	mbedtls_sha256((const unsigned char *) jwt, len, hash, 0);
+
+	if (mqtt_JwtSign(pk, hash, signature, &signatureLen) != SUCCESS || len + 1 >= jwtSize)
+	{
+		return FAILURE;
+	}
+	jwt[len++] = '.';
+
+	if (mqtt_JwtAppendBase64Url(jwt, jwtSize, &len, signature, signatureLen) != SUCCESS)
+	{
+		return FAILURE;
+	}
+
+	return (int) len;
+}
+
+int mqtt_JwtCreate(const char* privateKeyFile, const char* audience, int validitySec, char* jwt, size_t jwtSize)
+{
+	//returns the length of the token written in jwt, FAILURE if the key cannot be used or jwt is too small
+	mbedtls_pk_context*	pk = tlsKeyCache_get(privateKeyFile);
+
+	if (pk == NULL)
+	{
+		return FAILURE;
+	}
+
+	int rc = mqtt_JwtBuild(pk, privateKeyFile, audience, validitySec, jwt, jwtSize);
+
+	tlsKeyCache_release(pk);
+
+	return rc;
+}
+
+//-------------------------------------------------------------------------------------------------------
+static int mqtt_JwtRenew(mqtt_instance_st * mqttObject, mqtt_jwtRollover_t* rollover)
+{
+	char	jwt[sizeof(mqttObject->mqttConfig.secret)];
+	int		margin = rollover->validitySec / 10;
+
+	if (mqtt_JwtCreate(rollover->privateKeyFile, rollover->audience, rollover->validitySec, jwt, sizeof(jwt)) < 0 ||
+		mqtt_RolloverSession(mqttObject, jwt) != SUCCESS)
+	{
+		fprintf(stdout, "JWT : renewal failed, retrying in %d s\n", MQTT_JWT_RETRY_DELAY);
+		fflush(stdout);
+		countdown(&rollover->renewAt, MQTT_JWT_RETRY_DELAY);
+		return FAILURE;
+	}
+
+	if (margin > MQTT_JWT_RENEW_MARGIN)
+	{
+		margin = MQTT_JWT_RENEW_MARGIN;
+	}
+	countdown(&rollover->renewAt, rollover->validitySec - margin);
+
+	return SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------------------------
+static void mqtt_JwtProcessRollover(mqtt_instance_st * mqttObject, void* context)
+{
+	mqtt_jwtRollover_t* rollover = (mqtt_jwtRollover_t *) context;
+
+	if (expired(&rollover->renewAt))
+	{
+		mqtt_JwtRenew(mqttObject, rollover);
+	}
+}
+
+//-------------------------------------------------------------------------------------------------------
+static void mqtt_JwtReleaseRollover(mqtt_instance_st * mqttObject, void* context)
+{
+	free(context);
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_JwtSetRollover(mqtt_instance_st * mqttObject, const char* privateKeyFile, const char* audience, int validitySec)
+{
+	/*
+		The secret is replaced by a token signed now : a started session is rolled over right away,
+		the age of its token being unknown. privateKeyFile empty : rollover disabled
+	*/
+	mqtt_jwtRollover_t* rollover = mqtt_GetProcessHookContext(mqttObject, mqtt_JwtProcessRollover);
+
+	if (privateKeyFile == NULL || privateKeyFile[0] == 0)
+	{
+		mqtt_RemoveProcessHook(mqttObject, mqtt_JwtProcessRollover);
+		return SUCCESS;
+	}
+
+	if (strlen(privateKeyFile) >= sizeof(rollover->privateKeyFile) || strlen(audience) >= sizeof(rollover->audience))
+	{
+		return FAILURE;
+	}
+
+	if (rollover == NULL)
+	{
+		rollover = (mqtt_jwtRollover_t *) malloc(sizeof(mqtt_jwtRollover_t));
+
+		if (rollover == NULL || mqtt_AddProcessHook(mqttObject, mqtt_JwtProcessRollover, mqtt_JwtReleaseRollover, rollover) != SUCCESS)
+		{
+			free(rollover);
+			return FAILURE;
+		}
+	}
+
+	strcpy(rollover->privateKeyFile, privateKeyFile);
+	strcpy(rollover->audience, audience);
+	rollover->validitySec = (validitySec > 0) ? validitySec : MQTT_JWT_DEFAULT_VALIDITY;
+	InitTimer(&rollover->renewAt);
+
+	if (mqtt_JwtRenew(mqttObject, rollover) != SUCCESS)
+	{
+		mqtt_RemoveProcessHook(mqttObject, mqtt_JwtProcessRollover);
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_JwtRenewIfDue(mqtt_instance_st * mqttObject)
+{
+	//process hooks do not run without session : called before starting one, so that it does not use an expired token
+	mqtt_jwtRollover_t* rollover = mqtt_GetProcessHookContext(mqttObject, mqtt_JwtProcessRollover);
+
+	if (rollover == NULL || !expired(&rollover->renewAt))
+	{
+		return SUCCESS;
+	}
+
+	return mqtt_JwtRenew(mqttObject, rollover);
+}
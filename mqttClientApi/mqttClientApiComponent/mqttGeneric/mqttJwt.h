@@ -0,0 +1,48 @@
+/*******************************************************************************************************************
+
+ MQTT JSON Web Token
+
+	Builds the JWT used as MQTT password by Google Cloud IoT Core :
+		base64url(header) . base64url({"aud" : audience, "iat" : now, "exp" : now + validity}) . base64url(signature)
+
+	The algorithm follows the private key : RS256 for a RSA key, ES256 for a P-256 EC key
+	(deterministic ECDSA, raw r || s signature). Keys are parsed once and cached (tlsKeyCache).
+
+	Rollover : the broker closes the session when the token used as password expires. With a rollover
+	policy the next token is signed ahead of expiry (process hook) and the session replaced
+	make-before-break by mqtt_RolloverSession. A failed renewal is retried while the old token is valid.
+
+	View of the stack :
+	_________________________
+
+	 mqttClient service
+	_________________________
+
+	 mqttJwt  <--- this file
+	_________________________
+
+	 TLSinterface (key cache)
+	_________________________
+
+	 Mbed TLS
+	_________________________
+
+*******************************************************************************************************************/
+
+#ifndef _MQTT_JWT_H_
+#define _MQTT_JWT_H_
+
+#include <stddef.h>
+
+#include "mqttGeneric.h"
+
+#define		MQTT_JWT_DEFAULT_VALIDITY		3600	//seconds, Google accepts up to 24 hours
+#define		MQTT_JWT_RENEW_MARGIN			300		//seconds, renewal before expiry (at most a tenth of the validity)
+#define		MQTT_JWT_RETRY_DELAY			30		//seconds, after a failed renewal
+
+int  mqtt_JwtCreate(const char* privateKeyFile, const char* audience, int validitySec, char* jwt, size_t jwtSize);
+
+int  mqtt_JwtSetRollover(mqtt_instance_st * mqttObject, const char* privateKeyFile, const char* audience, int validitySec);
+int  mqtt_JwtRenewIfDue(mqtt_instance_st * mqttObject);
+
+#endif	//_MQTT_JWT_H_
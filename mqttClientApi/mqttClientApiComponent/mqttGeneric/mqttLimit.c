@@ -0,0 +1,240 @@
+/*******************************************************************************************************************
+
+ MQTT rate limiter
+
+	Token buckets per instance and per topic prefix, see mqttLimit.h
+
+*******************************************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <sys/time.h>
+
+#include "MQTTClient.h"
+#include "mqttLimit.h"
+
+//-------------------------------------------------------------------------------------------------------
+static unsigned long long mqtt_LimitNow(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return (unsigned long long) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+//-------------------------------------------------------------------------------------------------------
+static void mqtt_BucketFill(mqtt_bucket_t* bucket, unsigned long long elapsedMs)
+{
+	long long capacity = (long long) bucket->rate * 1000;
+
+	//keeps the product in range, a long idle time fills the bucket anyway
+	if (elapsedMs > 1000000)
+	{
+		elapsedMs = 1000000;
+	}
+
+	//rate thousandths of token per ms
+	bucket->tokens += (long long) elapsedMs * bucket->rate;
+
+	if (bucket->tokens > capacity)
+	{
+		bucket->tokens = capacity;
+	}
+}
+
+//-------------------------------------------------------------------------------------------------------
+//ms before the bucket allows the cost, 0 if it does
+static unsigned long long mqtt_BucketWait(const mqtt_bucket_t* bucket, size_t cost)
+{
+	if (bucket->rate == 0)
+	{
+		return 0;
+	}
+
+	long long capacity = (long long) bucket->rate * 1000;
+	long long needed = (long long) cost * 1000;
+
+	if (needed > capacity)
+	{
+		//larger than the bucket : sent once it is full
+		needed = capacity;
+	}
+
+	if (bucket->tokens >= needed)
+	{
+		return 0;
+	}
+
+	return (unsigned long long) ((needed - bucket->tokens + bucket->rate - 1) / bucket->rate);
+}
+
+//-------------------------------------------------------------------------------------------------------
+static void mqtt_BucketTake(mqtt_bucket_t* bucket, size_t cost)
+{
+	if (bucket->rate)
+	{
+		bucket->tokens -= (long long) cost * 1000;
+	}
+}
+
+//-------------------------------------------------------------------------------------------------------
+static int mqtt_LimitMatch(const mqtt_limitRule_t* rule, const char* topicName)
+{
+	return strncmp(topicName, rule->prefix, strlen(rule->prefix)) == 0;
+}
+
+//-------------------------------------------------------------------------------------------------------
+mqtt_limit_st* mqtt_LimitCreate(void)
+{
+	mqtt_limit_st* limit = (mqtt_limit_st *) malloc(sizeof(mqtt_limit_st));
+
+	if (limit)
+	{
+		memset(limit, 0, sizeof(mqtt_limit_st));
+		limit->refilledAt = mqtt_LimitNow();
+	}
+
+	return limit;
+}
+
+//-------------------------------------------------------------------------------------------------------
+void mqtt_LimitDelete(mqtt_limit_st* limit)
+{
+	free(limit);
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_LimitSet(mqtt_limit_st* limit, const char* topicPrefix, unsigned long messagesPerSec, unsigned long bytesPerSec)
+{
+	int i;
+
+	if (topicPrefix == NULL)
+	{
+		topicPrefix = "";
+	}
+
+	if (strlen(topicPrefix) >= MQTT_LIMIT_PREFIX_SIZE)
+	{
+		return FAILURE;
+	}
+
+	for (i=0; i<limit->ruleCount && strcmp(limit->rules[i].prefix, topicPrefix) != 0; i++);
+
+	if (messagesPerSec == 0 && bytesPerSec == 0)
+	{
+		//rule removed
+		if (i < limit->ruleCount)
+		{
+			limit->ruleCount--;
+			memmove(&limit->rules[i], &limit->rules[i + 1], (limit->ruleCount - i) * sizeof(mqtt_limitRule_t));
+		}
+		return SUCCESS;
+	}
+
+	if (i == MQTT_LIMIT_MAX_RULES)
+	{
+		fprintf(stdout, "mqttLimit : no more than %d rules\n", MQTT_LIMIT_MAX_RULES);
+		fflush(stdout);
+		return FAILURE;
+	}
+
+	mqtt_limitRule_t* rule = &limit->rules[i];
+
+	if (i == limit->ruleCount)
+	{
+		//a new rule starts with full buckets
+		strcpy(rule->prefix, topicPrefix);
+		rule->messages.tokens = (long long) messagesPerSec * 1000;
+		rule->bytes.tokens = (long long) bytesPerSec * 1000;
+		limit->ruleCount++;
+	}
+
+	rule->messages.rate = messagesPerSec;
+	rule->bytes.rate = bytesPerSec;
+
+	//a lower rate caps the tokens held, the refill does the rest
+	mqtt_BucketFill(&rule->messages, 0);
+	mqtt_BucketFill(&rule->bytes, 0);
+
+	return SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_LimitAcquire(mqtt_limit_st* limit, const char* topicName, size_t dataLen)
+{
+	if (limit == NULL || limit->ruleCount == 0)
+	{
+		return SUCCESS;
+	}
+
+	unsigned long long	now = mqtt_LimitNow();
+	unsigned long long	waitMs = 0;
+	size_t				bytes = strlen(topicName) + dataLen;
+	int					i;
+
+	for (i=0; i<limit->ruleCount; i++)
+	{
+		mqtt_limitRule_t* rule = &limit->rules[i];
+
+		if (now > limit->refilledAt)
+		{
+			mqtt_BucketFill(&rule->messages, now - limit->refilledAt);
+			mqtt_BucketFill(&rule->bytes, now - limit->refilledAt);
+		}
+
+		if (mqtt_LimitMatch(rule, topicName))
+		{
+			unsigned long long ms = mqtt_BucketWait(&rule->messages, 1);
+
+			if (ms > waitMs)
+			{
+				waitMs = ms;
+			}
+
+			ms = mqtt_BucketWait(&rule->bytes, bytes);
+			if (ms > waitMs)
+			{
+				waitMs = ms;
+			}
+		}
+	}
+	limit->refilledAt = now;
+
+	if (waitMs > 0)
+	{
+		limit->retryAt = now + waitMs;
+		limit->throttled++;
+		return FAILURE;
+	}
+
+	//all or nothing : no bucket is charged for a message which is not sent
+	for (i=0; i<limit->ruleCount; i++)
+	{
+		if (mqtt_LimitMatch(&limit->rules[i], topicName))
+		{
+			mqtt_BucketTake(&limit->rules[i].messages, 1);
+			mqtt_BucketTake(&limit->rules[i].bytes, bytes);
+		}
+	}
+
+	//nothing throttled any more : the paced yield is back to its normal wait
+	limit->retryAt = 0;
+
+	return SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_LimitWaitMs(mqtt_limit_st* limit)
+{
+	if (limit == NULL || limit->ruleCount == 0 || limit->retryAt == 0)
+	{
+		return 0;
+	}
+
+	unsigned long long now = mqtt_LimitNow();
+
+	//at least 1 : messages left queued are retried on the next slice
+	return (limit->retryAt > now) ? (int) (limit->retryAt - now) : 1;
+}
@@ -0,0 +1,71 @@
+/*******************************************************************************************************************
+
+ MQTT rate limiter
+
+	Token buckets bounding the outbound traffic of an instance, so that a device stays below the limits of
+	its broker (cloud brokers typically throttle or disconnect a client above 100 publishes per second) :
+
+		- a rule applies to the topics starting with its prefix, the empty prefix being the whole instance.
+		  A message is sent once all the rules matching its topic allow it
+		- each rule has a bucket of messages per second and a bucket of bytes (topic and payload) per second,
+		  a rate of 0 leaves that dimension unlimited
+		- a bucket holds up to one second of its rate : a burst of that size goes out at once, then the
+		  traffic is paced at the rate. A message larger than the byte bucket is sent when the bucket is full,
+		  the bucket then owes the excess and refills from below zero
+		- a message which is not allowed yet is not dropped : it stays queued (offline store or priority
+		  queues, bounded) and is sent by mqtt_ProcessEvent when the buckets have refilled
+
+	Tokens are counted in thousandths, refilled from the elapsed milliseconds.
+
+	View of the stack :
+	_________________________
+
+	 mqttGeneric interface
+	_________________________
+
+	 mqttLimit  <--- this file
+	_________________________
+
+	 mqttSched / mqttStore
+	_________________________
+
+	 paho
+	_________________________
+
+*******************************************************************************************************************/
+
+#ifndef _MQTT_LIMIT_H_
+#define _MQTT_LIMIT_H_
+
+#include <stddef.h>
+
+#define		MQTT_LIMIT_MAX_RULES			8
+#define		MQTT_LIMIT_PREFIX_SIZE			128
+
+typedef struct {
+	unsigned long			rate;					//per second, 0 : unlimited
+	long long				tokens;					//thousandths, at most rate * 1000
+} mqtt_bucket_t;
+
+typedef struct {
+	char					prefix[MQTT_LIMIT_PREFIX_SIZE];
+	mqtt_bucket_t			messages;
+	mqtt_bucket_t			bytes;
+} mqtt_limitRule_t;
+
+typedef struct mqtt_limit_st {
+	mqtt_limitRule_t		rules[MQTT_LIMIT_MAX_RULES];
+	int						ruleCount;
+	unsigned long long		refilledAt;				//ms
+	unsigned long long		retryAt;				//ms, when the last message throttled is allowed, 0 once one is sent
+	unsigned long			throttled;				//sends deferred, a message retried is counted again
+} mqtt_limit_st;
+
+mqtt_limit_st* mqtt_LimitCreate(void);
+void mqtt_LimitDelete(mqtt_limit_st* limit);
+
+int  mqtt_LimitSet(mqtt_limit_st* limit, const char* topicPrefix, unsigned long messagesPerSec, unsigned long bytesPerSec);
+int  mqtt_LimitAcquire(mqtt_limit_st* limit, const char* topicName, size_t dataLen);
+int  mqtt_LimitWaitMs(mqtt_limit_st* limit);
+
+#endif	//_MQTT_LIMIT_H_
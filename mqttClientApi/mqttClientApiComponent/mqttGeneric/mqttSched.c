@@ -0,0 +1,475 @@
+/*******************************************************************************************************************
+
+ MQTT send scheduler
+
+	Per class queues of outbound messages, strict priority then deficit round robin, see mqttSched.h
+
+*******************************************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <sys/time.h>
+
+#include "mqttSched.h"
+
+static const size_t g_schedQuantum[MQTT_PRIORITY_COUNT] = {
+	0,									//alarm : strict priority
+	0,									//command-ack : strict priority
+	MQTT_SCHED_TELEMETRY_QUANTUM,
+	MQTT_SCHED_BULK_QUANTUM
+};
+
+//-------------------------------------------------------------------------------------------------------
+static unsigned long long mqtt_SchedNow(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return (unsigned long long) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+//-------------------------------------------------------------------------------------------------------
+//bytes accounted to the class for a message
+static size_t mqtt_SchedCost(const mqtt_schedMessage_st* message)
+{
+	return strlen(message->topic) + message->dataLen;
+}
+
+//-------------------------------------------------------------------------------------------------------
+//deadline heap : each message knows its position, so that a message sent before its deadline is removed in O(log n)
+static void mqtt_SchedHeapSet(mqtt_sched_st* sched, size_t index, mqtt_schedMessage_st* message)
+{
+	sched->heap[index] = message;
+	message->heapIndex = index;
+}
+
+static void mqtt_SchedHeapUp(mqtt_sched_st* sched, size_t index)
+{
+	mqtt_schedMessage_st* message = sched->heap[index];
+
+	while (index > 0 && sched->heap[(index - 1) / 2]->expiresAt > message->expiresAt)
+	{
+		mqtt_SchedHeapSet(sched, index, sched->heap[(index - 1) / 2]);
+		index = (index - 1) / 2;
+	}
+
+	mqtt_SchedHeapSet(sched, index, message);
+}
+
+static void mqtt_SchedHeapDown(mqtt_sched_st* sched, size_t index)
+{
+	mqtt_schedMessage_st* message = sched->heap[index];
+
+	for (;;)
+	{
+		size_t child = 2 * index + 1;
+
+		if (child >= sched->heapCount)
+		{
+			break;
+		}
+		if (child + 1 < sched->heapCount && sched->heap[child + 1]->expiresAt < sched->heap[child]->expiresAt)
+		{
+			child++;
+		}
+		if (sched->heap[child]->expiresAt >= message->expiresAt)
+		{
+			break;
+		}
+
+		mqtt_SchedHeapSet(sched, index, sched->heap[child]);
+		index = child;
+	}
+
+	mqtt_SchedHeapSet(sched, index, message);
+}
+
+static int mqtt_SchedHeapInsert(mqtt_sched_st* sched, mqtt_schedMessage_st* message)
+{
+	if (sched->heapCount == sched->heapSize)
+	{
+		size_t					size = sched->heapSize ? 2 * sched->heapSize : MQTT_SCHED_HEAP_MIN;
+		mqtt_schedMessage_st**	heap = (mqtt_schedMessage_st **) realloc(sched->heap, size * sizeof(mqtt_schedMessage_st *));
+
+		if (heap == NULL)
+		{
+			return FAILURE;
+		}
+
+		sched->heap = heap;
+		sched->heapSize = size;
+	}
+
+	sched->heap[sched->heapCount++] = message;
+	mqtt_SchedHeapUp(sched, sched->heapCount - 1);
+
+	return SUCCESS;
+}
+
+static void mqtt_SchedHeapRemove(mqtt_sched_st* sched, mqtt_schedMessage_st* message)
+{
+	size_t					index = message->heapIndex;
+	mqtt_schedMessage_st*	last;
+
+	if (--sched->heapCount == index)
+	{
+		return;
+	}
+
+	//the last entry takes the place, then moves whichever way its deadline says
+	last = sched->heap[sched->heapCount];
+	mqtt_SchedHeapSet(sched, index, last);
+	mqtt_SchedHeapDown(sched, index);
+	mqtt_SchedHeapUp(sched, last->heapIndex);
+}
+
+//-------------------------------------------------------------------------------------------------------
+//the message leaves its class (sent or expired), the caller frees it
+static void mqtt_SchedUnlink(mqtt_sched_st* sched, mqtt_schedMessage_st* message)
+{
+	mqtt_schedQueue_t* queue = &sched->queues[message->priority];
+
+	if (message->prev)
+	{
+		message->prev->next = message->next;
+	}
+	else
+	{
+		queue->head = message->next;
+	}
+
+	if (message->next)
+	{
+		message->next->prev = message->prev;
+	}
+	else
+	{
+		queue->tail = message->prev;
+	}
+
+	if (queue->head == NULL)
+	{
+		queue->deficit = 0;
+	}
+	queue->bytes -= strlen(message->topic) + 1 + message->dataLen;
+	queue->count--;
+
+	if (message->expiresAt)
+	{
+		mqtt_SchedHeapRemove(sched, message);
+	}
+}
+
+//-------------------------------------------------------------------------------------------------------
+mqtt_sched_st* mqtt_SchedCreate(void)
+{
+	mqtt_sched_st* sched = (mqtt_sched_st *) malloc(sizeof(mqtt_sched_st));
+
+	if (sched)
+	{
+		memset(sched, 0, sizeof(mqtt_sched_st));
+		sched->drrClass = MQTT_PRIORITY_TELEMETRY;
+	}
+
+	return sched;
+}
+
+//-------------------------------------------------------------------------------------------------------
+void mqtt_SchedDelete(mqtt_sched_st* sched)
+{
+	int i;
+
+	if (!sched)
+	{
+		return;
+	}
+
+	for (i=0; i<MQTT_PRIORITY_COUNT; i++)
+	{
+		while (sched->queues[i].head)
+		{
+			mqtt_schedMessage_st* message = sched->queues[i].head;
+
+			sched->queues[i].head = message->next;
+			free(message);
+		}
+	}
+
+	free(sched->heap);
+	free(sched);
+}
+
+//-------------------------------------------------------------------------------------------------------
+//message allocated for dataLen bytes, *data points to its payload, to be filled then committed or discarded
+mqtt_schedMessage_st* mqtt_SchedReserve(mqtt_sched_st* sched, mqtt_priority_t priority, const char* topicName, int qoS, int retained, size_t dataLen, unsigned long ttlMs, char** data)
+{
+	if (priority < MQTT_PRIORITY_ALARM || priority >= MQTT_PRIORITY_COUNT)
+	{
+		return NULL;
+	}
+
+	mqtt_schedQueue_t*	queue = &sched->queues[priority];
+	size_t				topicLen = strlen(topicName) + 1;
+
+	if (queue->head && queue->bytes + topicLen + dataLen > MQTT_SCHED_MAX_QUEUED)
+	{
+		fprintf(stdout, "mqttSched : queue of class %d full\n", (int) priority);
+		fflush(stdout);
+		return NULL;
+	}
+
+	mqtt_schedMessage_st* message = (mqtt_schedMessage_st *) malloc(sizeof(mqtt_schedMessage_st) + topicLen + dataLen);
+
+	if (message == NULL)
+	{
+		return NULL;
+	}
+
+	message->next = NULL;
+	message->prev = NULL;
+	message->dataLen = dataLen;
+	message->queuedAt = mqtt_SchedNow();
+	message->expiresAt = ttlMs ? message->queuedAt + ttlMs : 0;
+	message->heapIndex = 0;
+	message->priority = (int) priority;
+	message->qoS = qoS;
+	message->retained = retained;
+	memcpy(message->topic, topicName, topicLen);
+
+	*data = message->topic + topicLen;
+
+	return message;
+}
+
+//-------------------------------------------------------------------------------------------------------
+//reserved message appended to its class, freed on failure
+int mqtt_SchedCommit(mqtt_sched_st* sched, mqtt_schedMessage_st* message)
+{
+	mqtt_schedQueue_t* queue = &sched->queues[message->priority];
+
+	if (message->expiresAt && mqtt_SchedHeapInsert(sched, message) != SUCCESS)
+	{
+		free(message);
+		return FAILURE;
+	}
+
+	message->prev = queue->tail;
+	if (queue->tail)
+	{
+		queue->tail->next = message;
+	}
+	else
+	{
+		queue->head = message;
+	}
+	queue->tail = message;
+	queue->bytes += strlen(message->topic) + 1 + message->dataLen;
+	queue->count++;
+
+	return SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------------------------
+void mqtt_SchedDiscard(mqtt_schedMessage_st* message)
+{
+	free(message);
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_SchedPush(mqtt_sched_st* sched, mqtt_priority_t priority, const char* topicName, int qoS, int retained, const char* data, size_t dataLen, unsigned long ttlMs)
+{
+	char*					payload;
+	mqtt_schedMessage_st*	message = mqtt_SchedReserve(sched, priority, topicName, qoS, retained, dataLen, ttlMs, &payload);
+
+	if (message == NULL)
+	{
+		return FAILURE;
+	}
+
+	memcpy(payload, data, dataLen);
+
+	return mqtt_SchedCommit(sched, message);
+}
+
+//-------------------------------------------------------------------------------------------------------
+//class of the next message to send, -1 if nothing is queued
+//the classes of the blocked mask (throttled by the rate limiter) are passed over
+static int mqtt_SchedNext(mqtt_sched_st* sched, unsigned int blocked)
+{
+	int i;
+
+	for (i=0; i<MQTT_PRIORITY_TELEMETRY; i++)
+	{
+		if (sched->queues[i].head && !(blocked & (1 << i)))
+		{
+			return i;
+		}
+	}
+
+	for (i=MQTT_PRIORITY_TELEMETRY; i<MQTT_PRIORITY_COUNT && (!sched->queues[i].head || (blocked & (1 << i))); i++);
+
+	if (i == MQTT_PRIORITY_COUNT)
+	{
+		return -1;
+	}
+
+	//deficit round robin : the class keeps the turn while its credit covers its next message
+	for (;;)
+	{
+		mqtt_schedQueue_t* queue = &sched->queues[sched->drrClass];
+
+		if (queue->head == NULL)
+		{
+			queue->deficit = 0;
+		}
+		else if (!(blocked & (1 << sched->drrClass)))
+		{
+			if (!sched->drrCredited)
+			{
+				queue->deficit += g_schedQuantum[sched->drrClass];
+				sched->drrCredited = 1;
+			}
+
+			if (mqtt_SchedCost(queue->head) <= queue->deficit)
+			{
+				return sched->drrClass;
+			}
+		}
+
+		sched->drrClass = (sched->drrClass + 1 < MQTT_PRIORITY_COUNT) ? sched->drrClass + 1 : MQTT_PRIORITY_TELEMETRY;
+		sched->drrCredited = 0;
+	}
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_SchedRun(mqtt_sched_st* sched, Client* client, mqtt_limit_st* limit)
+{
+	Timer			budget;
+	int				sent = 0;
+	unsigned int	blocked = 0;
+
+	InitTimer(&budget);
+	countdown_ms(&budget, MQTT_SCHED_RUN_MS);
+
+	while (client->isconnected && !expired(&budget))
+	{
+		int priority = mqtt_SchedNext(sched, blocked);
+
+		if (priority < 0)
+		{
+			break;
+		}
+
+		mqtt_schedQueue_t*		queue = &sched->queues[priority];
+		mqtt_schedMessage_st*	message = queue->head;
+		size_t					topicLen = strlen(message->topic) + 1;
+		MQTTMessage				msg;
+
+		if (mqtt_LimitAcquire(limit, message->topic, message->dataLen) != SUCCESS)
+		{
+			//kept at the head of its class, the order within a class is kept
+			blocked |= 1 << priority;
+			continue;
+		}
+
+		msg.qos = (enum QoS) message->qoS;
+		msg.retained = (char) message->retained;
+		msg.dup = 0;
+		msg.id = 0;
+		msg.payload = message->topic + topicLen;
+		msg.payloadlen = message->dataLen;
+
+		//kept queued (and its credit kept) if not acknowledged, sent again by the next run
+		if (MQTTPublishBuffered(client, message->topic, &msg) != SUCCESS)
+		{
+			fprintf(stdout, "mqttSched : publish error on %s\n", message->topic);
+			fflush(stdout);
+			break;
+		}
+
+		unsigned long long waitMs = mqtt_SchedNow() - message->queuedAt;
+
+		if (waitMs > sched->maxWaitMs[priority])
+		{
+			sched->maxWaitMs[priority] = waitMs;
+		}
+
+		if (queue->deficit >= mqtt_SchedCost(message))
+		{
+			queue->deficit -= mqtt_SchedCost(message);
+		}
+
+		mqtt_SchedUnlink(sched, message);
+		sched->sent[priority]++;
+		sent++;
+
+		free(message);
+	}
+
+	return sent;
+}
+
+//-------------------------------------------------------------------------------------------------------
+//messages past their deadline are dropped, earliest first : the cost is that of the expired ones
+int mqtt_SchedExpire(mqtt_sched_st* sched, mqtt_expiry_st* expiry)
+{
+	unsigned long long	now;
+	int					count = 0;
+
+	if (!sched || sched->heapCount == 0)
+	{
+		return 0;
+	}
+
+	now = mqtt_SchedNow();
+
+	while (sched->heapCount > 0 && sched->heap[0]->expiresAt <= now)
+	{
+		mqtt_schedMessage_st* message = sched->heap[0];
+
+		mqtt_SchedUnlink(sched, message);
+		mqtt_ExpiryCount(expiry, message->topic, message->queuedAt);
+		sched->expired++;
+		count++;
+
+		free(message);
+	}
+
+	if (count > 0)
+	{
+		fprintf(stdout, "mqttSched : %d messages expired\n", count);
+		fflush(stdout);
+	}
+
+	return count;
+}
+
+//-------------------------------------------------------------------------------------------------------
+unsigned long mqtt_SchedQueued(mqtt_sched_st* sched)
+{
+	unsigned long count = 0;
+	int i;
+
+	for (i=0; sched && i<MQTT_PRIORITY_COUNT; i++)
+	{
+		count += sched->queues[i].count;
+	}
+
+	return count;
+}
+
+//-------------------------------------------------------------------------------------------------------
+size_t mqtt_SchedFootprint(mqtt_sched_st* sched)
+{
+	size_t footprint = 0;
+	int i;
+
+	for (i=0; sched && i<MQTT_PRIORITY_COUNT; i++)
+	{
+		footprint += sched->queues[i].bytes + sched->queues[i].count * sizeof(mqtt_schedMessage_st);
+	}
+
+	return sched ? footprint + sizeof(mqtt_sched_st) + sched->heapSize * sizeof(mqtt_schedMessage_st *) : 0;
+}
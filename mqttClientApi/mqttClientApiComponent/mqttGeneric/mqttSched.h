@@ -0,0 +1,107 @@
+/*******************************************************************************************************************
+
+ MQTT send scheduler
+
+	Outbound messages published with a priority class are queued per class and sent by the scheduler :
+
+		- alarm and command-ack classes have strict priority : they are sent before anything else
+		- telemetry and bulk share what is left with a deficit round robin : each round, a class may send
+		  up to its quantum of bytes (credit carried over while it has messages queued), telemetry first.
+		  Bulk uploads get about a fifth of the link under a telemetry backlog, they are never starved
+		- an alarm waits at most one round of telemetry and bulk (their quanta) plus the message being sent
+
+	Queued messages are sent when the session is up, from mqtt_ProcessEvent before the backlog of the
+	offline store, and right away when a message is queued while connected.
+	With a rate limiter, a class whose next message is throttled is passed over for the rest of the run :
+	a throttled topic prefix does not hold the other classes back.
+	Queues are in memory : the messages queued while offline are lost with the process (use the offline
+	store for durability).
+	Messages with a time-to-live are indexed in a min-heap of their deadlines : mqtt_SchedExpire removes
+	the expired ones from their class without walking the queues (see mqttExpiry.h).
+	A payload can be written in place : mqtt_SchedReserve allocates the message and returns its payload,
+	filled by the caller before mqtt_SchedCommit (or mqtt_SchedDiscard). A file is read straight into it.
+
+	View of the stack :
+	_________________________
+
+	 mqttGeneric interface
+	_________________________
+
+	 mqttSched  <--- this file
+	_________________________
+
+	 paho
+	_________________________
+
+*******************************************************************************************************************/
+
+#ifndef _MQTT_SCHED_H_
+#define _MQTT_SCHED_H_
+
+#include "MQTTClient.h"
+#include "mqttLimit.h"
+#include "mqttExpiry.h"
+
+typedef enum {
+	MQTT_PRIORITY_ALARM = 0,
+	MQTT_PRIORITY_COMMAND_ACK,
+	MQTT_PRIORITY_TELEMETRY,
+	MQTT_PRIORITY_BULK,
+	MQTT_PRIORITY_COUNT
+} mqtt_priority_t;
+
+#define		MQTT_SCHED_TELEMETRY_QUANTUM	4096		//bytes per round
+#define		MQTT_SCHED_BULK_QUANTUM			1024		//bytes per round
+#define		MQTT_SCHED_MAX_QUEUED			65536		//bytes queued per class, a single message is always accepted
+#define		MQTT_SCHED_RUN_MS				200			//time budget of one run
+#define		MQTT_SCHED_HEAP_MIN				64			//initial entries of the deadline heap
+
+typedef struct mqtt_schedMessage_st {
+	struct mqtt_schedMessage_st*	next;
+	struct mqtt_schedMessage_st*	prev;
+	size_t							dataLen;
+	unsigned long long				queuedAt;			//ms
+	unsigned long long				expiresAt;			//ms, 0 : never expires
+	size_t							heapIndex;			//position in the deadline heap
+	int								priority;
+	int								qoS;
+	int								retained;
+	char							topic[];			//NUL terminated, followed by the data
+} mqtt_schedMessage_st;
+
+typedef struct {
+	mqtt_schedMessage_st*	head;
+	mqtt_schedMessage_st*	tail;
+	size_t					bytes;
+	unsigned long			count;
+	size_t					deficit;					//credit of the deficit round robin
+} mqtt_schedQueue_t;
+
+typedef struct mqtt_sched_st {
+	mqtt_schedQueue_t		queues[MQTT_PRIORITY_COUNT];
+	unsigned long			sent[MQTT_PRIORITY_COUNT];
+	unsigned long long		maxWaitMs[MQTT_PRIORITY_COUNT];	//longest time from queued to sent
+	int						drrClass;					//class of the round robin being served
+	int						drrCredited;				//its quantum was added
+
+	mqtt_schedMessage_st**	heap;						//messages with a deadline, earliest first
+	size_t					heapCount;
+	size_t					heapSize;
+	unsigned long			expired;					//messages dropped past their deadline
+} mqtt_sched_st;
+
+mqtt_sched_st* mqtt_SchedCreate(void);
+void mqtt_SchedDelete(mqtt_sched_st* sched);
+
+int  mqtt_SchedPush(mqtt_sched_st* sched, mqtt_priority_t priority, const char* topicName, int qoS, int retained, const char* data, size_t dataLen, unsigned long ttlMs);
+
+mqtt_schedMessage_st* mqtt_SchedReserve(mqtt_sched_st* sched, mqtt_priority_t priority, const char* topicName, int qoS, int retained, size_t dataLen, unsigned long ttlMs, char** data);
+int  mqtt_SchedCommit(mqtt_sched_st* sched, mqtt_schedMessage_st* message);
+void mqtt_SchedDiscard(mqtt_schedMessage_st* message);
+int  mqtt_SchedRun(mqtt_sched_st* sched, Client* client, mqtt_limit_st* limit);
+int  mqtt_SchedExpire(mqtt_sched_st* sched, mqtt_expiry_st* expiry);
+
+unsigned long mqtt_SchedQueued(mqtt_sched_st* sched);
+size_t mqtt_SchedFootprint(mqtt_sched_st* sched);
+
+#endif	//_MQTT_SCHED_H_
@@ -0,0 +1,227 @@
+/*******************************************************************************************************************
+
+ MQTT time series
+
+	Accumulates (key, value, timestamp) samples and serializes them as one multi-timestamp message,
+	see mqttSeries.h
+
+*******************************************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <sys/time.h>
+
+#include "mqttSeries.h"
+#include "mqttCodec.h"
+
+#define		SERIES_KEY_OVERHEAD			8		//"key":[],
+#define		SERIES_SAMPLE_OVERHEAD		48		//{"timestamp":1234567890123,"value":""},
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_SeriesInit(mqtt_series_t* series, int maxSamples, size_t maxBytes, int maxAgeMs)
+{
+	memset(series, 0, sizeof(mqtt_series_t));
+
+	if (maxSamples <= 0 || maxSamples > 0xFFFF || maxBytes == 0)
+	{
+		return FAILURE;
+	}
+
+	series->maxSamples = maxSamples;
+	series->maxBytes = maxBytes;
+	series->maxAgeMs = maxAgeMs;
+
+	series->samples = (mqtt_sample_t *) malloc(maxSamples * sizeof(mqtt_sample_t));
+	series->keys = (unsigned int *) malloc(maxSamples * sizeof(unsigned int));
+	series->pool = (char *) malloc(maxBytes);
+
+	if (!series->samples || !series->keys || !series->pool)
+	{
+		mqtt_SeriesFree(series);
+		return FAILURE;
+	}
+
+	mqtt_SeriesClear(series);
+
+	return SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------------------------
+void mqtt_SeriesFree(mqtt_series_t* series)
+{
+	free(series->samples);
+	free(series->keys);
+	free(series->pool);
+
+	memset(series, 0, sizeof(mqtt_series_t));
+}
+
+//-------------------------------------------------------------------------------------------------------
+void mqtt_SeriesClear(mqtt_series_t* series)
+{
+	series->count = 0;
+	series->keyCount = 0;
+	series->poolUsed = 0;
+	series->payloadBytes = 2;	//{}
+}
+
+//-------------------------------------------------------------------------------------------------------
+static int mqtt_SeriesFindKey(mqtt_series_t* series, const char* szKey)
+{
+	int i;
+
+	for (i=0; i<series->keyCount; i++)
+	{
+		if (strcmp(series->pool + series->keys[i], szKey) == 0)
+		{
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_SeriesAdd(mqtt_series_t* series, const char* szKey, const char* szValue, unsigned long long timestamp)
+{
+	//FAILURE when the series is full : publish it and add the sample again
+	size_t	valueLen = strlen(szValue) + 1;
+	size_t	keyLen = 0;
+	size_t	needed = SERIES_SAMPLE_OVERHEAD + valueLen;
+	int		key;
+
+	if (series->count >= series->maxSamples)
+	{
+		return FAILURE;
+	}
+
+	key = mqtt_SeriesFindKey(series, szKey);
+	if (key < 0)
+	{
+		keyLen = strlen(szKey) + 1;
+		needed += SERIES_KEY_OVERHEAD + keyLen;
+	}
+
+	if (series->payloadBytes + needed > series->maxBytes || series->poolUsed + keyLen + valueLen > series->maxBytes)
+	{
+		return FAILURE;
+	}
+
+	if (key < 0)
+	{
+		key = series->keyCount++;
+		series->keys[key] = (unsigned int) series->poolUsed;
+		memcpy(series->pool + series->poolUsed, szKey, keyLen);
+		series->poolUsed += keyLen;
+	}
+
+	mqtt_sample_t* sample = &series->samples[series->count];
+
+	sample->key = (unsigned short) key;
+	sample->value = (unsigned int) series->poolUsed;
+	sample->timestamp = timestamp ? timestamp : mqtt_SeriesNow();
+
+	memcpy(series->pool + series->poolUsed, szValue, valueLen);
+	series->poolUsed += valueLen;
+	series->payloadBytes += needed;
+
+	if (series->count++ == 0)
+	{
+		countdown_ms(&series->deadline, (unsigned int) series->maxAgeMs);
+	}
+
+	return SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_SeriesIsDue(mqtt_series_t* series)
+{
+	if (series->count == 0)
+	{
+		return 0;
+	}
+
+	return (series->count >= series->maxSamples) || (series->maxAgeMs > 0 && expired(&series->deadline));
+}
+
+//-------------------------------------------------------------------------------------------------------
+void mqtt_SeriesWrite(mqtt_series_t* series, mqtt_jsonWriter_t* writer)
+{
+	int k, i;
+
+	mqtt_JsonBeginObject(writer);
+
+	for (k=0; k<series->keyCount; k++)
+	{
+		mqtt_JsonWriteKey(writer, series->pool + series->keys[k]);
+		mqtt_JsonBeginArray(writer);
+
+		for (i=0; i<series->count; i++)
+		{
+			mqtt_sample_t* sample = &series->samples[i];
+
+			if (sample->key == k)
+			{
+				mqtt_JsonBeginObject(writer);
+				mqtt_JsonWriteKey(writer, "timestamp");
+				mqtt_JsonWriteNumber(writer, "%llu", sample->timestamp);
+				mqtt_JsonWriteKeyValue(writer, "value", series->pool + sample->value);
+				mqtt_JsonEndObject(writer);
+			}
+		}
+
+		mqtt_JsonEndArray(writer);
+	}
+
+	mqtt_JsonEndObject(writer);
+}
+
+//-------------------------------------------------------------------------------------------------------
+//binary batch of mqttCodec : returns its size, 0 if the buffer is too small
+size_t mqtt_SeriesEncode(mqtt_series_t* series, unsigned char* buffer, size_t size)
+{
+	mqtt_codecEncoder_t	encoder;
+	int					k, i;
+
+	mqtt_CodecBegin(&encoder, buffer, size, (unsigned int) series->keyCount);
+
+	for (k=0; k<series->keyCount; k++)
+	{
+		mqtt_codecType_t	type = MQTT_CODEC_INTEGER;
+		unsigned int		count = 0;
+
+		for (i=0; i<series->count; i++)
+		{
+			if (series->samples[i].key == k)
+			{
+				type = mqtt_CodecNarrow(type, series->pool + series->samples[i].value);
+				count++;
+			}
+		}
+
+		mqtt_CodecBeginKey(&encoder, series->pool + series->keys[k], count, type);
+
+		for (i=0; i<series->count; i++)
+		{
+			mqtt_sample_t* sample = &series->samples[i];
+
+			if (sample->key == k)
+			{
+				mqtt_CodecAddSample(&encoder, sample->timestamp, series->pool + sample->value);
+			}
+		}
+	}
+
+	return mqtt_CodecEnd(&encoder);
+}
+
+//-------------------------------------------------------------------------------------------------------
+unsigned long long mqtt_SeriesNow(void)
+{
+	struct timeval	now;
+
+	gettimeofday(&now, NULL);
+
+	return (unsigned long long) now.tv_sec * 1000 + (unsigned long long) (now.tv_usec / 1000);
+}
@@ -0,0 +1,65 @@
+/*******************************************************************************************************************
+
+ MQTT time series
+
+	Accumulates (key, value, timestamp) samples and serializes them as one multi-timestamp message :
+		{"key1" : [{"timestamp" : ts, "value" : "value"}, ...], "key2" : [...]}
+	Samples of a key are grouped in the order they were added, timestamps are in ms since epoch.
+
+	The series is due (to be published) when maxSamples are buffered, when the next sample would
+	exceed maxBytes of payload, or when the oldest sample is maxAgeMs old.
+	Keys and values are copied in a pool allocated with the policy, no allocation per sample.
+	mqtt_SeriesEncode writes the same samples as a binary batch of mqttCodec instead.
+
+	View of the stack :
+	_________________________
+
+	 mqttAirVantage interface
+	_________________________
+
+	 mqttSeries  <--- this file
+	_________________________
+
+	 mqttGeneric interface
+	_________________________
+
+*******************************************************************************************************************/
+
+#ifndef _MQTT_SERIES_H_
+#define _MQTT_SERIES_H_
+
+#include "mqttGeneric.h"
+
+typedef struct {
+	unsigned short			key;				//index in the key table
+	unsigned int			value;				//offset of the value in the pool
+	unsigned long long		timestamp;
+} mqtt_sample_t;
+
+typedef struct {
+	int						maxSamples;
+	size_t					maxBytes;			//payload size estimate
+	int						maxAgeMs;
+
+	mqtt_sample_t*			samples;			//maxSamples
+	unsigned int*			keys;				//maxSamples, pool offsets of the distinct keys
+	char*					pool;				//maxBytes, NUL terminated keys and values
+	int						count;
+	int						keyCount;
+	size_t					poolUsed;
+	size_t					payloadBytes;
+	Timer					deadline;			//age of the oldest sample
+} mqtt_series_t;
+
+int  mqtt_SeriesInit(mqtt_series_t* series, int maxSamples, size_t maxBytes, int maxAgeMs);
+void mqtt_SeriesFree(mqtt_series_t* series);
+void mqtt_SeriesClear(mqtt_series_t* series);
+
+int  mqtt_SeriesAdd(mqtt_series_t* series, const char* szKey, const char* szValue, unsigned long long timestamp);
+int  mqtt_SeriesIsDue(mqtt_series_t* series);
+void mqtt_SeriesWrite(mqtt_series_t* series, mqtt_jsonWriter_t* writer);
+size_t mqtt_SeriesEncode(mqtt_series_t* series, unsigned char* buffer, size_t size);
+
+unsigned long long mqtt_SeriesNow(void);
+
+#endif	//_MQTT_SERIES_H_
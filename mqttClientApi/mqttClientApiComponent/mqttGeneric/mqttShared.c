@@ -0,0 +1,416 @@
+/*******************************************************************************************************************
+ 
+ MQTT shared session
+
+	Several mqtt clients targeting the same broker with the same identity (broker, port, TLS, clientId,
+	username, secret) can attach to one underlying mqtt instance : one Network, one TLS handshake and one
+	keep-alive stream are shared by all attachments.
+
+	View of the stack :
+	_________________________
+	
+	 mqttClientApi.c
+	_________________________
+
+	 mqttShared  <--- this file
+	_________________________
+
+	 mqttGeneric interface
+	_________________________
+
+	 paho
+	_________________________
+
+*******************************************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <memory.h>
+
+#include "mqttShared.h"
+
+typedef struct {
+	char*						topicFilter;
+	int							refCount;
+} mqtt_sharedSubscription_t;
+
+struct mqtt_sharedSession {
+	mqtt_instance_st*			mqttObject;
+	int							attachCount;
+	int							startCount;
+	mqtt_attachment_st*			attachments;
+	mqtt_sharedSubscription_t	subscriptions[MAX_MESSAGE_HANDLERS];
+	mqtt_sharedSession_st*		next;
+};
+
+static mqtt_sharedSession_st*	g_sharedSessions = NULL;
+
+//-------------------------------------------------------------------------------------------------------
+static int mqtt_SharedIsSameIdentity(mqtt_config_t* a, mqtt_config_t* b)
+{
+	return (strcmp(a->serverUrl, b->serverUrl) == 0)
+			&& (a->serverPort == b->serverPort)
+			&& (a->useTLS == b->useTLS)
+			&& (strcmp(a->deviceId, b->deviceId) == 0)
+			&& (strcmp(a->username, b->username) == 0)
+			&& (strcmp(a->secret, b->secret) == 0);
+}
+
+//-------------------------------------------------------------------------------------------------------
+static void mqtt_SharedDispatch(const char* topic, const char* key, const char* value, const char* timestamp, void* pUserContext)
+{
+	mqtt_sharedSession_st* session = (mqtt_sharedSession_st*) pUserContext;
+
+	MQTTString topicName = MQTTString_initializer;
+	topicName.lenstring.data = (char *) topic;
+	topicName.lenstring.len = strlen(topic);
+
+	mqtt_attachment_st* attachment = session->attachments;
+
+	while (attachment)
+	{
+		int i;
+		for (i=0; i<MAX_ATTACHMENT_FILTERS; i++)
+		{
+			char* filter = attachment->topicFilters[i];
+
+			if (filter && (strcmp(filter, topic) == 0 || isTopicMatched(filter, &topicName)))
+			{
+				if (attachment->pfnHandler)
+				{
+					attachment->pfnHandler(topic, key, value, timestamp, attachment->pUserContext);
+				}
+				break;	//deliver once per attachment, even if several of its filters match
+			}
+		}
+
+		attachment = attachment->next;
+	}
+}
+
+//-------------------------------------------------------------------------------------------------------
+static mqtt_sharedSubscription_t* mqtt_SharedFindSubscription(mqtt_sharedSession_st* session, const char* topicName)
+{
+	int i;
+	for (i=0; i<MAX_MESSAGE_HANDLERS; i++)
+	{
+		if (session->subscriptions[i].topicFilter && strcmp(session->subscriptions[i].topicFilter, topicName) == 0)
+		{
+			return &session->subscriptions[i];
+		}
+	}
+
+	return NULL;
+}
+
+//-------------------------------------------------------------------------------------------------------
+static void mqtt_SharedReleaseSubscription(mqtt_sharedSession_st* session, const char* topicName, int unsubscribe)
+{
+	mqtt_sharedSubscription_t* subscription = mqtt_SharedFindSubscription(session, topicName);
+
+	if (subscription)
+	{
+		subscription->refCount--;
+		if (subscription->refCount <= 0)
+		{
+			//last user of this topic filter
+			if (unsubscribe)
+			{
+				mqtt_UnsubscribeTopic(session->mqttObject, topicName);
+			}
+			free(subscription->topicFilter);
+			subscription->topicFilter = NULL;
+			subscription->refCount = 0;
+		}
+	}
+}
+
+//-------------------------------------------------------------------------------------------------------
+static void mqtt_SharedClearFilters(mqtt_attachment_st* attachment, int unsubscribe)
+{
+	int i;
+	for (i=0; i<MAX_ATTACHMENT_FILTERS; i++)
+	{
+		if (attachment->topicFilters[i])
+		{
+			mqtt_SharedReleaseSubscription(attachment->session, attachment->topicFilters[i], unsubscribe);
+			free(attachment->topicFilters[i]);
+			attachment->topicFilters[i] = NULL;
+		}
+	}
+}
+
+//-------------------------------------------------------------------------------------------------------
+mqtt_attachment_st* mqtt_SharedAttach(mqtt_config_t* mqttConfig)
+{
+	mqtt_sharedSession_st* session = g_sharedSessions;
+
+	//compared as stored in the sessions : a port left to 0 is the same broker as the default port
+	mqtt_NormalizeConfig(mqttConfig);
+
+	while (session)
+	{
+		if (mqtt_SharedIsSameIdentity(&session->mqttObject->mqttConfig, mqttConfig))
+		{
+			break;
+		}
+		session = session->next;
+	}
+
+	mqtt_attachment_st* attachment = (mqtt_attachment_st*) malloc(sizeof(mqtt_attachment_st));
+	if (!attachment)
+	{
+		return NULL;
+	}
+	memset(attachment, 0, sizeof(mqtt_attachment_st));
+
+	if (!session)
+	{
+		//linked only once complete : a session is never listed without its instance nor attachment
+		session = (mqtt_sharedSession_st*) malloc(sizeof(mqtt_sharedSession_st));
+		if (!session)
+		{
+			free(attachment);
+			return NULL;
+		}
+		memset(session, 0, sizeof(mqtt_sharedSession_st));
+
+		session->mqttObject = mqtt_CreateInstance(mqttConfig);
+		if (!session->mqttObject)
+		{
+			free(session);
+			free(attachment);
+			return NULL;
+		}
+		mqtt_SetCommandHandler(session->mqttObject, mqtt_SharedDispatch, session);
+
+		session->next = g_sharedSessions;
+		g_sharedSessions = session;
+
+		fprintf(stdout, "mqtt_SharedAttach : new shared session to %s:%d\n", mqttConfig->serverUrl, mqttConfig->serverPort);
+		fflush(stdout);
+	}
+
+	attachment->session = session;
+	attachment->next = session->attachments;
+	session->attachments = attachment;
+	session->attachCount++;
+
+	return attachment;
+}
+
+//-------------------------------------------------------------------------------------------------------
+void mqtt_SharedDetach(mqtt_attachment_st* attachment)
+{
+	if (!attachment)
+	{
+		return;
+	}
+
+	mqtt_sharedSession_st* session = attachment->session;
+
+	mqtt_SharedStopSession(attachment);
+
+	//an attachment which was never started (or already stopped) may still hold filters : they must not
+	//outlive it, the dispatch would reach it once freed
+	mqtt_SharedClearFilters(attachment, mqtt_IsConnected(session->mqttObject));
+
+	mqtt_attachment_st** link = &session->attachments;
+	while (*link)
+	{
+		if (*link == attachment)
+		{
+			*link = attachment->next;
+			break;
+		}
+		link = &(*link)->next;
+	}
+
+	free(attachment);
+	session->attachCount--;
+
+	if (session->attachCount <= 0)
+	{
+		mqtt_sharedSession_st** sessionLink = &g_sharedSessions;
+		while (*sessionLink)
+		{
+			if (*sessionLink == session)
+			{
+				*sessionLink = session->next;
+				break;
+			}
+			sessionLink = &(*sessionLink)->next;
+		}
+
+		mqtt_DeleteInstance(session->mqttObject);
+		free(session);
+	}
+}
+
+//-------------------------------------------------------------------------------------------------------
+mqtt_instance_st* mqtt_SharedGetInstance(mqtt_attachment_st* attachment)
+{
+	return attachment ? attachment->session->mqttObject : NULL;
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_SharedGetAttachmentCount(mqtt_attachment_st* attachment)
+{
+	return attachment ? attachment->session->attachCount : 0;
+}
+
+//-------------------------------------------------------------------------------------------------------
+//one attachment stands for its session when the statistics of the shared instance are summed
+int mqtt_SharedIsFirstAttachment(mqtt_attachment_st* attachment)
+{
+	return attachment ? attachment->session->attachments == attachment : 0;
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_SharedStartSession(mqtt_attachment_st* attachment)
+{
+	mqtt_sharedSession_st* session = attachment->session;
+
+	int rc = SUCCESS;
+
+	if (!mqtt_IsConnected(session->mqttObject))
+	{
+		rc = mqtt_StartSession(session->mqttObject);
+		if (rc != SUCCESS && rc != MQTT_DEFERRED)
+		{
+			return rc;
+		}
+	}
+
+	//a deferred session is started with the link : the attachment already counts as a user of it
+	if (!attachment->started)
+	{
+		attachment->started = 1;
+		session->startCount++;
+	}
+
+	return rc;
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_SharedStopSession(mqtt_attachment_st* attachment)
+{
+	mqtt_sharedSession_st* session = attachment->session;
+
+	if (!attachment->started)
+	{
+		return SUCCESS;
+	}
+
+	attachment->started = 0;
+	session->startCount--;
+
+	if (session->startCount > 0)
+	{
+		//other attachments still use the connection, only drop the subscriptions of this one
+		mqtt_SharedClearFilters(attachment, 1);
+		return SUCCESS;
+	}
+
+	//last user : the broker connection goes away with all its subscriptions
+	mqtt_attachment_st* other = session->attachments;
+	while (other)
+	{
+		mqtt_SharedClearFilters(other, 0);
+		other = other->next;
+	}
+
+	return mqtt_StopSession(session->mqttObject);
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_SharedSubscribe(mqtt_attachment_st* attachment, const char* topicName)
+{
+	mqtt_sharedSession_st* session = attachment->session;
+
+	if (!attachment->started || !mqtt_IsConnected(session->mqttObject))
+	{
+		return FAILURE;
+	}
+
+	int i, freeSlot = -1;
+	for (i=0; i<MAX_ATTACHMENT_FILTERS; i++)
+	{
+		if (attachment->topicFilters[i] == NULL)
+		{
+			if (freeSlot < 0)
+			{
+				freeSlot = i;
+			}
+		}
+		else if (strcmp(attachment->topicFilters[i], topicName) == 0)
+		{
+			return SUCCESS;	//already subscribed by this attachment
+		}
+	}
+
+	if (freeSlot < 0)
+	{
+		return FAILURE;
+	}
+
+	mqtt_sharedSubscription_t* subscription = mqtt_SharedFindSubscription(session, topicName);
+
+	if (!subscription)
+	{
+		for (i=0; i<MAX_MESSAGE_HANDLERS; i++)
+		{
+			if (session->subscriptions[i].topicFilter == NULL)
+			{
+				subscription = &session->subscriptions[i];
+				break;
+			}
+		}
+
+		if (!subscription)
+		{
+			return FAILURE;
+		}
+
+		//first user of this topic filter
+		int rc = mqtt_SubscribeTopic(session->mqttObject, topicName);
+		if (rc != SUCCESS)
+		{
+			return rc;
+		}
+
+		subscription->topicFilter = strdup(topicName);
+		subscription->refCount = 0;
+	}
+
+	subscription->refCount++;
+	attachment->topicFilters[freeSlot] = strdup(topicName);
+
+	return SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_SharedUnsubscribe(mqtt_attachment_st* attachment, const char* topicName)
+{
+	int i;
+	for (i=0; i<MAX_ATTACHMENT_FILTERS; i++)
+	{
+		if (attachment->topicFilters[i] && strcmp(attachment->topicFilters[i], topicName) == 0)
+		{
+			mqtt_SharedReleaseSubscription(attachment->session, topicName, 1);
+			free(attachment->topicFilters[i]);
+			attachment->topicFilters[i] = NULL;
+			return SUCCESS;
+		}
+	}
+
+	return FAILURE;
+}
+
+//-------------------------------------------------------------------------------------------------------
+void mqtt_SharedSetCommandHandler(mqtt_attachment_st* attachment, incomingMessageHandler pHandler, void * pUserContext)
+{
+	attachment->pfnHandler = pHandler;
+	attachment->pUserContext = pUserContext;
+}
@@ -0,0 +1,65 @@
+/*******************************************************************************************************************
+ 
+ MQTT shared session
+
+	Several mqtt clients targeting the same broker with the same identity (broker, port, TLS, clientId,
+	username, secret) can attach to one underlying mqtt instance : one Network, one TLS handshake and one
+	keep-alive stream are shared by all attachments.
+
+		- subscriptions are reference counted per topic filter : the broker only sees the first
+		  subscribe and the last unsubscribe, an attachment subscribes once it has started its session
+		- incoming messages are demultiplexed to the attachments whose topic filters match
+		- the session is connected by the first StartSession and disconnected by the last StopSession
+		- outbound publishes of all attachments go through the shared instance
+
+	View of the stack :
+	_________________________
+	
+	 mqttClientApi.c
+	_________________________
+
+	 mqttShared  <--- this file
+	_________________________
+
+	 mqttGeneric interface
+	_________________________
+
+	 paho
+	_________________________
+
+*******************************************************************************************************************/
+
+#ifndef _MQTT_SHARED_H_
+#define _MQTT_SHARED_H_
+
+#include "mqttGeneric.h"
+
+#define		MAX_ATTACHMENT_FILTERS		MAX_MESSAGE_HANDLERS
+
+typedef struct mqtt_sharedSession mqtt_sharedSession_st;
+
+typedef struct mqtt_attachment {
+	mqtt_sharedSession_st*		session;
+	int							started;
+	char*						topicFilters[MAX_ATTACHMENT_FILTERS];
+	incomingMessageHandler		pfnHandler;
+	void*						pUserContext;
+	struct mqtt_attachment*		next;
+} mqtt_attachment_st;
+
+mqtt_attachment_st* mqtt_SharedAttach(mqtt_config_t* mqttConfig);
+void mqtt_SharedDetach(mqtt_attachment_st* attachment);
+
+mqtt_instance_st* mqtt_SharedGetInstance(mqtt_attachment_st* attachment);
+int  mqtt_SharedGetAttachmentCount(mqtt_attachment_st* attachment);
+int  mqtt_SharedIsFirstAttachment(mqtt_attachment_st* attachment);
+
+int  mqtt_SharedStartSession(mqtt_attachment_st* attachment);
+int  mqtt_SharedStopSession(mqtt_attachment_st* attachment);
+
+int  mqtt_SharedSubscribe(mqtt_attachment_st* attachment, const char* topicName);
+int  mqtt_SharedUnsubscribe(mqtt_attachment_st* attachment, const char* topicName);
+
+void mqtt_SharedSetCommandHandler(mqtt_attachment_st* attachment, incomingMessageHandler pHandler, void * pUserContext);
+
+#endif	//_MQTT_SHARED_H_
@@ -0,0 +1,705 @@
+/*******************************************************************************************************************
+
+ MQTT outbound store
+
+	Store-and-forward queue of the messages published while the session is down, see mqttStore.h
+
+*******************************************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mqttStore.h"
+
+#define		STORE_MAGIC					"MQS1"
+#define		STORE_SEGMENT_HEADER		8
+#define		STORE_RECORD_HEADER			8
+#define		STORE_BODY_HEADER			4		//QoS, flags, topic length
+#define		STORE_FLAG_RETAINED			0x01
+#define		STORE_FLAG_TTL				0x02
+#define		STORE_TTL_SIZE				12		//queued time, TTL
+#define		STORE_ALIGN(size)			(((size) + 7) & ~((size_t) 7))
+#define		STORE_CURSOR_SLOT			16		//[generation][sequence][offset][CRC-32 of the 12 first bytes]
+#define		STORE_CURSOR_SIZE			(2 * STORE_CURSOR_SLOT)
+
+#define		STORE_RECORD_END			0
+#define		STORE_RECORD_VALID			1
+#define		STORE_RECORD_CORRUPT		-1
+
+static unsigned int		g_crcTable[256];
+
+//-------------------------------------------------------------------------------------------------------
+static unsigned int mqtt_StoreCrc32(const unsigned char* data, size_t len)
+{
+	unsigned int crc = 0xFFFFFFFF;
+	size_t i;
+
+	if (g_crcTable[1] == 0)
+	{
+		unsigned int n, k, c;
+
+		for (n=0; n<256; n++)
+		{
+			for (c=n, k=0; k<8; k++)
+			{
+				c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+			}
+			g_crcTable[n] = c;
+		}
+	}
+
+	for (i=0; i<len; i++)
+	{
+		crc = g_crcTable[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	}
+
+	return crc ^ 0xFFFFFFFF;
+}
+
+//-------------------------------------------------------------------------------------------------------
+static unsigned int mqtt_StoreGet32(const unsigned char* p)
+{
+	unsigned int value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static void mqtt_StorePut32(unsigned char* p, unsigned int value)
+{
+	memcpy(p, &value, sizeof(value));
+}
+
+//offset of the topic in a body
+static size_t mqtt_StoreTopicOffset(const unsigned char* body)
+{
+	return STORE_BODY_HEADER + ((body[1] & STORE_FLAG_TTL) ? STORE_TTL_SIZE : 0);
+}
+
+//-------------------------------------------------------------------------------------------------------
+//flush a range of a mapping to the file
+static void mqtt_StoreSync(unsigned char* map, size_t offset, size_t len)
+{
+	size_t page = (size_t) sysconf(_SC_PAGESIZE);
+	size_t start = offset & ~(page - 1);
+
+	msync(map + start, offset + len - start, MS_SYNC);
+}
+
+//-------------------------------------------------------------------------------------------------------
+static void mqtt_StoreSegmentPath(mqtt_store_st* store, unsigned int seq, char* path, size_t pathSize)
+{
+	snprintf(path, pathSize, "%s/%08x.seg", store->directory, seq);
+}
+
+//-------------------------------------------------------------------------------------------------------
+//map a segment file, created (and made durable) if needed
+static unsigned char* mqtt_StoreMapSegment(mqtt_store_st* store, unsigned int seq, int create)
+{
+	char			path[160];
+	unsigned char*	map;
+	struct stat		st;
+	int				fd;
+
+	mqtt_StoreSegmentPath(store, seq, path, sizeof(path));
+
+	fd = open(path, create ? (O_RDWR | O_CREAT) : O_RDWR, 0600);
+	if (fd < 0)
+	{
+		return NULL;
+	}
+
+	if (fstat(fd, &st) != 0 || (st.st_size < MQTT_STORE_SEGMENT_SIZE && ftruncate(fd, MQTT_STORE_SEGMENT_SIZE) != 0))
+	{
+		close(fd);
+		return NULL;
+	}
+
+	map = (unsigned char *) mmap(NULL, MQTT_STORE_SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+	if (map != MAP_FAILED && (memcmp(map, STORE_MAGIC, 4) != 0 || mqtt_StoreGet32(map + 4) != seq))
+	{
+		if (!create)
+		{
+			//not a segment of this store
+			munmap(map, MQTT_STORE_SEGMENT_SIZE);
+			map = MAP_FAILED;
+		}
+		else
+		{
+			memcpy(map, STORE_MAGIC, 4);
+			mqtt_StorePut32(map + 4, seq);
+			mqtt_StoreSync(map, 0, STORE_SEGMENT_HEADER);
+			fsync(fd);
+
+			//the new file name must survive a power loss as well
+			int dirFd = open(store->directory, O_RDONLY);
+			if (dirFd >= 0)
+			{
+				fsync(dirFd);
+				close(dirFd);
+			}
+		}
+	}
+
+	close(fd);
+
+	return (map == MAP_FAILED) ? NULL : map;
+}
+
+//-------------------------------------------------------------------------------------------------------
+static void mqtt_StoreUnmap(unsigned char** map)
+{
+	if (*map)
+	{
+		munmap(*map, MQTT_STORE_SEGMENT_SIZE);
+		*map = NULL;
+	}
+}
+
+//-------------------------------------------------------------------------------------------------------
+static void mqtt_StoreDeleteSegment(mqtt_store_st* store, unsigned int seq)
+{
+	char path[160];
+
+	mqtt_StoreSegmentPath(store, seq, path, sizeof(path));
+	unlink(path);
+}
+
+//-------------------------------------------------------------------------------------------------------
+//check the record at offset : STORE_RECORD_VALID (bodyLen set), STORE_RECORD_END or STORE_RECORD_CORRUPT
+static int mqtt_StoreRecordAt(const unsigned char* map, size_t offset, size_t* bodyLen)
+{
+	if (offset + STORE_RECORD_HEADER > MQTT_STORE_SEGMENT_SIZE)
+	{
+		return STORE_RECORD_END;
+	}
+
+	size_t len = mqtt_StoreGet32(map + offset);
+
+	if (len == 0)
+	{
+		return STORE_RECORD_END;
+	}
+
+	if (len < STORE_BODY_HEADER || len > MQTT_STORE_SEGMENT_SIZE - offset - STORE_RECORD_HEADER ||
+		mqtt_StoreCrc32(map + offset + STORE_RECORD_HEADER, len) != mqtt_StoreGet32(map + offset + 4))
+	{
+		return STORE_RECORD_CORRUPT;
+	}
+
+	const unsigned char* body = map + offset + STORE_RECORD_HEADER;
+	size_t topicLen = body[2] | (body[3] << 8);
+	size_t topicOffset = mqtt_StoreTopicOffset(body);
+
+	if (topicLen == 0 || topicOffset + topicLen > len || body[topicOffset + topicLen - 1] != 0)
+	{
+		return STORE_RECORD_CORRUPT;
+	}
+
+	*bodyLen = len;
+	return STORE_RECORD_VALID;
+}
+
+//-------------------------------------------------------------------------------------------------------
+//offset after the last valid record from offset, records counted in count
+static size_t mqtt_StoreWalk(const unsigned char* map, size_t offset, unsigned long* count)
+{
+	size_t bodyLen;
+
+	while (mqtt_StoreRecordAt(map, offset, &bodyLen) == STORE_RECORD_VALID)
+	{
+		offset += STORE_ALIGN(STORE_RECORD_HEADER + bodyLen);
+		(*count)++;
+	}
+
+	return offset;
+}
+
+//-------------------------------------------------------------------------------------------------------
+static void mqtt_StoreWriteCursor(mqtt_store_st* store)
+{
+	unsigned char* slot;
+
+	if (!store->cursorMap)
+	{
+		return;
+	}
+
+	store->cursorGeneration++;
+	slot = store->cursorMap + (store->cursorGeneration & 1) * STORE_CURSOR_SLOT;
+
+	mqtt_StorePut32(slot, store->cursorGeneration);
+	mqtt_StorePut32(slot + 4, store->readSeq);
+	mqtt_StorePut32(slot + 8, (unsigned int) store->readOffset);
+	mqtt_StorePut32(slot + 12, mqtt_StoreCrc32(slot, 12));
+
+	//the other slot keeps the previous position if this write is torn
+	mqtt_StoreSync(store->cursorMap, 0, STORE_CURSOR_SIZE);
+}
+
+//-------------------------------------------------------------------------------------------------------
+static int mqtt_StoreReadCursor(mqtt_store_st* store, unsigned int* seq, size_t* offset)
+{
+	char	path[160];
+	int		found = 0;
+	int		i, fd;
+
+	snprintf(path, sizeof(path), "%s/cursor", store->directory);
+
+	fd = open(path, O_RDWR | O_CREAT, 0600);
+	if (fd < 0)
+	{
+		return FAILURE;
+	}
+
+	if (ftruncate(fd, STORE_CURSOR_SIZE) == 0)
+	{
+		store->cursorMap = (unsigned char *) mmap(NULL, STORE_CURSOR_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (store->cursorMap == MAP_FAILED)
+		{
+			store->cursorMap = NULL;
+		}
+	}
+	close(fd);
+
+	if (!store->cursorMap)
+	{
+		return FAILURE;
+	}
+
+	for (i=0; i<2; i++)
+	{
+		const unsigned char* slot = store->cursorMap + i * STORE_CURSOR_SLOT;
+		unsigned int generation = mqtt_StoreGet32(slot);
+
+		if (mqtt_StoreCrc32(slot, 12) == mqtt_StoreGet32(slot + 12) && (!found || generation > store->cursorGeneration))
+		{
+			found = 1;
+			store->cursorGeneration = generation;
+			*seq = mqtt_StoreGet32(slot + 4);
+			*offset = mqtt_StoreGet32(slot + 8);
+		}
+	}
+
+	return found ? SUCCESS : FAILURE;
+}
+
+//-------------------------------------------------------------------------------------------------------
+//sequence range of the segment files of the directory
+static int mqtt_StoreScan(mqtt_store_st* store, unsigned int* firstSeq, unsigned int* lastSeq)
+{
+	DIR*			dir = opendir(store->directory);
+	struct dirent*	entry;
+	int				count = 0;
+
+	if (dir == NULL)
+	{
+		return 0;
+	}
+
+	while ((entry = readdir(dir)) != NULL)
+	{
+		unsigned int	seq;
+		char			suffix[8];
+
+		if (strlen(entry->d_name) == 12 && sscanf(entry->d_name, "%8x%4s", &seq, suffix) == 2 && strcmp(suffix, ".seg") == 0)
+		{
+			if (count == 0 || seq < *firstSeq)
+			{
+				*firstSeq = seq;
+			}
+			if (count == 0 || seq > *lastSeq)
+			{
+				*lastSeq = seq;
+			}
+			count++;
+		}
+	}
+
+	closedir(dir);
+
+	return count;
+}
+
+//-------------------------------------------------------------------------------------------------------
+mqtt_store_st* mqtt_StoreOpen(const char* directory, size_t maxBytes)
+{
+	mqtt_store_st*	store;
+	unsigned int	firstSeq = 1, lastSeq = 1, seq, cursorSeq = 0;
+	size_t			cursorOffset = 0;
+	int				segments;
+
+	if (directory == NULL || strlen(directory) == 0 || strlen(directory) >= sizeof(store->directory))
+	{
+		return NULL;
+	}
+
+	if (mkdir(directory, 0700) != 0 && errno != EEXIST)
+	{
+		fprintf(stdout, "mqttStore : cannot create %s\n", directory);
+		return NULL;
+	}
+
+	store = (mqtt_store_st *) malloc(sizeof(mqtt_store_st));
+	if (store == NULL)
+	{
+		return NULL;
+	}
+
+	memset(store, 0, sizeof(mqtt_store_st));
+	strcpy(store->directory, directory);
+
+	store->maxSegments = (int) (maxBytes / MQTT_STORE_SEGMENT_SIZE);
+	if (store->maxSegments < MQTT_STORE_MIN_SEGMENTS)
+	{
+		store->maxSegments = MQTT_STORE_MIN_SEGMENTS;
+	}
+
+	segments = mqtt_StoreScan(store, &firstSeq, &lastSeq);
+
+	if (mqtt_StoreReadCursor(store, &cursorSeq, &cursorOffset) != SUCCESS || cursorSeq < firstSeq || cursorSeq > lastSeq)
+	{
+		//no cursor, or the segment it points to was dropped : from the oldest record
+		cursorSeq = firstSeq;
+		cursorOffset = STORE_SEGMENT_HEADER;
+	}
+
+	//segments already sent, or beyond the size bound (oldest first)
+	for (seq=firstSeq; segments > 0 && seq != cursorSeq; seq++)
+	{
+		mqtt_StoreDeleteSegment(store, seq);
+	}
+	while (lastSeq - cursorSeq + 1 > (unsigned int) store->maxSegments)
+	{
+		mqtt_StoreDeleteSegment(store, cursorSeq++);
+		cursorOffset = STORE_SEGMENT_HEADER;
+	}
+
+	store->readSeq = cursorSeq;
+	store->writeSeq = lastSeq;
+	store->writeMap = mqtt_StoreMapSegment(store, lastSeq, 1);
+
+	if (store->writeMap == NULL)
+	{
+		fprintf(stdout, "mqttStore : cannot map the segments of %s\n", directory);
+		mqtt_StoreClose(store);
+		return NULL;
+	}
+
+	//end of the valid records of the last segment, a record torn by a power loss is erased
+	unsigned long count = 0;
+	store->writeOffset = mqtt_StoreWalk(store->writeMap, STORE_SEGMENT_HEADER, &count);
+
+
+	if (store->writeOffset + 4 <= MQTT_STORE_SEGMENT_SIZE && mqtt_StoreGet32(store->writeMap + store->writeOffset) != 0)
+	{
+		fprintf(stdout, "mqttStore : discarding a torn record in %s\n", directory);
+		memset(store->writeMap + store->writeOffset, 0, MQTT_STORE_SEGMENT_SIZE - store->writeOffset);
+		mqtt_StoreSync(store->writeMap, store->writeOffset, MQTT_STORE_SEGMENT_SIZE - store->writeOffset);
+	}
+
+	//records still to send
+	for (seq=store->readSeq; seq<=store->writeSeq; seq++)
+	{
+		unsigned char*	map = (seq == store->writeSeq) ? store->writeMap : mqtt_StoreMapSegment(store, seq, 0);
+		size_t			offset = (seq == store->readSeq) ? cursorOffset : STORE_SEGMENT_HEADER;
+
+		if (map)
+		{
+			if (offset < STORE_SEGMENT_HEADER || offset > MQTT_STORE_SEGMENT_SIZE)
+			{
+				offset = STORE_SEGMENT_HEADER;
+			}
+			mqtt_StoreWalk(map, offset, &store->pending);
+
+			if (seq != store->writeSeq)
+			{
+				mqtt_StoreUnmap(&map);
+			}
+		}
+	}
+
+	store->readOffset = (cursorOffset < STORE_SEGMENT_HEADER || cursorOffset > MQTT_STORE_SEGMENT_SIZE) ? STORE_SEGMENT_HEADER : cursorOffset;
+	if (store->readSeq == store->writeSeq && store->readOffset > store->writeOffset)
+	{
+		store->readOffset = store->writeOffset;
+	}
+
+	fprintf(stdout, "mqttStore : %s opened, %lu messages to send\n", directory, store->pending);
+	fflush(stdout);
+
+	return store;
+}
+
+//-------------------------------------------------------------------------------------------------------
+void mqtt_StoreClose(mqtt_store_st* store)
+{
+	if (store)
+	{
+		mqtt_StoreUnmap(&store->readMap);
+		mqtt_StoreUnmap(&store->writeMap);
+
+		if (store->cursorMap)
+		{
+			munmap(store->cursorMap, STORE_CURSOR_SIZE);
+		}
+
+		free(store);
+	}
+}
+
+//-------------------------------------------------------------------------------------------------------
+unsigned long mqtt_StorePending(mqtt_store_st* store)
+{
+	return store ? store->pending : 0;
+}
+
+//-------------------------------------------------------------------------------------------------------
+//the read position leaves its segment, which is deleted
+static void mqtt_StoreNextReadSegment(mqtt_store_st* store)
+{
+	mqtt_StoreUnmap(&store->readMap);
+	mqtt_StoreDeleteSegment(store, store->readSeq);
+
+	store->readSeq++;
+	store->readOffset = STORE_SEGMENT_HEADER;
+}
+
+//-------------------------------------------------------------------------------------------------------
+//start a new segment, the oldest one is dropped when the size bound is reached
+static int mqtt_StoreNextWriteSegment(mqtt_store_st* store)
+{
+	while (store->writeSeq + 1 - store->readSeq + 1 > (unsigned int) store->maxSegments)
+	{
+		unsigned char*	map = store->readMap ? store->readMap : mqtt_StoreMapSegment(store, store->readSeq, 0);
+		unsigned long	lost = 0;
+
+		if (map)
+		{
+			mqtt_StoreWalk(map, store->readOffset, &lost);
+			if (map != store->readMap)
+			{
+				mqtt_StoreUnmap(&map);
+			}
+		}
+
+		store->pending -= (lost < store->pending) ? lost : store->pending;
+		store->dropped += lost;
+
+		mqtt_StoreNextReadSegment(store);
+		mqtt_StoreWriteCursor(store);
+	}
+
+	unsigned char* map = mqtt_StoreMapSegment(store, store->writeSeq + 1, 1);
+
+	if (map == NULL)
+	{
+		return FAILURE;
+	}
+
+	//the read position keeps the full segment mapped
+	if (store->readSeq == store->writeSeq)
+	{
+		store->readMap = store->writeMap;
+	}
+	else
+	{
+		mqtt_StoreUnmap(&store->writeMap);
+	}
+
+	store->writeMap = map;
+	store->writeSeq++;
+	store->writeOffset = STORE_SEGMENT_HEADER;
+
+	return SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_StoreAppend(mqtt_store_st* store, const char* topicName, int qoS, int retained, const char* data, size_t dataLen, unsigned long ttlMs)
+{
+	size_t topicLen = strlen(topicName) + 1;
+	size_t topicOffset = STORE_BODY_HEADER + (ttlMs ? STORE_TTL_SIZE : 0);
+	size_t bodyLen = topicOffset + topicLen + dataLen;
+	size_t recordLen = STORE_ALIGN(STORE_RECORD_HEADER + bodyLen);
+
+	if (topicLen > 0xFFFF || recordLen > MQTT_STORE_SEGMENT_SIZE - STORE_SEGMENT_HEADER)
+	{
+		fprintf(stdout, "mqttStore : message too large (%u bytes)\n", (unsigned int) dataLen);
+		return FAILURE;
+	}
+
+	if (store->writeOffset + recordLen > MQTT_STORE_SEGMENT_SIZE && mqtt_StoreNextWriteSegment(store) != SUCCESS)
+	{
+		fprintf(stdout, "mqttStore : cannot create a segment in %s\n", store->directory);
+		return FAILURE;
+	}
+
+	unsigned char* record = store->writeMap + store->writeOffset;
+	unsigned char* body = record + STORE_RECORD_HEADER;
+
+	body[0] = (unsigned char) qoS;
+	body[1] = (retained ? STORE_FLAG_RETAINED : 0) | (ttlMs ? STORE_FLAG_TTL : 0);
+	body[2] = (unsigned char) topicLen;
+	body[3] = (unsigned char) (topicLen >> 8);
+
+	if (ttlMs)
+	{
+		unsigned long long queuedAt = mqtt_ExpiryNow();
+
+		memcpy(body + STORE_BODY_HEADER, &queuedAt, sizeof(queuedAt));
+		mqtt_StorePut32(body + STORE_BODY_HEADER + 8, (unsigned int) ttlMs);
+	}
+
+	memcpy(body + topicOffset, topicName, topicLen);
+	memcpy(body + topicOffset + topicLen, data, dataLen);
+
+	//the length is written last : until then the record is the end of the segment
+	mqtt_StorePut32(record + 4, mqtt_StoreCrc32(body, bodyLen));
+	mqtt_StorePut32(record, (unsigned int) bodyLen);
+
+	mqtt_StoreSync(store->writeMap, store->writeOffset, recordLen);
+
+	store->writeOffset += recordLen;
+	store->pending++;
+
+	return SUCCESS;
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_StoreDrain(mqtt_store_st* store, Client* client, mqtt_limit_st* limit, mqtt_expiry_st* expiry)
+{
+	Timer				budget;
+	int					sent = 0;
+	int					skipped = 0;
+	unsigned long long	now = mqtt_ExpiryNow();
+
+	InitTimer(&budget);
+	countdown_ms(&budget, MQTT_STORE_DRAIN_MS);
+
+	while (store->pending > 0 && client->isconnected && !expired(&budget))
+	{
+		unsigned char*	map;
+		size_t			bodyLen;
+		int				status = STORE_RECORD_END;
+
+		if (store->readSeq == store->writeSeq)
+		{
+			map = store->writeMap;
+			if (store->readOffset < store->writeOffset)
+			{
+				status = mqtt_StoreRecordAt(map, store->readOffset, &bodyLen);
+			}
+		}
+		else
+		{
+			if (!store->readMap)
+			{
+				store->readMap = mqtt_StoreMapSegment(store, store->readSeq, 0);
+			}
+			map = store->readMap;
+			if (map)
+			{
+				status = mqtt_StoreRecordAt(map, store->readOffset, &bodyLen);
+			}
+		}
+
+		if (status != STORE_RECORD_VALID)
+		{
+			if (store->readSeq == store->writeSeq)
+			{
+				//nothing readable up to the end of the log
+				store->readOffset = store->writeOffset;
+				store->pending = 0;
+				break;
+			}
+
+			//end of the segment (or the rest of it is unreadable)
+			mqtt_StoreNextReadSegment(store);
+			continue;
+		}
+
+		const unsigned char*	body = map + store->readOffset + STORE_RECORD_HEADER;
+		size_t					topicLen = body[2] | (body[3] << 8);
+		size_t					topicOffset = mqtt_StoreTopicOffset(body);
+		const char*				topicName = (const char *) body + topicOffset;
+		MQTTMessage				msg;
+
+		if (body[1] & STORE_FLAG_TTL)
+		{
+			unsigned long long queuedAt;
+
+			memcpy(&queuedAt, body + STORE_BODY_HEADER, sizeof(queuedAt));
+
+			if (now >= queuedAt + mqtt_StoreGet32(body + STORE_BODY_HEADER + 8))
+			{
+				mqtt_ExpiryCount(expiry, topicName, queuedAt);
+
+				store->readOffset += STORE_ALIGN(STORE_RECORD_HEADER + bodyLen);
+				store->pending--;
+				store->expired++;
+				skipped++;
+				continue;
+			}
+		}
+
+		msg.qos = (enum QoS) body[0];
+		msg.retained = (body[1] & STORE_FLAG_RETAINED) ? 1 : 0;
+		msg.dup = 0;
+		msg.id = 0;
+		msg.payload = (void *) (body + topicOffset + topicLen);
+		msg.payloadlen = bodyLen - topicOffset - topicLen;
+
+		if (mqtt_LimitAcquire(limit, topicName, msg.payloadlen) != SUCCESS)
+		{
+			break;
+		}
+
+		//returns once acknowledged for QoS 1 and 2
+		if (MQTTPublishBuffered(client, topicName, &msg) != SUCCESS)
+		{
+			if (store->failures == 0 || store->failedSeq != store->readSeq || store->failedOffset != store->readOffset)
+			{
+				store->failedSeq = store->readSeq;
+				store->failedOffset = store->readOffset;
+				store->failures = 0;
+			}
+
+			if (++store->failures < MQTT_STORE_MAX_ATTEMPTS)
+			{
+				break;
+			}
+
+			fprintf(stdout, "mqttStore : message to %s dropped after %d failed attempts\n", topicName, store->failures);
+			fflush(stdout);
+
+			store->failures = 0;
+			store->readOffset += STORE_ALIGN(STORE_RECORD_HEADER + bodyLen);
+			store->pending--;
+			store->poisoned++;
+			skipped++;
+			continue;
+		}
+
+		store->failures = 0;
+		store->readOffset += STORE_ALIGN(STORE_RECORD_HEADER + bodyLen);
+		store->pending--;
+		sent++;
+	}
+
+	if (sent > 0 || skipped > 0)
+	{
+		mqtt_StoreWriteCursor(store);
+
+		fprintf(stdout, "mqttStore : %d stored messages sent, %d expired or dropped, %lu left\n", sent, skipped, store->pending);
+		fflush(stdout);
+	}
+
+	return sent;
+}
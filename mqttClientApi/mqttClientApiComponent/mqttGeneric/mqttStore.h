@@ -0,0 +1,92 @@
+/*******************************************************************************************************************
+
+ MQTT outbound store
+
+	Store-and-forward queue of the messages published while the session is down : they are appended to an
+	on-disk log and sent in order once the session is up again.
+
+		- the log is a sequence of segment files (<directory>/<sequence>.seg), mapped in memory, a record
+		  never spans two segments
+		- each record is framed with its length and a CRC-32 : a record torn by a power loss is detected
+		  and discarded when the store is opened again
+		- the read cursor (next record to send) is kept in <directory>/cursor, it moves once the broker has
+		  acknowledged the message (QoS 1 and 2) or once it is sent (QoS 0)
+		- the total size is bounded : when a new segment is needed and the bound is reached, the oldest
+		  segment is dropped with the messages it still holds
+		- segments are deleted once all their records are sent
+	- with a rate limiter, the drain stops at the first record throttled (the log is sent in order)
+	- a record with a time-to-live past its deadline is skipped by the drain : counted, not sent
+	  (see mqttExpiry.h)
+	- a record the broker or the client keeps refusing (MQTT_STORE_MAX_ATTEMPTS failed publishes in a
+	  row) is dropped and counted as poisoned, so that it does not hold back the records behind it
+
+	Delivery is at least once : messages sent but not acknowledged when the link or the power is lost
+	are sent again.
+
+	Segment file :
+		[magic "MQS1"][sequence : 4 bytes] then records, 8 bytes aligned :
+		[body length : 4 bytes][CRC-32 of the body : 4 bytes][body]
+		body : [QoS : 1 byte][flags : 1 byte][topic length, NUL included : 2 bytes]([TTL])[topic][payload]
+		flags : 0x01 retained, 0x02 TTL present : [queued time, ms : 8 bytes][TTL, ms : 4 bytes]
+		a zero length ends the records of the segment
+
+	View of the stack :
+	_________________________
+
+	 mqttGeneric interface
+	_________________________
+
+	 mqttStore  <--- this file
+	_________________________
+
+	 paho
+	_________________________
+
+*******************************************************************************************************************/
+
+#ifndef _MQTT_STORE_H_
+#define _MQTT_STORE_H_
+
+#include "MQTTClient.h"
+#include "mqttLimit.h"
+#include "mqttExpiry.h"
+
+#define		MQTT_STORE_SEGMENT_SIZE			65536	//size of a segment file
+#define		MQTT_STORE_MIN_SEGMENTS			2		//segment being sent and segment being written
+#define		MQTT_STORE_DRAIN_MS				200		//time budget of one drain, queued messages are sent at full speed within it
+#define		MQTT_STORE_MAX_ATTEMPTS			5		//failed publishes of a record before it is dropped
+
+typedef struct mqtt_store_st {
+	char					directory[128];
+	int						maxSegments;
+
+	unsigned int			writeSeq;			//segment appended to
+	unsigned char*			writeMap;
+	size_t					writeOffset;
+
+	unsigned int			readSeq;			//segment of the next record to send, older segments are deleted
+	unsigned char*			readMap;			//mapped when readSeq != writeSeq
+	size_t					readOffset;
+
+	unsigned char*			cursorMap;			//two slots, the most recent valid one is used
+	unsigned int			cursorGeneration;
+
+	unsigned long			pending;			//records not sent yet
+	unsigned long			dropped;			//records evicted before they were sent
+	unsigned long			expired;			//records skipped past their deadline
+	unsigned long			poisoned;			//records dropped after MQTT_STORE_MAX_ATTEMPTS failed publishes
+
+	unsigned int			failedSeq;			//record at the read cursor which failed to publish
+	size_t					failedOffset;
+	int						failures;			//in a row, not kept across a restart
+} mqtt_store_st;
+
+mqtt_store_st* mqtt_StoreOpen(const char* directory, size_t maxBytes);
+void mqtt_StoreClose(mqtt_store_st* store);
+
+int  mqtt_StoreAppend(mqtt_store_st* store, const char* topicName, int qoS, int retained, const char* data, size_t dataLen, unsigned long ttlMs);
+int  mqtt_StoreDrain(mqtt_store_st* store, Client* client, mqtt_limit_st* limit, mqtt_expiry_st* expiry);
+
+unsigned long mqtt_StorePending(mqtt_store_st* store);
+
+#endif	//_MQTT_STORE_H_
@@ -0,0 +1,85 @@
+/*******************************************************************************************************************
+
+ MQTT wake-up slots
+
+	Slots shared by the instances of the process and radio activity, see mqttWake.h
+
+*******************************************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "mqttWake.h"
+
+//last packet sent by an instance of the process
+static unsigned long long g_radioActivity = 0;
+
+//-------------------------------------------------------------------------------------------------------
+mqtt_wake_st* mqtt_WakeCreate(unsigned long slotMs)
+{
+	mqtt_wake_st* wake = (mqtt_wake_st *) calloc(1, sizeof(mqtt_wake_st));
+
+	if (wake)
+	{
+		wake->slotMs = slotMs;
+	}
+
+	return wake;
+}
+
+//-------------------------------------------------------------------------------------------------------
+void mqtt_WakeDelete(mqtt_wake_st* wake)
+{
+	free(wake);
+}
+
+//-------------------------------------------------------------------------------------------------------
+//wall clock : the slots are the same for all the instances, and for the devices of a fleet
+unsigned long long mqtt_WakeNow(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return (unsigned long long) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+//-------------------------------------------------------------------------------------------------------
+void mqtt_WakeActivity(unsigned long long sentAt)
+{
+	if (sentAt > g_radioActivity)
+	{
+		g_radioActivity = sentAt;
+	}
+}
+
+//-------------------------------------------------------------------------------------------------------
+int mqtt_WakeRadioAwake(unsigned long long now)
+{
+	return g_radioActivity > 0 && now < g_radioActivity + MQTT_WAKE_RADIO_TAIL_MS;
+}
+
+//-------------------------------------------------------------------------------------------------------
+unsigned long long mqtt_WakeNextSlot(mqtt_wake_st* wake, unsigned long long now)
+{
+	return (now / wake->slotMs + 1) * wake->slotMs;
+}
+
+//-------------------------------------------------------------------------------------------------------
+//when the keepalive due at dueAt is to be sent : now if the radio is awake within the advance window,
+//otherwise the last slot of the window, or dueAt (sent by paho) if there is none
+unsigned long long mqtt_WakePingAt(mqtt_wake_st* wake, unsigned long long now, unsigned long long dueAt, unsigned long long keepAliveMs)
+{
+	unsigned long long advance = keepAliveMs / MQTT_WAKE_PING_ADVANCE;
+	unsigned long long earliest = dueAt > advance ? dueAt - advance : 0;
+
+	if (now >= earliest && mqtt_WakeRadioAwake(now))
+	{
+		return now;
+	}
+
+	unsigned long long slot = (dueAt / wake->slotMs) * wake->slotMs;
+
+	return slot >= earliest ? slot : dueAt;
+}
@@ -0,0 +1,56 @@
+/*******************************************************************************************************************
+
+ MQTT wake-up slots
+
+	Each packet sent wakes the modem up, which then stays in its high power state for a few seconds.
+	Instances sending on their own schedule (keepalives, periodic telemetry) keep it awake many times a
+	minute. Instances joining the wake-up slots gather their traffic on shared wake-ups instead :
+
+		- slots are the multiples of the slot period since the epoch : instances with periods multiple of
+		  each other share the slots of the longer one
+		- the radio is deemed awake for MQTT_WAKE_RADIO_TAIL_MS after a packet sent by any instance of the
+		  process
+		- keepalive : in the last MQTT_WAKE_PING_ADVANCE of its keepalive period, the PINGREQ is sent ahead
+		  of time when the radio is awake, or on the last slot before it is due. It is never sent late
+		- deferrable messages (telemetry and bulk classes of the priority queues) queued while the radio
+		  sleeps wait for the next slot, or for the radio to be woken by other traffic. Alarms and command
+		  acks are sent at once and take the waiting messages along
+
+	View of the stack :
+	_________________________
+
+	 mqttGeneric interface
+	_________________________
+
+	 mqttWake  <--- this file
+	_________________________
+
+	 mqttSched / paho
+	_________________________
+
+*******************************************************************************************************************/
+
+#ifndef _MQTT_WAKE_H_
+#define _MQTT_WAKE_H_
+
+#define		MQTT_WAKE_RADIO_TAIL_MS			2000		//radio awake after a packet
+#define		MQTT_WAKE_PING_ADVANCE			4			//ping up to keepalive / 4 ahead of time
+
+typedef struct mqtt_wake_st {
+	unsigned long			slotMs;
+	unsigned long long		releaseAt;				//ms, slot of the messages held, 0 if none is
+	unsigned long			pings;					//keepalives sent ahead of time
+	unsigned long			held;					//messages queued while waiting for a slot
+} mqtt_wake_st;
+
+mqtt_wake_st* mqtt_WakeCreate(unsigned long slotMs);
+void mqtt_WakeDelete(mqtt_wake_st* wake);
+
+unsigned long long mqtt_WakeNow(void);
+void mqtt_WakeActivity(unsigned long long sentAt);
+int  mqtt_WakeRadioAwake(unsigned long long now);
+
+unsigned long long mqtt_WakeNextSlot(mqtt_wake_st* wake, unsigned long long now);
+unsigned long long mqtt_WakePingAt(mqtt_wake_st* wake, unsigned long long now, unsigned long long dueAt, unsigned long long keepAliveMs);
+
+#endif	//_MQTT_WAKE_H_
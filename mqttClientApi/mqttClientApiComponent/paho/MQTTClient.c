@@ -103,7 +103,7 @@ void MQTTClient(Client* c, Network* network, unsigned int command_timeout_ms, un
     /*
     int i;
     for (i = 0; i < MAX_MESSAGE_HANDLERS; ++i)
-        c->messageHandlers[i].topicFilter = NULL;
+        c->messageHandlers[i].topicFilter[0] = '\0';
         */
     c->command_timeout_ms = command_timeout_ms;
     c->buf = buf;
@@ -224,7 +224,7 @@ int deliverMessage(Client* c, MQTTString* topicName, MQTTMessage* message)
     //fflush(stdout);
     for (i = 0; i < MAX_MESSAGE_HANDLERS; ++i)
     {
-        if (c->messageHandlers[i].topicFilter != NULL && (MQTTPacket_equals(topicName, (char*)c->messageHandlers[i].topicFilter) ||
+        if (c->messageHandlers[i].topicFilter[0] != '\0' && (MQTTPacket_equals(topicName, (char*)c->messageHandlers[i].topicFilter) ||
                 isTopicMatched((char*)c->messageHandlers[i].topicFilter, topicName)))
         {
             if (c->messageHandlers[i].fp != NULL)
@@ -501,6 +501,11 @@ int MQTTSubscribe(Client* c, const char* topicFilter, enum QoS qos, messageHandl
 
     if (!c->isconnected)
         goto exit;
+    if (strlen(topicFilter) >= MAX_TOPIC_FILTER_SIZE)
+    {
+        rc = BUFFER_OVERFLOW; // does not fit the handler table
+        goto exit;
+    }
     
     len = MQTTSerialize_subscribe(c->buf, c->buf_size, 0, getNextPacketId(c), 1, &topic, (int*)&qos);
     if (len <= 0)
@@ -519,11 +524,11 @@ int MQTTSubscribe(Client* c, const char* topicFilter, enum QoS qos, messageHandl
             int i;
             for (i = 0; i < MAX_MESSAGE_HANDLERS; ++i)
             {
-                if (c->messageHandlers[i].topicFilter == NULL)
+                if (c->messageHandlers[i].topicFilter[0] == '\0')
                 {
-                    c->messageHandlers[i].topicFilter = malloc(strlen(topicFilter)+1);
                     strcpy(c->messageHandlers[i].topicFilter, topicFilter);
                     c->messageHandlers[i].fp = messageHandler;
+                    c->messageHandlers[i].qos = (grantedQoS >= QOS0 && grantedQoS <= QOS2) ? (enum QoS) grantedQoS : qos;
                     rc = 0;
                     break;
                 }
@@ -566,15 +571,11 @@ int MQTTUnsubscribe(Client* c, const char* topicFilter)
         int i;
         for (i = 0; i < MAX_MESSAGE_HANDLERS; ++i)
         {
-            if (c->messageHandlers[i].topicFilter != NULL)
+            if (strcmp(c->messageHandlers[i].topicFilter, topicFilter) == 0)
             {
-                if (strcmp(c->messageHandlers[i].topicFilter, topicFilter) == 0)
-                {
-                    free(c->messageHandlers[i].topicFilter);
-                    c->messageHandlers[i].topicFilter = NULL;
-                    c->messageHandlers[i].fp = NULL;
-                    break;
-                }
+                c->messageHandlers[i].topicFilter[0] = '\0';
+                c->messageHandlers[i].fp = NULL;
+                break;
             }
         }
     }
@@ -586,6 +587,57 @@ exit:
 }
 
 
+static int waitforPublishAck(Client* c, MQTTMessage* message, Timer* timer)
+{
+    int rc = SUCCESS;
+
+    if (message->qos == QOS1)
+    {
+        if (waitfor(c, PUBACK, timer) == PUBACK)
+        {
+            unsigned short mypacketid;
+            unsigned char dup, type;
+            if (MQTTDeserialize_ack(&type, &dup, &mypacketid, c->readbuf, c->readbuf_size) != 1)
+                rc = FAILURE;
+        }
+        else
+            rc = FAILURE;
+    }
+    else if (message->qos == QOS2)
+    {
+        if (waitfor(c, PUBCOMP, timer) == PUBCOMP)
+        {
+            unsigned short mypacketid;
+            unsigned char dup, type;
+            if (MQTTDeserialize_ack(&type, &dup, &mypacketid, c->readbuf, c->readbuf_size) != 1)
+                rc = FAILURE;
+        }
+        else
+            rc = FAILURE;
+    }
+
+    return rc;
+}
+
+
+static int completePublish(Client* c, MQTTMessage* message, Timer* timer)
+{
+    int rc = SUCCESS;
+    unsigned int timeout = c->command_timeout_ms + c->command_timeout_ms * (message->payloadlen / 150000);
+
+    //send payload here separately, not serialized in c
+    fprintf(stdout, "Now sending Publish payload : %zu bytes, timeout= %u\n", message->payloadlen, timeout);
+    fflush(stdout);
+
+    InitTimer(timer);
+    countdown_ms(timer, timeout);
+    if ((rc = sendPacket2(c, message->payload, message->payloadlen, timer)) != SUCCESS) // send the subscribe packet
+        return rc; // there was a problem
+
+    return waitforPublishAck(c, message, timer);
+}
+
+
 int MQTTPublish(Client* c, const char* topicName, MQTTMessage* message)
 {
     int rc = FAILURE;
@@ -613,58 +665,151 @@ int MQTTPublish(Client* c, const char* topicName, MQTTMessage* message)
     if (len <= 0)
         goto exit;
 
-    if (payloadToSerialized == NULL)
-    {
-        fprintf(stdout, "Sending Publish header : %d bytes\n", len);
-        fflush(stdout);
-    }
-    else
-    {
-        fprintf(stdout, "Sending Publish : %d bytes\n", len);
-        fflush(stdout);
-    }
+    fprintf(stdout, "Sending Publish header : %d bytes\n", len);
+    fflush(stdout);
 
     if ((rc = sendPacket(c, len, &timer)) != SUCCESS) // send the subscribe packet
         goto exit; // there was a problem
     
-    if (payloadToSerialized == NULL)   //send payload here separately, not serialized in c
-    {
-        unsigned int timeout = c->command_timeout_ms + c->command_timeout_ms * (message->payloadlen / 150000);
+    rc = completePublish(c, message, &timer);
+    
+exit:
+    return rc;
+}
 
-        fprintf(stdout, "Now sending Publish payload : %d bytes, timeout= %u\n", message->payloadlen, timeout);
-        fflush(stdout);
 
-        InitTimer(&timer);
-        countdown_ms(&timer, timeout);
-        if ((rc = sendPacket2(c, message->payload, message->payloadlen, &timer)) != SUCCESS) // send the subscribe packet
-            goto exit; // there was a problem
-    }
+int MQTTPublishHeaderLength(const char* topicName, enum QoS qos)
+{
+    // upper bound : fixed header, 4 bytes of remaining length, topic and packet id
+    return 1 + 4 + 2 + (int)strlen(topicName) + ((qos > QOS0) ? 2 : 0);
+}
 
-    if (message->qos == QOS1)
-    {
-        if (waitfor(c, PUBACK, &timer) == PUBACK)
-        {
-            unsigned short mypacketid;
-            unsigned char dup, type;
-            if (MQTTDeserialize_ack(&type, &dup, &mypacketid, c->readbuf, c->readbuf_size) != 1)
-                rc = FAILURE;
-        }
-        else
-            rc = FAILURE;
-    }
-    else if (message->qos == QOS2)
+
+int MQTTPublishInPlace(Client* c, const char* topicName, MQTTMessage* message, int payloadOffset)
+{
+    int rc = FAILURE;
+    Timer timer;
+    MQTTString topic = MQTTString_initializer;
+    topic.cstring = (char *)topicName;
+    int headerLen = 0;
+    int start = 0;
+    unsigned int timeout = c->command_timeout_ms + c->command_timeout_ms * (message->payloadlen / 150000);
+
+    InitTimer(&timer);
+    countdown_ms(&timer, timeout);
+
+    // the payload is already in c->buf at payloadOffset, the header is serialized just before it
+    if (!c->isconnected || payloadOffset < MQTTPublishHeaderLength(topicName, message->qos) 
+            || payloadOffset + message->payloadlen > c->buf_size)
+        goto exit;
+
+    if (message->qos == QOS1 || message->qos == QOS2)
+        message->id = getNextPacketId(c);
+
+    headerLen = MQTTPacket_len(MQTTSerialize_publishLength(message->qos, topic, message->payloadlen)) - message->payloadlen;
+    start = payloadOffset - headerLen;
+
+    if (MQTTSerialize_publish(c->buf + start, headerLen, 0, message->qos, message->retained, message->id,
+              topic, NULL, message->payloadlen) != headerLen)
+        goto exit;
+
+    if ((rc = sendPacket2(c, c->buf + start, headerLen + message->payloadlen, &timer)) != SUCCESS)
+        goto exit; // there was a problem
+
+    rc = waitforPublishAck(c, message, &timer);
+
+exit:
+    return rc;
+}
+
+
+int MQTTPublishBuffered(Client* c, const char* topicName, MQTTMessage* message)
+{
+    // a payload fitting in c->buf is copied after the header : the packet goes out in one write instead of
+    // two, the second one being held by most TCP stacks until the first is acknowledged
+    int headerLen = MQTTPublishHeaderLength(topicName, message->qos);
+
+    if (c->buf == NULL || headerLen + message->payloadlen > c->buf_size)
+        return MQTTPublish(c, topicName, message);
+
+    memmove(c->buf + headerLen, message->payload, message->payloadlen);
+
+    MQTTMessage inPlace = *message;
+    inPlace.payload = c->buf + headerLen;
+
+    int rc = MQTTPublishInPlace(c, topicName, &inPlace, headerLen);
+    message->id = inPlace.id;
+
+    return rc;
+}
+
+
+int MQTTPrepareTopic(MQTTTopicHandle* handle, const char* topicName, enum QoS qos, char retained)
+{
+    MQTTString topic = MQTTString_initializer;
+    MQTTHeader header = {0};
+    topic.cstring = (char *)topicName;
+
+    handle->qos = qos;
+    handle->retained = retained;
+    handle->topiclen = 2 + MQTTstrlen(topic);
+    handle->buflen = MQTT_PUBLISH_HEADROOM + handle->topiclen + 2;
+    handle->buf = (unsigned char *) malloc(handle->buflen);
+
+    if (handle->buf == NULL)
+        return FAILURE;
+
+    header.bits.type = PUBLISH;
+    header.bits.qos = qos;
+    header.bits.retain = retained;
+    handle->header = header.byte;
+
+    if (MQTTSerialize_publishTopic(handle->buf, handle->buflen, qos, topic) <= 0)
     {
-        if (waitfor(c, PUBCOMP, &timer) == PUBCOMP)
-        {
-            unsigned short mypacketid;
-            unsigned char dup, type;
-            if (MQTTDeserialize_ack(&type, &dup, &mypacketid, c->readbuf, c->readbuf_size) != 1)
-                rc = FAILURE;
-        }
-        else
-            rc = FAILURE;
+        MQTTReleaseTopic(handle);
+        return FAILURE;
     }
-    
+
+    return SUCCESS;
+}
+
+
+void MQTTReleaseTopic(MQTTTopicHandle* handle)
+{
+    free(handle->buf);
+    handle->buf = NULL;
+    handle->buflen = 0;
+}
+
+
+int MQTTPublishTopic(Client* c, MQTTTopicHandle* handle, MQTTMessage* message)
+{
+    int rc = FAILURE;
+    Timer timer;
+    int len = 0;
+    unsigned char* packet = NULL;
+
+    InitTimer(&timer);
+    countdown_ms(&timer, c->command_timeout_ms);
+
+    if (!c->isconnected || handle->buf == NULL)
+        goto exit;
+
+    message->qos = handle->qos;
+    message->retained = handle->retained;
+    if (message->qos == QOS1 || message->qos == QOS2)
+        message->id = getNextPacketId(c);
+
+    // only the remaining length and the packet id are written, the topic is already encoded in the handle
+    packet = MQTTSerialize_publishHeader(handle->buf, handle->topiclen, handle->header, message->id, message->payloadlen, &len);
+    if (packet == NULL)
+        goto exit;
+
+    if ((rc = sendPacket2(c, packet, len, &timer)) != SUCCESS)
+        goto exit; // there was a problem
+
+    rc = completePublish(c, message, &timer);
+
 exit:
     return rc;
 }
@@ -689,12 +834,8 @@ int MQTTDisconnect(Client* c)
         int i;
         for (i = 0; i < MAX_MESSAGE_HANDLERS; ++i)
         {
-            if (c->messageHandlers[i].topicFilter != NULL)
-            {
-                free(c->messageHandlers[i].topicFilter);
-                c->messageHandlers[i].topicFilter = NULL;
-                c->messageHandlers[i].fp = NULL;
-            }
+            c->messageHandlers[i].topicFilter[0] = '\0';
+            c->messageHandlers[i].fp = NULL;
         }
 
         return rc;
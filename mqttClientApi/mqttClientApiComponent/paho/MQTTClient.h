@@ -23,6 +23,8 @@
 
 #define MAX_PACKET_ID 65535
 #define MAX_MESSAGE_HANDLERS 5
+#define MAX_TOPIC_FILTER_SIZE 160   // topic filters are held in the handler table, no allocation on subscribe :
+                                    // a longer filter is refused with BUFFER_OVERFLOW
 
 
 enum QoS { QOS0, QOS1, QOS2 };
@@ -49,6 +51,19 @@ struct MQTTMessage
 
 typedef void (*messageHandler)(MessageData*);
 
+typedef struct MQTTTopicHandle MQTTTopicHandle;
+
+/* Topic encoded once for repeated publishes, see MQTTSerialize_publishTopic */
+struct MQTTTopicHandle
+{
+    enum QoS qos;
+    char retained;
+    unsigned char header;       // fixed header byte
+    int topiclen;               // encoded topic length : 2 + strlen(topic)
+    int buflen;
+    unsigned char* buf;         // [headroom][encoded topic][packet id]
+};
+
 typedef struct Client Client;
 typedef struct MessageHandlers MessageHandlers;
 
@@ -62,12 +77,20 @@ struct MessageData
 
 int MQTTConnect (Client*, MQTTPacket_connectData*);
 int MQTTPublish (Client*, const char*, MQTTMessage*);
+int MQTTPublishHeaderLength (const char*, enum QoS);
+int MQTTPublishInPlace (Client*, const char*, MQTTMessage*, int);
+int MQTTPublishBuffered (Client*, const char*, MQTTMessage*);
+int MQTTPrepareTopic (MQTTTopicHandle*, const char*, enum QoS, char);
+void MQTTReleaseTopic (MQTTTopicHandle*);
+int MQTTPublishTopic (Client*, MQTTTopicHandle*, MQTTMessage*);
 int MQTTSubscribe (Client*, const char*, enum QoS, messageHandler);
 int MQTTUnsubscribe (Client*, const char*);
 int MQTTDisconnect (Client*);
 int MQTTYield (Client*, int);
+int keepalive (Client*);
 
 void setDefaultMessageHandler(Client*, messageHandler);
+char isTopicMatched(char* topicFilter, MQTTString* topicName);
 
 void MQTTClient(Client*, Network*, unsigned int, unsigned char*, size_t, unsigned char*, size_t);
 
@@ -83,8 +106,9 @@ struct Client {
 
     struct MessageHandlers
     {
-        char* topicFilter;
+        char topicFilter[MAX_TOPIC_FILTER_SIZE];
         void (*fp) (MessageData*);
+        enum QoS qos;                             // granted by the broker, reused when subscribing again
     } messageHandlers[MAX_MESSAGE_HANDLERS];      // Message handlers are indexed by subscription topic
     
     void (*defaultMessageHandler) (MessageData*);
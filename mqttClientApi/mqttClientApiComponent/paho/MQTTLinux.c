@@ -118,7 +118,10 @@ int linux_read(Network* n, unsigned char* buffer, int len, int timeout_ms)
 			}
 			else if (rc == 0)
 			{
-				bytes = -3;	//CON_EOF, server closed the connection
+				if (bytes == 0)
+				{
+					bytes = -3;	//CON_EOF, server closed the connection (reported by the next read after a partial one)
+				}
 				break;
 			}
 			else
@@ -28,6 +28,14 @@
 DLLExport int MQTTSerialize_publish(unsigned char* buf, int buflen, unsigned char dup, int qos, unsigned char retained, unsigned short packetid,
 		MQTTString topicName, unsigned char* payload, int payloadlen);
 
+DLLExport int MQTTSerialize_publishLength(int qos, MQTTString topicName, int payloadlen);
+
+#define MQTT_PUBLISH_HEADROOM 5 /* fixed header byte + up to 4 bytes of remaining length */
+
+DLLExport int MQTTSerialize_publishTopic(unsigned char* buf, int buflen, int qos, MQTTString topicName);
+DLLExport unsigned char* MQTTSerialize_publishHeader(unsigned char* buf, int topiclen, unsigned char header, unsigned short packetid,
+		int payloadlen, int* len);
+
 DLLExport int MQTTDeserialize_publish(unsigned char* dup, int* qos, unsigned char* retained, unsigned short* packetid, MQTTString* topicName,
 		unsigned char** payload, int* payloadlen, unsigned char* buf, int len);
 
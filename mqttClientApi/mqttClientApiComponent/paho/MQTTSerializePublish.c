@@ -111,6 +111,86 @@ exit:
 
 
 
+/**
+  * Encodes the topic of a publish once, so that it can be reused for several packets.
+  * The buffer is laid out as [MQTT_PUBLISH_HEADROOM][topic length][topic][packet id], the headroom
+  * receiving the fixed header and the remaining length when the packet is sent.
+  * @param buf the buffer into which the topic will be serialized
+  * @param buflen the length in bytes of the supplied buffer
+  * @param qos integer - the MQTT QoS value, a packet id is reserved for QoS > 0
+  * @param topicName MQTTString - the MQTT topic in the publish
+  * @return the length of the serialized data.  <= 0 indicates error
+  */
+int MQTTSerialize_publishTopic(unsigned char* buf, int buflen, int qos, MQTTString topicName)
+{
+	unsigned char *ptr = buf + MQTT_PUBLISH_HEADROOM;
+	int rc = 0;
+
+	FUNC_ENTRY;
+	if (MQTT_PUBLISH_HEADROOM + 2 + MQTTstrlen(topicName) + ((qos > 0) ? 2 : 0) > buflen)
+	{
+		rc = MQTTPACKET_BUFFER_TOO_SHORT;
+		goto exit;
+	}
+
+	writeMQTTString(&ptr, topicName);
+
+	if (qos > 0)
+		writeInt(&ptr, 0);
+
+	rc = ptr - buf;
+
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/**
+  * Completes a topic serialized with MQTTSerialize_publishTopic : the remaining length is written just before
+  * the topic, preceded by the fixed header, and the packet id is patched after the topic.
+  * The payload is not copied and must be sent after the returned header.
+  * @param buf the buffer filled by MQTTSerialize_publishTopic
+  * @param topiclen the length of the encoded topic : 2 + topic string length
+  * @param header the MQTT fixed header byte, its QoS bits tell if a packet id is present
+  * @param packetid integer - the MQTT packet identifier
+  * @param payloadlen integer - the length of the MQTT payload
+  * @param len returns the length of the header to send
+  * @return the start of the header to send, NULL indicates error
+  */
+unsigned char* MQTTSerialize_publishHeader(unsigned char* buf, int topiclen, unsigned char header, unsigned short packetid,
+		int payloadlen, int* len)
+{
+	MQTTHeader h = {0};
+	unsigned char remlen[4];
+	unsigned char *start = NULL;
+	unsigned char *ptr = NULL;
+	int rem_len = 0;
+	int n = 0;
+
+	FUNC_ENTRY;
+	h.byte = header;
+	rem_len = topiclen + payloadlen + ((h.bits.qos > 0) ? 2 : 0);
+	if (rem_len > 268435455) /* largest value of a 4 bytes remaining length */
+		goto exit;
+
+	n = MQTTPacket_encode(remlen, rem_len);
+	start = buf + MQTT_PUBLISH_HEADROOM - 1 - n;
+	start[0] = header;
+	memcpy(start + 1, remlen, n);
+
+	ptr = buf + MQTT_PUBLISH_HEADROOM + topiclen;
+	if (h.bits.qos > 0)
+		writeInt(&ptr, packetid);
+
+	*len = ptr - start;
+
+exit:
+	FUNC_EXIT;
+	return start;
+}
+
+
 /**
   * Serializes the ack packet into the supplied buffer.
   * @param buf the buffer into which the packet will be serialized
@@ -0,0 +1,507 @@
+/*
+ * Private key cache : keys are parsed once (PEM or DER file) and kept for the life of the process,
+ * a key is parsed again when its file changes (size or modification time).
+ * A parsed key is counted by its cache slot and by each user (TLS configuration, signature) : evicted
+ * or replaced, it is freed once the last user releases it.
+ *
+ * Comb tables of G are shared per curve and copied in the group of each EC key.
+ * Saved table file :
+ *		[magic "ECT1"][group id : 2 bytes][point count : 2 bytes][coordinate length : 2 bytes]
+ *		[X, Y of each point : coordinate length bytes each, big endian][SHA-256 of all the above]
+ *
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+#include "tlsKeyCache.h"
+
+#include "mbedtls/entropy.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/ecp.h"
+#include "mbedtls/sha256.h"
+
+#if defined(MBEDTLS_PLATFORM_C)
+#include "mbedtls/platform.h"
+#else
+#include <stdlib.h>
+#define mbedtls_calloc		calloc
+#define mbedtls_free		free
+#endif
+
+#define TABLE_MAGIC			"ECT1"
+#define TABLE_HEADER_SIZE	10
+
+
+typedef struct {
+	mbedtls_pk_context			pk;					//first : the address given to the users is the one of the key
+	int							refs;				//cache slot and users
+} tlsKeyCache_key;
+
+typedef struct {
+	char						filename[128];
+	time_t						mtime;
+	off_t						size;
+	unsigned long				lastUse;
+	tlsKeyCache_key*			key;
+} tlsKeyCache_entry;
+
+static tlsKeyCache_entry			g_keyCache[TLS_KEY_CACHE_SIZE];
+static unsigned long				g_keyCacheUse = 0;
+static pthread_mutex_t				g_keyCacheLock = PTHREAD_MUTEX_INITIALIZER;
+
+typedef struct {
+	mbedtls_ecp_group_id		id;
+	mbedtls_ecp_point*			T;
+	size_t						T_size;
+} tlsKeyCache_table;
+
+static tlsKeyCache_table			g_tables[TLS_KEY_CACHE_CURVES];
+static char							g_tableDirectory[128];
+
+static int							g_rngSeeded = 0;
+static mbedtls_entropy_context		g_entropy;
+static mbedtls_ctr_drbg_context		g_ctrDrbg;
+
+static void tlsKeyCache_free_points(mbedtls_ecp_point* T, size_t count)
+{
+	size_t i;
+
+	if (T)
+	{
+		for (i=0; i<count; i++)
+		{
+			mbedtls_ecp_point_free(&T[i]);
+		}
+		mbedtls_free(T);
+	}
+}
+
+static int tlsKeyCache_table_path(const mbedtls_ecp_group* grp, char* path, size_t pathSize)
+{
+	const mbedtls_ecp_curve_info* curve = mbedtls_ecp_curve_info_from_grp_id(grp->id);
+
+	if (g_tableDirectory[0] == 0 || curve == NULL)
+	{
+		return -1;
+	}
+
+	int len = snprintf(path, pathSize, "%s/%s.comb", g_tableDirectory, curve->name);
+	return (len > 0 && (size_t) len < pathSize) ? 0 : -1;
+}
+
+//load a saved table : digest, size and curve are checked, T[0] must be G
+static int tlsKeyCache_load_table(mbedtls_ecp_group* grp, tlsKeyCache_table* table)
+{
+	char				path[192];
+	unsigned char		digest[32];
+	unsigned char*		data = NULL;
+	mbedtls_ecp_point*	T = NULL;
+	size_t				count = 1U << (MBEDTLS_ECP_WINDOW_SIZE - 1);
+	size_t				plen = mbedtls_mpi_size(&grp->P);
+	size_t				dataLen = TABLE_HEADER_SIZE + count * 2 * plen;
+	size_t				i;
+	int					ret = -1;
+	FILE*				file;
+
+	if (tlsKeyCache_table_path(grp, path, sizeof(path)) != 0 || (file = fopen(path, "rb")) == NULL)
+	{
+		return -1;
+	}
+
+	data = mbedtls_calloc(1, dataLen + sizeof(digest) + 1);
+	if (data == NULL || fread(data, 1, dataLen + sizeof(digest) + 1, file) != dataLen + sizeof(digest))
+	{
+		goto cleanup;
+	}
+
+	mbedtls_sha256(data, dataLen, digest, 0);
+
+	if (memcmp(data + dataLen, digest, sizeof(digest)) != 0 || memcmp(data, TABLE_MAGIC, 4) != 0 ||
+		((data[4] << 8) | data[5]) != (int) grp->id || ((data[6] << 8) | data[7]) != (int) count ||
+		(size_t) ((data[8] << 8) | data[9]) != plen)
+	{
+		goto cleanup;
+	}
+
+	T = mbedtls_calloc(count, sizeof(mbedtls_ecp_point));
+	if (T == NULL)
+	{
+		goto cleanup;
+	}
+
+	for (i=0; i<count; i++)
+	{
+		mbedtls_ecp_point_init(&T[i]);
+	}
+
+	for (i=0; i<count; i++)
+	{
+		const unsigned char* point = data + TABLE_HEADER_SIZE + i * 2 * plen;
+
+		if (mbedtls_mpi_read_binary(&T[i].X, point, plen) != 0 ||
+			mbedtls_mpi_read_binary(&T[i].Y, point + plen, plen) != 0 ||
+			mbedtls_mpi_lset(&T[i].Z, 1) != 0 ||
+			mbedtls_ecp_check_pubkey(grp, &T[i]) != 0)
+		{
+			goto cleanup;
+		}
+	}
+
+	if (mbedtls_ecp_point_cmp(&T[0], &grp->G) != 0)
+	{
+		goto cleanup;
+	}
+
+	table->T = T;
+	table->T_size = count;
+	T = NULL;
+	ret = 0;
+
+cleanup:
+	fclose(file);
+	tlsKeyCache_free_points(T, count);
+	mbedtls_free(data);
+
+	if (ret != 0)
+	{
+		fprintf(stdout, "tlsKeyCache : invalid table %s, computing it again\n", path);
+	}
+	return ret;
+}
+
+//save the table in a temporary file renamed once complete, a failure only costs the next process a computation
+static void tlsKeyCache_save_table(const mbedtls_ecp_group* grp, const tlsKeyCache_table* table)
+{
+	char				path[192];
+	char				tmpPath[200];
+	size_t				plen = mbedtls_mpi_size(&grp->P);
+	size_t				dataLen = TABLE_HEADER_SIZE + table->T_size * 2 * plen;
+	unsigned char*		data;
+	size_t				i;
+	int					ret = 0;
+	FILE*				file;
+
+	if (tlsKeyCache_table_path(grp, path, sizeof(path)) != 0)
+	{
+		return;
+	}
+
+	data = mbedtls_calloc(1, dataLen + 32);
+	if (data == NULL)
+	{
+		return;
+	}
+
+	memcpy(data, TABLE_MAGIC, 4);
+	data[4] = (unsigned char) (grp->id >> 8);
+	data[5] = (unsigned char) grp->id;
+	data[6] = (unsigned char) (table->T_size >> 8);
+	data[7] = (unsigned char) table->T_size;
+	data[8] = (unsigned char) (plen >> 8);
+	data[9] = (unsigned char) plen;
+
+	for (i=0; i<table->T_size && ret == 0; i++)
+	{
+		unsigned char* point = data + TABLE_HEADER_SIZE + i * 2 * plen;
+
+		ret = mbedtls_mpi_write_binary(&table->T[i].X, point, plen);
+		if (ret == 0)
+		{
+			ret = mbedtls_mpi_write_binary(&table->T[i].Y, point + plen, plen);
+		}
+	}
+
+	mbedtls_sha256(data, dataLen, data + dataLen, 0);
+
+	snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+
+	if (ret == 0 && (file = fopen(tmpPath, "wb")) != NULL)
+	{
+		ret = (fwrite(data, 1, dataLen + 32, file) == dataLen + 32) ? 0 : -1;
+		if (fclose(file) != 0 || ret != 0 || rename(tmpPath, path) != 0)
+		{
+			fprintf(stdout, "tlsKeyCache : cannot save %s\n", path);
+			remove(tmpPath);
+		}
+	}
+
+	mbedtls_free(data);
+}
+
+//comb table of the curve : from memory, from the table directory or computed
+static tlsKeyCache_table* tlsKeyCache_get_table(mbedtls_ecp_group_id id)
+{
+	tlsKeyCache_table*	table = NULL;
+	mbedtls_ecp_group	grp;
+	int					i;
+
+	for (i=0; i<TLS_KEY_CACHE_CURVES; i++)
+	{
+		if (g_tables[i].T && g_tables[i].id == id)
+		{
+			return &g_tables[i];
+		}
+		if (table == NULL && g_tables[i].T == NULL)
+		{
+			table = &g_tables[i];
+		}
+	}
+
+	if (table == NULL)
+	{
+		return NULL;
+	}
+
+	mbedtls_ecp_group_init(&grp);
+
+	if (mbedtls_ecp_group_load(&grp, id) == 0)
+	{
+		if (tlsKeyCache_load_table(&grp, table) != 0 && mbedtls_ecp_precompute_g(&grp, MBEDTLS_ECP_WINDOW_SIZE) == 0)
+		{
+			//take the table over from the group
+			table->T = grp.T;
+			table->T_size = grp.T_size;
+			grp.T = NULL;
+			grp.T_size = 0;
+
+			tlsKeyCache_save_table(&grp, table);
+		}
+	}
+
+	mbedtls_ecp_group_free(&grp);
+
+	if (table->T == NULL)
+	{
+		return NULL;
+	}
+
+	table->id = id;
+	return table;
+}
+
+//copy the comb table of the curve in the group of the key, the group frees it with the key
+static int tlsKeyCache_install_table(mbedtls_ecp_keypair* ec)
+{
+	tlsKeyCache_table*	table = tlsKeyCache_get_table(ec->grp.id);
+	mbedtls_ecp_point*	T;
+	size_t				i;
+
+	if (table == NULL || (T = mbedtls_calloc(table->T_size, sizeof(mbedtls_ecp_point))) == NULL)
+	{
+		return -1;
+	}
+
+	for (i=0; i<table->T_size; i++)
+	{
+		mbedtls_ecp_point_init(&T[i]);
+	}
+
+	for (i=0; i<table->T_size; i++)
+	{
+		if (mbedtls_ecp_copy(&T[i], &table->T[i]) != 0)
+		{
+			tlsKeyCache_free_points(T, table->T_size);
+			return -1;
+		}
+	}
+
+	tlsKeyCache_free_points(ec->grp.T, ec->grp.T_size);
+	ec->grp.T = T;
+	ec->grp.T_size = table->T_size;
+
+	return 0;
+}
+
+static void tlsKeyCache_unref(tlsKeyCache_key* key)
+{
+	if (key && --key->refs == 0)
+	{
+		mbedtls_pk_free(&key->pk);
+		mbedtls_free(key);
+	}
+}
+
+//the slot drops its reference, the key lives on while it is in use
+static void tlsKeyCache_clear_entry(tlsKeyCache_entry* entry)
+{
+	tlsKeyCache_unref(entry->key);
+	entry->key = NULL;
+	entry->filename[0] = 0;
+}
+
+static mbedtls_pk_context* tlsKeyCache_get_locked(const char* privateKeyFile, const struct stat* st)
+{
+	tlsKeyCache_entry*	entry = NULL;
+	tlsKeyCache_key*	key;
+	int					i;
+
+	for (i=0; i<TLS_KEY_CACHE_SIZE; i++)
+	{
+		if (strcmp(g_keyCache[i].filename, privateKeyFile) == 0)
+		{
+			entry = &g_keyCache[i];
+
+			if (entry->mtime == st->st_mtime && entry->size == st->st_size)
+			{
+				entry->lastUse = ++g_keyCacheUse;
+				entry->key->refs++;
+				return &entry->key->pk;
+			}
+			break;
+		}
+	}
+
+	if (entry == NULL)
+	{
+		//free entry or least recently used one
+		entry = &g_keyCache[0];
+		for (i=0; i<TLS_KEY_CACHE_SIZE && entry->filename[0]; i++)
+		{
+			if (g_keyCache[i].filename[0] == 0 || g_keyCache[i].lastUse < entry->lastUse)
+			{
+				entry = &g_keyCache[i];
+			}
+		}
+	}
+
+	if (entry->filename[0])
+	{
+		tlsKeyCache_clear_entry(entry);
+	}
+
+	key = mbedtls_calloc(1, sizeof(tlsKeyCache_key));
+	if (key == NULL)
+	{
+		return NULL;
+	}
+
+	mbedtls_pk_init(&key->pk);
+
+	int ret = mbedtls_pk_parse_keyfile(&key->pk, privateKeyFile, NULL);
+	if (ret != 0)
+	{
+		fprintf(stdout, "tlsKeyCache : cannot parse %s : -0x%x\n", privateKeyFile, -ret);
+		mbedtls_pk_free(&key->pk);
+		mbedtls_free(key);
+		return NULL;
+	}
+
+	if (mbedtls_pk_can_do(&key->pk, MBEDTLS_PK_ECKEY))
+	{
+		//not fatal : without table, the first signature computes a smaller one
+		tlsKeyCache_install_table(mbedtls_pk_ec(key->pk));
+	}
+
+	//the slot and the caller
+	key->refs = 2;
+
+	strcpy(entry->filename, privateKeyFile);
+	entry->mtime = st->st_mtime;
+	entry->size = st->st_size;
+	entry->lastUse = ++g_keyCacheUse;
+	entry->key = key;
+
+	return &key->pk;
+}
+
+mbedtls_pk_context* tlsKeyCache_get(const char* privateKeyFile)
+{
+	mbedtls_pk_context*	pk;
+	struct stat			st;
+
+	if (privateKeyFile == NULL || strlen(privateKeyFile) >= sizeof(g_keyCache[0].filename) || stat(privateKeyFile, &st) != 0)
+	{
+		return NULL;
+	}
+
+	pthread_mutex_lock(&g_keyCacheLock);
+	pk = tlsKeyCache_get_locked(privateKeyFile, &st);
+	pthread_mutex_unlock(&g_keyCacheLock);
+
+	return pk;
+}
+
+void tlsKeyCache_release(mbedtls_pk_context* pk)
+{
+	if (pk)
+	{
+		pthread_mutex_lock(&g_keyCacheLock);
+		tlsKeyCache_unref((tlsKeyCache_key *) pk);
+		pthread_mutex_unlock(&g_keyCacheLock);
+	}
+}
+
+int tlsKeyCache_random(void* context, unsigned char* output, size_t len)
+{
+	const char *	pers = "tlsKeyCache";
+	int				ret = -1;
+
+	pthread_mutex_lock(&g_keyCacheLock);
+
+	if (!g_rngSeeded)
+	{
+		mbedtls_entropy_init(&g_entropy);
+		mbedtls_ctr_drbg_init(&g_ctrDrbg);
+
+		if (mbedtls_ctr_drbg_seed(&g_ctrDrbg, mbedtls_entropy_func, &g_entropy, (const unsigned char *) pers, strlen(pers)) != 0)
+		{
+			mbedtls_ctr_drbg_free(&g_ctrDrbg);
+			mbedtls_entropy_free(&g_entropy);
+			pthread_mutex_unlock(&g_keyCacheLock);
+			return -1;
+		}
+		g_rngSeeded = 1;
+	}
+
+	ret = mbedtls_ctr_drbg_random(&g_ctrDrbg, output, len);
+
+	pthread_mutex_unlock(&g_keyCacheLock);
+
+	return ret;
+}
+
+int tlsKeyCache_set_table_directory(const char* directory)
+{
+	if (directory == NULL)
+	{
+		directory = "";
+	}
+
+	if (strlen(directory) >= sizeof(g_tableDirectory))
+	{
+		return -1;
+	}
+
+	pthread_mutex_lock(&g_keyCacheLock);
+	strcpy(g_tableDirectory, directory);
+	pthread_mutex_unlock(&g_keyCacheLock);
+
+	return 0;
+}
+
+void tlsKeyCache_flush(void)
+{
+	int i;
+
+	pthread_mutex_lock(&g_keyCacheLock);
+
+	for (i=0; i<TLS_KEY_CACHE_CURVES; i++)
+	{
+		tlsKeyCache_free_points(g_tables[i].T, g_tables[i].T_size);
+		g_tables[i].T = NULL;
+		g_tables[i].T_size = 0;
+	}
+
+	for (i=0; i<TLS_KEY_CACHE_SIZE; i++)
+	{
+		if (g_keyCache[i].filename[0])
+		{
+			tlsKeyCache_clear_entry(&g_keyCache[i]);
+		}
+	}
+
+	pthread_mutex_unlock(&g_keyCacheLock);
+}
@@ -0,0 +1,57 @@
+/*
+ * Private key cache : keys are parsed once (PEM or DER file) and kept for the life of the process,
+ * a key is parsed again when its file changes (size or modification time). The cache is thread safe.
+ *
+ * EC keys get the comb table of the base point G of their curve with the largest window
+ * (MBEDTLS_ECP_WINDOW_SIZE) : signatures (TLS client authentication, JWT ES256) then cost a few
+ * table lookups per window instead of a full scalar multiplication.
+ * The table is computed once per curve, it can be saved to a directory and loaded back by the
+ * next process (digest and curve checks on load, recomputed if they fail).
+ *
+ */
+
+#ifndef _TLSKEYCACHE_H_
+#define _TLSKEYCACHE_H_
+
+#include <stddef.h>
+
+#if !defined(MBEDTLS_CONFIG_FILE)
+#include "mbedtls/config.h"
+#else
+#include MBEDTLS_CONFIG_FILE
+#endif
+
+#include "mbedtls/pk.h"
+
+#define TLS_KEY_CACHE_SIZE		4
+#define TLS_KEY_CACHE_CURVES	2
+
+	/** Get the parsed private key of a file
+	\param privateKeyFile path of the PEM or DER key file (not encrypted)
+	\return the cached key, NULL if the file cannot be parsed.
+	The key stays valid until tlsKeyCache_release, even if it is evicted (more than TLS_KEY_CACHE_SIZE keys,
+	file changed) or flushed meanwhile
+	 */
+	mbedtls_pk_context* tlsKeyCache_get(const char* privateKeyFile);
+
+	/** Release a key returned by tlsKeyCache_get
+	\param pk key, NULL is ignored
+	 */
+	void tlsKeyCache_release(mbedtls_pk_context* pk);
+
+	/** Random generator (CTR-DRBG seeded once), compatible with mbedtls f_rng parameters
+	\return 0 on success
+	 */
+	int tlsKeyCache_random(void* context, unsigned char* output, size_t len);
+
+	/** Directory where the comb tables of the curves are saved (<directory>/<curve name>.comb)
+	\param directory existing directory, NULL or "" : tables are kept in memory only
+	\return 0 on success
+	 */
+	int tlsKeyCache_set_table_directory(const char* directory);
+
+	/** Release all the cached keys and tables
+	 */
+	void tlsKeyCache_flush(void);
+
+#endif	//_TLSKEYCACHE_H_
@@ -50,6 +50,8 @@
 #include <string.h>
 
 #include "tlsSocket.h"
+#include "tlsKeyCache.h"
+#include "mbedtls/ssl_internal.h"
 
 
 typedef struct {
@@ -62,7 +64,7 @@ typedef struct {
 	mbedtls_ssl_config          conf;
 	mbedtls_x509_crt            cacert;
 	mbedtls_x509_crt            clicert;
-	mbedtls_pk_context          pkey;
+	mbedtls_pk_context*         pkey;					//held from tlsKeyCache, released with the configuration
 	int							is_connected;
 } tlsSocket_st;
 
@@ -127,7 +129,10 @@ int tlsSocket_connect(void* sockObj, const char* host, const int port, const cha
 	mbedtls_ctr_drbg_init( &socket->ctr_drbg );
 
 	mbedtls_x509_crt_init( &socket->clicert );
-	mbedtls_pk_init( &socket->pkey );
+
+	//key of a previous configuration not freed (closed while connected)
+	tlsKeyCache_release(socket->pkey);
+	socket->pkey = NULL;
 
 	fprintf(stdout,  "\n  . Seeding the random number generator..." );
 
@@ -208,9 +213,11 @@ int tlsSocket_connect(void* sockObj, const char* host, const int port, const cha
 	if (privateKey && strlen(privateKey))
 	{
 		fprintf(stdout,  "  . Loading the client private key... %s", privateKey);
-		ret = mbedtls_pk_parse_keyfile(&socket->pkey, privateKey, "");
-		if(ret != 0) {
-			fprintf(stdout,  " failed\n  !  mbedtls_pk_parse_keyfile returned -0x%x while parsing private key\n\n", -ret);
+		//parsed once per process, EC keys come with the comb table of their curve
+		socket->pkey = tlsKeyCache_get(privateKey);
+		if(socket->pkey == NULL) {
+			ret = MBEDTLS_ERR_PK_KEY_INVALID_FORMAT;
+			fprintf(stdout,  " failed\n  !  tlsKeyCache_get returned -0x%x while parsing private key\n\n", -ret);
 			fprintf(stdout,  " path : %s ", privateKey);
 			tlsSocket_get_error(socket, ret);
 			tlsSocket_free(socket);
@@ -263,7 +270,7 @@ int tlsSocket_connect(void* sockObj, const char* host, const int port, const cha
 
 	if (certificate && strlen(certificate) && privateKey && strlen(privateKey))
 	{
-		if( (ret = mbedtls_ssl_conf_own_cert(&socket->conf, &socket->clicert, &socket->pkey)) != 0)
+		if( (ret = mbedtls_ssl_conf_own_cert(&socket->conf, &socket->clicert, socket->pkey)) != 0)
 		{
 			fprintf(stdout, " failed\n  ! mbedtls_ssl_conf_own_cert returned %d\n\n", ret);
 			tlsSocket_get_error(socket, ret);
@@ -411,7 +418,12 @@ int tlsSocket_receive(void* sockObj, char* data, int length)
 			//fflush(stdout);
 
 			//socket->is_connected = false;
-			if (rc == MBEDTLS_ERR_SSL_CONN_EOF)
+			if (bytes > 0)
+			{
+				//the bytes already read are returned, the error is reported by the next read
+				break;
+			}
+			else if (rc == MBEDTLS_ERR_SSL_CONN_EOF)
 			{
 				bytes = -3;	//CON_EOF
 			}
@@ -507,6 +519,21 @@ int tlsSocket_receive_pattern(void* sockObj, char* data, int dataSize, const cha
 
 
 
+size_t tlsSocket_get_footprint(void* sockObj)
+{
+	SOCKET_OBJECT(sockObj);
+
+	size_t footprint = sizeof(tlsSocket_st);
+
+	if (socket->is_connected)
+	{
+		//input and output record buffers allocated by mbedtls_ssl_setup()
+		footprint += 2 * MBEDTLS_SSL_BUFFER_LEN;
+	}
+
+	return footprint;
+}
+
 void tlsSocket_get_error(void* sockObj, int errorCode)
 {
 	//SOCKET_OBJECT(sockObj);
@@ -528,11 +555,11 @@ void tlsSocket_free(void* sockObj)
 		mbedtls_net_free( &socket->server_fd );
 		mbedtls_x509_crt_free( &socket->cacert );
 		mbedtls_x509_crt_free( &socket->clicert );
-		mbedtls_pk_free( &socket->pkey );
 		mbedtls_ssl_free( &socket->ssl );
 		mbedtls_ssl_config_free( &socket->conf );
 		mbedtls_ctr_drbg_free( &socket->ctr_drbg );
 		mbedtls_entropy_free( &socket->entropy );
+		tlsKeyCache_release( socket->pkey );
 
 		memset(socket, 0, sizeof(tlsSocket_st));
 		strcpy(socket->trustedCaFolderName, "certs");
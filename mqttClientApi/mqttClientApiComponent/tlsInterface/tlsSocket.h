@@ -134,6 +134,11 @@ void*	tlsSocket_delete(void* socket);
 
 	
 
+	/** Memory held by the socket object, including the TLS record buffers when connected
+	\return size in bytes
+	 */
+	size_t tlsSocket_get_footprint(void* socket);
+
 	void 						tlsSocket_free(void* socket);
 	void 						tlsSocket_get_error(void* socket, int errorCode);
 
@@ -14,6 +14,7 @@
 
 
 #define     YIELD_INTERVAL_SECOND       15
+#define     JWT_VALIDITY_SEC            3600    //renewed ahead of expiry by the mqttClient service
 
 #define     MAX_ARGS                    10
 #define     MAX_ARG_LENGTH              48
@@ -51,20 +52,14 @@ char                                 _gDeviceId[64] = {0};
 char                                 _gRsaPrivateKeyFilename[128] = {0};
 char                                 _gPublishTopicName[256] = {0};
 
-//Intermediate files used to generate JWT, for step-by-step and debugging purpose
-char                                _jwt_headerFile[] = "header.txt";   //for debugging JWT
-char                                _jwt_claimFile[] = "claim.txt";
-char                                _jwt_enc_headerFile[] = "enc_header.txt";   //for debugging JWT
-char                                _jwt_enc_claimFile[] = "enc_claim.txt";
-char                                _jwt_fullClaimFile[] = "tobesigned.txt";
-char                                _jwt_binSignatureFile[] = "signature.bin";
-char                                _jwt_signatureFile[] = "signature.txt";
-char                                _jwt_JwtFile[] = "jwt.txt";
-
 static le_data_RequestObjRef_t  _RequestRef = NULL;
 static le_data_ConnectionStateHandlerRef_t  _hDataConnectionState = NULL;
 
+// the service saw the bearer down when the session was started : it starts it once the bearer is back
+static bool                 _sessionDeferred = false;
+
 static void DcsStateHandler(const char* intfName, bool        isConnected, void*       contextPtr);
+static void OnSessionStarted(void);
 static void OnIncomingMessage(
                 const char* topicName,
                 const char* key,
@@ -75,96 +70,17 @@ static void OnIncomingMessage(
 
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
-size_t WriteFile(const char * filename, const char * buffer, size_t bufferLen)
+size_t jwt_Create(const char * privateKeyPemFile, const char * projectId, char* jwt, size_t jwtLen)
 {
-    FILE*           file = NULL;
-
-    file = fopen(filename, "will");
-    if (NULL == file)
+    //signed by the mqttClient service (RS256 or ES256 according to the key)
+    if (mqttClient_CreateJwt(privateKeyPemFile, projectId, JWT_VALIDITY_SEC, jwt, jwtLen) != LE_OK)
     {
+        LE_ERROR("Failed to create JWT with key %s", privateKeyPemFile);
+        jwt[0] = 0;
         return 0;
     }
 
-    size_t written = fwrite(buffer, 1, bufferLen, file);
-
-    fclose(file);
-
-    return written;
-}
-
-////////////////////////////////////////////////////////////////////////////////////////////////////
-size_t ReadFile(const char* szFilename, char * buffer, size_t   bufferLen)
-{
-    FILE*           file = NULL;
-
-    file = fopen(szFilename, "r");
-    if (NULL == file)
-    {
-        return 0;
-    }
-
-    fseek(file, 0, SEEK_END);
-    size_t fsize = ftell(file);
-    fseek(file, 0, SEEK_SET);
-
-    if (bufferLen > fsize)
-    {
-        memset(buffer, 0, bufferLen);
-        fread(buffer, 1, fsize, file);
-        buffer[fsize] = 0;  //zero terminate the string
-    }
-    
-    fclose(file);
-
-    return fsize;
-}
-
-
-////////////////////////////////////////////////////////////////////////////////////////////////////
-size_t jwt_Create(const char * rsaPrivateKeyPemFile, const char * clientId, char* jwt, size_t jwtLen)
-{
-    //quick & dirty sample using openssl command line to show the different JWT steps. Your final solution should be using openssl EVP_* API functions
-
-    char header[] = "{\"alg\":\"RS256\",\"typ\":\"JWT\"}";
-    char claim[128] = {0};
-
-    unsigned long epoch = time(NULL);
-    sprintf(claim, "{\"aud\":\"%s\",\"iat\":%lu,\"exp\":%lu}", clientId, epoch, epoch + 86400); //valid for 24h
-
-    remove(_jwt_headerFile);
-    remove(_jwt_claimFile);
-    remove(_jwt_enc_headerFile);
-    remove(_jwt_enc_claimFile);
-    remove(_jwt_fullClaimFile);
-    remove(_jwt_binSignatureFile);
-    remove(_jwt_signatureFile);
-    remove(_jwt_JwtFile);
-
-    WriteFile(_jwt_headerFile, header, strlen(header));
-
-    WriteFile(_jwt_claimFile, claim, strlen(claim));
-
-    char command[128];
-
-    sprintf(command, "openssl enc -base64 -in %s | tr -d '\n' >> %s", _jwt_headerFile, _jwt_enc_headerFile);
-    system(command);
-
-    sprintf(command, "openssl enc -base64 -in %s | tr -d '\n' >> %s", _jwt_claimFile, _jwt_enc_claimFile);
-    system(command);
-    
-    sprintf(command, "(cat %s ;echo -n '.';cat %s) >> %s", _jwt_enc_headerFile, _jwt_enc_claimFile, _jwt_fullClaimFile);
-    system(command);
-
-    sprintf(command, "openssl dgst -sha256 -sign %s -out %s %s", rsaPrivateKeyPemFile, _jwt_binSignatureFile, _jwt_fullClaimFile);
-    system(command);
-
-    sprintf(command, "openssl enc -base64 -in %s | tr -d '\n' >> %s", _jwt_binSignatureFile, _jwt_signatureFile);
-    system(command);
-
-    sprintf(command, "(cat %s ;echo -n '.';cat %s) >> %s", _jwt_fullClaimFile, _jwt_signatureFile, _jwt_JwtFile);
-    system(command);
-
-    return ReadFile(_jwt_JwtFile, jwt, jwtLen);
+    return strlen(jwt);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -273,6 +189,12 @@ static void Connect
             _cliMqttRef = mqttClient_Create(_broker, _portNumber, _useTLS, _deviceId, _username, _secret, _keepAlive, _qoS);
 
             mqttClient_AddIncomingMessageHandler(_cliMqttRef, OnIncomingMessage, NULL);
+
+            //the service renews the JWT before it expires, without dropping the connection
+            if (LE_OK != mqttClient_SetJwtRollover(_cliMqttRef, _gRsaPrivateKeyFilename, _gProjectId, JWT_VALIDITY_SEC))
+            {
+                LE_WARN("JWT rollover not available, the session will be closed when the token expires");
+            }
         }       
     }
 
@@ -312,6 +234,7 @@ static void Disconnect
         LE_INFO("Delete MQTT instance");
         mqttClient_Delete(_cliMqttRef);
         _cliMqttRef = NULL;
+        _sessionDeferred = false;
     }
 
     
@@ -336,6 +259,27 @@ static void timerHandler
     le_timer_Ref_t  timerRef
 )
 {
+    if (_sessionDeferred)
+    {
+        le_result_t res = mqttClient_StartSession(_cliMqttRef);
+
+        if (LE_WOULD_BLOCK == res)
+        {
+            le_timer_Start(_timerRef);
+            return;
+        }
+
+        _sessionDeferred = false;
+        if (LE_OK == res)
+        {
+            OnSessionStarted();
+        }
+        else
+        {
+            PrintMessage("Failed to start MQTT session");
+        }
+    }
+
     if (mqttClient_IsConnected(_cliMqttRef))
     {
         LE_INFO("MQTT yield");
@@ -393,6 +337,35 @@ static void OnIncomingMessage(
 
 
 
+//--------------------------------------------------------------------------------------------------
+/**
+ *  MQTT session up : subscribe to the device configuration topic
+ */
+//--------------------------------------------------------------------------------------------------
+static void OnSessionStarted
+(
+    void
+)
+{
+    PrintMessage("MQTT session started");
+
+    char    topicName[128] = {0};
+
+    sprintf(topicName, "/devices/%s/config", _gDeviceId);
+
+    int rc = mqttClient_Subscribe(_cliMqttRef, topicName);
+
+    if (rc)
+    {
+        PrintMessage("Failed to subscribe to topic : %s", topicName);
+    }
+    else
+    {
+        
+        PrintMessage("Subscribed successfully to topic : %s", topicName);
+    }
+}
+
 //--------------------------------------------------------------------------------------------------
 /**
  *  Event callback for data connection state changes.
@@ -411,27 +384,18 @@ static void DcsStateHandler
 
         LE_INFO("%s connected! Starting MQTT session", intfName);
         
-        if (LE_OK == mqttClient_StartSession(_cliMqttRef))
-        {
-            PrintMessage("MQTT session started");
-
-            char    topicName[128] = {0};
-
-            sprintf(topicName, "/devices/%s/config", _gDeviceId);
-
-            int rc = mqttClient_Subscribe(_cliMqttRef, topicName);
-
-            if (rc)
-            {
-                PrintMessage("Failed to subscribe to topic : %s", topicName);
-            }
-            else
-            {
-                
-                PrintMessage("Subscribed successfully to topic : %s", topicName);
-            }
-
+        le_result_t res = mqttClient_StartSession(_cliMqttRef);
 
+        if (LE_OK == res)
+        {
+            OnSessionStarted();
+            le_timer_Start(_timerRef);
+        }
+        else if (LE_WOULD_BLOCK == res)
+        {
+            //the service has not seen the bearer up yet : not a failure, the session is kept
+            PrintMessage("MQTT session deferred until the service sees the data connection");
+            _sessionDeferred = true;
             le_timer_Start(_timerRef);
         }
         else
@@ -441,9 +405,9 @@ static void DcsStateHandler
     }
     else
     {
-        LE_INFO("Data connection is closed, deleting MQTT instance");
-        //restart the session if network issue
-        mqttClient_StopSession(_cliMqttRef);
+        LE_INFO("Data connection is closed, MQTT session paused");
+        //the service keeps the session and resumes it when the bearer is back
+        le_timer_Stop(_timerRef);
     }
 }
 